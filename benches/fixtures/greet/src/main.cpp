@@ -0,0 +1,12 @@
+#include <greeter/greeter.h>
+
+#include <iostream>
+
+int main(int argc, char** argv) {
+    std::vector<std::string> names(argv + 1, argv + argc);
+    if (names.empty()) {
+        names.push_back("world");
+    }
+    std::cout << greeter::banner(names) << std::endl;
+    return 0;
+}
@@ -0,0 +1,4 @@
+include(CMakeFindDependencyMacro)
+find_dependency(hello CONFIG)
+find_dependency(textutil CONFIG)
+include("${CMAKE_CURRENT_LIST_DIR}/greeter-targets.cmake")
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+namespace greeter {
+
+std::string banner(const std::vector<std::string>& names);
+
+}
@@ -0,0 +1,12 @@
+#include "greeter/greeter.h"
+
+#include <hello/hello.h>
+#include <textutil/textutil.h>
+
+namespace greeter {
+
+std::string banner(const std::vector<std::string>& names) {
+    return textutil::upper(hello::greeting(textutil::join(names, " and ")));
+}
+
+}
@@ -0,0 +1,9 @@
+#include "hello/hello.h"
+
+namespace hello {
+
+std::string greeting(const std::string& name) {
+    return "Hello, " + name + "!";
+}
+
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace textutil {
+
+std::string upper(std::string_view text);
+std::string join(const std::vector<std::string>& parts, std::string_view separator);
+
+}
@@ -0,0 +1,200 @@
+// Benchmarks of the native layer. Run `cmake --build <dir> --target bench`
+// for JSON results (<dir>/native_benchmarks.json) to compare across releases.
+//
+// The native classes have no headers of their own, so the layer is compiled
+// into this translation unit.
+#include "compiler_detector.cpp"
+
+#include <benchmark/benchmark.h>
+
+namespace {
+
+const std::string kCompiler = "c++";
+
+// Flags that change the probe key but not what the compiler accepts, so
+// every call misses the probe cache
+std::string unique_flag() {
+    static std::atomic<uint64_t> next{0};
+    return "-DCPPPM_BENCH_" + std::to_string(next.fetch_add(1));
+}
+
+// Sends stdout, inherited by the compilers and CMake the layer runs, to
+// /dev/null while a benchmark runs, so only the results reach the console
+class QuietStdout {
+public:
+    QuietStdout() {
+        std::cout.flush();
+        console_ = ::dup(STDOUT_FILENO);
+        int null = ::open("/dev/null", O_WRONLY);
+        ::dup2(null, STDOUT_FILENO);
+        ::close(null);
+    }
+    ~QuietStdout() {
+        std::cout.flush();
+        ::dup2(console_, STDOUT_FILENO);
+        ::close(console_);
+    }
+    QuietStdout(const QuietStdout&) = delete;
+    QuietStdout& operator=(const QuietStdout&) = delete;
+    
+private:
+    int console_;
+};
+
+ABIManager::ABIInfo sample_abi() {
+    ABIManager::ABIInfo info;
+    info.compiler = "gcc";
+    info.compiler_version = "13.2.0";
+    info.stdlib = "libstdc++";
+    info.cpu_arch = "x86_64";
+    info.os = "linux";
+    info.debug_mode = false;
+    info.cxx_standard = "c++20";
+    info.sanitizer = "address,undefined";
+    info.config_hash = "5f0c2a9d3e7b1164";
+    return info;
+}
+
+// Probe with no probe directory: creates it and pays for the compiler's
+// first start. Every iteration starts from a fresh directory, and the
+// repetitions give the spread a single sample would hide.
+void BM_ProbeCold(benchmark::State& state) {
+    for (auto _ : state) {
+        state.PauseTiming();
+        std::error_code ec;
+        std::filesystem::remove_all(std::filesystem::temp_directory_path() / "cpppm_probe", ec);
+        std::string flag = unique_flag();
+        state.ResumeTiming();
+        benchmark::DoNotOptimize(CompilerDetector::supports_flag(kCompiler, flag));
+    }
+}
+BENCHMARK(BM_ProbeCold)->Iterations(5)->Repetitions(5)->Unit(benchmark::kMillisecond);
+
+// Uncached probes with the compiler already in the page cache
+void BM_ProbeWarm(benchmark::State& state) {
+    CompilerDetector::supports_flag(kCompiler, unique_flag());
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CompilerDetector::supports_flag(kCompiler, unique_flag()));
+    }
+}
+BENCHMARK(BM_ProbeWarm)->Unit(benchmark::kMillisecond);
+
+void BM_ProbeCached(benchmark::State& state) {
+    CompilerDetector::supports_flag(kCompiler, "-fPIC");
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CompilerDetector::supports_flag(kCompiler, "-fPIC"));
+    }
+}
+BENCHMARK(BM_ProbeCached)->ThreadRange(1, 8);
+
+void BM_DetectSystemCompiler(benchmark::State& state) {
+    QuietStdout quiet;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CompilerDetector::detect_system_compiler());
+    }
+}
+BENCHMARK(BM_DetectSystemCompiler)->Unit(benchmark::kMillisecond);
+
+void BM_ABIFingerprint(benchmark::State& state) {
+    auto info = sample_abi();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ABIManager::fingerprint(info));
+    }
+}
+BENCHMARK(BM_ABIFingerprint);
+
+// Artifacts are compatible exactly when their fingerprints match
+void BM_ABICompatibility(benchmark::State& state) {
+    auto wanted = sample_abi();
+    auto cached = sample_abi();
+    cached.sanitizer.clear();
+    std::string cached_fingerprint = ABIManager::fingerprint(cached);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(ABIManager::fingerprint(wanted) == cached_fingerprint);
+    }
+}
+BENCHMARK(BM_ABICompatibility);
+
+void BM_ArtifactKey(benchmark::State& state) {
+    CMakeBuilder::BuildConfig config;
+    config.defines = {"NDEBUG", "HELLO_STATIC=1"};
+    config.compile_flags = {"-O2", "-fno-plt"};
+    config.config_hash = "5f0c2a9d3e7b1164";
+    config.source_hash = "af1349b9f5f9a1a6a0404dea36dcc9499bcb25c9adc112b7cc9a93cae41f3262";
+    QuietStdout quiet;
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CMakeBuilder::artifact_key(config));
+    }
+}
+BENCHMARK(BM_ArtifactKey)->Unit(benchmark::kMillisecond);
+
+// What crosses the FFI today (JSON text) against a binary encoding of the
+// same document
+void BM_FfiJson(benchmark::State& state) {
+    std::string text = ABIManager::abi_to_string(sample_abi());
+    for (auto _ : state) {
+        auto document = nlohmann::json::parse(text);
+        benchmark::DoNotOptimize(document.dump());
+    }
+    state.counters["bytes"] = static_cast<double>(text.size());
+}
+BENCHMARK(BM_FfiJson);
+
+void BM_FfiCbor(benchmark::State& state) {
+    auto bytes = nlohmann::json::to_cbor(nlohmann::json::parse(ABIManager::abi_to_string(sample_abi())));
+    for (auto _ : state) {
+        auto document = nlohmann::json::from_cbor(bytes);
+        benchmark::DoNotOptimize(nlohmann::json::to_cbor(document));
+    }
+    state.counters["bytes"] = static_cast<double>(bytes.size());
+}
+BENCHMARK(BM_FfiCbor);
+
+void BM_BuildConfigFromJson(benchmark::State& state) {
+    nlohmann::json config = {
+        {"build_type", "Release"},
+        {"install_prefix", "/opt/cpppm/hello"},
+        {"defines", {"NDEBUG", "HELLO_STATIC=1"}},
+        {"compile_flags", {"-O2", "-fno-plt"}},
+        {"artifact_store_layers", {"/var/cache/cpppm/artifacts"}},
+        {"config_hash", "5f0c2a9d3e7b1164"}
+    };
+    std::string text = config.dump();
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(CMakeBuilder::config_from_json(text));
+    }
+}
+BENCHMARK(BM_BuildConfigFromJson);
+
+void BM_ProcessSpawn(benchmark::State& state) {
+    for (auto _ : state) {
+        auto result = subprocess::run({"true"}, subprocess::RunOptions{.check = false});
+        benchmark::DoNotOptimize(result.returncode);
+    }
+}
+BENCHMARK(BM_ProcessSpawn)->Unit(benchmark::kMicrosecond);
+
+// configure + build + install of an up-to-date fixture tree, without the
+// artifact store, after one full build outside the timing
+void BM_CMakeNoopRebuild(benchmark::State& state) {
+    std::filesystem::path work = std::filesystem::temp_directory_path() / "cpppm_bench";
+    CMakeBuilder::BuildConfig config;
+    config.install_prefix = (work / "prefix").string();
+    std::string source = std::string(CPPPM_BENCH_FIXTURES) + "/hello";
+    QuietStdout quiet;
+    if (CMakeBuilder::build_package("cpppm-bench-hello", source, config) != 0) {
+        state.SkipWithError("fixture build failed");
+        return;
+    }
+    for (auto _ : state) {
+        if (CMakeBuilder::build_package("cpppm-bench-hello", source, config) != 0) {
+            state.SkipWithError("rebuild failed");
+            break;
+        }
+    }
+}
+BENCHMARK(BM_CMakeNoopRebuild)->Unit(benchmark::kMillisecond);
+
+}  // namespace
+
+BENCHMARK_MAIN();
@@ -1,18 +1,158 @@
 // C++ Integration Layer - handles build systems, compiler detection, ABI
 #include <string>
+#include <string_view>
 #include <vector>
 #include <memory>
 #include <filesystem>
 #include <iostream>
+#include <fstream>
+#include <thread>
+#include <cstring>
+#include <cctype>
+#include <cstdio>
+#include <cstdint>
+#include <iterator>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <signal.h>
+#include <poll.h>
+#include <cerrno>
+#include <algorithm>
+#include <map>
+#include <optional>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <utility>
+#include <stdexcept>
 #include <subprocess.hpp>  // For process execution
 #include <nlohmann/json.hpp>
 
-extern "C" {
-    // Export functions to Rust
-    int cpp_build_cmake(const char* package_name, size_t name_len);
-    const char* cpp_detect_compiler();
-    const char* cpp_get_abi_info();
-}
+#include "wrapper.h"
+
+#ifdef __linux__
+#include <elf.h>
+#endif
+
+// Counter split into cache-line-sized shards. Each thread adds to the shard
+// it was assigned on first use, so concurrent hot paths never contend on
+// one line; reads sum the shards.
+class ShardedCounter {
+public:
+    void add(uint64_t n = 1) {
+        shards_[shard()].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    
+    uint64_t value() const {
+        uint64_t total = 0;
+        for (const auto& shard : shards_) {
+            total += shard.value.load(std::memory_order_relaxed);
+        }
+        return total;
+    }
+    
+private:
+    static constexpr size_t kShards = 16;
+    
+    struct alignas(64) Shard {
+        std::atomic<uint64_t> value{0};
+    };
+    
+    static size_t shard() {
+        static std::atomic<size_t> next{0};
+        thread_local size_t index = next.fetch_add(1, std::memory_order_relaxed) % kShards;
+        return index;
+    }
+    
+    Shard shards_[kShards];
+};
+
+// Native counters exported to the Rust metrics through cpp_native_metrics
+struct NativeMetrics {
+    static inline ShardedCounter probe_cache_hits;
+    static inline ShardedCounter probe_cache_misses;
+};
+
+// Chrome trace complete events ("ph":"X") of native work, buffered until the
+// Rust side drains them into its CPKG_TRACE timeline. Timestamps are
+// steady_clock (CLOCK_MONOTONIC) microseconds, the clock the Rust spans use.
+// Disabled, a span costs one relaxed atomic load.
+class Tracer {
+    struct Event {
+        std::string name;
+        const char* category;
+        std::string detail;
+        long long start_us;
+        long long duration_us = 0;
+        long tid = 0;
+    };
+    
+public:
+    static void enable(bool enabled) {
+        enabled_.store(enabled, std::memory_order_relaxed);
+    }
+    
+    class Span {
+    public:
+        Span(std::string name, const char* category, const std::string& detail = {}) {
+            if (enabled_.load(std::memory_order_relaxed)) {
+                event_ = Event{std::move(name), category, detail, now_us()};
+            }
+        }
+        ~Span() {
+            if (!event_) {
+                return;
+            }
+            event_->duration_us = now_us() - event_->start_us;
+            event_->tid = static_cast<long>(::syscall(SYS_gettid));
+            std::lock_guard<std::mutex> lock(mutex_);
+            events_.push_back(std::move(*event_));
+        }
+        Span(const Span&) = delete;
+        Span& operator=(const Span&) = delete;
+        
+    private:
+        std::optional<Event> event_;
+    };
+    
+    // JSON array of the events recorded since the last drain
+    static std::string drain() {
+        std::vector<Event> events;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            events.swap(events_);
+        }
+        nlohmann::json out = nlohmann::json::array();
+        long pid = static_cast<long>(::getpid());
+        for (const auto& event : events) {
+            out.push_back({
+                {"name", event.name},
+                {"cat", event.category},
+                {"ph", "X"},
+                {"ts", event.start_us},
+                {"dur", event.duration_us},
+                {"pid", pid},
+                {"tid", event.tid},
+                {"args", {{"detail", event.detail}}}
+            });
+        }
+        return out.dump();
+    }
+    
+private:
+    static long long now_us() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+    
+    static inline std::atomic<bool> enabled_{false};
+    static inline std::mutex mutex_;
+    static inline std::vector<Event> events_;
+};
 
 class CompilerDetector {
 public:
@@ -29,6 +169,7 @@ public:
     };
     
     static CompilerInfo detect_system_compiler() {
+        Tracer::Span span("detect_system_compiler", "probe");
         CompilerInfo info;
         
         // Try different compilers
@@ -54,8 +195,62 @@ public:
         return info;
     }
     
+    // Checks whether `compiler` accepts `flag` when linking a shared library.
+    // Results are memoized per (compiler, flag) for the lifetime of the process.
+    static bool supports_flag(const std::string& compiler, const std::string& flag) {
+        static std::map<std::string, bool> probe_cache;
+        static std::mutex probe_mutex;
+        
+        std::string key = compiler + '\0' + flag;
+        {
+            std::lock_guard<std::mutex> lock(probe_mutex);
+            auto it = probe_cache.find(key);
+            if (it != probe_cache.end()) {
+                NativeMetrics::probe_cache_hits.add();
+                return it->second;
+            }
+        }
+        NativeMetrics::probe_cache_misses.add();
+        
+        bool supported = probe_flag(compiler, flag);
+        std::lock_guard<std::mutex> lock(probe_mutex);
+        probe_cache[key] = supported;
+        return supported;
+    }
+    
 private:
+    static bool probe_flag(const std::string& compiler, const std::string& flag) {
+        Tracer::Span span("probe_flag", "probe", compiler + " " + flag);
+        try {
+            std::filesystem::path dir =
+                std::filesystem::temp_directory_path() / "cpppm_probe";
+            std::filesystem::create_directories(dir);
+            std::filesystem::path source = dir / "probe.cpp";
+            {
+                std::ofstream out(source);
+                out << "int cpppm_probe() { return 0; }\n";
+            }
+            
+            // -Werror does not reach the linker, which only warns about
+            // options it ignores (GNU ld: "-z <keyword> ignored")
+            subprocess::CommandLine command = {compiler, "-shared", "-fPIC", "-Werror"};
+            if (flag.rfind("-Wl,", 0) == 0) {
+                command.push_back("-Wl,--fatal-warnings");
+            }
+            command.insert(command.end(), {flag, source.string(), "-o", (dir / "probe.so").string()});
+            auto result = subprocess::run(command, subprocess::RunOptions{
+                .check = false,
+                .cout = subprocess::PipeOption::pipe,
+                .cerr = subprocess::PipeOption::pipe
+            });
+            return result.returncode == 0;
+        } catch (...) {
+            return false;
+        }
+    }
+    
     static bool test_compiler(const std::string& compiler) {
+        Tracer::Span span("test_compiler", "probe", compiler);
         try {
             auto result = subprocess::run({compiler, "--version"}, 
                                         subprocess::RunOptions{.check = false});
@@ -65,29 +260,57 @@ private:
         }
     }
     
+    // Versions go into the ABI fingerprint, so they must change with every
+    // compiler release; the first word of --version is only the driver name
     static std::string get_gcc_version() {
-        auto result = subprocess::run({"g++", "--version"});
-        // Parse version from output
-        return extract_version_from_output(result.cout);
+        // GCC 7+ prints the full version for -dumpfullversion and ignores
+        // the -dumpversion that older releases answer
+        return first_line(run_for_output({"g++", "-dumpfullversion", "-dumpversion"}).cout);
     }
     
     static std::string get_clang_version() {
-        auto result = subprocess::run({"clang++", "--version"});
-        return extract_version_from_output(result.cout);
+        // #define __clang_version__ "17.0.6 (https://github.com/llvm/llvm-project ...)"
+        std::string macros = run_for_output({"clang++", "-dM", "-E", "-x", "c++", "/dev/null"}).cout;
+        const std::string name = "__clang_version__ \"";
+        size_t start = macros.find(name);
+        if (start == std::string::npos) {
+            return "unknown";
+        }
+        start += name.size();
+        size_t end = macros.find('"', start);
+        return first_line(macros.substr(start, end == std::string::npos ? std::string::npos : end - start));
     }
     
     static std::string get_msvc_version() {
-        auto result = subprocess::run({"cl.exe", "/?"});
-        return extract_version_from_output(result.cout);
+        // The banner on stderr: "... Compiler Version 19.38.33130 for x64"
+        std::string banner = run_for_output({"cl.exe"}).cerr;
+        const std::string marker = "Version ";
+        size_t start = banner.find(marker);
+        if (start == std::string::npos) {
+            return "unknown";
+        }
+        start += marker.size();
+        return first_line(banner.substr(start, banner.find(' ', start) - start));
     }
     
-    static std::string extract_version_from_output(const std::string& output) {
-        // Simple version extraction - would need more robust parsing
-        size_t pos = output.find(" ");
-        if (pos != std::string::npos) {
-            return output.substr(0, pos);
+    static subprocess::CompletedProcess run_for_output(const subprocess::CommandLine& command) {
+        try {
+            return subprocess::run(command, subprocess::RunOptions{
+                .check = false,
+                .cout = subprocess::PipeOption::pipe,
+                .cerr = subprocess::PipeOption::pipe
+            });
+        } catch (...) {
+            return {};
         }
-        return "unknown";
+    }
+    
+    // First line of `output` without surrounding blanks, or "unknown"
+    static std::string first_line(const std::string& output) {
+        std::string line = output.substr(0, output.find_first_of("\r\n"));
+        size_t first = line.find_first_not_of(" \t");
+        size_t last = line.find_last_not_of(" \t");
+        return first == std::string::npos ? "unknown" : line.substr(first, last - first + 1);
     }
     
     static std::string find_executable(const std::string& name) {
@@ -96,80 +319,6 @@ private:
     }
 };
 
-class CMakeBuilder {
-public:
-    struct BuildConfig {
-        std::string build_type = "Release";
-        std::string install_prefix = "/usr/local";
-        std::vector<std::string> cmake_args;
-        bool verbose = false;
-    };
-    
-    static int build_package(const std::string& package_name, 
-                           const std::string& source_dir,
-                           const BuildConfig& config = {}) {
-        try {
-            std::filesystem::path build_dir = 
-                std::filesystem::temp_directory_path() / "cpppm_build" / package_name;
-            
-            // Create build directory
-            std::filesystem::create_directories(build_dir);
-            
-            // Configure with CMake
-            std::vector<std::string> configure_cmd = {
-                "cmake",
-                "-S", source_dir,
-                "-B", build_dir.string(),
-                "-DCMAKE_BUILD_TYPE=" + config.build_type,
-                "-DCMAKE_INSTALL_PREFIX=" + config.install_prefix
-            };
-            
-            // Add custom CMake args
-            for (const auto& arg : config.cmake_args) {
-                configure_cmd.push_back(arg);
-            }
-            
-            std::cout << "Configuring " << package_name << " with CMake..." << std::endl;
-            auto configure_result = subprocess::run(configure_cmd);
-            
-            if (configure_result.returncode != 0) {
-                std::cerr << "CMake configure failed: " << configure_result.cerr << std::endl;
-                return 1;
-            }
-            
-            // Build
-            std::cout << "Building " << package_name << "..." << std::endl;
-            auto build_result = subprocess::run({
-                "cmake", "--build", build_dir.string(), 
-                "--parallel", std::to_string(std::thread::hardware_concurrency())
-            });
-            
-            if (build_result.returncode != 0) {
-                std::cerr << "Build failed: " << build_result.cerr << std::endl;
-                return 1;
-            }
-            
-            // Install
-            std::cout << "Installing " << package_name << "..." << std::endl;
-            auto install_result = subprocess::run({
-                "cmake", "--install", build_dir.string()
-            });
-            
-            if (install_result.returncode != 0) {
-                std::cerr << "Install failed: " << install_result.cerr << std::endl;
-                return 1;
-            }
-            
-            std::cout << "Successfully built and installed " << package_name << std::endl;
-            return 0;
-            
-        } catch (const std::exception& e) {
-            std::cerr << "Build error: " << e.what() << std::endl;
-            return 1;
-        }
-    }
-};
-
 class ABIManager {
 public:
     struct ABIInfo {
@@ -180,6 +329,8 @@ public:
         std::string os;
         bool debug_mode;
         std::string cxx_standard;
+        std::string sanitizer;  // normalized -fsanitize= list, empty if none
+        std::string config_hash;  // hash of the propagated build configuration
     };
     
     static ABIInfo get_current_abi() {
@@ -244,10 +395,30 @@ public:
         j["os"] = info.os;
         j["debug_mode"] = info.debug_mode;
         j["cxx_standard"] = info.cxx_standard;
+        j["sanitizer"] = info.sanitizer;
+        j["config_hash"] = info.config_hash;
         
         return j.dump();
     }
     
+    // Stable short key for artifact paths; nlohmann::json orders keys, so
+    // equal ABIInfo values always serialize (and hash) identically
+    static std::string fingerprint(const ABIInfo& info) {
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx",
+                      static_cast<unsigned long long>(fnv1a(abi_to_string(info))));
+        return hex;
+    }
+    
+    static uint64_t fnv1a(const std::string& data) {
+        uint64_t hash = 14695981039346656037ull;
+        for (unsigned char c : data) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+    
 private:
     static std::string compiler_type_to_string(CompilerDetector::CompilerType type) {
         switch (type) {
@@ -259,35 +430,2401 @@ private:
     }
 };
 
-// C interface for Rust FFI
-extern "C" {
-    int cpp_build_cmake(const char* package_name, size_t name_len) {
-        std::string pkg_name(package_name, name_len);
+// Separates debug info from installed ELF files into a build-id keyed tree.
+// The layout matches what a debuginfod server exposes, so the directory can be
+// served over HTTP (`cpkg debuginfod`) or used directly via a file:// URL in
+// DEBUGINFOD_URLS:
+//   <root>/buildid/<id>/debuginfo
+//   <root>/buildid/<id>/executable
+//   <root>/buildid/<id>/source -> <root>/sources/<package>
+class DebugInfoStore {
+public:
+    static std::string read_build_id(const std::filesystem::path& file) {
+#ifdef __linux__
+        std::ifstream in(file, std::ios::binary);
+        unsigned char ident[EI_NIDENT];
+        if (!in.read(reinterpret_cast<char*>(ident), EI_NIDENT)) {
+            return "";
+        }
+        if (std::memcmp(ident, ELFMAG, SELFMAG) != 0 || ident[EI_DATA] != ELFDATA2LSB) {
+            return "";
+        }
+        if (ident[EI_CLASS] == ELFCLASS64) {
+            return read_build_id_notes<Elf64_Ehdr, Elf64_Shdr>(in);
+        }
+        if (ident[EI_CLASS] == ELFCLASS32) {
+            return read_build_id_notes<Elf32_Ehdr, Elf32_Shdr>(in);
+        }
+#endif
+        return "";
+    }
+    
+    // Splits every ELF file listed in the CMake install manifest. The installed
+    // files are stripped in place and get a .gnu_debuglink to the separated copy.
+    static int separate_debug_info(const std::string& package_name,
+                                   const std::filesystem::path& install_manifest,
+                                   const std::filesystem::path& source_dir,
+                                   const std::filesystem::path& store_root,
+                                   const std::filesystem::path& destdir = {}) {
+        std::ifstream manifest(install_manifest);
+        if (!manifest) {
+            std::cerr << "No install manifest for " << package_name << std::endl;
+            return 1;
+        }
         
-        // In a real implementation, source_dir would be determined from cache
-        std::string source_dir = "/tmp/cpppm_cache/" + pkg_name;
+        std::filesystem::path sources = store_root / "sources" / package_name;
+        bool sources_copied = false;
+        int separated = 0;
         
-        return CMakeBuilder::build_package(pkg_name, source_dir);
+        std::string line;
+        while (std::getline(manifest, line)) {
+            // The manifest lists paths without the DESTDIR
+            std::filesystem::path installed = destdir.empty()
+                ? std::filesystem::path(line)
+                : destdir / std::filesystem::path(line).relative_path();
+            std::error_code ec;
+            if (!std::filesystem::is_regular_file(installed, ec) ||
+                std::filesystem::is_symlink(installed, ec)) {
+                continue;
+            }
+            
+            std::string build_id = read_build_id(installed);
+            if (build_id.empty()) {
+                continue;
+            }
+            
+            std::filesystem::path entry = store_root / "buildid" / build_id;
+            std::filesystem::create_directories(entry);
+            std::filesystem::path debuginfo = entry / "debuginfo";
+            
+            auto keep_result = subprocess::run({
+                "objcopy", "--only-keep-debug", installed.string(), debuginfo.string()
+            }, subprocess::RunOptions{.check = false});
+            if (keep_result.returncode != 0) {
+                std::cerr << "objcopy failed for " << installed << ": "
+                          << keep_result.cerr << std::endl;
+                continue;
+            }
+            
+            auto strip_result = subprocess::run({
+                "objcopy", "--strip-debug",
+                "--add-gnu-debuglink=" + debuginfo.string(),
+                installed.string()
+            }, subprocess::RunOptions{.check = false});
+            if (strip_result.returncode != 0) {
+                std::cerr << "Stripping failed for " << installed << ": "
+                          << strip_result.cerr << std::endl;
+                continue;
+            }
+            
+            std::filesystem::copy_file(installed, entry / "executable",
+                std::filesystem::copy_options::overwrite_existing);
+            
+            link_sources(entry, source_dir, sources, sources_copied);
+            separated++;
+        }
+        
+        std::cout << "Separated debug info for " << separated << " file(s) of "
+                  << package_name << std::endl;
+        return 0;
     }
     
-    const char* cpp_detect_compiler() {
-        static std::string compiler_info;
-        auto info = CompilerDetector::detect_system_compiler();
+    // Split debug files travel with the stripped files in the artifact store,
+    // under <artifact>/.cpkg-debuginfo/<build-id>/, so a deploy from the
+    // store (or a remote cache) can put them back into the debuginfod tree
+    static void stash(const std::filesystem::path& artifact, const std::filesystem::path& store_root) {
+        std::error_code ec;
+        for (auto it = std::filesystem::recursive_directory_iterator(artifact, ec);
+             it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+            if (ec) {
+                break;
+            }
+            if (it->path().filename().string().rfind(".cpkg-", 0) == 0) {
+                it.disable_recursion_pending();
+                continue;
+            }
+            if (it->is_symlink() || !it->is_regular_file()) {
+                continue;
+            }
+            std::string build_id = read_build_id(it->path());
+            std::filesystem::path entry = store_root / "buildid" / build_id;
+            if (build_id.empty() || !std::filesystem::exists(entry / "debuginfo")) {
+                continue;
+            }
+            std::filesystem::path stashed = artifact / ".cpkg-debuginfo" / build_id;
+            std::filesystem::create_directories(stashed);
+            for (const char* name : {"debuginfo", "executable"}) {
+                std::filesystem::copy_file(entry / name, stashed / name,
+                    std::filesystem::copy_options::overwrite_existing, ec);
+            }
+        }
+    }
+    
+    // Counterpart of stash() after ArtifactStore::deploy
+    static void restore(const std::string& package_name,
+                        const std::filesystem::path& artifact,
+                        const std::filesystem::path& source_dir,
+                        const std::filesystem::path& store_root) {
+        std::filesystem::path sources = store_root / "sources" / package_name;
+        bool sources_copied = false;
+        int restored = 0;
+        std::error_code ec;
+        for (const auto& stashed : std::filesystem::directory_iterator(artifact / ".cpkg-debuginfo", ec)) {
+            std::filesystem::path entry = store_root / "buildid" / stashed.path().filename();
+            std::filesystem::create_directories(entry);
+            for (const char* name : {"debuginfo", "executable"}) {
+                std::filesystem::copy_file(stashed.path() / name, entry / name,
+                    std::filesystem::copy_options::overwrite_existing, ec);
+            }
+            link_sources(entry, source_dir, sources, sources_copied);
+            restored++;
+        }
+        std::cout << "Restored debug info for " << restored << " file(s) of "
+                  << package_name << std::endl;
+    }
+    
+private:
+    // Points a build-id entry at the package's mirrored sources, copying them
+    // on first use
+    static void link_sources(const std::filesystem::path& entry,
+                             const std::filesystem::path& source_dir,
+                             const std::filesystem::path& sources,
+                             bool& sources_copied) {
+        if (!sources_copied) {
+            copy_sources(source_dir, sources);
+            sources_copied = true;
+        }
+        std::error_code ec;
+        std::filesystem::path source_link = entry / "source";
+        std::filesystem::remove(source_link, ec);
+        std::filesystem::create_directory_symlink(sources, source_link, ec);
+    }
+    
+#ifdef __linux__
+    template <typename Ehdr, typename Shdr>
+    static std::string read_build_id_notes(std::ifstream& in) {
+        in.seekg(0, std::ios::end);
+        uint64_t file_size = static_cast<uint64_t>(in.tellg());
+        Ehdr header;
+        in.seekg(0);
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            return "";
+        }
         
-        nlohmann::json j;
-        j["type"] = static_cast<int>(info.type);
-        j["version"] = info.version;
-        j["path"] = info.path;
-        j["stdlib"] = info.stdlib;
+        for (size_t i = 0; i < header.e_shnum; i++) {
+            Shdr section;
+            in.seekg(header.e_shoff + i * header.e_shentsize);
+            if (!in.read(reinterpret_cast<char*>(&section), sizeof(section))) {
+                return "";
+            }
+            if (section.sh_type != SHT_NOTE) {
+                continue;
+            }
+            
+            // sh_offset/sh_size come from the file; a note section can't
+            // extend past its end
+            if (section.sh_offset > file_size || section.sh_size > file_size - section.sh_offset) {
+                continue;
+            }
+            std::vector<unsigned char> notes(section.sh_size);
+            in.seekg(section.sh_offset);
+            if (!in.read(reinterpret_cast<char*>(notes.data()), notes.size())) {
+                return "";
+            }
+            
+            size_t pos = 0;
+            while (pos + 12 <= notes.size()) {
+                uint32_t namesz, descsz, type;
+                std::memcpy(&namesz, &notes[pos], 4);
+                std::memcpy(&descsz, &notes[pos + 4], 4);
+                std::memcpy(&type, &notes[pos + 8], 4);
+                // Rounded up to 4 bytes in size_t: in uint32_t a size near
+                // UINT32_MAX wraps to 0
+                size_t name_pos = pos + 12;
+                if (namesz > notes.size() - name_pos) {
+                    break;
+                }
+                size_t desc_pos = name_pos + ((size_t{namesz} + 3) & ~size_t{3});
+                if (desc_pos > notes.size() || descsz > notes.size() - desc_pos) {
+                    break;
+                }
+                size_t next = desc_pos + ((size_t{descsz} + 3) & ~size_t{3});
+                
+                // Build-ids are hashes of at most 64 bytes (SHA-512)
+                if (type == NT_GNU_BUILD_ID && namesz == 4 && descsz > 0 && descsz <= 64 &&
+                    std::memcmp(&notes[name_pos], "GNU", 4) == 0) {
+                    static const char digits[] = "0123456789abcdef";
+                    std::string id;
+                    for (size_t b = 0; b < descsz; b++) {
+                        id += digits[notes[desc_pos + b] >> 4];
+                        id += digits[notes[desc_pos + b] & 0xf];
+                    }
+                    return id;
+                }
+                pos = next;
+            }
+        }
+        return "";
+    }
+#endif
+    
+    // debuginfod clients request sources by the absolute path recorded in
+    // DW_AT_comp_dir, so the tree is mirrored under its absolute path.
+    static void copy_sources(const std::filesystem::path& source_dir,
+                             const std::filesystem::path& sources) {
+        static const std::vector<std::string> extensions = {
+            ".c", ".cc", ".cpp", ".cxx", ".h", ".hh", ".hpp", ".hxx", ".inl", ".ipp"
+        };
         
-        compiler_info = j.dump();
-        return compiler_info.c_str();
+        std::error_code ec;
+        std::filesystem::path absolute = std::filesystem::absolute(source_dir, ec);
+        for (auto it = std::filesystem::recursive_directory_iterator(absolute, ec);
+             it != std::filesystem::recursive_directory_iterator(); it.increment(ec)) {
+            if (ec || !it->is_regular_file()) {
+                continue;
+            }
+            std::string ext = it->path().extension().string();
+            if (std::find(extensions.begin(), extensions.end(), ext) == extensions.end()) {
+                continue;
+            }
+            
+            std::filesystem::path target = sources / it->path().relative_path();
+            std::filesystem::create_directories(target.parent_path(), ec);
+            std::filesystem::copy_file(it->path(), target,
+                std::filesystem::copy_options::overwrite_existing, ec);
+        }
+    }
+};
+
+// Built packages, one install prefix per package and ABI fingerprint:
+//   <root>/<package>/<fingerprint>/
+// A prefix only counts as cached once its build has fully installed and the
+// completion marker (holding the ABI description) has been written.
+class ArtifactStore {
+public:
+    static std::filesystem::path default_root() {
+        return std::filesystem::temp_directory_path() / "cpppm_artifacts";
     }
     
-    const char* cpp_get_abi_info() {
-        static std::string abi_info;
-        auto info = ABIManager::get_current_abi();
-        abi_info = ABIManager::abi_to_string(info);
-        return abi_info.c_str();
+    static std::filesystem::path prefix_for(const std::filesystem::path& root,
+                                            const std::string& package_name,
+                                            const std::string& fingerprint) {
+        return root / package_name / fingerprint;
+    }
+    
+    static bool contains(const std::filesystem::path& root,
+                         const std::string& package_name,
+                         const std::string& fingerprint) {
+        return std::filesystem::exists(prefix_for(root, package_name, fingerprint) / ".cpkg-complete");
+    }
+    
+    // First read-only layer (system cache) holding a complete entry, or an
+    // empty path. Layers are never locked or written: they are populated by
+    // an administrator, so a missing entry is simply built in the user store.
+    static std::filesystem::path find_in_layers(const std::vector<std::string>& layers,
+                                                const std::string& package_name,
+                                                const std::string& fingerprint) {
+        for (const auto& layer : layers) {
+            if (contains(layer, package_name, fingerprint)) {
+                return layer;
+            }
+        }
+        return {};
+    }
+    
+    // Held while an entry is built, so concurrent processes never build the
+    // same artifact twice: the waiter re-checks contains() and deploys. Lock
+    // files live under <root>/.locks, which garbage collection skips.
+    class EntryLock {
+    public:
+        EntryLock(const std::filesystem::path& root,
+                  const std::string& package_name,
+                  const std::string& fingerprint) {
+            std::filesystem::create_directories(root / ".locks");
+            auto path = root / ".locks" / (package_name + "-" + fingerprint + ".lock");
+            fd_ = ::open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+            if (fd_ >= 0 && ::flock(fd_, LOCK_EX | LOCK_NB) != 0) {
+                std::cout << "Waiting for another build of " << package_name
+                          << " (" << fingerprint << ")" << std::endl;
+                ::flock(fd_, LOCK_EX);
+            }
+        }
+        ~EntryLock() {
+            if (fd_ >= 0) {
+                ::close(fd_);
+            }
+        }
+        EntryLock(const EntryLock&) = delete;
+        EntryLock& operator=(const EntryLock&) = delete;
+        
+    private:
+        int fd_ = -1;
+    };
+    
+    // Scratch directory next to an entry for building it before publish()
+    static std::filesystem::path staging_for(const std::filesystem::path& root,
+                                             const std::string& package_name,
+                                             const std::string& fingerprint) {
+        return root / package_name / (".staging-" + fingerprint + "-" + std::to_string(::getpid()));
+    }
+    
+    // Entries are immutable once published, so readers never lock. The marker
+    // is renamed into place last; a staged entry is then renamed over the
+    // (missing or incomplete) entry as a whole.
+    static void publish(const std::filesystem::path& root,
+                        const std::string& package_name,
+                        const std::string& fingerprint,
+                        const std::string& abi_json,
+                        const std::filesystem::path& staging = {}) {
+        std::filesystem::path prefix = prefix_for(root, package_name, fingerprint);
+        std::filesystem::path entry = staging.empty() ? prefix : staging;
+        std::filesystem::path tmp = entry / (".cpkg-complete.tmp." + std::to_string(::getpid()));
+        {
+            std::ofstream marker(tmp);
+            marker << abi_json << "\n";
+        }
+        std::filesystem::rename(tmp, entry / ".cpkg-complete");
+        
+        if (!staging.empty()) {
+            std::error_code ec;
+            if (std::filesystem::exists(prefix) && !contains(root, package_name, fingerprint)) {
+                std::filesystem::remove_all(prefix);
+            }
+            std::filesystem::rename(staging, prefix, ec);
+            if (ec) {
+                // Published by someone else meanwhile; theirs is identical
+                std::filesystem::remove_all(staging, ec);
+            }
+        }
+    }
+    
+    // Copies the installed files listed in a CMake install manifest into a
+    // store prefix, keeping their paths relative to the install prefix. With
+    // a `destdir`, the files are read from under it (the manifest lists them
+    // without it).
+    static int ingest(const std::filesystem::path& install_manifest,
+                      const std::filesystem::path& install_prefix,
+                      const std::filesystem::path& store_prefix,
+                      const std::filesystem::path& destdir = {}) {
+        std::ifstream manifest(install_manifest);
+        std::string line;
+        while (std::getline(manifest, line)) {
+            std::filesystem::path installed(line);
+            std::filesystem::path relative = installed.lexically_relative(install_prefix);
+            if (relative.empty() || *relative.begin() == "..") {
+                continue;
+            }
+            if (!destdir.empty()) {
+                installed = destdir / installed.relative_path();
+            }
+            std::filesystem::path target = store_prefix / relative;
+            std::filesystem::create_directories(target.parent_path());
+            std::filesystem::copy(installed, target,
+                std::filesystem::copy_options::overwrite_existing |
+                std::filesystem::copy_options::copy_symlinks);
+        }
+        return manifest.eof() ? 0 : 1;
+    }
+    
+    // Installs a cached prefix into `install_prefix` and writes the same
+    // install manifest a CMake install would have left in `build_dir`
+    static void deploy(const std::filesystem::path& store_prefix,
+                       const std::filesystem::path& install_prefix,
+                       const std::filesystem::path& build_dir) {
+        std::filesystem::create_directories(build_dir);
+        std::ofstream manifest(build_dir / "install_manifest.txt");
+        
+        for (auto it = std::filesystem::recursive_directory_iterator(store_prefix);
+             it != std::filesystem::recursive_directory_iterator(); ++it) {
+            std::filesystem::path relative = it->path().lexically_relative(store_prefix);
+            if (relative == ".cpkg-debuginfo") {
+                it.disable_recursion_pending();
+                continue;
+            }
+            if (relative == ".cpkg-complete" || it->is_directory()) {
+                continue;
+            }
+            std::filesystem::path target = install_prefix / relative;
+            std::filesystem::create_directories(target.parent_path());
+            std::filesystem::copy(it->path(), target,
+                std::filesystem::copy_options::overwrite_existing |
+                std::filesystem::copy_options::copy_symlinks);
+            manifest << target.string() << "\n";
+        }
+    }
+};
+
+// Per-stage wall time and child CPU time of the last native build of each
+// package, read back through cpp_last_build_stats, and traced as
+// CMakeBuilder spans when tracing is on. A thread reports
+// into the package it was attached to; stages of the same name (one per
+// variant) accumulate. CPU time comes from RUSAGE_CHILDREN, which is
+// process-wide, so it overlaps when builds run concurrently. Peak RSS is
+// not recorded: RUSAGE_CHILDREN only has the largest child of the process.
+class BuildStats {
+public:
+    struct Stage {
+        double seconds = 0;
+        double cpu_seconds = 0;
+    };
+    
+    // Starts a fresh record for `package_name` on the calling thread
+    static void begin(const std::string& package_name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stages_[package_name].clear();
+        current_ = package_name;
+    }
+    
+    // Reports the calling thread's stages into an existing record
+    static void attach(const std::string& package_name) {
+        current_ = package_name;
+    }
+    
+    class Scope {
+    public:
+        explicit Scope(std::string stage)
+            : stage_(std::move(stage)), package_(current_), span_(stage_, "cmake", package_),
+              start_(std::chrono::steady_clock::now()), cpu_start_(children_cpu_seconds()) {}
+        ~Scope() {
+            if (package_.empty()) {
+                return;
+            }
+            std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start_;
+            std::lock_guard<std::mutex> lock(mutex_);
+            Stage& stage = stages_[package_].emplace(stage_, Stage{}).first->second;
+            stage.seconds += elapsed.count();
+            stage.cpu_seconds += children_cpu_seconds() - cpu_start_;
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+        
+    private:
+        std::string stage_;
+        std::string package_;
+        Tracer::Span span_;
+        std::chrono::steady_clock::time_point start_;
+        double cpu_start_;
+    };
+    
+    static nlohmann::json to_json(const std::string& package_name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        nlohmann::json stages = nlohmann::json::object();
+        auto found = stages_.find(package_name);
+        if (found != stages_.end()) {
+            for (const auto& [name, stage] : found->second) {
+                stages[name] = {
+                    {"seconds", stage.seconds},
+                    {"cpu_seconds", stage.cpu_seconds}
+                };
+            }
+        }
+        return {{"stages", stages}};
+    }
+    
+private:
+    static double children_cpu_seconds() {
+        struct rusage usage {};
+        ::getrusage(RUSAGE_CHILDREN, &usage);
+        return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec +
+            (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+    }
+    
+    static inline std::mutex mutex_;
+    static inline std::map<std::string, std::map<std::string, Stage>> stages_;
+    static inline thread_local std::string current_;
+};
+
+// Errors and warnings extracted from build output as it streams in.
+// Compilers that can describe their diagnostics in JSON do so (see
+// compiler_flag): GCC writes a JSON array per translation unit, or a SARIF
+// log with -fdiagnostics-format=sarif-stderr. Other lines are scanned for
+// the GCC/Clang and MSVC text formats, compiler driver and linker errors,
+// and CMake messages. A diagnostic is kept once per location
+// and message, counting repeats, since a header's warnings recur in every
+// translation unit that includes it. Diagnostics are echoed to stderr once,
+// in the GCC text format; all other output passes through to stdout.
+class DiagnosticParser {
+public:
+    struct Diagnostic {
+        std::string severity;  // "error" or "warning"
+        std::string file;
+        long line = 0;
+        long column = 0;
+        std::string message;
+        std::string option;  // -W flag or SARIF rule, when known
+        unsigned count = 1;
+        
+        bool same_as(const Diagnostic& other) const {
+            return severity == other.severity && file == other.file && line == other.line &&
+                column == other.column && message == other.message;
+        }
+    };
+    
+    // Flag that makes `compiler` describe diagnostics in JSON, or empty.
+    // Only GCC accepts these; Clang's SARIF output is still marked unstable,
+    // spelled differently, and stays text.
+    static std::string compiler_flag(const std::string& compiler) {
+        if (compiler.empty()) {
+            return {};
+        }
+        for (const std::string candidate : {"-fdiagnostics-format=sarif-stderr",
+                                            "-fdiagnostics-format=json"}) {
+            if (CompilerDetector::supports_flag(compiler, candidate)) {
+                return candidate;
+            }
+        }
+        return {};
+    }
+    
+    void feed(const char* data, size_t size) {
+        pending_.append(data, size);
+        size_t start = 0;
+        size_t end;
+        while ((end = pending_.find('\n', start)) != std::string::npos) {
+            line(pending_.substr(start, end - start));
+            start = end + 1;
+        }
+        pending_.erase(0, start);
+    }
+    
+    // Flushes a trailing partial line and any unterminated message
+    void finish() {
+        if (!pending_.empty()) {
+            line(pending_);
+            pending_.clear();
+        }
+        if (!document_.empty()) {
+            text_lines(std::exchange(document_, {}));
+        }
+        finish_cmake_message();
+    }
+    
+    const std::vector<Diagnostic>& diagnostics() const { return diagnostics_; }
+    size_t errors() const { return errors_; }
+    
+private:
+    // A JSON document larger than this is given up on and read as text
+    static constexpr size_t kMaxDocument = 64 << 20;
+    
+    void line(std::string text) {
+        if (!text.empty() && text.back() == '\r') {
+            text.pop_back();
+        }
+        if (document_.empty()) {
+            size_t first = text.find_first_not_of(" \t");
+            // GCC's JSON output when it has nothing to report
+            if (first != std::string::npos && text.compare(first, std::string::npos, "[]") == 0) {
+                return;
+            }
+            bool starts_document = first != std::string::npos &&
+                (text.compare(first, 2, "[{") == 0 || text.compare(first, 2, "{\"") == 0);
+            if (!starts_document) {
+                text_line(text);
+                return;
+            }
+            text.erase(0, first);
+            depth_ = 0;
+            in_string_ = escaped_ = false;
+        } else if (!continues_document(text)) {
+            // It was not JSON after all; this line may start a document again
+            text_lines(std::exchange(document_, {}));
+            line(std::move(text));
+            return;
+        } else {
+            document_ += '\n';
+        }
+        // Brackets are counted outside strings, so a document may span lines
+        for (char c : text) {
+            if (escaped_) {
+                escaped_ = false;
+            } else if (in_string_) {
+                escaped_ = c == '\\';
+                in_string_ = c != '"';
+            } else if (c == '"') {
+                in_string_ = true;
+            } else if (c == '[' || c == '{') {
+                depth_++;
+            } else if (c == ']' || c == '}') {
+                depth_--;
+            }
+        }
+        document_ += text;
+        if (depth_ <= 0) {
+            parse_document(std::exchange(document_, {}));
+        } else if (in_string_ || document_.size() > kMaxDocument) {
+            // JSON strings do not span lines
+            text_lines(std::exchange(document_, {}));
+        }
+    }
+    
+    // Whether `text` can be the next line of a multi-line document: nested
+    // lines are indented, and only punctuation starts one at the margin
+    static bool continues_document(const std::string& text) {
+        return text.empty() || std::string_view(" \t{}[],\"").find(text[0]) != std::string_view::npos;
+    }
+    
+    // Output of several processes shares the pipe, so a document can be
+    // split by another process's line; it is then read as text
+    void parse_document(const std::string& text) {
+        auto document = nlohmann::json::parse(text, nullptr, false);
+        try {
+            if (document.is_array()) {
+                for (const auto& item : document) {
+                    gcc_diagnostic(item);
+                }
+                return;
+            }
+            if (document.is_object() && document.contains("runs")) {
+                for (const auto& run : document["runs"]) {
+                    for (const auto& result : run.value("results", nlohmann::json::array())) {
+                        sarif_result(result);
+                    }
+                }
+                return;
+            }
+        } catch (const nlohmann::json::exception&) {
+        }
+        text_lines(text);
+    }
+    
+    void gcc_diagnostic(const nlohmann::json& item) {
+        Diagnostic diagnostic;
+        diagnostic.severity = item.value("kind", "");
+        diagnostic.message = item.value("message", "");
+        diagnostic.option = item.value("option", "");
+        auto locations = item.value("locations", nlohmann::json::array());
+        if (!locations.empty() && locations[0].contains("caret")) {
+            const auto& caret = locations[0]["caret"];
+            diagnostic.file = caret.value("file", "");
+            diagnostic.line = caret.value("line", 0L);
+            diagnostic.column = caret.value("column", 0L);
+        }
+        add(std::move(diagnostic), {});
+    }
+    
+    void sarif_result(const nlohmann::json& result) {
+        Diagnostic diagnostic;
+        // SARIF's default level is "warning"
+        diagnostic.severity = result.value("level", "warning");
+        diagnostic.message = result.contains("message") ? result["message"].value("text", "") : "";
+        diagnostic.option = result.value("ruleId", "");
+        // GCC names the rule after the level when no option controls it
+        if (diagnostic.option == diagnostic.severity) {
+            diagnostic.option.clear();
+        }
+        auto locations = result.value("locations", nlohmann::json::array());
+        if (!locations.empty() && locations[0].contains("physicalLocation")) {
+            const auto& physical = locations[0]["physicalLocation"];
+            if (physical.contains("artifactLocation")) {
+                diagnostic.file = physical["artifactLocation"].value("uri", "");
+                if (diagnostic.file.rfind("file://", 0) == 0) {
+                    diagnostic.file.erase(0, 7);
+                }
+            }
+            if (physical.contains("region")) {
+                diagnostic.line = physical["region"].value("startLine", 0L);
+                diagnostic.column = physical["region"].value("startColumn", 0L);
+            }
+        }
+        add(std::move(diagnostic), {});
+    }
+    
+    void text_lines(const std::string& text) {
+        std::istringstream lines(text);
+        std::string each;
+        while (std::getline(lines, each)) {
+            text_line(each);
+        }
+    }
+    
+    void text_line(const std::string& text) {
+        if (cmake_message_) {
+            // The message is indented, and may have several paragraphs
+            if (text.empty() || text[0] == ' ' || text[0] == '\t') {
+                size_t first = text.find_first_not_of(" \t");
+                if (first != std::string::npos) {
+                    std::string& message = cmake_message_->message;
+                    message += (message.empty() ? "" : " ") + text.substr(first);
+                }
+                std::cerr << text << '\n';
+                return;
+            }
+            finish_cmake_message();
+        }
+        
+        Diagnostic diagnostic;
+        if (cmake_text(text, diagnostic)) {
+            cmake_message_ = std::move(diagnostic);
+            std::cerr << text << '\n';
+            return;
+        }
+        if (gcc_text(text, diagnostic) || msvc_text(text, diagnostic) ||
+            tool_text(text, diagnostic) || linker_text(text, diagnostic)) {
+            add(std::move(diagnostic), text);
+            return;
+        }
+        std::cout << text << '\n';
+    }
+    
+    // The text formats are scanned by hand: a line can be megabytes long
+    // (a template error, a minified file echoed by a test), which
+    // std::regex matches by recursion deep enough to overflow the stack.
+    
+    // Severity ("fatal error", "error" or "warning") at `pos` if `suffix`
+    // follows it, else empty
+    static std::string severity_at(const std::string& text, size_t pos, std::string_view suffix) {
+        for (std::string_view severity : {"fatal error", "error", "warning"}) {
+            if (pos <= text.size() && text.compare(pos, severity.size(), severity) == 0 &&
+                text.compare(pos + severity.size(), suffix.size(), suffix) == 0) {
+                return std::string(severity);
+            }
+        }
+        return {};
+    }
+    
+    // Start of the digits that end at `end`, or npos if there are none
+    static size_t digits_before(const std::string& text, size_t end) {
+        size_t start = end;
+        while (start > 0 && std::isdigit(static_cast<unsigned char>(text[start - 1]))) {
+            start--;
+        }
+        return start == end ? std::string::npos : start;
+    }
+    
+    static long number(const std::string& text, size_t start, size_t end) {
+        return std::strtol(text.substr(start, end - start).c_str(), nullptr, 10);
+    }
+    
+    // file:line[:column]: severity: message [-Woption]
+    static bool gcc_text(const std::string& text, Diagnostic& diagnostic) {
+        for (size_t colon = text.find(": "); colon != std::string::npos; colon = text.find(": ", colon + 1)) {
+            std::string severity = severity_at(text, colon + 2, ": ");
+            size_t line = digits_before(text, colon);
+            if (severity.empty() || line == std::string::npos || line < 2 || text[line - 1] != ':') {
+                continue;
+            }
+            diagnostic = {severity, "", number(text, line, colon), 0};
+            size_t file_end = line - 1;
+            size_t first = digits_before(text, file_end);
+            if (first != std::string::npos && first >= 2 && text[first - 1] == ':') {
+                diagnostic.column = diagnostic.line;
+                diagnostic.line = number(text, first, file_end);
+                file_end = first - 1;
+            }
+            diagnostic.file = text.substr(0, file_end);
+            diagnostic.message = text.substr(colon + 2 + severity.size() + 2);
+            size_t option = diagnostic.message.rfind(" [-W");
+            if (option != std::string::npos && diagnostic.message.back() == ']' &&
+                diagnostic.message.find(']', option) == diagnostic.message.size() - 1) {
+                diagnostic.option = diagnostic.message.substr(option + 2,
+                                                              diagnostic.message.size() - option - 3);
+                diagnostic.message.erase(option);
+            }
+            return true;
+        }
+        return false;
+    }
+    
+    // file(line[,column]) ?: severity C1234: message
+    static bool msvc_text(const std::string& text, Diagnostic& diagnostic) {
+        for (size_t close = text.find(')'); close != std::string::npos; close = text.find(')', close + 1)) {
+            size_t colon = close + 1;
+            if (colon < text.size() && text[colon] == ' ') {
+                colon++;
+            }
+            if (text.compare(colon, 2, ": ") != 0) {
+                continue;
+            }
+            std::string severity = severity_at(text, colon + 2, " ");
+            if (severity.empty()) {
+                continue;
+            }
+            size_t code = colon + 2 + severity.size() + 1;
+            size_t code_end = code;
+            while (code_end < text.size() &&
+                   (std::isalnum(static_cast<unsigned char>(text[code_end])) || text[code_end] == '_')) {
+                code_end++;
+            }
+            size_t number_end = close;
+            size_t start = digits_before(text, number_end);
+            if (code_end == code || text.compare(code_end, 2, ": ") != 0 || start == std::string::npos) {
+                continue;
+            }
+            long column = 0;
+            if (start > 0 && text[start - 1] == ',') {
+                column = number(text, start, number_end);
+                number_end = start - 1;
+                start = digits_before(text, number_end);
+                if (start == std::string::npos) {
+                    continue;
+                }
+            }
+            if (start < 2 || text[start - 1] != '(') {
+                continue;
+            }
+            diagnostic = {severity, text.substr(0, start - 1), number(text, start, number_end), column,
+                          text.substr(code_end + 2), text.substr(code, code_end - code)};
+            return true;
+        }
+        return false;
+    }
+    
+    // Drivers and tools without a location: "c++: error: ...", "collect2: error: ..."
+    static bool tool_text(const std::string& text, Diagnostic& diagnostic) {
+        size_t colon = text.find(": ");
+        if (colon == 0 || colon == std::string::npos) {
+            return false;
+        }
+        for (size_t i = 0; i < colon; i++) {
+            unsigned char c = text[i];
+            if (!std::isalnum(c) && std::string_view("_.+/-").find(c) == std::string_view::npos) {
+                return false;
+            }
+        }
+        std::string severity = severity_at(text, colon + 2, ": ");
+        if (severity.empty()) {
+            return false;
+        }
+        diagnostic = {severity, "", 0, 0,
+                      text.substr(0, colon) + ": " + text.substr(colon + 2 + severity.size() + 2)};
+        return true;
+    }
+    
+    // ld, ld.bfd, ld.gold or ld.lld, by any path, reporting unresolved or
+    // duplicate symbols or a missing library
+    static bool linker_text(const std::string& text, Diagnostic& diagnostic) {
+        size_t colon = text.find(": ");
+        if (colon == std::string::npos) {
+            return false;
+        }
+        std::string_view tool(text.data(), colon);
+        if (std::any_of(tool.begin(), tool.end(), [](unsigned char c) { return std::isspace(c); })) {
+            return false;
+        }
+        auto ends_with = [&](std::string_view suffix) {
+            return tool.size() >= suffix.size() &&
+                tool.compare(tool.size() - suffix.size(), suffix.size(), suffix) == 0;
+        };
+        if (!ends_with("ld") && !ends_with("ld.bfd") && !ends_with("ld.gold") && !ends_with("ld.lld")) {
+            return false;
+        }
+        std::string message = text.substr(colon + 2);
+        for (const char* problem : {"undefined reference", "multiple definition", "cannot find"}) {
+            if (message.find(problem) != std::string::npos) {
+                diagnostic = {"error", "", 0, 0, text};
+                return true;
+            }
+        }
+        return false;
+    }
+    
+    // "CMake Error at file:line (command):" with the message on the indented
+    // lines that follow, or "CMake Error: message"; also Warning and
+    // Warning (dev)
+    static bool cmake_text(const std::string& text, Diagnostic& diagnostic) {
+        std::string severity;
+        size_t pos;
+        if (text.rfind("CMake Error", 0) == 0) {
+            severity = "error";
+            pos = 11;
+        } else if (text.rfind("CMake Warning", 0) == 0) {
+            severity = "warning";
+            pos = 13;
+            if (text.compare(pos, 6, " (dev)") == 0) {
+                pos += 6;
+            }
+        } else {
+            return false;
+        }
+        if (text.compare(pos, 4, " at ") == 0) {
+            pos += 4;
+            // The file ends at the first colon followed by a line number
+            for (size_t colon = text.find(':', pos + 1); colon != std::string::npos;
+                 colon = text.find(':', colon + 1)) {
+                size_t end = colon + 1;
+                while (end < text.size() && std::isdigit(static_cast<unsigned char>(text[end]))) {
+                    end++;
+                }
+                if (end > colon + 1) {
+                    diagnostic = {severity, text.substr(pos, colon - pos), number(text, colon + 1, end), 0};
+                    return true;
+                }
+            }
+            return false;
+        }
+        if (pos >= text.size() || text[pos] != ':') {
+            return false;
+        }
+        size_t message = text.find_first_not_of(" \t", pos + 1);
+        diagnostic = {severity, "", 0, 0, message == std::string::npos ? "" : text.substr(message)};
+        return true;
+    }
+    
+    void finish_cmake_message() {
+        if (cmake_message_) {
+            record(std::move(*cmake_message_));
+            cmake_message_.reset();
+        }
+    }
+    
+    // Echoes `diagnostic` the first time it is seen: `original` is the line
+    // it was read from, empty for structured diagnostics
+    void add(Diagnostic diagnostic, const std::string& original) {
+        if (diagnostic.severity.find("error") != std::string::npos) {
+            diagnostic.severity = "error";
+        } else if (diagnostic.severity != "warning") {
+            return;
+        }
+        if (!record(diagnostic)) {
+            return;
+        }
+        if (!original.empty()) {
+            std::cerr << original << '\n';
+            return;
+        }
+        if (!diagnostic.file.empty()) {
+            std::cerr << diagnostic.file << ':';
+            if (diagnostic.line > 0) {
+                std::cerr << diagnostic.line << ':';
+            }
+            if (diagnostic.column > 0) {
+                std::cerr << diagnostic.column << ':';
+            }
+            std::cerr << ' ';
+        }
+        std::cerr << diagnostic.severity << ": " << diagnostic.message;
+        if (!diagnostic.option.empty()) {
+            std::cerr << " [" << diagnostic.option << ']';
+        }
+        std::cerr << '\n';
+    }
+    
+    // False for a repeat
+    bool record(Diagnostic diagnostic) {
+        auto seen = std::find_if(diagnostics_.begin(), diagnostics_.end(),
+            [&](const Diagnostic& other) { return other.same_as(diagnostic); });
+        if (seen != diagnostics_.end()) {
+            seen->count++;
+            return false;
+        }
+        if (diagnostic.severity == "error") {
+            errors_++;
+        }
+        diagnostics_.push_back(std::move(diagnostic));
+        return true;
+    }
+    
+    std::string pending_;
+    // JSON document being read, and its bracket depth
+    std::string document_;
+    int depth_ = 0;
+    bool in_string_ = false;
+    bool escaped_ = false;
+    std::optional<Diagnostic> cmake_message_;
+    std::vector<Diagnostic> diagnostics_;
+    size_t errors_ = 0;
+};
+
+// Deduplicated diagnostics of the last native build of each package, read
+// back through cpp_last_build_diagnostics. As with BuildStats, a thread
+// reports into the package it was attached to; variants of one package
+// share its record.
+class BuildDiagnostics {
+public:
+    // Starts a fresh record for `package_name` on the calling thread
+    static void begin(const std::string& package_name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        diagnostics_[package_name].clear();
+        current_ = package_name;
+    }
+    
+    static void attach(const std::string& package_name) {
+        current_ = package_name;
+    }
+    
+    static void add(const std::vector<DiagnosticParser::Diagnostic>& found) {
+        if (current_.empty()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& record = diagnostics_[current_];
+        for (const auto& diagnostic : found) {
+            auto seen = std::find_if(record.begin(), record.end(),
+                [&](const DiagnosticParser::Diagnostic& other) { return other.same_as(diagnostic); });
+            if (seen != record.end()) {
+                seen->count += diagnostic.count;
+            } else {
+                record.push_back(diagnostic);
+            }
+        }
+    }
+    
+    static nlohmann::json to_json(const std::string& package_name) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        nlohmann::json out = nlohmann::json::array();
+        auto found = diagnostics_.find(package_name);
+        if (found != diagnostics_.end()) {
+            for (const auto& diagnostic : found->second) {
+                out.push_back({
+                    {"severity", diagnostic.severity},
+                    {"file", diagnostic.file},
+                    {"line", diagnostic.line},
+                    {"column", diagnostic.column},
+                    {"message", diagnostic.message},
+                    {"option", diagnostic.option},
+                    {"count", diagnostic.count}
+                });
+            }
+        }
+        return out;
+    }
+    
+private:
+    static inline std::mutex mutex_;
+    static inline std::map<std::string, std::vector<DiagnosticParser::Diagnostic>> diagnostics_;
+    static inline thread_local std::string current_;
+};
+
+class CMakeBuilder {
+public:
+    struct BuildConfig {
+        std::string build_type = "Release";
+        std::string install_prefix = "/usr/local";
+        std::vector<std::string> cmake_args;
+        bool verbose = false;
+        // Split debug info into debug_store after install (see DebugInfoStore)
+        bool split_debug_info = false;
+        std::string debug_store;
+        // Named option set applied on top of the config ("startup")
+        std::string profile;
+        // -fsanitize= list (asan/tsan/ubsan aliases accepted), part of the ABI
+        std::string sanitizer;
+        std::string artifact_store;
+        // Read-only system stores consulted, in order, before artifact_store
+        std::vector<std::string> artifact_store_layers;
+        // Command prefixed to every compile (CMAKE_<LANG>_COMPILER_LAUNCHER),
+        // e.g. the remote cache client; not part of the ABI
+        std::vector<std::string> compiler_launcher;
+        // Shared GNU make jobserver ("fifo:<path>") and its total token
+        // count; when set, builds join it instead of running a private -j
+        std::string jobserver;
+        unsigned jobs = 0;
+        // Effective flags propagated from the root and dependency usage
+        // requirements, and the hash of their normalized form
+        std::vector<std::string> defines;
+        std::vector<std::string> compile_flags;
+        std::vector<std::string> link_flags;
+        std::string config_hash;
+        // BLAKE3 fingerprint of the source tree (empty when unknown)
+        std::string source_hash;
+        // Stop a configure, build or install step at its first error
+        bool fail_fast = false;
+    };
+    
+    static BuildConfig config_from_json(const std::string& json_text) {
+        BuildConfig config;
+        auto j = nlohmann::json::parse(json_text);
+        config.build_type = j.value("build_type", config.build_type);
+        config.install_prefix = j.value("install_prefix", config.install_prefix);
+        config.cmake_args = j.value("cmake_args", config.cmake_args);
+        config.verbose = j.value("verbose", config.verbose);
+        config.split_debug_info = j.value("split_debug_info", config.split_debug_info);
+        config.debug_store = j.value("debug_store", config.debug_store);
+        config.profile = j.value("profile", config.profile);
+        config.sanitizer = j.value("sanitizer", config.sanitizer);
+        config.artifact_store = j.value("artifact_store", config.artifact_store);
+        config.artifact_store_layers = j.value("artifact_store_layers", config.artifact_store_layers);
+        config.compiler_launcher = j.value("compiler_launcher", config.compiler_launcher);
+        config.jobserver = j.value("jobserver", config.jobserver);
+        config.jobs = j.value("jobs", config.jobs);
+        config.defines = j.value("defines", config.defines);
+        config.compile_flags = j.value("compile_flags", config.compile_flags);
+        config.link_flags = j.value("link_flags", config.link_flags);
+        config.config_hash = j.value("config_hash", config.config_hash);
+        config.source_hash = j.value("source_hash", config.source_hash);
+        config.fail_fast = j.value("fail_fast", config.fail_fast);
+        return config;
+    }
+    
+    static int build_package(const std::string& package_name,
+                           const std::string& source_dir) {
+        return build_package(package_name, source_dir, BuildConfig{});
+    }
+    
+    static int build_package(const std::string& package_name, 
+                           const std::string& source_dir,
+                           const BuildConfig& config) {
+        try {
+            std::filesystem::path build_dir = 
+                std::filesystem::temp_directory_path() / "cpppm_build" / package_name;
+            
+            // Artifacts are keyed by the ABI fingerprint, which includes the
+            // propagated configuration hash: an identical effective config is
+            // deployed from the store, any difference builds a new artifact
+            std::filesystem::path store;
+            std::string fingerprint;
+            std::unique_ptr<ArtifactStore::EntryLock> lock;
+            if (!config.artifact_store.empty()) {
+                store = config.artifact_store;
+                fingerprint = artifact_key(config);
+                // System layers first, then a lock-free hit in the user store;
+                // on a miss, take the entry lock and look again in case a
+                // concurrent build just published it
+                std::filesystem::path source = ArtifactStore::find_in_layers(
+                    config.artifact_store_layers, package_name, fingerprint);
+                if (source.empty() && ArtifactStore::contains(store, package_name, fingerprint)) {
+                    source = store;
+                }
+                if (source.empty()) {
+                    lock = std::make_unique<ArtifactStore::EntryLock>(store, package_name, fingerprint);
+                    if (ArtifactStore::contains(store, package_name, fingerprint)) {
+                        source = store;
+                    }
+                }
+                if (!source.empty()) {
+                    std::cout << package_name << " is cached as " << fingerprint
+                              << (source == store ? "" : " in " + source.string()) << std::endl;
+                    BuildStats::Scope stage("deploy");
+                    auto prefix = ArtifactStore::prefix_for(source, package_name, fingerprint);
+                    ArtifactStore::deploy(prefix, config.install_prefix, build_dir);
+                    if (config.split_debug_info) {
+                        DebugInfoStore::restore(package_name, prefix, source_dir, debug_store_for(config));
+                    }
+                    return 0;
+                }
+            }
+            
+            // Create build directory
+            std::filesystem::create_directories(build_dir);
+            
+            if (configure(package_name, source_dir, build_dir, config) != 0) {
+                return 1;
+            }
+            if (build_and_install(package_name, source_dir, build_dir, config,
+                                  std::thread::hardware_concurrency()) != 0) {
+                return 1;
+            }
+            
+            if (!fingerprint.empty()) {
+                BuildStats::Scope stage("store");
+                std::filesystem::path staging = ArtifactStore::staging_for(store, package_name, fingerprint);
+                if (ArtifactStore::ingest(build_dir / "install_manifest.txt",
+                                          config.install_prefix, staging) == 0) {
+                    if (config.split_debug_info) {
+                        DebugInfoStore::stash(staging, debug_store_for(config));
+                    }
+                    ArtifactStore::publish(store, package_name, fingerprint,
+                                           ABIManager::abi_to_string(abi_for(config)), staging);
+                } else {
+                    std::error_code ec;
+                    std::filesystem::remove_all(staging, ec);
+                }
+            }
+            return 0;
+            
+        } catch (const std::exception& e) {
+            std::cerr << "Build error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    
+    // Builds one variant per sanitizer set ("" for a plain build) from the same
+    // source tree, in parallel, caching each in the artifact store under its ABI
+    // fingerprint. The first variant configures alone and its configure-check
+    // results seed the other variants' caches, so header/function/type-size
+    // checks run once per matrix instead of once per variant.
+    static int build_variants(const std::string& package_name,
+                              const std::string& source_dir,
+                              const BuildConfig& base,
+                              const std::vector<std::string>& sanitizers) {
+        struct Variant {
+            BuildConfig config;
+            std::string label;
+            std::string fingerprint;
+            std::string abi_json;
+            std::filesystem::path build_dir;
+        };
+        
+        try {
+            std::filesystem::path store = base.artifact_store.empty()
+                ? ArtifactStore::default_root()
+                : std::filesystem::path(base.artifact_store);
+            
+            std::vector<Variant> pending;
+            for (const auto& sanitizer : sanitizers) {
+                Variant variant;
+                variant.config = base;
+                variant.config.sanitizer = normalize_sanitizer(sanitizer);
+                variant.label = package_name + " [" +
+                    (variant.config.sanitizer.empty() ? "plain" : variant.config.sanitizer) + "]";
+                
+                auto abi = abi_for(variant.config);
+                variant.fingerprint = artifact_key(variant.config);
+                variant.abi_json = ABIManager::abi_to_string(abi);
+                auto layer = ArtifactStore::find_in_layers(base.artifact_store_layers, package_name,
+                                                           variant.fingerprint);
+                if (!layer.empty() || ArtifactStore::contains(store, package_name, variant.fingerprint)) {
+                    std::cout << variant.label << " is cached as " << variant.fingerprint
+                              << (layer.empty() ? "" : " in " + layer.string()) << std::endl;
+                    continue;
+                }
+                pending.push_back(std::move(variant));
+            }
+            
+            // Each variant is locked for its whole build, as its staging area is
+            // only unique per process. Locks are taken in fingerprint order, the
+            // map's, so processes building overlapping matrices cannot deadlock.
+            std::map<std::string, std::unique_ptr<ArtifactStore::EntryLock>> locks;
+            for (const auto& variant : pending) {
+                locks[variant.fingerprint];
+            }
+            for (auto& [fingerprint, lock] : locks) {
+                lock = std::make_unique<ArtifactStore::EntryLock>(store, package_name, fingerprint);
+            }
+            pending.erase(std::remove_if(pending.begin(), pending.end(), [&](const Variant& variant) {
+                if (!ArtifactStore::contains(store, package_name, variant.fingerprint)) {
+                    return false;
+                }
+                std::cout << variant.label << " was built concurrently as " << variant.fingerprint << std::endl;
+                return true;
+            }), pending.end());
+            for (auto& variant : pending) {
+                variant.build_dir = std::filesystem::temp_directory_path() / "cpppm_build"
+                    / (package_name + "-" + variant.fingerprint);
+            }
+            if (pending.empty()) {
+                return 0;
+            }
+            
+            std::filesystem::create_directories(pending[0].build_dir);
+            if (configure(pending[0].label, source_dir, pending[0].build_dir, pending[0].config) != 0) {
+                return 1;
+            }
+            std::filesystem::path check_cache = pending[0].build_dir / "cpkg-check-cache.cmake";
+            write_check_cache(pending[0].build_dir / "CMakeCache.txt", check_cache);
+            
+            unsigned jobs = std::max<unsigned>(1, std::thread::hardware_concurrency() / pending.size());
+            std::vector<int> results(pending.size(), 1);
+            std::vector<std::thread> workers;
+            for (size_t i = 0; i < pending.size(); i++) {
+                workers.emplace_back([&, i] {
+                    BuildStats::attach(package_name);
+                    BuildDiagnostics::attach(package_name);
+                    Variant& variant = pending[i];
+                    try {
+                        if (i > 0) {
+                            variant.config.cmake_args.push_back("-C");
+                            variant.config.cmake_args.push_back(check_cache.string());
+                            std::filesystem::create_directories(variant.build_dir);
+                            if (configure(variant.label, source_dir, variant.build_dir, variant.config) != 0) {
+                                return;
+                            }
+                        }
+                        // Variants install concurrently, so each goes through a
+                        // DESTDIR of its own: the configured prefix, which is part
+                        // of the key, stays the one baked into config files and
+                        // rpaths, and the installed files are ingested as in
+                        // build_package
+                        std::filesystem::path staging =
+                            ArtifactStore::staging_for(store, package_name, variant.fingerprint);
+                        std::filesystem::path destdir = staging.string() + ".destdir";
+                        std::error_code ec;
+                        std::filesystem::remove_all(destdir, ec);
+                        int built = build_and_install(variant.label, source_dir, variant.build_dir,
+                                                      variant.config, jobs, destdir);
+                        if (built == 0) {
+                            BuildStats::Scope stage("store");
+                            built = ArtifactStore::ingest(variant.build_dir / "install_manifest.txt",
+                                                          variant.config.install_prefix, staging, destdir);
+                        }
+                        std::filesystem::remove_all(destdir, ec);
+                        if (built != 0) {
+                            std::filesystem::remove_all(staging, ec);
+                            return;
+                        }
+                        if (variant.config.split_debug_info) {
+                            DebugInfoStore::stash(staging, debug_store_for(variant.config));
+                        }
+                        ArtifactStore::publish(store, package_name, variant.fingerprint,
+                                               variant.abi_json, staging);
+                        results[i] = 0;
+                    } catch (const std::exception& e) {
+                        std::cerr << "Build error in " << variant.label << ": " << e.what() << std::endl;
+                    }
+                });
+            }
+            for (auto& worker : workers) {
+                worker.join();
+            }
+            
+            return std::count(results.begin(), results.end(), 0) == static_cast<long>(results.size()) ? 0 : 1;
+            
+        } catch (const std::exception& e) {
+            std::cerr << "Build error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    
+    // The ABI an artifact built with `config` has: the toolchain's, with the
+    // build type and sanitizers of the config
+    static ABIManager::ABIInfo abi_for(const BuildConfig& config) {
+        auto info = ABIManager::get_current_abi();
+        info.debug_mode = config.build_type == "Debug";
+        info.sanitizer = normalize_sanitizer(config.sanitizer);
+        info.config_hash = config.config_hash;
+        return info;
+    }
+    
+    // Store key of an artifact: its ABI fingerprint, the settings that change
+    // what gets installed, and the source content it was built from when known
+    static std::string artifact_key(const BuildConfig& config) {
+        std::string key = ABIManager::fingerprint(abi_for(config)) + '\0' + build_settings(config);
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx",
+                      static_cast<unsigned long long>(ABIManager::fnv1a(key)));
+        if (config.source_hash.empty()) {
+            return hex;
+        }
+        // The source digest is kept whole: folded into 64 bits it would lose
+        // the collision resistance the store relies on
+        bool is_hex = std::all_of(config.source_hash.begin(), config.source_hash.end(), [](char c) {
+            return std::isxdigit(static_cast<unsigned char>(c)) != 0;
+        });
+        if (!is_hex) {
+            throw std::invalid_argument("source_hash is not a hex digest");
+        }
+        return std::string(hex) + "-" + config.source_hash;
+    }
+    
+    // Build inputs outside the ABI: the profile's flags, debug info, the
+    // prefix baked into installed config files, CMake arguments, and the
+    // user flags configure() keeps
+    static std::string build_settings(const BuildConfig& config) {
+        nlohmann::json settings = {
+            {"profile", config.profile},
+            {"split_debug_info", config.split_debug_info},
+            {"install_prefix", config.install_prefix},
+            {"cmake_args", config.cmake_args}
+        };
+        for (const char* env_var : {"CFLAGS", "CXXFLAGS", "LDFLAGS"}) {
+            const char* value = std::getenv(env_var);
+            settings[env_var] = value != nullptr ? value : "";
+        }
+        return settings.dump();
+    }
+    
+    static std::filesystem::path debug_store_for(const BuildConfig& config) {
+        return config.debug_store.empty()
+            ? std::filesystem::temp_directory_path() / "cpppm_debuginfo"
+            : std::filesystem::path(config.debug_store);
+    }
+    
+    static std::string normalize_sanitizer(const std::string& sanitizer) {
+        static const std::map<std::string, std::string> aliases = {
+            {"asan", "address"}, {"tsan", "thread"}, {"ubsan", "undefined"},
+            {"msan", "memory"}, {"lsan", "leak"}
+        };
+        
+        std::vector<std::string> parts;
+        std::istringstream in(sanitizer);
+        std::string part;
+        while (std::getline(in, part, ',')) {
+            if (part.empty()) {
+                continue;
+            }
+            auto alias = aliases.find(part);
+            parts.push_back(alias != aliases.end() ? alias->second : part);
+        }
+        std::sort(parts.begin(), parts.end());
+        parts.erase(std::unique(parts.begin(), parts.end()), parts.end());
+        
+        std::string normalized;
+        for (const auto& name : parts) {
+            normalized += (normalized.empty() ? "" : ",") + name;
+        }
+        return normalized;
+    }
+    
+private:
+    static int configure(const std::string& package_name,
+                         const std::string& source_dir,
+                         const std::filesystem::path& build_dir,
+                         const BuildConfig& config) {
+        BuildStats::Scope stage("configure");
+        // Configure with CMake
+        std::vector<std::string> configure_cmd = {
+            "cmake",
+            "-S", source_dir,
+            "-B", build_dir.string(),
+            "-DCMAKE_BUILD_TYPE=" + config.build_type,
+            "-DCMAKE_INSTALL_PREFIX=" + config.install_prefix,
+            // Flags are passed for both languages whatever the project uses
+            "--no-warn-unused-cli"
+        };
+        
+        // Debug info has to exist before it can be split off, even in Release
+        std::vector<std::string> compile_flags;
+        std::vector<std::string> shared_link_flags;
+        std::vector<std::string> exe_link_flags;
+        if (config.split_debug_info) {
+            compile_flags.push_back("-g");
+        }
+        if (config.profile == "startup") {
+            apply_startup_profile(configure_cmd, compile_flags,
+                                  shared_link_flags, exe_link_flags);
+        } else if (!config.profile.empty()) {
+            std::cerr << "Unknown build profile: " << config.profile << std::endl;
+            return 1;
+        }
+        std::string sanitizer = normalize_sanitizer(config.sanitizer);
+        if (!sanitizer.empty()) {
+            compile_flags.push_back("-fsanitize=" + sanitizer);
+            compile_flags.push_back("-fno-omit-frame-pointer");
+            shared_link_flags.push_back("-fsanitize=" + sanitizer);
+            exe_link_flags.push_back("-fsanitize=" + sanitizer);
+        }
+        for (const auto& define : config.defines) {
+            compile_flags.push_back("-D" + define);
+        }
+        compile_flags.insert(compile_flags.end(), config.compile_flags.begin(), config.compile_flags.end());
+        shared_link_flags.insert(shared_link_flags.end(), config.link_flags.begin(), config.link_flags.end());
+        exe_link_flags.insert(exe_link_flags.end(), config.link_flags.begin(), config.link_flags.end());
+        // Variables set here replace the user's; their flags are kept first
+        std::vector<std::string> overridden;
+        auto set_flags = [&](const std::string& variable, const char* env_var,
+                             const std::vector<std::string>& flags) {
+            if (flags.empty()) {
+                return;
+            }
+            configure_cmd.push_back("-D" + variable + "=" +
+                                    user_flags(variable, env_var, config.cmake_args) + join_flags(flags));
+            overridden.push_back(variable);
+        };
+        // Machine-readable diagnostics from whichever compiler CMake will use
+        // for the language; not part of the ABI. Put first, so a format the
+        // package asks for wins.
+        auto with_diagnostics = [&](const std::string& language) {
+            auto flags = compile_flags;
+            std::string flag = DiagnosticParser::compiler_flag(resolved_compiler(language, build_dir, config));
+            if (!flag.empty()) {
+                flags.insert(flags.begin(), flag);
+            }
+            return flags;
+        };
+        set_flags("CMAKE_C_FLAGS", "CFLAGS", with_diagnostics("C"));
+        set_flags("CMAKE_CXX_FLAGS", "CXXFLAGS", with_diagnostics("CXX"));
+        set_flags("CMAKE_SHARED_LINKER_FLAGS", "LDFLAGS", shared_link_flags);
+        set_flags("CMAKE_EXE_LINKER_FLAGS", "LDFLAGS", exe_link_flags);
+        
+        if (!config.compiler_launcher.empty()) {
+            std::string launcher;
+            for (const auto& part : config.compiler_launcher) {
+                launcher += (launcher.empty() ? "" : ";") + part;
+            }
+            configure_cmd.push_back("-DCMAKE_C_COMPILER_LAUNCHER=" + launcher);
+            configure_cmd.push_back("-DCMAKE_CXX_COMPILER_LAUNCHER=" + launcher);
+        }
+        
+        // Add custom CMake args, except flag variables merged above
+        for (const auto& arg : config.cmake_args) {
+            bool merged = std::any_of(overridden.begin(), overridden.end(), [&](const auto& variable) {
+                return cache_value(arg, variable).has_value();
+            });
+            if (!merged) {
+                configure_cmd.push_back(arg);
+            }
+        }
+        
+        std::cout << "Configuring " << package_name << " with CMake..." << std::endl;
+        if (run_step(configure_cmd, config) != 0) {
+            std::cerr << "CMake configure failed for " << package_name << std::endl;
+            return 1;
+        }
+        return 0;
+    }
+    
+    static int build_and_install(const std::string& package_name,
+                                 const std::string& source_dir,
+                                 const std::filesystem::path& build_dir,
+                                 const BuildConfig& config,
+                                 unsigned jobs,
+                                 const std::filesystem::path& destdir = {}) {
+        // Build
+        std::cout << "Building " << package_name << "..." << std::endl;
+        subprocess::CommandLine build_cmd = {"cmake", "--build", build_dir.string()};
+        if (config.jobserver.empty()) {
+            build_cmd.push_back("--parallel");
+            build_cmd.push_back(std::to_string(jobs));
+        }
+        int build_result = [&] {
+            BuildStats::Scope stage("build");
+            return run_step(build_cmd, config, build_environment(config));
+        }();
+        
+        if (build_result != 0) {
+            std::cerr << "Build failed for " << package_name << std::endl;
+            return 1;
+        }
+        
+        // Install, under `destdir` when given (the prefix stays the configured one)
+        std::cout << "Installing " << package_name << "..." << std::endl;
+        int install_result = [&] {
+            BuildStats::Scope stage("install");
+            subprocess::EnvMap env;
+            if (!destdir.empty()) {
+                env = inherited_environment();
+                env["DESTDIR"] = destdir.string();
+            }
+            return run_step({"cmake", "--install", build_dir.string()}, config, env);
+        }();
+        
+        if (install_result != 0) {
+            std::cerr << "Install failed for " << package_name << std::endl;
+            return 1;
+        }
+        
+        if (config.split_debug_info) {
+            BuildStats::Scope stage("debuginfo");
+            DebugInfoStore::separate_debug_info(package_name,
+                build_dir / "install_manifest.txt", source_dir, debug_store_for(config), destdir);
+        }
+        
+        std::cout << "Successfully built and installed " << package_name << std::endl;
+        return 0;
+    }
+    
+    // Runs one configure, build or install step, reading its stdout and
+    // stderr through DiagnosticParsers as they fill; the diagnostics go to
+    // BuildDiagnostics. The streams stay apart because a line on one can be
+    // unterminated when the other is written (CMake ends some errors without
+    // a newline). In fail-fast mode the step runs in a process group of its
+    // own, which is terminated as a whole at the first error, so no compile
+    // already queued by make or ninja is started.
+    static int run_step(const subprocess::CommandLine& command,
+                        const BuildConfig& config,
+                        const subprocess::EnvMap& env = {}) {
+        DiagnosticParser parsers[2];
+        auto process = subprocess::RunBuilder(command)
+            .cout(subprocess::PipeOption::pipe)
+            .cerr(subprocess::PipeOption::pipe)
+            .env(env)
+            .new_process_group(config.fail_fast)
+            .popen();
+        
+        bool stopped = false;
+        pollfd pipes[2] = {{process.cout, POLLIN, 0}, {process.cerr, POLLIN, 0}};
+        int open = 2;
+        char buffer[64 * 1024];
+        while (open > 0) {
+            if (::poll(pipes, 2, -1) < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                break;
+            }
+            for (int i = 0; i < 2; i++) {
+                if (pipes[i].revents == 0) {
+                    continue;
+                }
+                ssize_t n = subprocess::pipe_read(pipes[i].fd, buffer, sizeof(buffer));
+                if (n <= 0) {
+                    pipes[i].fd = -1;  // ignored by poll from now on
+                    open--;
+                    continue;
+                }
+                parsers[i].feed(buffer, static_cast<size_t>(n));
+            }
+            if (config.fail_fast && !stopped && parsers[0].errors() + parsers[1].errors() > 0) {
+                std::cerr << "Stopping at the first error (fail-fast)" << std::endl;
+                ::kill(-process.pid, SIGTERM);
+                stopped = true;
+            }
+        }
+        for (auto& parser : parsers) {
+            parser.finish();
+            BuildDiagnostics::add(parser.diagnostics());
+        }
+        std::cout.flush();
+        auto returncode = process.wait();
+        process.close();
+        return stopped ? 1 : static_cast<int>(returncode);
+    }
+    
+    // Environment for the build tool: unchanged (empty map) without a
+    // jobserver, else the current one with MAKEFLAGS naming it, as a parent
+    // make would pass it. An explicit -j would make make start its own.
+    static subprocess::EnvMap build_environment(const BuildConfig& config) {
+        if (config.jobserver.empty()) {
+            return {};
+        }
+        subprocess::EnvMap env = inherited_environment();
+        env["MAKEFLAGS"] = "-j" + std::to_string(std::max(1u, config.jobs)) +
+            " --jobserver-auth=" + config.jobserver;
+        return env;
+    }
+    
+    // This process's environment, as a base for adding variables: a non-empty
+    // EnvMap replaces the child's environment as a whole
+    static subprocess::EnvMap inherited_environment() {
+        subprocess::EnvMap env;
+        for (char** entry = environ; *entry; entry++) {
+            std::string variable(*entry);
+            auto eq = variable.find('=');
+            if (eq != std::string::npos) {
+                env[variable.substr(0, eq)] = variable.substr(eq + 1);
+            }
+        }
+        return env;
+    }
+    
+    // Copies configure-check results (HAVE_*, SIZEOF_* and friends, stored as
+    // INTERNAL cache entries) into an initial-cache script for `cmake -C`
+    static void write_check_cache(const std::filesystem::path& cmake_cache,
+                                  const std::filesystem::path& output) {
+        static const std::vector<std::string> prefixes = {"HAVE_", "SIZEOF_", "CMAKE_HAVE_"};
+        
+        std::ifstream in(cmake_cache);
+        std::ofstream out(output);
+        out << "# Configure-check results shared between variant builds\n";
+        
+        std::string line;
+        while (std::getline(in, line)) {
+            size_t colon = line.find(':');
+            size_t eq = line.find('=', colon);
+            if (colon == std::string::npos || eq == std::string::npos ||
+                line.compare(colon + 1, eq - colon - 1, "INTERNAL") != 0) {
+                continue;
+            }
+            std::string name = line.substr(0, colon);
+            bool is_check = std::any_of(prefixes.begin(), prefixes.end(),
+                [&](const std::string& prefix) { return name.rfind(prefix, 0) == 0; });
+            if (!is_check) {
+                continue;
+            }
+            
+            std::string value;
+            for (char c : line.substr(eq + 1)) {
+                if (c == '"' || c == '\\') {
+                    value += '\\';
+                }
+                value += c;
+            }
+            out << "set(" << name << " \"" << value << "\" CACHE INTERNAL \"\")\n";
+        }
+    }
+    
+    // Options that cut dynamic-loader work at process start. Hidden visibility
+    // goes through the CMake presets so libraries that mark their API with
+    // GenerateExportHeader (or explicit visibility attributes) keep exporting it.
+    // Toolchain-dependent flags are probed and dropped when unsupported.
+    static void apply_startup_profile(std::vector<std::string>& configure_cmd,
+                                      std::vector<std::string>& compile_flags,
+                                      std::vector<std::string>& shared_link_flags,
+                                      std::vector<std::string>& exe_link_flags) {
+        configure_cmd.push_back("-DCMAKE_C_VISIBILITY_PRESET=hidden");
+        configure_cmd.push_back("-DCMAKE_CXX_VISIBILITY_PRESET=hidden");
+        configure_cmd.push_back("-DCMAKE_VISIBILITY_INLINES_HIDDEN=ON");
+        
+        auto compiler = CompilerDetector::detect_system_compiler();
+        if (compiler.type == CompilerDetector::CompilerType::MSVC ||
+            compiler.type == CompilerDetector::CompilerType::Unknown) {
+            return;
+        }
+        
+        auto supported = [&](const std::string& flag) {
+            bool ok = CompilerDetector::supports_flag(compiler.path, flag);
+            if (!ok) {
+                std::cout << "Startup profile: " << compiler.path
+                          << " does not support " << flag << ", skipping" << std::endl;
+            }
+            return ok;
+        };
+        
+        if (supported("-fno-semantic-interposition")) {
+            compile_flags.push_back("-fno-semantic-interposition");
+        }
+        for (const std::string flag : {"-Wl,-z,pack-relative-relocs", "-Wl,--hash-style=gnu"}) {
+            if (supported(flag)) {
+                shared_link_flags.push_back(flag);
+                exe_link_flags.push_back(flag);
+            }
+        }
+        if (supported("-Wl,-Bsymbolic-functions")) {
+            shared_link_flags.push_back("-Wl,-Bsymbolic-functions");
+        }
+    }
+    
+    // Value of "-D<variable>=..." or "-D<variable>:<TYPE>=..."
+    static std::optional<std::string> cache_value(const std::string& arg, const std::string& variable) {
+        std::string prefix = "-D" + variable;
+        if (arg.compare(0, prefix.size(), prefix) != 0) {
+            return std::nullopt;
+        }
+        size_t equals = arg.find('=', prefix.size());
+        if (equals == std::string::npos ||
+            (equals != prefix.size() && arg[prefix.size()] != ':')) {
+            return std::nullopt;
+        }
+        return arg.substr(equals + 1);
+    }
+    
+    // The compiler CMake will use for `language` (C or CXX), as far as it can
+    // be told before configuring: the one an existing cache recorded, else
+    // CMAKE_<LANG>_COMPILER among the CMake arguments, CC or CXX, or CMake's
+    // first default. Empty when a toolchain file decides.
+    static std::string resolved_compiler(const std::string& language,
+                                         const std::filesystem::path& build_dir,
+                                         const BuildConfig& config) {
+        std::string variable = "CMAKE_" + language + "_COMPILER";
+        std::ifstream cache(build_dir / "CMakeCache.txt");
+        std::string line;
+        while (std::getline(cache, line)) {
+            if (auto value = cache_value("-D" + line, variable); value && !value->empty()) {
+                return *value;
+            }
+        }
+        
+        std::optional<std::string> compiler;
+        for (const auto& arg : config.cmake_args) {
+            if (cache_value(arg, "CMAKE_TOOLCHAIN_FILE")) {
+                return {};
+            }
+            if (auto value = cache_value(arg, variable)) {
+                compiler = value;
+            }
+        }
+        if (compiler) {
+            return *compiler;
+        }
+        if (const char* toolchain = std::getenv("CMAKE_TOOLCHAIN_FILE"); toolchain && *toolchain) {
+            return {};
+        }
+        // CC and CXX may carry arguments after the compiler
+        if (const char* value = std::getenv(language == "C" ? "CC" : "CXX"); value && *value) {
+            std::istringstream words(value);
+            std::string first;
+            words >> first;
+            return first;
+        }
+        return language == "C" ? "cc" : "c++";
+    }
+    
+    // CMake reads CFLAGS/CXXFLAGS/LDFLAGS only while the variable is unset,
+    // and a -D<variable> in cmake_args would replace the flags added here, so
+    // both are carried over in front of them (with a trailing space)
+    static std::string user_flags(const std::string& variable, const char* env_var,
+                                  const std::vector<std::string>& cmake_args) {
+        std::string flags;
+        if (const char* value = std::getenv(env_var); value != nullptr && *value != '\0') {
+            flags = std::string(value) + " ";
+        }
+        for (const auto& arg : cmake_args) {
+            if (auto value = cache_value(arg, variable); value && !value->empty()) {
+                flags += *value + " ";
+            }
+        }
+        return flags;
+    }
+    
+    static std::string join_flags(const std::vector<std::string>& flags) {
+        std::string joined;
+        for (const auto& flag : flags) {
+            if (!joined.empty()) {
+                joined += " ";
+            }
+            joined += flag;
+        }
+        return joined;
+    }
+};
+
+// Combines the static archives installed for a dependency closure into one
+// deduplicated archive with a single symbol index, and writes a CMake package
+// config exposing it as an imported target `cpkg::<name>`.
+class StaticBundler {
+public:
+    struct BundleRequest {
+        std::string name;
+        std::vector<std::string> packages;
+        std::filesystem::path output_dir;
+        bool thin = false;   // reference staged objects instead of copying them
+        bool index = true;   // write the archive symbol index
+    };
+    
+    static int bundle(const BundleRequest& request) {
+        try {
+            std::filesystem::path objects_dir = request.output_dir / (request.name + ".objects");
+            std::filesystem::remove_all(objects_dir);
+            std::filesystem::create_directories(objects_dir);
+            
+            std::vector<std::filesystem::path> staged;
+            std::vector<std::string> include_dirs;
+            std::map<uint64_t, std::string> seen;
+            size_t duplicates = 0;
+            
+            for (const auto& package : request.packages) {
+                std::filesystem::path manifest = std::filesystem::temp_directory_path()
+                    / "cpppm_build" / package / "install_manifest.txt";
+                std::ifstream in(manifest);
+                if (!in) {
+                    std::cerr << "No install manifest for " << package
+                              << ", was it built with CMakeBuilder?" << std::endl;
+                    return 1;
+                }
+                
+                std::string line;
+                while (std::getline(in, line)) {
+                    std::filesystem::path installed(line);
+                    size_t include_pos = line.find("/include/");
+                    if (include_pos != std::string::npos) {
+                        std::string dir = line.substr(0, include_pos + 8);
+                        if (std::find(include_dirs.begin(), include_dirs.end(), dir) == include_dirs.end()) {
+                            include_dirs.push_back(dir);
+                        }
+                    }
+                    if (installed.extension() != ".a") {
+                        continue;
+                    }
+                    
+                    for (auto& member : read_archive(installed)) {
+                        uint64_t digest = ABIManager::fnv1a(member.data);
+                        auto it = seen.find(digest);
+                        if (it != seen.end() && it->second == member.data) {
+                            duplicates++;
+                            continue;
+                        }
+                        
+                        // Members of different archives often share names (util.o)
+                        char prefix[16];
+                        std::snprintf(prefix, sizeof(prefix), "%06zu_", staged.size());
+                        std::filesystem::path object = objects_dir / (prefix + member.name);
+                        std::ofstream out(object, std::ios::binary);
+                        out.write(member.data.data(), member.data.size());
+                        staged.push_back(object);
+                        seen.emplace(digest, std::move(member.data));
+                    }
+                }
+            }
+            
+            if (staged.empty()) {
+                std::cerr << "No static archives installed for " << request.name << std::endl;
+                return 1;
+            }
+            
+            std::filesystem::path archive = request.output_dir / ("lib" + request.name + ".a");
+            std::filesystem::remove(archive);
+            
+            // Response file keeps large closures under the command line limit
+            std::filesystem::path response = objects_dir / "members.rsp";
+            {
+                std::ofstream rsp(response);
+                for (const auto& object : staged) {
+                    rsp << '"' << object.string() << '"' << "\n";
+                }
+            }
+            
+            std::string mode = std::string("qc") + (request.thin ? "T" : "") + (request.index ? "s" : "S");
+            auto ar_result = subprocess::run({
+                "ar", mode, archive.string(), "@" + response.string()
+            }, subprocess::RunOptions{.check = false});
+            if (ar_result.returncode != 0) {
+                std::cerr << "ar failed: " << ar_result.cerr << std::endl;
+                return 1;
+            }
+            
+            if (!request.thin) {
+                std::filesystem::remove_all(objects_dir);
+            }
+            write_cmake_config(request, archive, include_dirs);
+            
+            std::cout << "Bundled " << staged.size() << " object(s) from "
+                      << request.packages.size() << " package(s) into " << archive.string()
+                      << " (" << duplicates << " duplicate(s) dropped)" << std::endl;
+            return 0;
+            
+        } catch (const std::exception& e) {
+            std::cerr << "Bundle error: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    
+private:
+    struct ArchiveMember {
+        std::string name;
+        std::string data;
+    };
+    
+    // Reads regular and thin GNU/BSD ar archives, skipping symbol tables
+    static std::vector<ArchiveMember> read_archive(const std::filesystem::path& path) {
+        std::vector<ArchiveMember> members;
+        std::ifstream in(path, std::ios::binary);
+        std::string data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        
+        bool thin = data.compare(0, 8, "!<thin>\n") == 0;
+        if (!thin && data.compare(0, 8, "!<arch>\n") != 0) {
+            std::cerr << "Not an ar archive: " << path << std::endl;
+            return members;
+        }
+        
+        std::string long_names;
+        size_t pos = 8;
+        while (pos + 60 <= data.size()) {
+            std::string name = data.substr(pos, 16);
+            name.erase(name.find_last_not_of(' ') + 1);
+            size_t size = std::stoull(data.substr(pos + 48, 10));
+            pos += 60;
+            size_t body = pos;
+            size_t body_size = size;
+            
+            bool special = name == "/" || name == "/SYM64/" || name == "//" ||
+                           name.rfind("__.SYMDEF", 0) == 0;
+            if (name.rfind("#1/", 0) == 0) {
+                size_t name_len = std::stoull(name.substr(3));
+                name = data.substr(body, name_len);
+                name.erase(name.find_last_not_of('\0') + 1);
+                body += name_len;
+                body_size -= name_len;
+                special = name.rfind("__.SYMDEF", 0) == 0;
+            } else if (name == "//") {
+                long_names = data.substr(body, size);
+            } else if (name.size() > 1 && name[0] == '/' && std::isdigit(static_cast<unsigned char>(name[1]))) {
+                size_t offset = std::stoull(name.substr(1));
+                size_t end = long_names.find("/\n", offset);
+                name = long_names.substr(offset, end - offset);
+            } else if (!special && !name.empty() && name.back() == '/') {
+                name.pop_back();
+            }
+            
+            // Thin archives only store the tables; members live next to them
+            bool external = thin && !special;
+            if (!special) {
+                ArchiveMember member;
+                member.name = std::filesystem::path(name).filename().string();
+                if (external) {
+                    std::ifstream object(path.parent_path() / name, std::ios::binary);
+                    member.data.assign(std::istreambuf_iterator<char>(object), std::istreambuf_iterator<char>());
+                } else {
+                    member.data = data.substr(body, body_size);
+                }
+                members.push_back(std::move(member));
+            }
+            
+            pos += external ? 0 : size + (size & 1);
+        }
+        return members;
+    }
+    
+    static void write_cmake_config(const BundleRequest& request,
+                                   const std::filesystem::path& archive,
+                                   const std::vector<std::string>& include_dirs) {
+        std::string includes;
+        for (const auto& dir : include_dirs) {
+            includes += (includes.empty() ? "" : ";") + dir;
+        }
+        
+        std::ofstream config(request.output_dir / (request.name + "Config.cmake"));
+        config << "# Generated by cpkg bundle\n"
+               << "if(NOT TARGET cpkg::" << request.name << ")\n"
+               << "  add_library(cpkg::" << request.name << " STATIC IMPORTED)\n"
+               << "  set_target_properties(cpkg::" << request.name << " PROPERTIES\n"
+               << "    IMPORTED_LOCATION \"" << archive.string() << "\"\n"
+               << "    INTERFACE_INCLUDE_DIRECTORIES \"" << includes << "\")\n"
+               << "endif()\n";
+    }
+};
+
+// Measures dynamic-loader startup cost of an executable: relocation counts
+// summed over the executable and every shared library it loads, plus the
+// timings glibc reports with LD_DEBUG=statistics.
+class StartupProfiler {
+public:
+    struct RelocationCounts {
+        uint64_t relative = 0;   // R_*_RELATIVE in REL/RELA tables
+        uint64_t symbolic = 0;   // relocations needing a symbol lookup
+        uint64_t plt = 0;        // lazy/PLT relocations
+        uint64_t relr_words = 0; // packed DT_RELR entries
+    };
+    
+    static RelocationCounts relocation_counts(const std::filesystem::path& file) {
+        RelocationCounts counts;
+#ifdef __linux__
+        std::ifstream in(file, std::ios::binary);
+        unsigned char ident[EI_NIDENT];
+        if (!in.read(reinterpret_cast<char*>(ident), EI_NIDENT) ||
+            std::memcmp(ident, ELFMAG, SELFMAG) != 0 || ident[EI_DATA] != ELFDATA2LSB) {
+            return counts;
+        }
+        std::map<int64_t, uint64_t> dynamic;
+        if (ident[EI_CLASS] == ELFCLASS64) {
+            dynamic = read_dynamic<Elf64_Ehdr, Elf64_Shdr, Elf64_Dyn>(in);
+        } else if (ident[EI_CLASS] == ELFCLASS32) {
+            dynamic = read_dynamic<Elf32_Ehdr, Elf32_Shdr, Elf32_Dyn>(in);
+        }
+        
+        auto entries = [&](int64_t size_tag, int64_t ent_tag) -> uint64_t {
+            uint64_t ent = dynamic.count(ent_tag) ? dynamic[ent_tag] : 0;
+            return ent ? dynamic[size_tag] / ent : 0;
+        };
+        uint64_t rela = entries(DT_RELASZ, DT_RELAENT);
+        uint64_t rel = entries(DT_RELSZ, DT_RELENT);
+        counts.relative = dynamic[DT_RELACOUNT] + dynamic[DT_RELCOUNT];
+        counts.symbolic = rela + rel - std::min(counts.relative, rela + rel);
+        uint64_t plt_ent = dynamic[DT_PLTREL] == DT_RELA ? dynamic[DT_RELAENT] : dynamic[DT_RELENT];
+        counts.plt = plt_ent ? dynamic[DT_PLTRELSZ] / plt_ent : 0;
+#ifdef DT_RELR
+        counts.relr_words = entries(DT_RELRSZ, DT_RELRENT);
+#endif
+#endif
+        return counts;
+    }
+    
+    // Runs the executable `runs` times and keeps the median of every counter.
+    // A run is killed after `timeout` seconds; ld.so reports the startup
+    // counters before main, so a server that never exits still has them.
+    static std::map<std::string, uint64_t> loader_statistics(const std::string& executable,
+                                                             int runs = 5,
+                                                             double timeout = 10) {
+        auto env = subprocess::EnvMap{{"LD_DEBUG", "statistics"}};
+        for (char** var = environ; *var; var++) {
+            std::string entry(*var);
+            size_t eq = entry.find('=');
+            if (eq != std::string::npos && !env.count(entry.substr(0, eq))) {
+                env[entry.substr(0, eq)] = entry.substr(eq + 1);
+            }
+        }
+        
+        std::map<std::string, std::vector<uint64_t>> samples;
+        for (int i = 0; i < runs; i++) {
+            pid_t pid = 0;
+            std::string output = run_with_timeout(executable, env, timeout, pid);
+            
+            // Lines look like "   1234:\t  number of relocations: 567"; only
+            // ld.so's lines for this process carry its pid
+            std::string prefix = std::to_string(pid) + ":";
+            std::istringstream lines(output);
+            std::string line;
+            while (std::getline(lines, line)) {
+                size_t first = line.find_first_not_of(' ');
+                if (first == std::string::npos || line.compare(first, prefix.size(), prefix) != 0) {
+                    continue;
+                }
+                size_t colon = first + prefix.size() - 1;
+                size_t value_colon = line.find(':', colon + 1);
+                if (value_colon == std::string::npos) {
+                    continue;
+                }
+                std::string key = trim(line.substr(colon + 1, value_colon - colon - 1));
+                std::string value = trim(line.substr(value_colon + 1));
+                if (key.empty() || value.empty() || !std::isdigit(static_cast<unsigned char>(value[0]))) {
+                    continue;
+                }
+                samples[key].push_back(std::strtoull(value.c_str(), nullptr, 10));
+            }
+        }
+        
+        std::map<std::string, uint64_t> medians;
+        for (auto& [key, values] : samples) {
+            std::sort(values.begin(), values.end());
+            medians[key] = values[values.size() / 2];
+        }
+        return medians;
+    }
+    
+    static nlohmann::json report(const std::string& executable) {
+        if (!std::filesystem::is_regular_file(executable)) {
+            throw std::runtime_error("no such executable");
+        }
+        nlohmann::json objects = nlohmann::json::array();
+        RelocationCounts total;
+        for (const auto& object : loaded_objects(executable)) {
+            auto counts = relocation_counts(object);
+            total.relative += counts.relative;
+            total.symbolic += counts.symbolic;
+            total.plt += counts.plt;
+            total.relr_words += counts.relr_words;
+            objects.push_back({
+                {"path", object},
+                {"relative", counts.relative},
+                {"symbolic", counts.symbolic},
+                {"plt", counts.plt},
+                {"relr_words", counts.relr_words}
+            });
+        }
+        
+        nlohmann::json j;
+        j["executable"] = executable;
+        j["objects"] = objects;
+        j["total"] = {
+            {"relative", total.relative},
+            {"symbolic", total.symbolic},
+            {"plt", total.plt},
+            {"relr_words", total.relr_words}
+        };
+        j["loader_statistics"] = loader_statistics(executable);
+        return j;
+    }
+    
+private:
+#ifdef __linux__
+    template <typename Ehdr, typename Shdr, typename Dyn>
+    static std::map<int64_t, uint64_t> read_dynamic(std::ifstream& in) {
+        std::map<int64_t, uint64_t> dynamic;
+        Ehdr header;
+        in.seekg(0);
+        if (!in.read(reinterpret_cast<char*>(&header), sizeof(header))) {
+            return dynamic;
+        }
+        
+        for (size_t i = 0; i < header.e_shnum; i++) {
+            Shdr section;
+            in.seekg(header.e_shoff + i * header.e_shentsize);
+            if (!in.read(reinterpret_cast<char*>(&section), sizeof(section))) {
+                break;
+            }
+            if (section.sh_type != SHT_DYNAMIC) {
+                continue;
+            }
+            
+            in.seekg(section.sh_offset);
+            for (size_t n = 0; n < section.sh_size / sizeof(Dyn); n++) {
+                Dyn entry;
+                if (!in.read(reinterpret_cast<char*>(&entry), sizeof(entry)) ||
+                    entry.d_tag == DT_NULL) {
+                    break;
+                }
+                dynamic[entry.d_tag] = entry.d_un.d_val;
+            }
+            break;
+        }
+        return dynamic;
+    }
+#endif
+    
+    // The executable followed by every shared object ldd resolves for it
+    static std::vector<std::string> loaded_objects(const std::string& executable) {
+        std::vector<std::string> objects = {executable};
+        auto result = subprocess::run({"ldd", executable}, subprocess::RunOptions{
+            .check = false,
+            .cout = subprocess::PipeOption::pipe
+        });
+        
+        // "libfoo.so.1 => /usr/lib/libfoo.so.1 (0x...)" or "/lib64/ld-linux... (0x...)"
+        std::istringstream lines(result.cout);
+        std::string line;
+        while (std::getline(lines, line)) {
+            size_t arrow = line.find("=> ");
+            size_t start = arrow != std::string::npos ? arrow + 3 : line.find_first_not_of(" \t");
+            if (start == std::string::npos || line[start] != '/') {
+                continue;
+            }
+            size_t end = line.find(" (", start);
+            objects.push_back(line.substr(start, end - start));
+        }
+        return objects;
+    }
+    
+    // stderr of one run of `executable` (stdout is discarded), which is
+    // killed with its process group after `timeout` seconds; `pid` is set
+    // to the process's id
+    static std::string run_with_timeout(const std::string& executable, const subprocess::EnvMap& env,
+                                        double timeout, pid_t& pid) {
+        auto process = subprocess::RunBuilder({executable})
+            .cout(subprocess::PipeOption::pipe)
+            .cerr(subprocess::PipeOption::pipe)
+            .env(env)
+            .new_process_group(true)
+            .popen();
+        pid = process.pid;
+        
+        auto deadline = std::chrono::steady_clock::now() +
+            std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(timeout));
+        std::string output;
+        pollfd pipes[2] = {{process.cout, POLLIN, 0}, {process.cerr, POLLIN, 0}};
+        int open = 2;
+        char buffer[16 * 1024];
+        while (open > 0) {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now()).count();
+            int ready = left > 0 ? ::poll(pipes, 2, static_cast<int>(left)) : 0;
+            if (ready < 0 && errno == EINTR) {
+                continue;
+            }
+            if (ready <= 0) {
+                ::kill(-process.pid, SIGKILL);
+                break;
+            }
+            for (int i = 0; i < 2; i++) {
+                if (pipes[i].revents == 0) {
+                    continue;
+                }
+                ssize_t n = subprocess::pipe_read(pipes[i].fd, buffer, sizeof(buffer));
+                if (n <= 0) {
+                    pipes[i].fd = -1;
+                    open--;
+                } else if (i == 1) {
+                    output.append(buffer, static_cast<size_t>(n));
+                }
+            }
+        }
+        process.wait();
+        process.close();
+        return output;
+    }
+    
+    static std::string trim(const std::string& text) {
+        size_t first = text.find_first_not_of(" \t");
+        if (first == std::string::npos) {
+            return "";
+        }
+        size_t last = text.find_last_not_of(" \t");
+        return text.substr(first, last - first + 1);
+    }
+};
+
+// C interface for Rust FFI
+extern "C" {
+    int cpp_build_cmake(const char* package_name, size_t name_len) {
+        std::string pkg_name(package_name, name_len);
+        
+        // In a real implementation, source_dir would be determined from cache
+        std::string source_dir = "/tmp/cpppm_cache/" + pkg_name;
+        
+        BuildStats::begin(pkg_name);
+        BuildDiagnostics::begin(pkg_name);
+        return CMakeBuilder::build_package(pkg_name, source_dir);
+    }
+    
+    int cpp_build_cmake_with_config(const char* package_name, size_t name_len,
+                                    const char* config_json) {
+        std::string pkg_name(package_name, name_len);
+        std::string source_dir = "/tmp/cpppm_cache/" + pkg_name;
+        
+        BuildStats::begin(pkg_name);
+        BuildDiagnostics::begin(pkg_name);
+        try {
+            auto config = CMakeBuilder::config_from_json(config_json);
+            return CMakeBuilder::build_package(pkg_name, source_dir, config);
+        } catch (const std::exception& e) {
+            std::cerr << "Invalid build config: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    
+    const char* cpp_detect_compiler() {
+        static std::string compiler_info;
+        auto info = CompilerDetector::detect_system_compiler();
+        
+        nlohmann::json j;
+        j["type"] = static_cast<int>(info.type);
+        j["version"] = info.version;
+        j["path"] = info.path;
+        j["stdlib"] = info.stdlib;
+        
+        compiler_info = j.dump();
+        return compiler_info.c_str();
+    }
+    
+    const char* cpp_get_abi_info() {
+        static std::string abi_info;
+        auto info = ABIManager::get_current_abi();
+        abi_info = ABIManager::abi_to_string(info);
+        return abi_info.c_str();
+    }
+    
+    int cpp_build_cmake_variants(const char* package_name, size_t name_len,
+                                 const char* config_json, const char* variants_json) {
+        std::string pkg_name(package_name, name_len);
+        std::string source_dir = "/tmp/cpppm_cache/" + pkg_name;
+        
+        BuildStats::begin(pkg_name);
+        BuildDiagnostics::begin(pkg_name);
+        try {
+            auto config = CMakeBuilder::config_from_json(config_json);
+            auto variants = nlohmann::json::parse(variants_json).get<std::vector<std::string>>();
+            return CMakeBuilder::build_variants(pkg_name, source_dir, config, variants);
+        } catch (const std::exception& e) {
+            std::cerr << "Invalid variant request: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    
+    int cpp_bundle_static(const char* request_json) {
+        try {
+            auto j = nlohmann::json::parse(request_json);
+            StaticBundler::BundleRequest request;
+            request.name = j.at("name").get<std::string>();
+            request.packages = j.at("packages").get<std::vector<std::string>>();
+            request.output_dir = j.at("output_dir").get<std::string>();
+            request.thin = j.value("thin", request.thin);
+            request.index = j.value("index", request.index);
+            std::filesystem::create_directories(request.output_dir);
+            return StaticBundler::bundle(request);
+        } catch (const std::exception& e) {
+            std::cerr << "Invalid bundle request: " << e.what() << std::endl;
+            return 1;
+        }
+    }
+    
+    // JSON startup report, or {"error": message} when the executable cannot
+    // be profiled
+    const char* cpp_startup_report(const char* executable) {
+        static thread_local std::string report;
+        try {
+            report = StartupProfiler::report(executable).dump();
+        } catch (const std::exception& e) {
+            report = nlohmann::json{{"error", e.what()}}.dump(-1, ' ', false, nlohmann::json::error_handler_t::replace);
+        }
+        return report.c_str();
+    }
+    
+    // Artifact store key a build with this config publishes under; empty if
+    // the config does not parse
+    const char* cpp_artifact_key(const char* config_json) {
+        static thread_local std::string key;
+        try {
+            auto config = CMakeBuilder::config_from_json(config_json);
+            config.sanitizer = CMakeBuilder::normalize_sanitizer(config.sanitizer);
+            key = CMakeBuilder::artifact_key(config);
+        } catch (const std::exception&) {
+            key.clear();
+        }
+        return key.c_str();
+    }
+    
+    // JSON {"stages": {name: {seconds, cpu_seconds}}} of the
+    // last build of the package; per thread, as builds may run concurrently
+    const char* cpp_last_build_stats(const char* package_name, size_t name_len) {
+        static thread_local std::string stats;
+        stats = BuildStats::to_json(std::string(package_name, name_len)).dump();
+        return stats.c_str();
+    }
+    
+    // JSON array of the deduplicated errors and warnings of the last build
+    // of the package: {severity, file, line, column, message, option, count}
+    const char* cpp_last_build_diagnostics(const char* package_name, size_t name_len) {
+        static thread_local std::string diagnostics;
+        diagnostics = BuildDiagnostics::to_json(std::string(package_name, name_len)).dump();
+        return diagnostics.c_str();
+    }
+    
+    void cpp_trace_enable(int enabled) {
+        Tracer::enable(enabled != 0);
+    }
+    
+    // JSON array of Chrome trace events since the last call
+    const char* cpp_trace_drain() {
+        static thread_local std::string events;
+        events = Tracer::drain();
+        return events.c_str();
+    }
+    
+    // JSON object of the native counters
+    const char* cpp_native_metrics() {
+        static thread_local std::string metrics;
+        metrics = nlohmann::json{
+            {"probe_cache_hits", NativeMetrics::probe_cache_hits.value()},
+            {"probe_cache_misses", NativeMetrics::probe_cache_misses.value()}
+        }.dump();
+        return metrics.c_str();
     }
 }
\ No newline at end of file
@@ -0,0 +1,29 @@
+// C interface of the native layer (src/cpp/compiler_detector.cpp), used by
+// the Rust core through bindgen and by the native benchmarks
+#pragma once
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+int cpp_build_cmake(const char* package_name, size_t name_len);
+int cpp_build_cmake_with_config(const char* package_name, size_t name_len,
+                                const char* config_json);
+const char* cpp_detect_compiler();
+const char* cpp_get_abi_info();
+const char* cpp_startup_report(const char* executable);
+int cpp_bundle_static(const char* request_json);
+int cpp_build_cmake_variants(const char* package_name, size_t name_len,
+                             const char* config_json, const char* variants_json);
+const char* cpp_artifact_key(const char* config_json);
+const char* cpp_last_build_stats(const char* package_name, size_t name_len);
+const char* cpp_last_build_diagnostics(const char* package_name, size_t name_len);
+void cpp_trace_enable(int enabled);
+const char* cpp_trace_drain();
+const char* cpp_native_metrics();
+
+#ifdef __cplusplus
+}
+#endif
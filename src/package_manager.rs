@@ -1,5 +1,6 @@
 // Rust Core - handles logic, networking, dependency resolution
 use serde::{Deserialize, Serialize};
+use sha2::Digest;
 use std::collections::HashMap;
 use tokio;
 
@@ -10,6 +11,100 @@ pub struct Package {
     pub dependencies: Vec<String>,
     pub source_url: String,
     pub build_type: BuildType,
+    // SHA-256 of the archive at source_url, verified while downloading
+    #[serde(default)]
+    pub checksum: Option<String>,
+    // Root of the archive's chunked Merkle manifest (see ChunkManifest),
+    // published next to the archive as <source_url>.merkle
+    #[serde(default)]
+    pub merkle_root: Option<String>,
+    // SHA-256 of the content-defined chunk index of the uncompressed tarball
+    // (see ChunkIndex), published as <source_url>.caidx
+    #[serde(default)]
+    pub chunk_index: Option<String>,
+    // zstd --patch-from deltas to this archive from earlier versions; the
+    // patched archive must still match `checksum`
+    #[serde(default)]
+    pub deltas: Vec<PackageDelta>,
+    // Publisher signature over the artifact digests (see artifact_message)
+    #[serde(default)]
+    pub signature: Option<PackageSignature>,
+    // Flags every consumer of this package (and the package itself) must
+    // build with, e.g. ABI-affecting defines
+    #[serde(default)]
+    pub usage_requirements: UsageRequirements,
+}
+
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+pub struct PackageDelta {
+    pub from_version: String,
+    // SHA-256 of the base archive the delta applies to
+    pub from_checksum: String,
+    // Relative to source_url unless absolute
+    pub url: String,
+    pub size: u64,
+}
+
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+pub struct PackageSignature {
+    pub key_id: String,
+    // Hex-encoded Ed25519 signature
+    pub signature: String,
+}
+
+// Registry index snapshot: the artifact digest of every package version, with
+// a Merkle root signed by the registry keys. Verifying the root once vouches
+// for every digest in the snapshot.
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct IndexSnapshot {
+    pub serial: u64,
+    pub entries: Vec<SnapshotEntry>,
+    pub merkle_root: String,
+    pub signatures: Vec<PackageSignature>,
+}
+
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct SnapshotEntry {
+    pub name: String,
+    pub version: String,
+    pub sha256: String,
+    #[serde(default)]
+    pub merkle_root: Option<String>,
+    #[serde(default)]
+    pub chunk_index: Option<String>,
+}
+
+#[derive(Debug, Clone, Default, PartialEq, Serialize, Deserialize)]
+pub struct UsageRequirements {
+    #[serde(default)]
+    pub defines: Vec<String>,
+    #[serde(default)]
+    pub compile_flags: Vec<String>,
+    #[serde(default)]
+    pub link_flags: Vec<String>,
+}
+
+// Normalized flags and settings a package is actually built with; its hash is
+// part of the artifact key, so equal configs share artifacts and any
+// difference rebuilds
+#[derive(Debug, Clone, PartialEq, Serialize)]
+pub struct EffectiveConfig {
+    pub build_type: String,
+    pub defines: Vec<String>,
+    pub compile_flags: Vec<String>,
+    pub link_flags: Vec<String>,
+    // Root build options that change what gets installed
+    pub profile: String,
+    pub split_debug_info: bool,
+    // Baked into installed config files; empty for the native default
+    pub install_prefix: String,
+}
+
+impl EffectiveConfig {
+    pub fn config_hash(&self) -> String {
+        let canonical = serde_json::to_string(self).unwrap_or_default();
+        format!("{:016x}", fnv1a(canonical.as_bytes()))
+    }
 }
 
 #[derive(Debug, Clone, Serialize, Deserialize)]
@@ -19,38 +114,503 @@ pub enum BuildType {
     Custom(String),
 }
 
+// Options forwarded to the native CMakeBuilder as its BuildConfig
+#[derive(Debug, Clone, Default, Serialize, Deserialize)]
+pub struct BuildOptions {
+    // Strip installed binaries and keep their debug info in the debuginfod tree
+    pub split_debug_info: bool,
+    // Named native build profile applied to every package ("startup")
+    pub profile: Option<String>,
+    // Sanitizer variant matrix ("" for a plain build); each variant is cached
+    // in the artifact store under its own ABI fingerprint
+    pub sanitizers: Vec<String>,
+    // Root of the flag propagation; defaults to Release
+    pub build_type: Option<String>,
+    pub root_requirements: UsageRequirements,
+    // Lockfile to write after install; it pins what it references against GC
+    // for as long as it exists
+    #[serde(default)]
+    pub lockfile: Option<std::path::PathBuf>,
+    // Remote cache base URL; overrides CPKG_REMOTE_CACHE
+    #[serde(default)]
+    pub remote_cache: Option<String>,
+    // Compile workers ("tcp:host:port", "unix:path"); override CPKG_WORKERS
+    #[serde(default)]
+    pub workers: Vec<String>,
+    // Packages built at once; defaults to 1, or 4 with compile workers,
+    // whose jobserver bounds the total load
+    #[serde(default)]
+    pub package_jobs: Option<usize>,
+    // CMAKE_INSTALL_PREFIX of every package; the native default is /usr/local
+    #[serde(default)]
+    pub install_prefix: Option<std::path::PathBuf>,
+    // Stop each native build step at its first compiler or CMake error
+    #[serde(default)]
+    pub fail_fast: bool,
+}
+
+// Expands a leading "~" to $HOME; other paths are returned unchanged
+pub fn expand_home(path: &std::path::Path) -> std::path::PathBuf {
+    let Ok(rest) = path.strip_prefix("~") else {
+        return path.to_path_buf();
+    };
+    match std::env::var_os("HOME") {
+        Some(home) => std::path::PathBuf::from(home).join(rest),
+        None => path.to_path_buf(),
+    }
+}
+
+// Per-user writable cache: $CPKG_CACHE_DIR, else ~/.cpppm/cache
+pub fn default_cache_dir() -> std::path::PathBuf {
+    match std::env::var_os("CPKG_CACHE_DIR") {
+        Some(dir) if !dir.is_empty() => expand_home(std::path::Path::new(&dir)),
+        _ => expand_home(std::path::Path::new("~/.cpppm/cache")),
+    }
+}
+
+// Registry base URL: $CPKG_REGISTRY, else the public registry
+pub fn default_registry_url() -> String {
+    match std::env::var("CPKG_REGISTRY") {
+        Ok(url) if !url.is_empty() => url.trim_end_matches('/').to_string(),
+        _ => "https://registry.cpppm.org".to_string(),
+    }
+}
+
+// System caches used when CPKG_SYSTEM_CACHES is unset, if they exist
+const DEFAULT_SYSTEM_CACHES: &[&str] = &["/var/cache/cpppm"];
+
+// Cache layering for shared build hosts. Read-only system caches, filled by
+// an administrator running cpkg with CPKG_CACHE_DIR pointing at them, are
+// consulted first, in order, then the per-user cache. Every layer has the
+// user cache's layout. Only the user layer is ever written, locked or
+// garbage collected; an entry missing from every layer is fetched or built
+// into it.
+#[derive(Debug, Clone)]
+pub struct CacheLayers {
+    pub system: Vec<std::path::PathBuf>,
+    pub user: std::path::PathBuf,
+}
+
+impl CacheLayers {
+    // System layers come from CPKG_SYSTEM_CACHES (colon-separated; empty
+    // disables them). The user cache itself is never listed as a system
+    // layer, so an administrator populating one sees it as writable.
+    pub fn from_env(user: std::path::PathBuf) -> Self {
+        let configured: Vec<std::path::PathBuf> = match std::env::var_os("CPKG_SYSTEM_CACHES") {
+            Some(list) => std::env::split_paths(&list)
+                .filter(|path| !path.as_os_str().is_empty())
+                .map(|path| expand_home(&path))
+                .collect(),
+            None => DEFAULT_SYSTEM_CACHES
+                .iter()
+                .map(std::path::PathBuf::from)
+                .filter(|path| path.is_dir())
+                .collect(),
+        };
+        let canonical_user = std::fs::canonicalize(&user).unwrap_or_else(|_| user.clone());
+        let system = configured
+            .into_iter()
+            .filter(|path| std::fs::canonicalize(path).unwrap_or_else(|_| path.clone()) != canonical_user)
+            .collect();
+        CacheLayers { system, user }
+    }
+
+    // Layers in lookup order: system caches, then the user cache
+    pub fn all(&self) -> impl Iterator<Item = &std::path::Path> {
+        self.system.iter().map(|p| p.as_path()).chain(std::iter::once(self.user.as_path()))
+    }
+
+    // First layer holding `relative` (a path inside the cache layout)
+    pub fn locate(&self, relative: impl AsRef<std::path::Path>) -> Option<std::path::PathBuf> {
+        self.all()
+            .map(|layer| layer.join(relative.as_ref()))
+            .find(|path| path.exists())
+    }
+
+    pub fn system_paths(&self, relative: impl AsRef<std::path::Path>) -> Vec<std::path::PathBuf> {
+        self.system.iter().map(|layer| layer.join(relative.as_ref())).collect()
+    }
+
+    // Unified index of one cache directory ("downloads", "artifacts/<pkg>",
+    // ...): every entry name across all layers, mapped to the layer that
+    // serves it. Earlier layers shadow later ones, as in locate().
+    pub fn index(&self, dir: &str) -> std::collections::BTreeMap<String, std::path::PathBuf> {
+        let mut index = std::collections::BTreeMap::new();
+        for layer in self.all() {
+            let Ok(entries) = std::fs::read_dir(layer.join(dir)) else { continue };
+            for entry in entries.flatten() {
+                let name = entry.file_name().to_string_lossy().into_owned();
+                if name.starts_with('.') {
+                    continue;
+                }
+                index.entry(name).or_insert_with(|| layer.to_path_buf());
+            }
+        }
+        index
+    }
+}
+
 #[derive(Debug)]
 pub struct PackageManager {
     cache_dir: std::path::PathBuf,
+    layers: CacheLayers,
+    remote: Option<RemoteCache>,
+    workers: Vec<WorkerAddress>,
+    // Token pool of the builds in progress, when workers are configured
+    jobserver: Option<Jobserver>,
     registry_url: String,
     installed_packages: HashMap<String, Package>,
+    build_options: BuildOptions,
 }
 
 impl PackageManager {
+    // `cache_dir` is the writable user layer; a leading "~" is expanded.
+    // Read-only system layers are taken from the environment (CacheLayers).
     pub fn new(cache_dir: std::path::PathBuf, registry_url: String) -> Self {
+        let cache_dir = expand_home(&cache_dir);
         Self {
+            layers: CacheLayers::from_env(cache_dir.clone()),
+            remote: RemoteCache::from_env(),
+            workers: WorkerAddress::from_env(),
+            jobserver: None,
             cache_dir,
             registry_url,
             installed_packages: HashMap::new(),
+            build_options: BuildOptions::default(),
+        }
+    }
+
+    // Only the user cache: no system layers, remote cache or workers from
+    // the environment. Build options can still name a remote or workers.
+    pub fn isolated(mut self) -> Self {
+        self.layers = CacheLayers {
+            system: Vec::new(),
+            user: self.cache_dir.clone(),
+        };
+        self.remote = None;
+        self.workers = Vec::new();
+        self
+    }
+
+    pub fn with_build_options(mut self, build_options: BuildOptions) -> Self {
+        if let Some(base) = &build_options.remote_cache {
+            self.remote = Some(RemoteCache::new(base));
+        }
+        if !build_options.workers.is_empty() {
+            self.workers = build_options.workers.iter().filter_map(|w| WorkerAddress::parse(w)).collect();
+        }
+        self.build_options = build_options;
+        self
+    }
+
+    pub fn debug_store_dir(&self) -> std::path::PathBuf {
+        self.cache_dir.join("debuginfo")
+    }
+
+    pub fn artifact_store_dir(&self) -> std::path::PathBuf {
+        self.cache_dir.join("artifacts")
+    }
+
+    // Packs every complete artifact store entry <pkg>/<fingerprint>/ into a
+    // seekable <pkg>/<fingerprint>.cpkg next to it, so single headers or
+    // libraries can later be materialized without unpacking the rest
+    pub fn pack_artifact_store(&self, level: i32) -> Result<Vec<std::path::PathBuf>, PackageError> {
+        let root = self.artifact_store_dir();
+        let mut packed = Vec::new();
+        let Ok(packages) = std::fs::read_dir(&root) else {
+            return Ok(packed);
+        };
+        for package in packages {
+            let package = package?;
+            if !package.file_type()?.is_dir() {
+                continue;
+            }
+            for entry in std::fs::read_dir(package.path())? {
+                let entry = entry?.path();
+                let archive = entry.with_extension("cpkg");
+                if !entry.join(".cpkg-complete").exists() || archive.exists() {
+                    continue;
+                }
+                pack_archive(&entry, &archive, level)?;
+                packed.push(archive);
+            }
         }
+        Ok(packed)
+    }
+
+    // Installs the registry's current version unless it is already installed.
+    // The previous version's cached archive serves as the base for a delta
+    // download. Returns the (old, new) versions when something changed.
+    pub async fn update(
+        &mut self,
+        package_name: &str,
+    ) -> Result<Option<(Option<String>, String)>, PackageError> {
+        let installed = self
+            .manifest_store()
+            .get(package_name)?
+            .and_then(|data| serde_json::from_slice::<InstallManifest>(&data).ok())
+            .map(|manifest| manifest.version);
+        let latest = self.fetch_package_info(package_name).await?;
+        if installed.as_deref() == Some(latest.version.as_str()) {
+            return Ok(None);
+        }
+        self.install(package_name).await?;
+        Ok(Some((installed, latest.version)))
     }
 
     pub async fn install(&mut self, package_name: &str) -> Result<(), PackageError> {
+        let _span = Trace::span("install", package_name);
         // 1. Resolve dependencies (pure Rust logic)
         let resolved_deps = self.resolve_dependencies(package_name).await?;
         
+        // Signatures are checked before anything is fetched or built
+        self.verify_signatures(&resolved_deps).await?;
+        
         // 2. Download packages (async Rust)
         let downloaded = self.download_packages(&resolved_deps).await?;
         
-        // 3. Build packages (call C++ bridge)
-        for package in downloaded {
-            self.build_package(&package).await?;
+        // 3. Propagate build flags through the dependency graph
+        let configs = propagate_build_config(&self.build_options, &resolved_deps)?;
+        
+        // 4. Build packages (call C++ bridge)
+        self.jobserver = self.create_jobserver().await;
+        let locked = self.build_scheduled(downloaded, &configs).await;
+        self.jobserver = None;
+        let locked = locked?;
+
+        if let Some(remote) = &self.remote {
+            remote.flush().await;
+        }
+
+        if let Some(path) = &self.build_options.lockfile {
+            std::fs::write(
+                path,
+                serde_json::to_vec_pretty(&Lockfile { packages: locked }).unwrap_or_default(),
+            )?;
+            register_lockfile(&self.cache_dir, path)?;
         }
         
         Ok(())
     }
 
+    // Builds every package once its dependencies are built, up to
+    // package_jobs at a time, starting ready packages in critical-path order
+    // (see critical_path_priorities) from predicted build times
+    async fn build_scheduled(
+        &self,
+        downloaded: Vec<(Package, std::path::PathBuf, f64)>,
+        configs: &HashMap<String, EffectiveConfig>,
+    ) -> Result<Vec<LockedPackage>, PackageError> {
+        use futures::StreamExt;
+
+        let history = BuildHistory::load(&self.cache_dir);
+        let machine = machine_class();
+        let packages: Vec<Package> = downloaded.iter().map(|(package, _, _)| package.clone()).collect();
+        let estimates = self.estimate_builds(&history, &packages, configs, &machine);
+        let priorities = critical_path_priorities(&packages, &estimates);
+        let jobs = self.package_jobs();
+        if !estimates.is_empty() {
+            let planned = simulate_schedule(&packages, &estimates, jobs);
+            let makespan = planned.iter().map(|build| build.finish).fold(0.0, f64::max);
+            println!("Estimated build time: {} ({} of {} packages known)", format_seconds(makespan), estimates.len(), packages.len());
+        }
+
+        let names: std::collections::HashSet<String> = packages.iter().map(|p| p.name.clone()).collect();
+        let mut waiting = downloaded;
+        waiting.sort_by(|a, b| priorities[&a.0.name].total_cmp(&priorities[&b.0.name]));
+        let mut built = std::collections::HashSet::new();
+        let mut running = futures::stream::FuturesUnordered::new();
+        let mut locked = Vec::new();
+        let (history, machine) = (&history, machine.as_str());
+        loop {
+            while running.len() < jobs {
+                // Highest priority sorts last
+                let Some(index) = waiting.iter().rposition(|(package, _, _)| {
+                    package.dependencies.iter().all(|d| !names.contains(d) || built.contains(d))
+                }) else {
+                    break;
+                };
+                let (package, archive, download_seconds) = waiting.remove(index);
+                let effective = &configs[&package.name];
+                running.push(async move {
+                    let result = self
+                        .build_recorded(&package, &archive, download_seconds, effective, history, machine)
+                        .await;
+                    (package.name, result)
+                });
+            }
+            let Some((name, result)) = running.next().await else {
+                break;
+            };
+            locked.push(result?);
+            built.insert(name);
+        }
+        if let Some((package, _, _)) = waiting.first() {
+            eprintln!("Dependency cycle involving {}", package.name);
+            return Err(PackageError::DependencyResolution);
+        }
+        Ok(locked)
+    }
+
+    // Extracts and builds one package, records the build in the history and
+    // warns when it regressed. Source and build trees are per package name
+    // and shared by every cache dir, so concurrent installs of one package
+    // take turns on the lock beside them; the later one then deploys the
+    // artifact the first published.
+    async fn build_recorded(
+        &self,
+        package: &Package,
+        archive: &std::path::Path,
+        download_seconds: f64,
+        effective: &EffectiveConfig,
+        history: &BuildHistory,
+        machine: &str,
+    ) -> Result<LockedPackage, PackageError> {
+        let _lock = acquire_lock(tree_lock_path(&package.name), format!("to build {}", package.name)).await?;
+        let started = std::time::Instant::now();
+        self.extract_source(package, archive).await?;
+        let extract_seconds = started.elapsed().as_secs_f64();
+        let (artifact_keys, mut stages) = match self.build_package(package, effective).await {
+            Ok(built) => built,
+            Err(e) => {
+                METRICS.build("failed");
+                return Err(e);
+            }
+        };
+        let total = started.elapsed().as_secs_f64();
+
+        stages.insert("download".to_string(), StageStats { seconds: download_seconds, ..Default::default() });
+        stages.insert("extract".to_string(), StageStats { seconds: extract_seconds, ..Default::default() });
+        let mut record = BuildRecord {
+            package: package.name.clone(),
+            version: package.version.clone(),
+            config: self.history_config(effective),
+            machine: machine.to_string(),
+            timestamp: (unix_time_ns() / 1_000_000_000) as u64,
+            cached: stages.contains_key("deploy") && !stages.contains_key("build"),
+            total,
+            stages,
+            regression: false,
+        };
+        METRICS.build(if record.cached { "cached" } else { "built" });
+        METRICS.cache_lookup("artifacts", record.cached as u64, !record.cached as u64);
+        if let Some((baseline, samples)) = history.regression(&record) {
+            record.regression = true;
+            eprintln!(
+                "warning: {} {} took {} to build, {:.1}x its median of {} over {} builds",
+                package.name,
+                package.version,
+                format_seconds(total),
+                total / baseline,
+                format_seconds(baseline),
+                samples
+            );
+        }
+        BuildHistory::append(&self.cache_dir, &record);
+
+        Ok(LockedPackage {
+            name: package.name.clone(),
+            version: package.version.clone(),
+            checksum: package.checksum.clone(),
+            chunk_index: package.chunk_index.clone(),
+            artifact_keys,
+        })
+    }
+
+    fn package_jobs(&self) -> usize {
+        self.build_options
+            .package_jobs
+            .unwrap_or(if self.workers.is_empty() { 1 } else { 4 })
+            .max(1)
+    }
+
+    // History key for everything besides the version that shapes a build
+    fn history_config(&self, effective: &EffectiveConfig) -> String {
+        let options = format!("{}|{:?}", effective.config_hash(), self.build_options.sanitizers);
+        format!("{:016x}", fnv1a(options.as_bytes()))
+    }
+
+    // Predicted build seconds of the packages with any history
+    fn estimate_builds(
+        &self,
+        history: &BuildHistory,
+        packages: &[Package],
+        configs: &HashMap<String, EffectiveConfig>,
+        machine: &str,
+    ) -> HashMap<String, f64> {
+        packages
+            .iter()
+            .filter_map(|package| {
+                let config = self.history_config(&configs[&package.name]);
+                let estimate = history.predict(&package.name, &package.version, &config, machine)?;
+                Some((package.name.clone(), estimate.seconds))
+            })
+            .collect()
+    }
+
+    // Predicts an install without downloading or building anything
+    pub async fn plan(&self, package_name: &str) -> Result<InstallPlan, PackageError> {
+        let packages = self.resolve_dependencies(package_name).await?;
+        let configs = propagate_build_config(&self.build_options, &packages)?;
+        let history = BuildHistory::load(&self.cache_dir);
+        let machine = machine_class();
+        let estimates = self.estimate_builds(&history, &packages, &configs, &machine);
+        let jobs = self.package_jobs();
+        let builds = simulate_schedule(&packages, &estimates, jobs)
+            .into_iter()
+            .map(|build| {
+                let package = packages.iter().find(|p| p.name == build.package);
+                let estimate = package.and_then(|package| {
+                    let config = self.history_config(&configs[&package.name]);
+                    history.predict(&package.name, &package.version, &config, &machine)
+                });
+                (build, estimate)
+            })
+            .collect();
+        let download_seconds = packages
+            .iter()
+            .filter_map(|package| history.predict_download(&package.name, &machine))
+            .fold(0.0, f64::max);
+        Ok(InstallPlan { machine, jobs, download_seconds, builds })
+    }
+
+    // Links the installed static archives of a package's resolved closure into
+    // one archive plus a CMake config for the imported target cpkg::<package>
+    pub async fn bundle(
+        &self,
+        package_name: &str,
+        output_dir: Option<std::path::PathBuf>,
+        thin: bool,
+        index: bool,
+    ) -> Result<std::path::PathBuf, PackageError> {
+        let resolved = self.resolve_dependencies(package_name).await?;
+        let output_dir =
+            output_dir.unwrap_or_else(|| self.cache_dir.join("bundles").join(package_name));
+
+        let request = serde_json::json!({
+            "name": package_name,
+            "packages": resolved.iter().map(|pkg| pkg.name.as_str()).collect::<Vec<_>>(),
+            "output_dir": output_dir.to_string_lossy(),
+            "thin": thin,
+            "index": index,
+        });
+        let request = std::ffi::CString::new(request.to_string())
+            .map_err(|_| PackageError::BuildFailed(package_name.to_string()))?;
+
+        let result = unsafe { cpp_bundle_static(request.as_ptr()) };
+        if result != 0 {
+            return Err(PackageError::BuildFailed(package_name.to_string()));
+        }
+
+        Ok(output_dir)
+    }
+
     async fn resolve_dependencies(&self, package_name: &str) -> Result<Vec<Package>, PackageError> {
+        let _span = Trace::span("resolve_dependencies", package_name);
+        SelfProfile::phase("resolve", package_name, self.resolve_dependency_graph(package_name)).await
+    }
+
+    async fn resolve_dependency_graph(&self, package_name: &str) -> Result<Vec<Package>, PackageError> {
         // Sophisticated dependency resolution algorithm
         // This is where Rust's pattern matching and error handling shine
         
@@ -79,12 +639,18 @@ impl PackageManager {
         Ok(resolved)
     }
 
-    async fn download_packages(&self, packages: &[Package]) -> Result<Vec<Package>, PackageError> {
-        // Parallel downloads using Rust's async capabilities
+    async fn download_packages(
+        &self,
+        packages: &[Package],
+    ) -> Result<Vec<(Package, std::path::PathBuf, f64)>, PackageError> {
+        // Parallel downloads using Rust's async capabilities; each is timed
+        // for the build history
         use futures::future::join_all;
         
-        let download_futures = packages.iter().map(|pkg| {
-            self.download_single_package(pkg)
+        let download_futures = packages.iter().map(|pkg| async move {
+            let started = std::time::Instant::now();
+            let (package, archive) = self.download_single_package(pkg).await?;
+            Ok::<_, PackageError>((package, archive, started.elapsed().as_secs_f64()))
         });
         
         let results = join_all(download_futures).await;
@@ -98,31 +664,620 @@ impl PackageManager {
         Ok(downloaded)
     }
 
-    async fn download_single_package(&self, package: &Package) -> Result<Package, PackageError> {
-        // Use reqwest or similar for HTTP downloads
-        // Handle caching, checksums, etc.
-        println!("Downloading {}", package.name);
-        
-        // Simulate download
-        tokio::time::sleep(tokio::time::Duration::from_millis(100)).await;
-        
-        Ok(package.clone())
+    // Fetches and verifies the archive into the download cache, unless a
+    // system cache layer already holds a verified copy; returns the package
+    // and the archive to use. Sources are extracted later, under the
+    // package's build lock.
+    async fn download_single_package(
+        &self,
+        package: &Package,
+    ) -> Result<(Package, std::path::PathBuf), PackageError> {
+        let _span = Trace::span("download_single_package", &package.name);
+        tokio::fs::create_dir_all(self.cache_dir.join("downloads")).await?;
+        let archive = self.archive_path(package);
+        let archive_name = archive.file_name().unwrap_or_default().to_string_lossy().into_owned();
+        record_use(&self.cache_dir, CacheKind::Downloads, &archive_name);
+
+        // One process fetches an archive; others wait, then find it cached
+        let _lock = acquire_lock(
+            self.lock_path(&format!("download-{}", archive_name)),
+            format!("to download {}", package.name),
+        )
+        .await?;
+
+        if let Some(index_digest) = &package.chunk_index {
+            record_use(&self.cache_dir, CacheKind::Chunks, &format!("index/{}", index_digest));
+            self.download_from_chunks(package, index_digest, &archive).await?;
+            return Ok((package.clone(), archive));
+        }
+
+        let chunk_manifest = match &package.merkle_root {
+            Some(root) => Some(self.fetch_chunk_manifest(package, root).await?),
+            None => None,
+        };
+
+        // A cached archive is reused only if it still matches the registry
+        // digests. System layers are tried before the user's own copy.
+        for candidate in self.layers.system_paths(std::path::Path::new("downloads").join(&archive_name)) {
+            if self.archive_is_valid(package, chunk_manifest.as_ref(), &candidate).await? {
+                METRICS.cache_lookup("downloads", 1, 0);
+                return Ok((package.clone(), candidate));
+            }
+        }
+        let cached = self.archive_is_valid(package, chunk_manifest.as_ref(), &archive).await?;
+        METRICS.cache_lookup("downloads", cached as u64, !cached as u64);
+
+        if !cached {
+            println!("Downloading {}", package.name);
+
+            let partial = archive.with_extension("partial");
+            let delta = self.download_delta(package, &partial).await?;
+            let content_address = match (delta, &chunk_manifest) {
+                (Some(address), _) => address,
+                (None, Some(manifest)) => {
+                    self.download_chunked(package, manifest, &partial).await?;
+                    let path = partial.clone();
+                    tokio::task::spawn_blocking(move || -> std::io::Result<String> {
+                        SelfProfile::measure("hash", &path.to_string_lossy(), || {
+                            let mut hasher = blake3::Hasher::new();
+                            hasher.update_mmap_rayon(&path)?;
+                            Ok(hasher.finalize().to_hex().to_string())
+                        })
+                    })
+                    .await
+                    .map_err(|e| std::io::Error::new(std::io::ErrorKind::Other, e))??
+                }
+                (None, None) => self.download_streaming(package, &partial).await?,
+            };
+            tokio::fs::rename(&partial, &archive).await?;
+
+            // Content-addressed alias used for internal lookups and `verify --store`
+            let cas = self.cache_dir.join("cas");
+            tokio::fs::create_dir_all(&cas).await?;
+            let address = cas.join(content_address);
+            if !address.exists() && tokio::fs::hard_link(&archive, &address).await.is_err() {
+                let tmp = tmp_path(&address);
+                tokio::fs::copy(&archive, &tmp).await?;
+                tokio::fs::rename(&tmp, &address).await?;
+            }
+        }
+
+        Ok((package.clone(), archive))
+    }
+
+    // Whether `path` exists and matches the registry digests; with a chunk
+    // manifest every chunk is checked in parallel. Without any registry
+    // digest, the one pinned on first download is used.
+    async fn archive_is_valid(
+        &self,
+        package: &Package,
+        chunk_manifest: Option<&ChunkManifest>,
+        path: &std::path::Path,
+    ) -> Result<bool, PackageError> {
+        if !path.exists() {
+            return Ok(false);
+        }
+        let path = path.to_path_buf();
+        match (chunk_manifest, &package.checksum) {
+            (Some(manifest), _) => {
+                if tokio::fs::metadata(&path).await?.len() != manifest.total_size {
+                    return Ok(false);
+                }
+                let manifest = manifest.clone();
+                let bad = tokio::task::spawn_blocking(move || {
+                    manifest.verify_file(&path, 0..manifest.chunks.len())
+                })
+                .await
+                .map_err(|e| std::io::Error::new(std::io::ErrorKind::Other, e))??;
+                Ok(bad.is_empty())
+            }
+            (None, Some(expected)) => {
+                let actual = tokio::task::spawn_blocking(move || sha256_file(&path))
+                    .await
+                    .map_err(|e| std::io::Error::new(std::io::ErrorKind::Other, e))??;
+                Ok(actual.eq_ignore_ascii_case(expected))
+            }
+            (None, None) => {
+                // Only the digest pinned on first download vouches for a copy
+                let Some(pinned) = self.pinned_digest(package).await else {
+                    return Ok(false);
+                };
+                let actual = tokio::task::spawn_blocking(move || sha256_file(&path))
+                    .await
+                    .map_err(|e| std::io::Error::new(std::io::ErrorKind::Other, e))??;
+                Ok(actual.eq_ignore_ascii_case(&pinned))
+            }
+        }
     }
 
-    async fn build_package(&self, package: &Package) -> Result<(), PackageError> {
+    // SHA-256 recorded on the first download of an archive the registry
+    // publishes no checksum for (trust on first use). Later downloads and
+    // cached copies must match it. The pins live outside downloads/, so
+    // they survive garbage collection of the archives.
+    fn pinned_digest_path(&self, package: &Package) -> std::path::PathBuf {
+        self.cache_dir
+            .join("digests")
+            .join(format!("{}-{}.sha256", package.name, package.version))
+    }
+
+    async fn pinned_digest(&self, package: &Package) -> Option<String> {
+        let pinned = tokio::fs::read_to_string(self.pinned_digest_path(package)).await.ok()?;
+        let pinned = pinned.trim();
+        (pinned.len() == 64 && pinned.chars().all(|c| c.is_ascii_hexdigit())).then(|| pinned.to_string())
+    }
+
+    // Download cache location: the reassembled tarball for chunked packages,
+    // otherwise the archive as published
+    fn archive_path(&self, package: &Package) -> std::path::PathBuf {
+        let extension = if package.chunk_index.is_some() {
+            "tar"
+        } else {
+            archive_extension(package)
+        };
+        self.cache_dir
+            .join("downloads")
+            .join(format!("{}-{}.{}", package.name, package.version, extension))
+    }
+
+    fn lock_path(&self, name: &str) -> std::path::PathBuf {
+        self.cache_dir.join("locks").join(format!("{}.lock", name))
+    }
+
+    // Unpacks into the source tree where the native CMakeBuilder expects it.
+    // Seekable .cpkg archives are extracted in parallel; for tarballs, tar
+    // detects whether the archive is compressed.
+    async fn extract_source(
+        &self,
+        package: &Package,
+        archive: &std::path::Path,
+    ) -> Result<(), PackageError> {
+        let _span = Trace::span("extract_source", &package.name);
+        let source_dir = std::env::temp_dir().join("cpppm_cache").join(&package.name);
+        if source_dir.exists() {
+            tokio::fs::remove_dir_all(&source_dir).await?;
+        }
+        tokio::fs::create_dir_all(&source_dir).await?;
+
+        if archive.extension().map_or(false, |ext| ext == "cpkg") {
+            let (archive, dest, name) = (archive.to_path_buf(), source_dir.clone(), package.name.clone());
+            tokio::task::spawn_blocking(move || {
+                SelfProfile::measure("extract", &name, || SeekableArchive::open(&archive)?.extract(&dest, &[]))
+            })
+                .await
+                .map_err(|e| std::io::Error::new(std::io::ErrorKind::Other, e))?
+                .map_err(|e| PackageError::Extraction(format!("{}: {}", package.name, e)))?;
+        } else {
+            let status = tokio::process::Command::new("tar")
+                .arg("-xf")
+                .arg(archive)
+                .arg("-C")
+                .arg(&source_dir)
+                .arg("--strip-components=1")
+                .status()
+                .await?;
+            if !status.success() {
+                return Err(PackageError::Extraction(package.name.clone()));
+            }
+        }
+        // What extraction wrote, not the size of the (compressed) archive
+        let written = tokio::task::spawn_blocking(move || disk_usage(&source_dir)).await.unwrap_or(0);
+        METRICS.extracted_bytes.add(written);
+        Ok(())
+    }
+
+    // Fetches the content-defined chunk index, downloads only the chunks
+    // missing from the local chunk store, and reassembles the uncompressed
+    // tarball. Chunks shared with versions installed earlier are never
+    // downloaded again.
+    async fn download_from_chunks(
+        &self,
+        package: &Package,
+        index_digest: &str,
+        tarball: &std::path::Path,
+    ) -> Result<(), PackageError> {
+        use futures::{StreamExt, TryStreamExt};
+
+        let index_url = format!("{}.caidx", package.source_url);
+        let body = reqwest::get(&index_url).await?.error_for_status()?.bytes().await?;
+        let actual = to_hex(&sha2::Sha256::digest(&body));
+        if !actual.eq_ignore_ascii_case(index_digest) {
+            return Err(PackageError::ChecksumMismatch {
+                package: package.name.clone(),
+                expected: index_digest.to_string(),
+                actual,
+            });
+        }
+        let index = ChunkIndex::parse(&body)
+            .map_err(|e| PackageError::Extraction(format!("{}: bad chunk index: {}", package.name, e)))?;
+
+        let store = ChunkStore::new(self.cache_dir.join("chunks"))
+            .with_layers(self.layers.system_paths("chunks"));
+        // Kept so GC can tell which chunks a package still references
+        store.put_index(index_digest, &body).await?;
+        let mut seen = std::collections::HashSet::new();
+        let missing: Vec<(usize, &ChunkRef)> = index
+            .chunks
+            .iter()
+            .enumerate()
+            .filter(|(_, chunk)| seen.insert(&chunk.digest) && !store.contains(&chunk.digest))
+            .collect();
+        let missing_bytes: u64 = missing.iter().map(|(_, chunk)| chunk.size).sum();
+        METRICS.cache_lookup("chunks", (seen.len() - missing.len()) as u64, missing.len() as u64);
+        println!(
+            "Downloading {}: {} of {} chunks ({} of {} bytes)",
+            package.name,
+            missing.len(),
+            index.chunks.len(),
+            missing_bytes,
+            index.total_size
+        );
+
+        let base = index.store_url(&index_url);
+        let client = reqwest::Client::new();
+        futures::stream::iter(missing)
+            .map(|(position, chunk)| {
+                let (client, store, base) = (&client, &store, &base);
+                async move {
+                    let url = format!("{}{}", base, ChunkStore::relative_path(&chunk.digest));
+                    let data = client.get(url).send().await?.error_for_status()?.bytes().await?;
+                    METRICS.downloaded_bytes.add(data.len() as u64);
+                    if data.len() as u64 != chunk.size || blake3::hash(&data).to_hex().as_str() != chunk.digest {
+                        return Err(PackageError::ChunkMismatch {
+                            package: package.name.clone(),
+                            chunk: position,
+                        });
+                    }
+                    store.put(&chunk.digest, &data).await?;
+                    Ok(())
+                }
+            })
+            .buffer_unordered(CHUNK_FETCH_CONCURRENCY)
+            .try_collect::<Vec<()>>()
+            .await?;
+
+        let (store, path) = (store.clone(), tarball.to_path_buf());
+        let assembled = tokio::task::spawn_blocking(move || index.assemble(&store, &path))
+            .await
+            .map_err(|e| std::io::Error::new(std::io::ErrorKind::Other, e))??;
+        match assembled {
+            Ok(()) => Ok(()),
+            Err(chunk) => Err(PackageError::ChunkMismatch {
+                package: package.name.clone(),
+                chunk,
+            }),
+        }
+    }
+
+    // Downloads the whole archive, hashing while streaming so verification
+    // costs no extra pass over the file. Returns the BLAKE3 content address.
+    async fn download_streaming(
+        &self,
+        package: &Package,
+        partial: &std::path::Path,
+    ) -> Result<String, PackageError> {
+        use futures::StreamExt;
+        use tokio::io::AsyncWriteExt;
+
+        let response = reqwest::get(&package.source_url).await?.error_for_status()?;
+        let mut file = tokio::fs::File::create(partial).await?;
+        let mut sha256 = sha2::Sha256::new();
+        let mut blake3 = blake3::Hasher::new();
+        let mut stream = response.bytes_stream();
+        while let Some(chunk) = stream.next().await {
+            let chunk = chunk?;
+            METRICS.downloaded_bytes.add(chunk.len() as u64);
+            sha256.update(&chunk);
+            blake3.update(&chunk);
+            file.write_all(&chunk).await?;
+        }
+        file.flush().await?;
+        drop(file);
+
+        let actual = to_hex(&sha256.finalize());
+        let expected = match &package.checksum {
+            Some(checksum) => Some(checksum.clone()),
+            None => self.pinned_digest(package).await,
+        };
+        match expected {
+            Some(expected) if !actual.eq_ignore_ascii_case(&expected) => {
+                tokio::fs::remove_file(partial).await?;
+                return Err(PackageError::ChecksumMismatch {
+                    package: package.name.clone(),
+                    expected,
+                    actual,
+                });
+            }
+            Some(_) => {}
+            None => {
+                eprintln!(
+                    "warning: {} {} has no registry checksum; pinning sha256 {}",
+                    package.name, package.version, actual
+                );
+                let pin = self.pinned_digest_path(package);
+                if let Some(parent) = pin.parent() {
+                    tokio::fs::create_dir_all(parent).await?;
+                }
+                let tmp = tmp_path(&pin);
+                tokio::fs::write(&tmp, format!("{}\n", actual)).await?;
+                tokio::fs::rename(&tmp, &pin).await?;
+            }
+        }
+        Ok(blake3.finalize().to_hex().to_string())
+    }
+
+    // Rebuilds the archive from a cached earlier version plus a published
+    // zstd --patch-from delta. The result is held to the target checksum, so
+    // deltas need no signature of their own. Returns the BLAKE3 content
+    // address, or None to fall back to a full download.
+    async fn download_delta(
+        &self,
+        package: &Package,
+        partial: &std::path::Path,
+    ) -> Result<Option<String>, PackageError> {
+        let Some(expected) = &package.checksum else {
+            return Ok(None);
+        };
+        let downloads = self.cache_dir.join("downloads");
+
+        for delta in &package.deltas {
+            let base = downloads.join(format!(
+                "{}-{}.{}",
+                package.name,
+                delta.from_version,
+                archive_extension(package)
+            ));
+            if !base.exists() {
+                continue;
+            }
+            let path = base.clone();
+            let (base_sha256, _) = tokio::task::spawn_blocking(move || archive_digests(&path))
+                .await
+                .map_err(|e| std::io::Error::new(std::io::ErrorKind::Other, e))??;
+            if !base_sha256.eq_ignore_ascii_case(&delta.from_checksum) {
+                continue;
+            }
+
+            println!(
+                "Downloading {} as a {} byte delta from {}",
+                package.name, delta.size, delta.from_version
+            );
+            let patch = partial.with_extension("delta");
+            let url = resolve_url(&package.source_url, &delta.url);
+            let bytes = reqwest::get(&url).await?.error_for_status()?.bytes().await?;
+            METRICS.downloaded_bytes.add(bytes.len() as u64);
+            tokio::fs::write(&patch, &bytes).await?;
+
+            // --long must cover the base archive, which acts as the dictionary
+            let status = tokio::process::Command::new("zstd")
+                .args(["-d", "-q", "-f", "--long=31"])
+                .arg(format!("--patch-from={}", base.display()))
+                .arg(&patch)
+                .arg("-o")
+                .arg(partial)
+                .status()
+                .await;
+            let _ = tokio::fs::remove_file(&patch).await;
+            if !matches!(status, Ok(status) if status.success()) {
+                let _ = tokio::fs::remove_file(partial).await;
+                eprintln!("warning: could not apply delta for {}", package.name);
+                continue;
+            }
+
+            let path = partial.to_path_buf();
+            let (actual, address) = tokio::task::spawn_blocking(move || archive_digests(&path))
+                .await
+                .map_err(|e| std::io::Error::new(std::io::ErrorKind::Other, e))??;
+            if !actual.eq_ignore_ascii_case(expected) {
+                tokio::fs::remove_file(partial).await?;
+                eprintln!(
+                    "warning: delta for {} produced {} instead of {}",
+                    package.name, actual, expected
+                );
+                continue;
+            }
+            return Ok(Some(address));
+        }
+        Ok(None)
+    }
+
+    async fn fetch_chunk_manifest(
+        &self,
+        package: &Package,
+        merkle_root: &str,
+    ) -> Result<ChunkManifest, PackageError> {
+        let url = format!("{}.merkle", package.source_url);
+        let manifest: ChunkManifest = reqwest::get(&url)
+            .await?
+            .error_for_status()?
+            .json()
+            .await?;
+        if manifest.root().as_deref() != Some(merkle_root) {
+            return Err(PackageError::ChecksumMismatch {
+                package: package.name.clone(),
+                expected: merkle_root.to_string(),
+                actual: manifest.root().unwrap_or_default(),
+            });
+        }
+        Ok(manifest)
+    }
+
+    // Downloads against a chunk manifest. The verified prefix of an interrupted
+    // download is kept (its chunks are re-checked in parallel) and the rest is
+    // fetched with a Range request; every chunk is verified as soon as it is
+    // complete, so corruption is caught without hashing the whole archive.
+    async fn download_chunked(
+        &self,
+        package: &Package,
+        manifest: &ChunkManifest,
+        partial: &std::path::Path,
+    ) -> Result<(), PackageError> {
+        use futures::StreamExt;
+        use tokio::io::AsyncWriteExt;
+
+        let existing = tokio::fs::metadata(partial).await.map_or(0, |m| m.len());
+        let whole_chunks = ((existing / manifest.chunk_size) as usize).min(manifest.chunks.len());
+        let (check, path) = (manifest.clone(), partial.to_path_buf());
+        let bad = tokio::task::spawn_blocking(move || check.verify_file(&path, 0..whole_chunks))
+            .await
+            .map_err(|e| std::io::Error::new(std::io::ErrorKind::Other, e))?
+            .unwrap_or_default();
+        let mut next_chunk = bad.first().copied().unwrap_or(whole_chunks);
+
+        let client = reqwest::Client::new();
+        let mut request = client.get(&package.source_url);
+        if next_chunk > 0 {
+            request = request.header(
+                reqwest::header::RANGE,
+                format!("bytes={}-", next_chunk as u64 * manifest.chunk_size),
+            );
+        }
+        let response = request.send().await?.error_for_status()?;
+        if response.status() != reqwest::StatusCode::PARTIAL_CONTENT {
+            // Server ignored the range; start over
+            next_chunk = 0;
+        }
+
+        let file = tokio::fs::OpenOptions::new()
+            .create(true)
+            .write(true)
+            .open(partial)
+            .await?;
+        file.set_len(next_chunk as u64 * manifest.chunk_size).await?;
+        let mut file = tokio::io::BufWriter::new(file);
+        tokio::io::AsyncSeekExt::seek(&mut file, std::io::SeekFrom::End(0)).await?;
+
+        let mut pending: Vec<u8> = Vec::new();
+        let mut stream = response.bytes_stream();
+        while let Some(bytes) = stream.next().await {
+            let bytes = bytes?;
+            METRICS.downloaded_bytes.add(bytes.len() as u64);
+            pending.extend_from_slice(&bytes);
+            while next_chunk < manifest.chunks.len() {
+                let (_, len) = manifest.chunk_range(next_chunk);
+                if (pending.len() as u64) < len {
+                    break;
+                }
+                let data: Vec<u8> = pending.drain(..len as usize).collect();
+                if !manifest.verify_chunk(next_chunk, &data) {
+                    return Err(PackageError::ChunkMismatch {
+                        package: package.name.clone(),
+                        chunk: next_chunk,
+                    });
+                }
+                file.write_all(&data).await?;
+                next_chunk += 1;
+            }
+        }
+        file.flush().await?;
+
+        let written = tokio::fs::metadata(partial).await?.len();
+        if next_chunk != manifest.chunks.len() || !pending.is_empty() || written != manifest.total_size {
+            return Err(PackageError::ChunkMismatch {
+                package: package.name.clone(),
+                chunk: next_chunk,
+            });
+        }
+        Ok(())
+    }
+
+    // Returns the artifact store keys the build published under
+    async fn build_package(
+        &self,
+        package: &Package,
+        effective: &EffectiveConfig,
+    ) -> Result<(Vec<String>, std::collections::BTreeMap<String, StageStats>), PackageError> {
+        let _span = Trace::span("build_package", &package.name);
+        let mut artifact_keys = Vec::new();
+        let mut stages = std::collections::BTreeMap::new();
         // This is where we call into C++ for build system integration
         match package.build_type {
             BuildType::CMake => {
-                // Call C++ function to handle CMake build
-                unsafe {
-                    let result = cpp_build_cmake(
-                        package.name.as_ptr() as *const i8,
-                        package.name.len(),
-                    );
-                    if result != 0 {
-                        return Err(PackageError::BuildFailed(package.name.clone()));
+                // Source content is part of the artifact key, so edited trees rebuild
+                let source_dir = std::env::temp_dir().join("cpppm_cache").join(&package.name);
+                let source_hash = if source_dir.is_dir() {
+                    let cache = self
+                        .cache_dir
+                        .join("fingerprints")
+                        .join(format!("{}.json", package.name));
+                    // Walks and hashes on threads of its own; off the runtime
+                    tokio::task::spawn_blocking(move || fingerprint_source_tree(&source_dir, &cache))
+                        .await
+                        .map_err(|e| std::io::Error::new(std::io::ErrorKind::Other, e))??
+                        .root_hash
+                } else {
+                    String::new()
+                };
+
+                artifact_keys = self.artifact_keys(effective, &source_hash).await?;
+                record_use(&self.cache_dir, CacheKind::Sources, &package.name);
+                if self.build_options.sanitizers.is_empty() {
+                    record_use(&self.cache_dir, CacheKind::Builds, &package.name);
+                }
+                for key in &artifact_keys {
+                    if !self.build_options.sanitizers.is_empty() {
+                        record_use(&self.cache_dir, CacheKind::Builds, &format!("{}-{}", package.name, key));
                     }
+                    record_use(&self.cache_dir, CacheKind::Artifacts, &format!("{}/{}", package.name, key));
+                }
+
+                let fetched = self.fetch_remote_artifacts(&package.name, &artifact_keys).await?;
+
+                // Call C++ function to handle CMake build
+                let config = std::ffi::CString::new(self.build_config_json(effective, &source_hash))
+                    .map_err(|_| PackageError::BuildFailed(package.name.clone()))?;
+                let variants = std::ffi::CString::new(
+                    serde_json::to_string(&self.build_options.sanitizers).unwrap_or_default(),
+                )
+                .map_err(|_| PackageError::BuildFailed(package.name.clone()))?;
+                // On a blocking thread, so several packages can build at once
+                let (name, plain) = (package.name.clone(), self.build_options.sanitizers.is_empty());
+                let (result, stats, diagnostics) = tokio::task::spawn_blocking(move || unsafe {
+                    // Compiler detection and probing happen in here
+                    let result = SelfProfile::measure("native", &name, || {
+                        if plain {
+                            cpp_build_cmake_with_config(name.as_ptr() as *const i8, name.len(), config.as_ptr())
+                        } else {
+                            cpp_build_cmake_variants(
+                                name.as_ptr() as *const i8,
+                                name.len(),
+                                config.as_ptr(),
+                                variants.as_ptr(),
+                            )
+                        }
+                    });
+                    let stats = std::ffi::CStr::from_ptr(cpp_last_build_stats(name.as_ptr() as *const i8, name.len()))
+                        .to_string_lossy()
+                        .into_owned();
+                    let diagnostics =
+                        std::ffi::CStr::from_ptr(cpp_last_build_diagnostics(name.as_ptr() as *const i8, name.len()))
+                            .to_string_lossy()
+                            .into_owned();
+                    (result, stats, diagnostics)
+                })
+                .await
+                .map_err(|_| PackageError::BuildFailed(package.name.clone()))?;
+                METRICS.fold_launcher_log(&self.cache_dir);
+                stages = serde_json::from_str::<NativeBuildStats>(&stats)
+                    .map(|stats| stats.stages)
+                    .unwrap_or_default();
+                // Logs matter most when the build failed, so keep them first
+                if let Err(e) = self.archive_build_logs(&package.name, &diagnostics) {
+                    eprintln!("warning: could not store build logs for {}: {}", package.name, e);
+                }
+                if result != 0 {
+                    let diagnostics: Vec<BuildDiagnostic> = serde_json::from_str(&diagnostics).unwrap_or_default();
+                    let errors: Vec<&BuildDiagnostic> = diagnostics.iter().filter(|d| d.severity == "error").collect();
+                    return Err(PackageError::BuildFailed(match errors.first() {
+                        Some(first) if errors.len() > 1 => {
+                            format!("{}: {} (and {} more errors)", package.name, first, errors.len() - 1)
+                        }
+                        Some(first) => format!("{}: {}", package.name, first),
+                        None => package.name.clone(),
+                    }));
                 }
+                let built: Vec<String> = artifact_keys.iter().filter(|key| !fetched.contains(*key)).cloned().collect();
+                self.upload_remote_artifacts(&package.name, &built);
+                self.write_install_manifest(package)?;
             }
             BuildType::HeaderOnly => {
                 // Simple file copying, can be done in Rust
@@ -134,80 +1289,6473 @@ impl PackageManager {
             }
         }
         
-        Ok(())
+        Ok((artifact_keys, stages))
     }
 
-    async fn fetch_package_info(&self, package_name: &str) -> Result<Package, PackageError> {
-        // Fetch from registry (HTTP request)
-        // Parse JSON response
-        // Return Package struct
-        
-        // Mock implementation
-        Ok(Package {
-            name: package_name.to_string(),
-            version: "1.0.0".to_string(),
-            dependencies: vec![],
-            source_url: format!("https://github.com/example/{}", package_name),
-            build_type: BuildType::CMake,
-        })
+    // Fills the user artifact store with entries no cache layer has but the
+    // remote cache does, so the native build deploys them instead of
+    // building. Entries are unpacked beside their final place and renamed in
+    // under the same lock the native store takes. Returns the keys fetched.
+    async fn fetch_remote_artifacts(
+        &self,
+        package_name: &str,
+        keys: &[String],
+    ) -> Result<std::collections::HashSet<String>, PackageError> {
+        let mut fetched = std::collections::HashSet::new();
+        let Some(remote) = &self.remote else {
+            return Ok(fetched);
+        };
+        let store = self.artifact_store_dir();
+        for key in keys {
+            let marker = format!("artifacts/{}/{}/.cpkg-complete", package_name, key);
+            if self.layers.locate(&marker).is_some() {
+                continue;
+            }
+            let Some(entry) = remote.get_action(&artifact_action_key(package_name, key)).await else {
+                continue;
+            };
+            let Some(archive) = entry.outputs.iter().find(|output| output.path == "artifact.cpkg") else {
+                continue;
+            };
+
+            let _lock = acquire_lock(
+                store.join(".locks").join(format!("{}-{}.lock", package_name, key)),
+                format!("to fetch {} ({})", package_name, key),
+            )
+            .await?;
+            let prefix = store.join(package_name).join(key);
+            if prefix.join(".cpkg-complete").exists() {
+                continue;
+            }
+            let packed = prefix.with_extension("cpkg");
+            if !remote.fetch_blob(&archive.digest, &packed).await? {
+                continue;
+            }
+            let staging = store
+                .join(package_name)
+                .join(format!(".remote-{}-{}", key, std::process::id()));
+            let (source, target) = (packed.clone(), staging.clone());
+            let unpacked = tokio::task::spawn_blocking(move || {
+                SeekableArchive::open(&source)?.extract(&target, &[])
+            })
+            .await;
+            if !matches!(unpacked, Ok(Ok(_))) || !staging.join(".cpkg-complete").exists() {
+                eprintln!("warning: ignoring unusable remote artifact for {} ({})", package_name, key);
+                let _ = std::fs::remove_dir_all(&staging);
+                continue;
+            }
+            if prefix.exists() {
+                std::fs::remove_dir_all(&prefix)?;
+            }
+            std::fs::rename(&staging, &prefix)?;
+            println!("Fetched {} ({}) from the remote cache", package_name, key);
+            fetched.insert(key.clone());
+        }
+        Ok(fetched)
     }
 
-    fn install_headers(&self, package: &Package) -> Result<(), PackageError> {
-        // Header-only library installation
-        println!("Installing headers for {}", package.name);
-        Ok(())
+    // Packs freshly built store entries into their seekable .cpkg form and
+    // queues them for upload; the install carries on meanwhile
+    fn upload_remote_artifacts(&self, package_name: &str, keys: &[String]) {
+        let Some(remote) = &self.remote else {
+            return;
+        };
+        for key in keys {
+            let prefix = self.artifact_store_dir().join(package_name).join(key);
+            if !prefix.join(".cpkg-complete").exists() {
+                continue;
+            }
+            let (remote, package_name, key) = (remote.clone(), package_name.to_string(), key.clone());
+            let task = remote.clone();
+            task.track(tokio::spawn(async move {
+                let packed = tokio::task::spawn_blocking(move || -> std::io::Result<(std::path::PathBuf, String, u64)> {
+                    let packed = prefix.with_extension("cpkg");
+                    if !packed.exists() {
+                        pack_archive(&prefix, &packed, 19)?;
+                    }
+                    let digest = sha256_file(&packed)?;
+                    let size = std::fs::metadata(&packed)?.len();
+                    Ok((packed, digest, size))
+                })
+                .await
+                .map_err(|e| std::io::Error::new(std::io::ErrorKind::Other, e))
+                .and_then(|packed| packed);
+                match packed {
+                    Ok((packed, digest, size)) => {
+                        let output = ActionOutput { path: "artifact.cpkg".to_string(), digest: digest.clone(), size };
+                        let entry = ActionEntry { outputs: vec![output], ..Default::default() };
+                        remote.upload_action(artifact_action_key(&package_name, &key), entry, vec![(packed, digest)]);
+                    }
+                    Err(e) => eprintln!("warning: could not pack {} ({}) for upload: {}", package_name, key, e),
+                }
+            }));
+        }
     }
 
-    fn execute_build_script(&self, script: &str) -> Result<(), PackageError> {
-        // Execute custom build script
-        println!("Executing build script: {}", script);
-        Ok(())
+    // Command CMake prefixes to every compile so single translation units
+    // are shared through the remote cache and spread over the workers
+    fn compiler_launcher(&self) -> Vec<String> {
+        let Ok(exe) = std::env::current_exe() else {
+            return Vec::new();
+        };
+        if self.remote.is_none() && self.workers.is_empty() {
+            return Vec::new();
+        }
+        let mut launcher = vec![exe.to_string_lossy().into_owned(), "cc-launcher".to_string()];
+        if let Some(remote) = &self.remote {
+            launcher.extend(["--remote-cache".to_string(), remote.base().to_string()]);
+        }
+        if !self.workers.is_empty() {
+            let workers: Vec<String> = self.workers.iter().map(|w| w.to_string()).collect();
+            launcher.extend(["--workers".to_string(), workers.join(",")]);
+        }
+        launcher.push("--".to_string());
+        launcher
     }
-}
 
-#[derive(Debug, thiserror::Error)]
-pub enum PackageError {
-    #[error("Network error: {0}")]
-    Network(#[from] reqwest::Error),
-    #[error("IO error: {0}")]
-    Io(#[from] std::io::Error),
-    #[error("Build failed for package: {0}")]
-    BuildFailed(String),
-    #[error("Dependency resolution failed")]
-    DependencyResolution,
-}
+    // Jobserver sized for the local CPUs plus the slots of every reachable
+    // worker; None without workers, where each build keeps its own -j
+    async fn create_jobserver(&self) -> Option<Jobserver> {
+        if self.workers.is_empty() {
+            return None;
+        }
+        let loads = futures::future::join_all(self.workers.iter().map(|worker| worker.load())).await;
+        let remote: usize = loads.into_iter().flatten().map(|(_, slots)| slots).sum();
+        let local = std::thread::available_parallelism().map_or(1, |n| n.get());
+        match Jobserver::create(&self.cache_dir.join("jobserver"), local + remote) {
+            Ok(jobserver) => {
+                println!("Building with {} jobs ({} local, {} on workers)", local + remote, local, remote);
+                Some(jobserver)
+            }
+            Err(e) => {
+                eprintln!("warning: could not create jobserver: {}", e);
+                None
+            }
+        }
+    }
+
+    // Keys the native store files this build under, one per sanitizer variant
+    async fn artifact_keys(&self, effective: &EffectiveConfig, source_hash: &str) -> std::io::Result<Vec<String>> {
+        let variants = if self.build_options.sanitizers.is_empty() {
+            vec![String::new()]
+        } else {
+            self.build_options.sanitizers.clone()
+        };
+        let configs: Vec<std::ffi::CString> = variants
+            .into_iter()
+            .filter_map(|sanitizer| {
+                let mut config: serde_json::Value =
+                    serde_json::from_str(&self.build_config_json(effective, source_hash)).ok()?;
+                config["sanitizer"] = sanitizer.into();
+                std::ffi::CString::new(config.to_string()).ok()
+            })
+            .collect();
+        // Keys fingerprint the toolchain, which runs the compiler; off the runtime
+        tokio::task::spawn_blocking(move || {
+            configs
+                .iter()
+                .filter_map(|config| {
+                    let key = unsafe { std::ffi::CStr::from_ptr(cpp_artifact_key(config.as_ptr())) }
+                        .to_string_lossy()
+                        .into_owned();
+                    (!key.is_empty()).then_some(key)
+                })
+                .collect()
+        })
+        .await
+        .map_err(|e| std::io::Error::new(std::io::ErrorKind::Other, e))
+    }
+
+    // JSON understood by CMakeBuilder::config_from_json
+    fn build_config_json(&self, effective: &EffectiveConfig, source_hash: &str) -> String {
+        let mut config = serde_json::json!({
+            "build_type": effective.build_type,
+            "defines": effective.defines,
+            "compile_flags": effective.compile_flags,
+            "link_flags": effective.link_flags,
+            "config_hash": effective.config_hash(),
+            "source_hash": source_hash,
+            "split_debug_info": effective.split_debug_info,
+            "debug_store": self.debug_store_dir().to_string_lossy(),
+            "profile": effective.profile,
+            "artifact_store": self.artifact_store_dir().to_string_lossy(),
+            "artifact_store_layers": self.layers.system_paths("artifacts"),
+            "compiler_launcher": self.compiler_launcher(),
+            "jobserver": self.jobserver.as_ref().map(Jobserver::auth).unwrap_or_default(),
+            "jobs": self.jobserver.as_ref().map_or(0, Jobserver::jobs),
+            "fail_fast": self.build_options.fail_fast,
+        });
+        if !effective.install_prefix.is_empty() {
+            config["install_prefix"] = effective.install_prefix.clone().into();
+        }
+        config.to_string()
+    }
+
+    async fn fetch_package_info(&self, package_name: &str) -> Result<Package, PackageError> {
+        // Registry metadata carries the archive URL and its SHA-256. The last
+        // document seen is kept in the metadata cache for offline use; trust
+        // still comes from signature verification, not from the cache.
+        if !is_path_component(package_name) {
+            return Err(PackageError::Extraction(format!("invalid package name {:?}", package_name)));
+        }
+        let url = format!("{}/api/v1/packages/{}", self.registry_url, package_name);
+        let metadata = ObjectStore::new(&self.cache_dir, ObjectKind::Metadata);
+        let started = std::time::Instant::now();
+        let fetched = match reqwest::get(&url).await.and_then(|r| r.error_for_status()) {
+            Ok(response) => response.bytes().await.map(|body| body.to_vec()),
+            Err(e) => Err(e),
+        };
+        METRICS.registry_request(fetched.is_ok(), started.elapsed());
+        let body = match fetched {
+            Ok(body) => {
+                if let Err(e) = metadata.put(package_name, &body) {
+                    eprintln!("warning: could not cache metadata for {}: {}", package_name, e);
+                }
+                body
+            }
+            Err(e) => match self.cached_metadata(package_name)? {
+                Some(body) => {
+                    eprintln!("warning: registry unreachable, using cached metadata for {}", package_name);
+                    body
+                }
+                None => return Err(e.into()),
+            },
+        };
+        let package: Package = serde_json::from_slice(&body).map_err(|e| {
+            PackageError::Extraction(format!("{}: bad registry metadata: {}", package_name, e))
+        })?;
+        // Name and version become cache paths and the source tree's name
+        if package.name != package_name || !is_path_component(&package.version) {
+            return Err(PackageError::Extraction(format!(
+                "{}: bad registry metadata: describes {:?} version {:?}",
+                package_name, package.name, package.version
+            )));
+        }
+        Ok(package)
+    }
+
+    // Last metadata document seen for `package_name`, from the user cache or
+    // else the first system layer that has one
+    fn cached_metadata(&self, package_name: &str) -> Result<Option<Vec<u8>>, PackageError> {
+        let layers = std::iter::once(&self.layers.user).chain(&self.layers.system);
+        for layer in layers {
+            if let Some(body) = ObjectStore::new(layer, ObjectKind::Metadata).get(package_name)? {
+                return Ok(Some(body));
+            }
+        }
+        Ok(None)
+    }
+
+    // Establishes trust in the artifact digests of `packages`. The registry's
+    // signed index snapshot is verified once per Merkle root; digests of packages
+    // outside it fall back to their own signatures, checked together in one
+    // batch. Verified digests are cached, so unchanged artifacts are not
+    // re-verified on later installs. Without configured trusted keys nothing
+    // is enforced.
+    async fn verify_signatures(&self, packages: &[Package]) -> Result<(), PackageError> {
+        let keys = self.trusted_keys()?;
+        if keys.is_empty() {
+            return Ok(());
+        }
+        let mut cache = self.load_verified_cache();
+
+        let pending: Vec<&Package> = packages
+            .iter()
+            .filter(|pkg| !cache.covers(pkg))
+            .collect();
+        if pending.is_empty() {
+            return Ok(());
+        }
+
+        // One snapshot covers every package it lists
+        let url = format!("{}/api/v1/index/snapshot", self.registry_url);
+        if let Ok(response) = reqwest::get(&url).await.and_then(|r| r.error_for_status()) {
+            let snapshot: IndexSnapshot = response.json().await?;
+            // The entries are always held to the root; only the signature
+            // check over a root already verified is skipped
+            check_snapshot_root(&snapshot)?;
+            if !cache.roots.contains(&snapshot.merkle_root) {
+                verify_snapshots(std::slice::from_ref(&snapshot), &keys)?;
+                cache.roots.push(snapshot.merkle_root.clone());
+            }
+            for entry in &snapshot.entries {
+                cache.record(
+                    &entry.name,
+                    &entry.version,
+                    Some(&entry.sha256),
+                    entry.merkle_root.as_ref(),
+                    entry.chunk_index.as_ref(),
+                );
+            }
+        }
+
+        let unsigned: Vec<&Package> = pending
+            .into_iter()
+            .filter(|pkg| !cache.covers(pkg))
+            .collect();
+        verify_package_signatures(&unsigned, &keys)?;
+        for pkg in &unsigned {
+            cache.record(
+                &pkg.name,
+                &pkg.version,
+                pkg.checksum.as_ref(),
+                pkg.merkle_root.as_ref(),
+                pkg.chunk_index.as_ref(),
+            );
+        }
+
+        self.save_verified_cache(&cache)
+    }
+
+    // key id -> Ed25519 public key, from <cache>/trusted_keys.json
+    fn trusted_keys(&self) -> Result<HashMap<String, ed25519_dalek::VerifyingKey>, PackageError> {
+        let Ok(data) = std::fs::read(self.cache_dir.join("trusted_keys.json")) else {
+            return Ok(HashMap::new());
+        };
+        let encoded: HashMap<String, String> = serde_json::from_slice(&data)
+            .map_err(|e| PackageError::Signature(format!("invalid trusted_keys.json: {}", e)))?;
+
+        let mut keys = HashMap::new();
+        for (key_id, hex) in encoded {
+            let bytes: [u8; 32] = from_hex(&hex)
+                .and_then(|bytes| bytes.try_into().ok())
+                .ok_or_else(|| PackageError::Signature(format!("invalid key {}", key_id)))?;
+            let key = ed25519_dalek::VerifyingKey::from_bytes(&bytes)
+                .map_err(|_| PackageError::Signature(format!("invalid key {}", key_id)))?;
+            keys.insert(key_id, key);
+        }
+        Ok(keys)
+    }
+
+    pub fn trust_key(&self, key_id: &str, public_key_hex: &str) -> Result<(), PackageError> {
+        let path = self.cache_dir.join("trusted_keys.json");
+        let mut encoded: HashMap<String, String> = std::fs::read(&path)
+            .ok()
+            .and_then(|data| serde_json::from_slice(&data).ok())
+            .unwrap_or_default();
+        let valid = from_hex(public_key_hex)
+            .and_then(|bytes| <[u8; 32]>::try_from(bytes).ok())
+            .map_or(false, |bytes| ed25519_dalek::VerifyingKey::from_bytes(&bytes).is_ok());
+        if !valid {
+            return Err(PackageError::Signature(format!("invalid key {}", key_id)));
+        }
+        encoded.insert(key_id.to_string(), public_key_hex.to_string());
+
+        std::fs::create_dir_all(&self.cache_dir)?;
+        let tmp = tmp_path(&path);
+        std::fs::write(&tmp, serde_json::to_vec_pretty(&encoded).unwrap_or_default())?;
+        std::fs::rename(&tmp, &path)?;
+        Ok(())
+    }
+
+    fn load_verified_cache(&self) -> VerifiedCache {
+        std::fs::read(self.cache_dir.join("verified.json"))
+            .ok()
+            .and_then(|data| serde_json::from_slice(&data).ok())
+            .unwrap_or_default()
+    }
+
+    fn save_verified_cache(&self, cache: &VerifiedCache) -> Result<(), PackageError> {
+        let path = self.cache_dir.join("verified.json");
+        std::fs::create_dir_all(&self.cache_dir)?;
+        let tmp = tmp_path(&path);
+        std::fs::write(&tmp, serde_json::to_vec(cache).unwrap_or_default())?;
+        std::fs::rename(&tmp, &path)?;
+        Ok(())
+    }
+
+    // Installed-state DB: one install manifest per package
+    fn manifest_store(&self) -> ObjectStore {
+        ObjectStore::new(&self.cache_dir, ObjectKind::Manifest)
+    }
+
+    // Keeps CMake's configure logs (try_compile output and check results) and
+    // the deduplicated diagnostics the native parser extracted from the build
+    // output (see BuildDiagnostic) in the log store under
+    // <package>.<unix time ns>.<file>
+    fn archive_build_logs(&self, package_name: &str, diagnostics: &str) -> std::io::Result<()> {
+        let logs = ObjectStore::new(&self.cache_dir, ObjectKind::Log);
+        let cmake_files = std::env::temp_dir()
+            .join("cpppm_build")
+            .join(package_name)
+            .join("CMakeFiles");
+        let stamp = unix_time_ns();
+        for name in ["CMakeConfigureLog.yaml", "CMakeOutput.log", "CMakeError.log"] {
+            if let Ok(data) = std::fs::read(cmake_files.join(name)) {
+                logs.put(&format!("{}.{}.{}", package_name, stamp, name), &data)?;
+            }
+        }
+        if diagnostics != "[]" {
+            logs.put(&format!("{}.{}.diagnostics.json", package_name, stamp), diagnostics.as_bytes())?;
+        }
+        Ok(())
+    }
+
+    // Records SHA-256 and size of every file the CMake install wrote, so
+    // `verify` can re-validate the prefix later
+    fn write_install_manifest(&self, package: &Package) -> Result<(), PackageError> {
+        let cmake_manifest = std::env::temp_dir()
+            .join("cpppm_build")
+            .join(&package.name)
+            .join("install_manifest.txt");
+        let Ok(listing) = std::fs::read_to_string(&cmake_manifest) else {
+            return Ok(());
+        };
+
+        let paths: Vec<std::path::PathBuf> = listing
+            .lines()
+            .filter(|line| !line.is_empty())
+            .map(std::path::PathBuf::from)
+            .collect();
+        let hashes = parallel_map(&paths, |path| sha256_file(path));
+
+        let mut files = Vec::with_capacity(paths.len());
+        for (path, hash) in paths.iter().zip(hashes) {
+            files.push(ManifestEntry {
+                path: path.to_string_lossy().into_owned(),
+                size: std::fs::symlink_metadata(path)?.len(),
+                sha256: hash?,
+            });
+        }
+
+        let manifest = InstallManifest {
+            name: package.name.clone(),
+            version: package.version.clone(),
+            files,
+        };
+        self.manifest_store().put(
+            &package.name,
+            &serde_json::to_vec_pretty(&manifest).unwrap_or_default(),
+        )?;
+        Ok(())
+    }
+
+    // Re-hashes installed files (optionally only those under `prefix`) against
+    // their install manifests, one worker per core so the disks stay busy
+    pub fn verify_installed(
+        &self,
+        prefix: Option<&std::path::Path>,
+    ) -> Result<VerifyReport, PackageError> {
+        let mut expected = Vec::new();
+        let manifests = self.manifest_store();
+        for key in manifests.keys()? {
+            let Some(data) = manifests.get(&key)? else { continue };
+            let Ok(manifest) = serde_json::from_slice::<InstallManifest>(&data) else {
+                continue;
+            };
+            expected.extend(manifest.files.into_iter().filter(|file| {
+                prefix.map_or(true, |prefix| std::path::Path::new(&file.path).starts_with(prefix))
+            }));
+        }
+
+        let results = parallel_map(&expected, |file| sha256_file(std::path::Path::new(&file.path)));
+        let mut report = VerifyReport::default();
+        for (file, result) in expected.iter().zip(results) {
+            match result {
+                Ok(hash) if hash == file.sha256 => report.verified += 1,
+                Ok(_) => report.corrupted.push(file.path.clone()),
+                Err(_) => report.missing.push(file.path.clone()),
+            }
+        }
+        Ok(report)
+    }
+
+    // Every content-addressed entry must hash to its own name
+    pub fn verify_store(&self) -> Result<VerifyReport, PackageError> {
+        let mut entries = Vec::new();
+        if let Ok(dir) = std::fs::read_dir(self.cache_dir.join("cas")) {
+            for entry in dir {
+                entries.push(entry?.path());
+            }
+        }
+
+        let results = parallel_map(&entries, |path| -> std::io::Result<String> {
+            let mut hasher = blake3::Hasher::new();
+            hasher.update_mmap_rayon(path)?;
+            Ok(hasher.finalize().to_hex().to_string())
+        });
+        let mut report = VerifyReport::default();
+        for (path, result) in entries.iter().zip(results) {
+            let name = path.file_name().map(|n| n.to_string_lossy().into_owned());
+            match result {
+                Ok(hash) if Some(&hash) == name.as_ref() => report.verified += 1,
+                Ok(_) => report.corrupted.push(path.to_string_lossy().into_owned()),
+                Err(_) => report.missing.push(path.to_string_lossy().into_owned()),
+            }
+        }
+        Ok(report)
+    }
+
+    fn install_headers(&self, package: &Package) -> Result<(), PackageError> {
+        // Header-only library installation
+        println!("Installing headers for {}", package.name);
+        Ok(())
+    }
+
+    fn execute_build_script(&self, script: &str) -> Result<(), PackageError> {
+        // Execute custom build script
+        println!("Executing build script: {}", script);
+        Ok(())
+    }
+}
+
+// Computes every package's effective build flags: the root options first, then
+// the usage requirements of the package and its transitive dependencies in
+// name order. Conflicting values for one define are an error rather than a
+// silent ABI mismatch.
+pub fn propagate_build_config(
+    root: &BuildOptions,
+    packages: &[Package],
+) -> Result<HashMap<String, EffectiveConfig>, PackageError> {
+    let by_name: HashMap<&str, &Package> =
+        packages.iter().map(|pkg| (pkg.name.as_str(), pkg)).collect();
+
+    let mut configs = HashMap::new();
+    for package in packages {
+        // Transitive closure, including the package itself
+        let mut closure = std::collections::BTreeSet::new();
+        let mut stack = vec![package.name.as_str()];
+        while let Some(name) = stack.pop() {
+            if !closure.insert(name) {
+                continue;
+            }
+            if let Some(pkg) = by_name.get(name) {
+                stack.extend(pkg.dependencies.iter().map(|dep| dep.as_str()));
+            }
+        }
+
+        let sources: Vec<&UsageRequirements> = std::iter::once(&root.root_requirements)
+            .chain(
+                closure
+                    .iter()
+                    .filter_map(|name| by_name.get(name))
+                    .map(|pkg| &pkg.usage_requirements),
+            )
+            .collect();
+
+        let mut defines: std::collections::BTreeMap<&str, Option<&str>> =
+            std::collections::BTreeMap::new();
+        for define in sources.iter().flat_map(|req| req.defines.iter()) {
+            let (name, value) = match define.split_once('=') {
+                Some((name, value)) => (name, Some(value)),
+                None => (define.as_str(), None),
+            };
+            if let Some(existing) = defines.insert(name, value) {
+                if existing != value {
+                    return Err(PackageError::ConfigConflict(
+                        package.name.clone(),
+                        format!("define {} is set to both {:?} and {:?}", name, existing, value),
+                    ));
+                }
+            }
+        }
+
+        let config = EffectiveConfig {
+            build_type: root.build_type.clone().unwrap_or_else(|| "Release".to_string()),
+            defines: defines
+                .into_iter()
+                .map(|(name, value)| match value {
+                    Some(value) => format!("{}={}", name, value),
+                    None => name.to_string(),
+                })
+                .collect(),
+            compile_flags: normalize_flags(sources.iter().flat_map(|req| req.compile_flags.iter())),
+            link_flags: normalize_flags(sources.iter().flat_map(|req| req.link_flags.iter())),
+            profile: root.profile.clone().unwrap_or_default(),
+            split_debug_info: root.split_debug_info,
+            install_prefix: root
+                .install_prefix
+                .as_ref()
+                .map(|prefix| prefix.to_string_lossy().into_owned())
+                .unwrap_or_default(),
+        };
+        configs.insert(package.name.clone(), config);
+    }
+
+    Ok(configs)
+}
+
+// Drops repeated flags; for flag families where the compiler uses the last
+// occurrence (-O2 ... -O3) only that occurrence is kept
+fn normalize_flags<'a>(flags: impl Iterator<Item = &'a String>) -> Vec<String> {
+    const LAST_WINS: [&str; 5] = ["-O", "-std=", "-march=", "-mtune=", "-stdlib="];
+
+    let mut normalized: Vec<String> = Vec::new();
+    for flag in flags {
+        if let Some(family) = LAST_WINS.iter().find(|family| flag.starts_with(*family)) {
+            normalized.retain(|existing| !existing.starts_with(family));
+        } else if normalized.contains(flag) {
+            continue;
+        }
+        normalized.push(flag.clone());
+    }
+    normalized
+}
+
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct ManifestEntry {
+    pub path: String,
+    pub size: u64,
+    pub sha256: String,
+}
+
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct InstallManifest {
+    pub name: String,
+    pub version: String,
+    pub files: Vec<ManifestEntry>,
+}
+
+#[derive(Debug, Default)]
+pub struct VerifyReport {
+    pub verified: usize,
+    pub corrupted: Vec<String>,
+    pub missing: Vec<String>,
+}
+
+impl VerifyReport {
+    pub fn is_ok(&self) -> bool {
+        self.corrupted.is_empty() && self.missing.is_empty()
+    }
+}
+
+// Snapshot roots whose signatures verified, and the artifact digests they or
+// per-artifact signatures vouched for. A digest only vouches for the package
+// version and field it was signed for.
+#[derive(Debug, Default, Serialize, Deserialize)]
+struct VerifiedCache {
+    roots: Vec<String>,
+    // (name, version, field, digest)
+    digests: std::collections::HashSet<(String, String, String, String)>,
+}
+
+impl VerifiedCache {
+    fn record(
+        &mut self,
+        name: &str,
+        version: &str,
+        sha256: Option<&String>,
+        merkle_root: Option<&String>,
+        chunk_index: Option<&String>,
+    ) {
+        let fields = [("sha256", sha256), ("merkle_root", merkle_root), ("chunk_index", chunk_index)];
+        for (field, digest) in fields {
+            if let Some(digest) = digest {
+                self.digests.insert((name.to_string(), version.to_string(), field.to_string(), digest.clone()));
+            }
+        }
+    }
+
+    fn contains(&self, package: &Package, field: &str, digest: &str) -> bool {
+        self.digests.contains(&(
+            package.name.clone(),
+            package.version.clone(),
+            field.to_string(),
+            digest.to_string(),
+        ))
+    }
+
+    // Trusted only if the archive digest and any Merkle root or chunk index
+    // digest were verified for this package version
+    fn covers(&self, package: &Package) -> bool {
+        package.checksum.as_ref().map_or(false, |d| self.contains(package, "sha256", d))
+            && package.merkle_root.as_ref().map_or(true, |r| self.contains(package, "merkle_root", r))
+            && package.chunk_index.as_ref().map_or(true, |i| self.contains(package, "chunk_index", i))
+    }
+}
+
+// Checks that a snapshot's entries hash to its Merkle root
+fn check_snapshot_root(snapshot: &IndexSnapshot) -> Result<(), PackageError> {
+    let leaves: Vec<[u8; 32]> = snapshot
+        .entries
+        .iter()
+        .map(|entry| {
+            let mut leaf = format!("{}\0{}\0{}", entry.name, entry.version, entry.sha256);
+            if let Some(root) = &entry.merkle_root {
+                leaf.push('\0');
+                leaf.push_str(root);
+            }
+            if let Some(index) = &entry.chunk_index {
+                leaf.push_str("\0caidx:");
+                leaf.push_str(index);
+            }
+            merkle_leaf(leaf.as_bytes())
+        })
+        .collect();
+    if to_hex(&merkle_root(&leaves)) != snapshot.merkle_root {
+        return Err(PackageError::Signature(format!(
+            "index snapshot {} does not match its Merkle root",
+            snapshot.serial
+        )));
+    }
+    Ok(())
+}
+
+// Checks that each snapshot's entries hash to its Merkle root, then verifies
+// every root signature from a trusted key in a single batch
+pub fn verify_snapshots(
+    snapshots: &[IndexSnapshot],
+    keys: &HashMap<String, ed25519_dalek::VerifyingKey>,
+) -> Result<(), PackageError> {
+    let mut messages = Vec::new();
+    let mut signatures = Vec::new();
+    let mut signers = Vec::new();
+
+    for snapshot in snapshots {
+        check_snapshot_root(snapshot)?;
+
+        let mut trusted = 0;
+        for signed in &snapshot.signatures {
+            let Some(key) = keys.get(&signed.key_id) else { continue };
+            messages.push(snapshot_message(snapshot.serial, &snapshot.merkle_root));
+            signatures.push(parse_signature(&signed.signature)?);
+            signers.push(*key);
+            trusted += 1;
+        }
+        if trusted == 0 {
+            return Err(PackageError::Signature(format!(
+                "index snapshot {} has no signature from a trusted key",
+                snapshot.serial
+            )));
+        }
+    }
+
+    verify_signature_batch(&messages, &signatures, &signers)
+}
+
+// Verifies the per-artifact signatures of packages not covered by a snapshot
+pub fn verify_package_signatures(
+    packages: &[&Package],
+    keys: &HashMap<String, ed25519_dalek::VerifyingKey>,
+) -> Result<(), PackageError> {
+    let mut messages = Vec::new();
+    let mut signatures = Vec::new();
+    let mut signers = Vec::new();
+
+    for package in packages {
+        let (Some(digest), Some(signed)) = (&package.checksum, &package.signature) else {
+            return Err(PackageError::Signature(format!("{} is not signed", package.name)));
+        };
+        let key = keys.get(&signed.key_id).ok_or_else(|| {
+            PackageError::Signature(format!("{} is signed by untrusted key {}", package.name, signed.key_id))
+        })?;
+        messages.push(artifact_message(package, digest));
+        signatures.push(parse_signature(&signed.signature)?);
+        signers.push(*key);
+    }
+
+    verify_signature_batch(&messages, &signatures, &signers)
+}
+
+// Batch verification is all-or-nothing; on failure each signature is checked
+// on its own so the error names the offending message
+fn verify_signature_batch(
+    messages: &[Vec<u8>],
+    signatures: &[ed25519_dalek::Signature],
+    signers: &[ed25519_dalek::VerifyingKey],
+) -> Result<(), PackageError> {
+    if messages.is_empty() {
+        return Ok(());
+    }
+    let refs: Vec<&[u8]> = messages.iter().map(|m| m.as_slice()).collect();
+    if ed25519_dalek::verify_batch(&refs, signatures, signers).is_ok() {
+        return Ok(());
+    }
+
+    for ((message, signature), key) in messages.iter().zip(signatures).zip(signers) {
+        if key.verify_strict(message, signature).is_err() {
+            return Err(PackageError::Signature(format!(
+                "bad signature over {}",
+                String::from_utf8_lossy(message)
+            )));
+        }
+    }
+    Err(PackageError::Signature("batch verification failed".to_string()))
+}
+
+fn snapshot_message(serial: u64, merkle_root: &str) -> Vec<u8> {
+    format!("cpkg-index-v1 {} {}", serial, merkle_root).into_bytes()
+}
+
+fn artifact_message(package: &Package, sha256: &str) -> Vec<u8> {
+    let mut message = format!("cpkg-artifact-v1 {} {} {}", package.name, package.version, sha256);
+    if let Some(root) = &package.merkle_root {
+        message.push(' ');
+        message.push_str(root);
+    }
+    if let Some(index) = &package.chunk_index {
+        message.push_str(" caidx:");
+        message.push_str(index);
+    }
+    message.into_bytes()
+}
+
+fn parse_signature(hex: &str) -> Result<ed25519_dalek::Signature, PackageError> {
+    let bytes: [u8; 64] = from_hex(hex)
+        .and_then(|bytes| bytes.try_into().ok())
+        .ok_or_else(|| PackageError::Signature("malformed signature".to_string()))?;
+    Ok(ed25519_dalek::Signature::from_bytes(&bytes))
+}
+
+// RFC 6962-style hashing: domain-separated leaves and interior nodes, with an
+// unpaired node promoted to the next level unchanged
+pub fn merkle_leaf(data: &[u8]) -> [u8; 32] {
+    let mut hasher = sha2::Sha256::new();
+    hasher.update([0u8]);
+    hasher.update(data);
+    hasher.finalize().into()
+}
+
+fn merkle_node(left: &[u8; 32], right: &[u8; 32]) -> [u8; 32] {
+    let mut hasher = sha2::Sha256::new();
+    hasher.update([1u8]);
+    hasher.update(left);
+    hasher.update(right);
+    hasher.finalize().into()
+}
+
+pub fn merkle_root(leaves: &[[u8; 32]]) -> [u8; 32] {
+    if leaves.is_empty() {
+        return sha2::Sha256::digest([]).into();
+    }
+    let mut level = leaves.to_vec();
+    while level.len() > 1 {
+        level = level
+            .chunks(2)
+            .map(|pair| match pair {
+                [left, right] => merkle_node(left, right),
+                [single] => *single,
+                _ => unreachable!(),
+            })
+            .collect();
+    }
+    level[0]
+}
+
+// Chunked Merkle manifest of an artifact: one leaf per fixed-size chunk, so any
+// byte range can be verified by hashing only the chunks that cover it
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct ChunkManifest {
+    pub chunk_size: u64,
+    pub total_size: u64,
+    // Hex merkle_leaf() of each chunk's bytes
+    pub chunks: Vec<String>,
+}
+
+pub const DEFAULT_CHUNK_SIZE: u64 = 4 << 20;
+
+impl ChunkManifest {
+    pub fn for_file(path: &std::path::Path, chunk_size: u64) -> std::io::Result<Self> {
+        let file = std::fs::File::open(path)?;
+        let total_size = file.metadata()?.len();
+        let count = total_size.div_ceil(chunk_size) as usize;
+        let indices: Vec<usize> = (0..count).collect();
+        let mut manifest = ChunkManifest { chunk_size, total_size, chunks: Vec::new() };
+
+        let leaves = parallel_map(&indices, |&i| {
+            let (offset, len) = manifest.chunk_range(i);
+            read_at(&file, offset, len).map(|data| to_hex(&merkle_leaf(&data)))
+        });
+        manifest.chunks = leaves.into_iter().collect::<std::io::Result<_>>()?;
+        Ok(manifest)
+    }
+
+    // Root over the chunking as well as the leaves, so the leaves cannot be
+    // replayed with another chunk_size or total_size; None for a manifest
+    // whose leaves do not match its chunking
+    pub fn root(&self) -> Option<String> {
+        if self.chunk_size == 0 || self.chunks.len() as u64 != self.total_size.div_ceil(self.chunk_size) {
+            return None;
+        }
+        let leaves: Vec<[u8; 32]> = self
+            .chunks
+            .iter()
+            .map(|hex| from_hex(hex).and_then(|bytes| bytes.try_into().ok()))
+            .collect::<Option<_>>()?;
+        let mut hasher = sha2::Sha256::new();
+        hasher.update([2u8]);
+        hasher.update(self.chunk_size.to_le_bytes());
+        hasher.update(self.total_size.to_le_bytes());
+        hasher.update(merkle_root(&leaves));
+        Some(to_hex(&hasher.finalize()))
+    }
+
+    // (offset, length) of chunk `index`; the last chunk may be short
+    pub fn chunk_range(&self, index: usize) -> (u64, u64) {
+        let offset = index as u64 * self.chunk_size;
+        (offset, self.chunk_size.min(self.total_size.saturating_sub(offset)))
+    }
+
+    pub fn verify_chunk(&self, index: usize, data: &[u8]) -> bool {
+        self.chunks.get(index) == Some(&to_hex(&merkle_leaf(data)))
+    }
+
+    // Verifies the given chunks of `path` in parallel; returns the bad ones
+    pub fn verify_file(
+        &self,
+        path: &std::path::Path,
+        chunks: std::ops::Range<usize>,
+    ) -> std::io::Result<Vec<usize>> {
+        let file = std::fs::File::open(path)?;
+        let indices: Vec<usize> = chunks.collect();
+        let results = parallel_map(&indices, |&i| {
+            let (offset, len) = self.chunk_range(i);
+            read_at(&file, offset, len).map_or(false, |data| self.verify_chunk(i, &data))
+        });
+        Ok(indices
+            .into_iter()
+            .zip(results)
+            .filter(|(_, ok)| !ok)
+            .map(|(i, _)| i)
+            .collect())
+    }
+
+    // Reads `len` bytes at `offset` of `file`, verifying only the chunks that
+    // cover them
+    pub fn read_verified(&self, file: &std::fs::File, offset: u64, len: u64) -> std::io::Result<Vec<u8>> {
+        if len == 0 {
+            return Ok(Vec::new());
+        }
+        if offset.checked_add(len).map_or(true, |end| end > self.total_size) {
+            return Err(std::io::Error::new(
+                std::io::ErrorKind::UnexpectedEof,
+                "read past the end of the manifest",
+            ));
+        }
+        let first = (offset / self.chunk_size) as usize;
+        let last = ((offset + len - 1) / self.chunk_size) as usize;
+        let indices: Vec<usize> = (first..=last).collect();
+        let chunks = parallel_map(&indices, |&i| -> std::io::Result<Vec<u8>> {
+            let (chunk_offset, chunk_len) = self.chunk_range(i);
+            let data = read_at(file, chunk_offset, chunk_len)?;
+            if !self.verify_chunk(i, &data) {
+                return Err(std::io::Error::new(
+                    std::io::ErrorKind::InvalidData,
+                    format!("chunk {} failed verification", i),
+                ));
+            }
+            Ok(data)
+        });
+
+        let mut data = Vec::with_capacity(((last - first + 1) as u64 * self.chunk_size) as usize);
+        for chunk in chunks {
+            data.extend(chunk?);
+        }
+        let start = (offset - first as u64 * self.chunk_size) as usize;
+        Ok(data[start..start + len as usize].to_vec())
+    }
+}
+
+#[cfg(unix)]
+fn read_at(file: &std::fs::File, offset: u64, len: u64) -> std::io::Result<Vec<u8>> {
+    use std::os::unix::fs::FileExt;
+    let mut data = vec![0u8; len as usize];
+    file.read_exact_at(&mut data, offset)?;
+    Ok(data)
+}
+
+#[cfg(not(unix))]
+fn read_at(file: &std::fs::File, offset: u64, len: u64) -> std::io::Result<Vec<u8>> {
+    use std::io::{Read, Seek};
+    let mut file = file.try_clone()?;
+    file.seek(std::io::SeekFrom::Start(offset))?;
+    let mut data = vec![0u8; len as usize];
+    file.read_exact(&mut data)?;
+    Ok(data)
+}
+
+// Content-defined chunking with a FastCDC-style gear hash: cut points depend
+// only on nearby bytes, so an edit changes the chunks around it and successive
+// versions of a tarball share most of their chunks
+pub const CDC_MIN_SIZE: usize = 16 << 10;
+pub const CDC_AVG_SIZE: usize = 64 << 10;
+pub const CDC_MAX_SIZE: usize = 256 << 10;
+
+// Normalized chunking: harder to cut before the average size, easier after
+const CDC_MASK_SMALL: u64 = !0u64 << (64 - 18);
+const CDC_MASK_LARGE: u64 = !0u64 << (64 - 14);
+
+const CHUNK_FETCH_CONCURRENCY: usize = 16;
+
+const fn gear_table() -> [u64; 256] {
+    // splitmix64, so the table (and every cut point) is fixed across builds
+    let mut table = [0u64; 256];
+    let mut state: u64 = 0;
+    let mut i = 0;
+    while i < 256 {
+        state = state.wrapping_add(0x9E3779B97F4A7C15);
+        let mut z = state;
+        z = (z ^ (z >> 30)).wrapping_mul(0xBF58476D1CE4E5B9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94D049BB133111EB);
+        table[i] = z ^ (z >> 31);
+        i += 1;
+    }
+    table
+}
+
+static GEAR: [u64; 256] = gear_table();
+
+// Length of the first chunk of `data`; callers pass at least CDC_MAX_SIZE
+// bytes unless at end of input
+pub fn cdc_cut(data: &[u8]) -> usize {
+    if data.len() <= CDC_MIN_SIZE {
+        return data.len();
+    }
+    let end = data.len().min(CDC_MAX_SIZE);
+    let normal = end.min(CDC_AVG_SIZE);
+    let mut hash = 0u64;
+    for (i, &byte) in data.iter().enumerate().take(end).skip(CDC_MIN_SIZE) {
+        hash = (hash << 1).wrapping_add(GEAR[byte as usize]);
+        let mask = if i < normal { CDC_MASK_SMALL } else { CDC_MASK_LARGE };
+        if hash & mask == 0 {
+            return i + 1;
+        }
+    }
+    end
+}
+
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct ChunkRef {
+    // BLAKE3 of the chunk bytes, which is also its name in the chunk store
+    pub digest: String,
+    pub size: u64,
+}
+
+// casync-style index: the ordered chunks of an uncompressed tarball
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct ChunkIndex {
+    // Chunk store URL; relative to the index URL unless absolute
+    pub store: String,
+    pub total_size: u64,
+    pub chunks: Vec<ChunkRef>,
+}
+
+impl ChunkIndex {
+    // Index documents come from the network; every chunk digest becomes a
+    // store path, so anything but a BLAKE3 hex digest is rejected
+    pub fn parse(data: &[u8]) -> Result<ChunkIndex, String> {
+        let index: ChunkIndex = serde_json::from_slice(data).map_err(|e| e.to_string())?;
+        match index.chunks.iter().find(|chunk| !ChunkStore::is_valid_digest(&chunk.digest)) {
+            Some(chunk) => Err(format!("invalid chunk digest {:?}", chunk.digest)),
+            None => Ok(index),
+        }
+    }
+
+    // Splits `input` into content-defined chunks, writing new ones to `store`.
+    // Returns the index and the number of chunks that were already stored.
+    pub fn build(
+        mut input: impl std::io::Read,
+        store: &ChunkStore,
+        store_url: &str,
+    ) -> std::io::Result<(Self, usize)> {
+        let mut index = ChunkIndex { store: store_url.to_string(), total_size: 0, chunks: Vec::new() };
+        let mut reused = 0;
+        let mut buffer: Vec<u8> = Vec::with_capacity(2 * CDC_MAX_SIZE);
+        let mut eof = false;
+
+        while !eof || !buffer.is_empty() {
+            while !eof && buffer.len() < CDC_MAX_SIZE {
+                let start = buffer.len();
+                buffer.resize(start + CDC_MAX_SIZE, 0);
+                let n = input.read(&mut buffer[start..])?;
+                buffer.truncate(start + n);
+                eof = n == 0;
+            }
+            if buffer.is_empty() {
+                break;
+            }
+
+            let len = cdc_cut(&buffer);
+            let digest = blake3::hash(&buffer[..len]).to_hex().to_string();
+            if store.contains(&digest) {
+                reused += 1;
+            } else {
+                store.put_blocking(&digest, &buffer[..len])?;
+            }
+            index.chunks.push(ChunkRef { digest, size: len as u64 });
+            index.total_size += len as u64;
+            buffer.drain(..len);
+        }
+        Ok((index, reused))
+    }
+
+    pub fn store_url(&self, index_url: &str) -> String {
+        let mut url = resolve_url(index_url, &self.store);
+        if !url.ends_with('/') {
+            url.push('/');
+        }
+        url
+    }
+
+    // Writes the tarball from locally stored chunks, re-verifying each one. A
+    // corrupt chunk is evicted so the next install fetches it again; its
+    // position is returned as the error.
+    pub fn assemble(
+        &self,
+        store: &ChunkStore,
+        output: &std::path::Path,
+    ) -> std::io::Result<Result<(), usize>> {
+        use std::io::Write;
+
+        let partial = tmp_path(output);
+        let mut file = std::io::BufWriter::new(std::fs::File::create(&partial)?);
+        for (position, chunk) in self.chunks.iter().enumerate() {
+            let data = std::fs::read(store.path(&chunk.digest))?;
+            if blake3::hash(&data).to_hex().as_str() != chunk.digest {
+                std::fs::remove_file(store.path(&chunk.digest))?;
+                return Ok(Err(position));
+            }
+            file.write_all(&data)?;
+        }
+        file.flush()?;
+        drop(file);
+        std::fs::rename(&partial, output)?;
+        Ok(Ok(()))
+    }
+}
+
+// Local content-addressed chunk store: <root>/<first 4 hex>/<digest>.cacnk.
+// Read-only layers (system caches) are searched first; writes go to root.
+#[derive(Debug, Clone)]
+pub struct ChunkStore {
+    root: std::path::PathBuf,
+    layers: Vec<std::path::PathBuf>,
+}
+
+impl ChunkStore {
+    pub fn new(root: std::path::PathBuf) -> Self {
+        ChunkStore { root, layers: Vec::new() }
+    }
+
+    pub fn with_layers(mut self, layers: Vec<std::path::PathBuf>) -> Self {
+        self.layers = layers;
+        self
+    }
+
+    // 64 lowercase hex characters, as ChunkIndex::build writes them
+    pub fn is_valid_digest(digest: &str) -> bool {
+        digest.len() == 64 && digest.bytes().all(|b| matches!(b, b'0'..=b'9' | b'a'..=b'f'))
+    }
+
+    // Callers pass validated digests (ChunkIndex::parse)
+    pub fn relative_path(digest: &str) -> String {
+        format!("{}/{}.cacnk", digest.get(..4).unwrap_or(digest), digest)
+    }
+
+    // Where the chunk is read from: the first layer holding it, else root
+    pub fn path(&self, digest: &str) -> std::path::PathBuf {
+        let relative = Self::relative_path(digest);
+        self.layers
+            .iter()
+            .map(|layer| layer.join(&relative))
+            .find(|path| path.exists())
+            .unwrap_or_else(|| self.root.join(&relative))
+    }
+
+    pub fn contains(&self, digest: &str) -> bool {
+        self.path(digest).exists()
+    }
+
+    pub async fn put(&self, digest: &str, data: &[u8]) -> std::io::Result<()> {
+        let path = self.root.join(Self::relative_path(digest));
+        if let Some(parent) = path.parent() {
+            tokio::fs::create_dir_all(parent).await?;
+        }
+        let tmp = tmp_path(&path);
+        tokio::fs::write(&tmp, data).await?;
+        tokio::fs::rename(&tmp, &path).await
+    }
+
+    pub async fn put_index(&self, digest: &str, body: &[u8]) -> std::io::Result<()> {
+        let path = self.index_path(digest);
+        if let Some(parent) = path.parent() {
+            tokio::fs::create_dir_all(parent).await?;
+        }
+        let tmp = tmp_path(&path);
+        tokio::fs::write(&tmp, body).await?;
+        tokio::fs::rename(&tmp, &path).await
+    }
+
+    pub fn index_path(&self, digest: &str) -> std::path::PathBuf {
+        self.root.join("index").join(format!("{}.caidx", digest))
+    }
+
+    pub fn put_blocking(&self, digest: &str, data: &[u8]) -> std::io::Result<()> {
+        let path = self.root.join(Self::relative_path(digest));
+        if let Some(parent) = path.parent() {
+            std::fs::create_dir_all(parent)?;
+        }
+        let tmp = tmp_path(&path);
+        std::fs::write(&tmp, data)?;
+        std::fs::rename(&tmp, &path)
+    }
+}
+
+// Seekable artifact archive (.cpkg). Each file is a run of independent zstd
+// frames of at most ARCHIVE_FRAME_SIZE input bytes, and the file index with
+// every frame offset trails the data in a zstd skippable frame ending in a
+// fixed footer:
+//
+//   [frames...][0x184D2A5E, len][index JSON][index len: u32 LE]["CPKGIDX1"]
+//
+// The whole archive is still a valid zstd stream, but a reader can list it
+// from the footer alone and decompress any file, or any frame of a file,
+// without touching the rest.
+pub const ARCHIVE_FRAME_SIZE: usize = 1 << 20;
+const ARCHIVE_MAGIC: &[u8; 8] = b"CPKGIDX1";
+const ZSTD_SKIPPABLE_MAGIC: u32 = 0x184D2A5E;
+// Files compressed per parallel batch, bounding memory while packing
+const ARCHIVE_BATCH: usize = 256;
+
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct ArchiveFrame {
+    pub offset: u64,
+    pub compressed: u64,
+    pub size: u64,
+}
+
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct ArchiveEntry {
+    pub path: String,
+    pub mode: u32,
+    pub size: u64,
+    // Symlink target; links have no frames
+    #[serde(default)]
+    pub link: Option<String>,
+    // Empty directory, kept so extraction recreates it; no frames
+    #[serde(default)]
+    pub dir: bool,
+    #[serde(default)]
+    pub sha256: String,
+    pub frames: Vec<ArchiveFrame>,
+}
+
+#[derive(Debug, Default, Clone, Serialize, Deserialize)]
+pub struct ArchiveIndex {
+    pub files: Vec<ArchiveEntry>,
+}
+
+// Packs the tree under `root` (paths relative to it), compressing files in
+// parallel; the archive is written to a temporary name and renamed into place
+pub fn pack_archive(
+    root: &std::path::Path,
+    output: &std::path::Path,
+    level: i32,
+) -> std::io::Result<ArchiveIndex> {
+    use std::io::Write;
+
+    let mut paths: Vec<String> = walk_source_tree(root)?.into_iter().map(|(path, _)| path).collect();
+    paths.sort();
+
+    let partial = tmp_path(output);
+    let mut writer = std::io::BufWriter::new(std::fs::File::create(&partial)?);
+    let mut index = ArchiveIndex::default();
+    let mut offset = 0u64;
+
+    for batch in paths.chunks(ARCHIVE_BATCH) {
+        let packed = parallel_map(batch, |relative| -> std::io::Result<(ArchiveEntry, Vec<Vec<u8>>)> {
+            let path = root.join(relative);
+            let meta = std::fs::symlink_metadata(&path)?;
+            let mut entry = ArchiveEntry {
+                path: relative.clone(),
+                mode: file_mode(&meta),
+                size: 0,
+                link: None,
+                dir: false,
+                sha256: String::new(),
+                frames: Vec::new(),
+            };
+            if meta.file_type().is_symlink() {
+                entry.link = Some(std::fs::read_link(&path)?.to_string_lossy().into_owned());
+                return Ok((entry, Vec::new()));
+            }
+
+            let data = std::fs::read(&path)?;
+            entry.size = data.len() as u64;
+            entry.sha256 = to_hex(&sha2::Sha256::digest(&data));
+            let frames = data
+                .chunks(ARCHIVE_FRAME_SIZE)
+                .map(|frame| zstd::bulk::compress(frame, level))
+                .collect::<std::io::Result<Vec<_>>>()?;
+            Ok((entry, frames))
+        });
+
+        for result in packed {
+            let (mut entry, frames) = result?;
+            let mut remaining = entry.size;
+            for frame in frames {
+                let size = remaining.min(ARCHIVE_FRAME_SIZE as u64);
+                remaining -= size;
+                entry.frames.push(ArchiveFrame { offset, compressed: frame.len() as u64, size });
+                writer.write_all(&frame)?;
+                offset += frame.len() as u64;
+            }
+            index.files.push(entry);
+        }
+    }
+    // Directories only exist in the index through their files, so empty ones
+    // get entries of their own
+    for relative in empty_dirs(root)? {
+        let meta = std::fs::symlink_metadata(root.join(&relative))?;
+        index.files.push(ArchiveEntry {
+            path: relative,
+            mode: file_mode(&meta),
+            size: 0,
+            link: None,
+            dir: true,
+            sha256: String::new(),
+            frames: Vec::new(),
+        });
+    }
+
+    let body = serde_json::to_vec(&index).unwrap_or_default();
+    writer.write_all(&ZSTD_SKIPPABLE_MAGIC.to_le_bytes())?;
+    writer.write_all(&((body.len() + 12) as u32).to_le_bytes())?;
+    writer.write_all(&body)?;
+    writer.write_all(&(body.len() as u32).to_le_bytes())?;
+    writer.write_all(ARCHIVE_MAGIC)?;
+    writer.flush()?;
+    drop(writer);
+    std::fs::rename(&partial, output)?;
+    Ok(index)
+}
+
+pub struct SeekableArchive {
+    file: std::fs::File,
+    // When set, every read is checked against the chunks that cover it
+    manifest: Option<ChunkManifest>,
+    pub index: ArchiveIndex,
+}
+
+impl SeekableArchive {
+    // Reads only the footer and the index
+    pub fn open(path: &std::path::Path) -> std::io::Result<Self> {
+        Self::open_with(path, None)
+    }
+
+    // Like open, for an archive of untrusted origin with a chunk manifest
+    // that matches `root`: the index and each frame are verified as they are
+    // read, so materializing a few files hashes only the chunks they span
+    pub fn open_verified(path: &std::path::Path, manifest: ChunkManifest, root: &str) -> std::io::Result<Self> {
+        if manifest.root().as_deref() != Some(root) {
+            return Err(std::io::Error::new(
+                std::io::ErrorKind::InvalidData,
+                format!("{}: chunk manifest does not match {}", path.display(), root),
+            ));
+        }
+        Self::open_with(path, Some(manifest))
+    }
+
+    fn open_with(path: &std::path::Path, manifest: Option<ChunkManifest>) -> std::io::Result<Self> {
+        let invalid = |what: &str| {
+            std::io::Error::new(
+                std::io::ErrorKind::InvalidData,
+                format!("{}: {}", path.display(), what),
+            )
+        };
+        let file = std::fs::File::open(path)?;
+        let len = file.metadata()?.len();
+        if manifest.as_ref().map_or(false, |manifest| manifest.total_size != len) {
+            return Err(invalid("size does not match the chunk manifest"));
+        }
+        let archive = SeekableArchive { file, manifest, index: ArchiveIndex::default() };
+        if len < 20 {
+            return Err(invalid("not a cpkg archive"));
+        }
+        let footer = archive.read_bytes(len - 12, 12)?;
+        if &footer[4..] != ARCHIVE_MAGIC {
+            return Err(invalid("not a cpkg archive"));
+        }
+        let index_len = u32::from_le_bytes([footer[0], footer[1], footer[2], footer[3]]) as u64;
+        if index_len + 12 > len {
+            return Err(invalid("truncated index"));
+        }
+        let body = archive.read_bytes(len - 12 - index_len, index_len)?;
+        let index: ArchiveIndex = serde_json::from_slice(&body).map_err(|e| invalid(&e.to_string()))?;
+
+        // Archives can come from remote caches, so the frames must lie in the
+        // data area ahead of the index and add up to their file's size
+        let data_end = (len - 12 - index_len).saturating_sub(8);
+        for entry in &index.files {
+            let mut total = 0u64;
+            for frame in &entry.frames {
+                if frame.size > ARCHIVE_FRAME_SIZE as u64
+                    || frame.offset.checked_add(frame.compressed).map_or(true, |end| end > data_end)
+                {
+                    return Err(invalid(&format!("bad frame in {}", entry.path)));
+                }
+                total += frame.size;
+            }
+            if total != entry.size {
+                return Err(invalid(&format!("frames of {} do not add up to its size", entry.path)));
+            }
+        }
+        Ok(SeekableArchive { index, ..archive })
+    }
+
+    fn read_bytes(&self, offset: u64, len: u64) -> std::io::Result<Vec<u8>> {
+        match &self.manifest {
+            Some(manifest) => manifest.read_verified(&self.file, offset, len),
+            None => read_at(&self.file, offset, len),
+        }
+    }
+
+    pub fn entry(&self, path: &str) -> Option<&ArchiveEntry> {
+        self.index.files.iter().find(|entry| entry.path == path)
+    }
+
+    // Whole file contents, checked against the recorded SHA-256
+    pub fn read(&self, entry: &ArchiveEntry) -> std::io::Result<Vec<u8>> {
+        let data = self.read_range(entry, 0, entry.size)?;
+        if to_hex(&sha2::Sha256::digest(&data)) != entry.sha256 {
+            return Err(std::io::Error::new(
+                std::io::ErrorKind::InvalidData,
+                format!("{} does not match its recorded digest", entry.path),
+            ));
+        }
+        Ok(data)
+    }
+
+    // Decompresses only the frames that cover [offset, offset + len)
+    pub fn read_range(&self, entry: &ArchiveEntry, offset: u64, len: u64) -> std::io::Result<Vec<u8>> {
+        let end = offset.saturating_add(len).min(entry.size);
+        let mut data = Vec::with_capacity(end.saturating_sub(offset) as usize);
+        let mut frame_start = 0u64;
+        for frame in &entry.frames {
+            let frame_end = frame_start + frame.size;
+            if frame_end > offset && frame_start < end {
+                let compressed = self.read_bytes(frame.offset, frame.compressed)?;
+                let plain = zstd::bulk::decompress(&compressed, frame.size as usize)?;
+                if plain.len() as u64 != frame.size {
+                    return Err(std::io::Error::new(
+                        std::io::ErrorKind::InvalidData,
+                        format!("a frame of {} is shorter than recorded", entry.path),
+                    ));
+                }
+                let from = offset.saturating_sub(frame_start) as usize;
+                let to = (end.min(frame_end) - frame_start) as usize;
+                data.extend_from_slice(&plain[from..to]);
+            }
+            frame_start = frame_end;
+        }
+        Ok(data)
+    }
+
+    // Materializes the selected files (exact paths or directory prefixes; all
+    // when empty) under `dest` in parallel. Files already present with the
+    // recorded contents are left alone, so repeated calls only fill in what
+    // is missing. Returns the number of files written.
+    pub fn extract(&self, dest: &std::path::Path, select: &[String]) -> std::io::Result<usize> {
+        let selected: Vec<&ArchiveEntry> = self
+            .index
+            .files
+            .iter()
+            .filter(|entry| {
+                select.is_empty()
+                    || select.iter().any(|want| {
+                        let want = want.trim_end_matches('/');
+                        entry.path == want
+                            || (entry.path.starts_with(want) && entry.path[want.len()..].starts_with('/'))
+                    })
+            })
+            .collect();
+
+        // Archives can come from remote caches: every path stays below `dest`
+        // and links may only point further down, never to an absolute path
+        // or through ".."
+        let refuse = |entry: &ArchiveEntry, why: &str| {
+            std::io::Error::new(
+                std::io::ErrorKind::InvalidData,
+                format!("refusing to extract {}: {}", entry.path, why),
+            )
+        };
+        let downward = |path: &str| {
+            !path.is_empty()
+                && std::path::Path::new(path)
+                    .components()
+                    .all(|c| matches!(c, std::path::Component::Normal(_) | std::path::Component::CurDir))
+        };
+        for entry in &selected {
+            if !downward(&entry.path) {
+                return Err(refuse(entry, "path leaves the destination"));
+            }
+            if entry.link.as_deref().map_or(false, |link| !downward(link)) {
+                return Err(refuse(entry, "link target leaves the destination"));
+            }
+        }
+
+        let results = parallel_map(&selected, |entry| -> std::io::Result<bool> {
+            let relative = std::path::Path::new(&entry.path);
+            let target = dest.join(relative);
+            if let Some(parent) = relative.parent() {
+                create_dirs_nofollow(dest, parent).map_err(|e| refuse(entry, &e.to_string()))?;
+            }
+
+            if entry.dir {
+                if std::fs::symlink_metadata(&target).map_or(false, |meta| meta.is_dir()) {
+                    return Ok(false);
+                }
+                std::fs::create_dir(&target)?;
+                set_file_mode(&target, entry.mode)?;
+                return Ok(true);
+            }
+            if let Some(link) = &entry.link {
+                if std::fs::read_link(&target).ok().as_deref() == Some(std::path::Path::new(link)) {
+                    return Ok(false);
+                }
+                let _ = std::fs::remove_file(&target);
+                #[cfg(unix)]
+                std::os::unix::fs::symlink(link, &target)?;
+                return Ok(true);
+            }
+
+            let current = std::fs::symlink_metadata(&target).ok();
+            if current.map_or(false, |meta| meta.is_file() && meta.len() == entry.size)
+                && sha256_file(&target)? == entry.sha256
+            {
+                return Ok(false);
+            }
+            let data = self.read(entry)?;
+            let tmp = tmp_path(&target);
+            std::fs::write(&tmp, &data)?;
+            set_file_mode(&tmp, entry.mode)?;
+            std::fs::rename(&tmp, &target)?;
+            Ok(true)
+        });
+
+        let mut written = 0;
+        for result in results {
+            written += result? as usize;
+        }
+        Ok(written)
+    }
+}
+
+// Creates `relative` below `dest` one component at a time, failing on any
+// component that is a symlink (from the archive or already on disk), so no
+// write is ever redirected outside `dest`
+fn create_dirs_nofollow(dest: &std::path::Path, relative: &std::path::Path) -> std::io::Result<()> {
+    let mut dir = dest.to_path_buf();
+    for component in relative.components() {
+        dir.push(component);
+        match std::fs::symlink_metadata(&dir) {
+            Ok(meta) if meta.is_dir() => continue,
+            Ok(_) => {
+                return Err(std::io::Error::new(
+                    std::io::ErrorKind::InvalidData,
+                    format!("{} is not a directory", dir.display()),
+                ))
+            }
+            Err(e) if e.kind() == std::io::ErrorKind::NotFound => {}
+            Err(e) => return Err(e),
+        }
+        match std::fs::create_dir(&dir) {
+            Err(e) if e.kind() != std::io::ErrorKind::AlreadyExists => return Err(e),
+            _ => {}
+        }
+        // Created concurrently as something else
+        if !std::fs::symlink_metadata(&dir)?.is_dir() {
+            return Err(std::io::Error::new(
+                std::io::ErrorKind::InvalidData,
+                format!("{} is not a directory", dir.display()),
+            ));
+        }
+    }
+    Ok(())
+}
+
+// Directories under `root` with no entries at all, relative to it
+fn empty_dirs(root: &std::path::Path) -> std::io::Result<Vec<String>> {
+    let mut empty = Vec::new();
+    let mut stack = vec![root.to_path_buf()];
+    while let Some(dir) = stack.pop() {
+        let mut entries = 0;
+        for dir_entry in std::fs::read_dir(&dir)? {
+            let dir_entry = dir_entry?;
+            entries += 1;
+            if dir_entry.file_type()?.is_dir() && dir_entry.file_name() != ".git" {
+                stack.push(dir_entry.path());
+            }
+        }
+        if entries == 0 && dir != root {
+            empty.push(dir.strip_prefix(root).unwrap_or(&dir).to_string_lossy().into_owned());
+        }
+    }
+    empty.sort();
+    Ok(empty)
+}
+
+#[cfg(unix)]
+fn file_mode(meta: &std::fs::Metadata) -> u32 {
+    use std::os::unix::fs::PermissionsExt;
+    meta.permissions().mode() & 0o7777
+}
+
+#[cfg(not(unix))]
+fn file_mode(meta: &std::fs::Metadata) -> u32 {
+    if meta.permissions().readonly() { 0o444 } else { 0o644 }
+}
+
+#[cfg(unix)]
+fn set_file_mode(path: &std::path::Path, mode: u32) -> std::io::Result<()> {
+    use std::os::unix::fs::PermissionsExt;
+    std::fs::set_permissions(path, std::fs::Permissions::from_mode(mode))
+}
+
+#[cfg(not(unix))]
+fn set_file_mode(_path: &std::path::Path, _mode: u32) -> std::io::Result<()> {
+    Ok(())
+}
+
+fn archive_extension(package: &Package) -> &'static str {
+    if package.source_url.ends_with(".cpkg") {
+        "cpkg"
+    } else {
+        "tar.gz"
+    }
+}
+
+// Small, repetitive objects (registry metadata, install manifests, build logs)
+// compress poorly one at a time, so each kind gets a zstd dictionary trained
+// from the objects already stored. Dictionaries are versioned and never
+// deleted, and every object records the version it was written with, so
+// retraining never invalidates what is on disk.
+//
+//   object:     <cache>/<kind>/<key>.zst = ["CPZ1"][dictionary version: u32 LE][zstd frame]
+//   dictionary: <cache>/dicts/<kind>-v<version>.dict (version 0 means none)
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ObjectKind {
+    Metadata,
+    Manifest,
+    Log,
+}
+
+impl ObjectKind {
+    pub const ALL: [ObjectKind; 3] = [ObjectKind::Metadata, ObjectKind::Manifest, ObjectKind::Log];
+
+    pub fn name(self) -> &'static str {
+        match self {
+            ObjectKind::Metadata => "metadata",
+            ObjectKind::Manifest => "manifests",
+            ObjectKind::Log => "logs",
+        }
+    }
+
+    pub fn parse(name: &str) -> Option<Self> {
+        Self::ALL.into_iter().find(|kind| kind.name() == name)
+    }
+}
+
+const OBJECT_MAGIC: &[u8; 4] = b"CPZ1";
+const OBJECT_LEVEL: i32 = 9;
+// Objects of a kind needed before its first dictionary is trained
+const DICT_TRAIN_THRESHOLD: usize = 64;
+// Samples used per training run, newest first
+const DICT_TRAIN_SAMPLES: usize = 4096;
+const DICT_MAX_SIZE: usize = 32 << 10;
+
+pub struct ObjectStore {
+    root: std::path::PathBuf,
+    dict_dir: std::path::PathBuf,
+    kind: ObjectKind,
+}
+
+impl ObjectStore {
+    pub fn new(cache_dir: &std::path::Path, kind: ObjectKind) -> Self {
+        ObjectStore {
+            root: cache_dir.join(kind.name()),
+            dict_dir: cache_dir.join("dicts"),
+            kind,
+        }
+    }
+
+    pub fn put(&self, key: &str, data: &[u8]) -> std::io::Result<()> {
+        let (version, dictionary) = self.current_dictionary()?;
+        let encoded = encode_object(data, version, dictionary.as_deref())?;
+        std::fs::create_dir_all(&self.root)?;
+        let path = self.root.join(format!("{}.zst", key));
+        let tmp = tmp_path(&path);
+        std::fs::write(&tmp, encoded)?;
+        std::fs::rename(&tmp, &path)?;
+
+        // Training is best-effort: the object is stored either way. After a
+        // failure (zstd rejects small or uniform sample sets) it is retried
+        // once the store has doubled, not on every write.
+        if version == 0 {
+            let stored = self.keys()?.len();
+            let failed_at = std::fs::read_to_string(self.training_failed_path())
+                .ok()
+                .and_then(|count| count.trim().parse::<usize>().ok())
+                .unwrap_or(0);
+            if stored >= DICT_TRAIN_THRESHOLD.max(failed_at * 2) {
+                if let Err(e) = self.train() {
+                    eprintln!(
+                        "warning: could not train a {} dictionary, storing without one: {}",
+                        self.kind.name(),
+                        e
+                    );
+                    let _ = std::fs::create_dir_all(&self.dict_dir)
+                        .and_then(|_| std::fs::write(self.training_failed_path(), stored.to_string()));
+                }
+            }
+        }
+        Ok(())
+    }
+
+    fn training_failed_path(&self) -> std::path::PathBuf {
+        self.dict_dir.join(format!("{}.train-failed", self.kind.name()))
+    }
+
+    // Stored objects, plus plain .json files written before the store existed
+    pub fn get(&self, key: &str) -> std::io::Result<Option<Vec<u8>>> {
+        match std::fs::read(self.root.join(format!("{}.zst", key))) {
+            Ok(encoded) => self.decode(&encoded).map(Some),
+            Err(e) if e.kind() == std::io::ErrorKind::NotFound => {
+                match std::fs::read(self.root.join(format!("{}.json", key))) {
+                    Ok(plain) => Ok(Some(plain)),
+                    Err(e) if e.kind() == std::io::ErrorKind::NotFound => Ok(None),
+                    Err(e) => Err(e),
+                }
+            }
+            Err(e) => Err(e),
+        }
+    }
+
+    pub fn keys(&self) -> std::io::Result<Vec<String>> {
+        let mut keys = Vec::new();
+        let Ok(dir) = std::fs::read_dir(&self.root) else {
+            return Ok(keys);
+        };
+        for entry in dir {
+            let name = entry?.file_name().to_string_lossy().into_owned();
+            if let Some(key) = name.strip_suffix(".zst").or_else(|| name.strip_suffix(".json")) {
+                keys.push(key.to_string());
+            }
+        }
+        keys.sort();
+        keys.dedup();
+        Ok(keys)
+    }
+
+    // Trains the next dictionary version from the stored objects. Objects keep
+    // the version they were written with; new writes use the new dictionary.
+    pub fn train(&self) -> std::io::Result<Option<u32>> {
+        let samples = self.samples(DICT_TRAIN_SAMPLES)?;
+        if samples.len() < 8 {
+            return Ok(None);
+        }
+        let dictionary = zstd::dict::from_samples(&samples, DICT_MAX_SIZE)?;
+        let version = self.current_dictionary()?.0 + 1;
+        std::fs::create_dir_all(&self.dict_dir)?;
+        let path = self.dictionary_path(version);
+        let tmp = tmp_path(&path);
+        std::fs::write(&tmp, &dictionary)?;
+        // Published with link(2), which never replaces: objects written with
+        // a version must always decode with the dictionary that won
+        let published = std::fs::hard_link(&tmp, &path);
+        std::fs::remove_file(&tmp)?;
+        match published {
+            Err(e) if e.kind() == std::io::ErrorKind::AlreadyExists => return Ok(None),
+            result => result?,
+        }
+        Ok(Some(version))
+    }
+
+    // Decoded contents of up to `limit` objects, most recently written first
+    pub fn samples(&self, limit: usize) -> std::io::Result<Vec<Vec<u8>>> {
+        let mut keyed = Vec::new();
+        for key in self.keys()? {
+            let path = self.root.join(format!("{}.zst", key));
+            let modified = std::fs::metadata(&path).and_then(|m| m.modified()).ok();
+            keyed.push((modified, key));
+        }
+        keyed.sort_by(|a, b| b.0.cmp(&a.0));
+
+        let mut samples = Vec::new();
+        for (_, key) in keyed.into_iter().take(limit) {
+            if let Some(data) = self.get(&key)? {
+                samples.push(data);
+            }
+        }
+        Ok(samples)
+    }
+
+    pub fn current_dictionary(&self) -> std::io::Result<(u32, Option<Vec<u8>>)> {
+        let prefix = format!("{}-v", self.kind.name());
+        let mut latest = 0;
+        if let Ok(dir) = std::fs::read_dir(&self.dict_dir) {
+            for entry in dir {
+                let name = entry?.file_name().to_string_lossy().into_owned();
+                let version = name
+                    .strip_prefix(&prefix)
+                    .and_then(|rest| rest.strip_suffix(".dict"))
+                    .and_then(|version| version.parse().ok());
+                latest = latest.max(version.unwrap_or(0));
+            }
+        }
+        if latest == 0 {
+            return Ok((0, None));
+        }
+        Ok((latest, Some(std::fs::read(self.dictionary_path(latest))?)))
+    }
+
+    fn dictionary_path(&self, version: u32) -> std::path::PathBuf {
+        self.dict_dir.join(format!("{}-v{}.dict", self.kind.name(), version))
+    }
+
+    fn decode(&self, encoded: &[u8]) -> std::io::Result<Vec<u8>> {
+        let invalid = || std::io::Error::new(std::io::ErrorKind::InvalidData, "bad object header");
+        if encoded.len() < 8 || &encoded[..4] != OBJECT_MAGIC {
+            return Err(invalid());
+        }
+        let version = u32::from_le_bytes(encoded[4..8].try_into().map_err(|_| invalid())?);
+        let dictionary = match version {
+            0 => Vec::new(),
+            version => std::fs::read(self.dictionary_path(version))?,
+        };
+        decode_frame(&encoded[8..], &dictionary)
+    }
+}
+
+fn encode_object(data: &[u8], version: u32, dictionary: Option<&[u8]>) -> std::io::Result<Vec<u8>> {
+    let mut compressor = zstd::bulk::Compressor::with_dictionary(OBJECT_LEVEL, dictionary.unwrap_or(&[]))?;
+    let frame = compressor.compress(data)?;
+    let mut encoded = Vec::with_capacity(8 + frame.len());
+    encoded.extend_from_slice(OBJECT_MAGIC);
+    encoded.extend_from_slice(&version.to_le_bytes());
+    encoded.extend_from_slice(&frame);
+    Ok(encoded)
+}
+
+fn decode_frame(frame: &[u8], dictionary: &[u8]) -> std::io::Result<Vec<u8>> {
+    use std::io::Read;
+    let mut decoder = zstd::stream::read::Decoder::with_dictionary(frame, dictionary)?;
+    let mut data = Vec::new();
+    decoder.read_to_end(&mut data)?;
+    Ok(data)
+}
+
+#[derive(Debug, Serialize)]
+pub struct CodecResult {
+    pub codec: String,
+    pub bytes: u64,
+    pub decode_mb_per_s: f64,
+}
+
+// Stored size and single-object decode throughput of one kind's objects under
+// gzip, plain zstd and zstd with the kind's current dictionary
+pub fn benchmark_object_store(store: &ObjectStore) -> std::io::Result<Vec<CodecResult>> {
+    use std::io::{Read, Write};
+
+    let samples = store.samples(usize::MAX)?;
+    let raw: u64 = samples.iter().map(|s| s.len() as u64).sum();
+    let (_, dictionary) = store.current_dictionary()?;
+
+    // Repeats decoding until ~200ms have passed so tiny stores still measure
+    fn throughput(raw: u64, mut decode_all: impl FnMut() -> std::io::Result<()>) -> std::io::Result<f64> {
+        let start = std::time::Instant::now();
+        let mut rounds = 0u64;
+        while rounds == 0 || start.elapsed() < std::time::Duration::from_millis(200) {
+            decode_all()?;
+            rounds += 1;
+        }
+        Ok((raw * rounds) as f64 / start.elapsed().as_secs_f64() / 1e6)
+    }
+
+    let mut results = Vec::new();
+
+    let gzipped = samples
+        .iter()
+        .map(|sample| {
+            let mut encoder = flate2::write::GzEncoder::new(Vec::new(), flate2::Compression::new(9));
+            encoder.write_all(sample)?;
+            encoder.finish()
+        })
+        .collect::<std::io::Result<Vec<_>>>()?;
+    results.push(CodecResult {
+        codec: "gzip -9".to_string(),
+        bytes: gzipped.iter().map(|g| g.len() as u64).sum(),
+        decode_mb_per_s: throughput(raw, || {
+            for compressed in &gzipped {
+                let mut data = Vec::new();
+                flate2::read::GzDecoder::new(compressed.as_slice()).read_to_end(&mut data)?;
+            }
+            Ok(())
+        })?,
+    });
+
+    let mut dictionaries = vec![("zstd", Vec::new())];
+    if let Some(dictionary) = dictionary {
+        dictionaries.push(("zstd+dict", dictionary));
+    }
+    for (codec, dictionary) in dictionaries {
+        let frames = samples
+            .iter()
+            .map(|sample| encode_object(sample, 0, Some(&dictionary)).map(|e| e[8..].to_vec()))
+            .collect::<std::io::Result<Vec<_>>>()?;
+        let mut decompressor = zstd::bulk::Decompressor::with_dictionary(&dictionary)?;
+        let capacity = samples.iter().map(|s| s.len()).max().unwrap_or(0);
+        results.push(CodecResult {
+            codec: format!("{} -{}", codec, OBJECT_LEVEL),
+            bytes: frames.iter().map(|f| f.len() as u64).sum::<u64>() + dictionary.len() as u64,
+            decode_mb_per_s: throughput(raw, || {
+                for frame in &frames {
+                    decompressor.decompress(frame, capacity)?;
+                }
+                Ok(())
+            })?,
+        });
+    }
+    results.insert(
+        0,
+        CodecResult { codec: "raw".to_string(), bytes: raw, decode_mb_per_s: 0.0 },
+    );
+    Ok(results)
+}
+
+// Cache garbage collection. Each cache is a set of entries (a directory or
+// file) evicted as a unit. Uses are appended to <cache>/gc/access.log instead
+// of relying on atime; a GC run folds the log into gc/state.json, pins
+// everything an active lockfile references, and evicts segmented-LRU style:
+// entries used once go before entries used repeatedly, oldest first, until
+// the cache fits its budget. Entries used within GC_GRACE_NS are never
+// evicted, and source and build trees are only evicted under their
+// package's build lock, so in-flight installs are safe however long they
+// take.
+#[derive(Debug, Clone, Copy, PartialEq, Eq, Hash)]
+pub enum CacheKind {
+    Builds,
+    Sources,
+    Artifacts,
+    Downloads,
+    Chunks,
+}
+
+impl CacheKind {
+    pub const ALL: [CacheKind; 5] = [
+        CacheKind::Builds,
+        CacheKind::Sources,
+        CacheKind::Artifacts,
+        CacheKind::Downloads,
+        CacheKind::Chunks,
+    ];
+
+    pub fn name(self) -> &'static str {
+        match self {
+            CacheKind::Builds => "builds",
+            CacheKind::Sources => "sources",
+            CacheKind::Artifacts => "artifacts",
+            CacheKind::Downloads => "downloads",
+            CacheKind::Chunks => "chunks",
+        }
+    }
+
+    pub fn parse(name: &str) -> Option<Self> {
+        Self::ALL.into_iter().find(|kind| kind.name() == name)
+    }
+
+    fn default_budget(self) -> u64 {
+        match self {
+            CacheKind::Builds => 10 << 30,
+            CacheKind::Sources => 5 << 30,
+            CacheKind::Artifacts => 20 << 30,
+            CacheKind::Downloads => 5 << 30,
+            CacheKind::Chunks => 10 << 30,
+        }
+    }
+}
+
+const GC_GRACE_NS: i64 = 15 * 60 * 1_000_000_000;
+// Background runs are incremental: at most this long, at most this often
+const GC_SLICE: std::time::Duration = std::time::Duration::from_secs(5);
+const GC_INTERVAL: std::time::Duration = std::time::Duration::from_secs(3600);
+
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct Lockfile {
+    pub packages: Vec<LockedPackage>,
+}
+
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct LockedPackage {
+    pub name: String,
+    pub version: String,
+    #[serde(default)]
+    pub checksum: Option<String>,
+    #[serde(default)]
+    pub chunk_index: Option<String>,
+    #[serde(default)]
+    pub artifact_keys: Vec<String>,
+}
+
+// Bookkeeping only: a failed append never fails the caller
+pub fn record_use(cache_dir: &std::path::Path, kind: CacheKind, key: &str) {
+    use std::io::Write;
+    let gc_dir = cache_dir.join("gc");
+    let line = format!("{}\t{}\t{}\n", unix_time_ns(), kind.name(), key);
+    let _ = std::fs::create_dir_all(&gc_dir)
+        .and_then(|_| {
+            std::fs::OpenOptions::new()
+                .create(true)
+                .append(true)
+                .open(gc_dir.join("access.log"))
+        })
+        .and_then(|mut log| log.write_all(line.as_bytes()));
+}
+
+// Roots live in gc/roots/ and name the lockfile; a root whose lockfile is gone
+// is inactive and dropped by the next GC
+pub fn register_lockfile(cache_dir: &std::path::Path, lockfile: &std::path::Path) -> std::io::Result<()> {
+    let lockfile = std::fs::canonicalize(lockfile)?;
+    let roots = cache_dir.join("gc").join("roots");
+    std::fs::create_dir_all(&roots)?;
+    let name = format!("{:016x}.root", fnv1a(lockfile.to_string_lossy().as_bytes()));
+    std::fs::write(roots.join(name), lockfile.to_string_lossy().as_bytes())
+}
+
+// Starts a detached `cpkg gc --background` on `cache_dir` when the last run
+// is older than GC_INTERVAL; installs never wait for it. System cache layers
+// are read-only and never collected. Only the CLI calls this: in any other
+// host, current_exe is not cpkg.
+pub fn spawn_background_gc(cache_dir: &std::path::Path) {
+    let gc_dir = cache_dir.join("gc");
+    let stamp = gc_dir.join("last-run");
+    let due = std::fs::metadata(&stamp)
+        .and_then(|meta| meta.modified())
+        .ok()
+        .and_then(|modified| modified.elapsed().ok())
+        .map_or(true, |age| age > GC_INTERVAL);
+    if !due || std::fs::create_dir_all(&gc_dir).and_then(|_| std::fs::write(&stamp, b"")).is_err() {
+        return;
+    }
+    if let Ok(exe) = std::env::current_exe() {
+        let _ = std::process::Command::new(exe)
+            .args(["gc", "--background"])
+            .env("CPKG_CACHE_DIR", cache_dir)
+            .env_remove("CPKG_TRACE")
+            // The collector would replace the installer's metrics with its own
+            .env_remove("CPKG_METRICS_TEXTFILE")
+            .stdin(std::process::Stdio::null())
+            .stdout(std::process::Stdio::null())
+            .stderr(std::process::Stdio::null())
+            .spawn();
+    }
+}
+
+#[derive(Debug, Default, Serialize, Deserialize)]
+struct AccessState {
+    // "<cache>\t<key>" -> (last use in unix ns, number of uses)
+    entries: HashMap<String, (i64, u32)>,
+}
+
+#[derive(Debug)]
+struct CacheEntry {
+    key: String,
+    paths: Vec<std::path::PathBuf>,
+    size: u64,
+    last_use: i64,
+    uses: u32,
+}
+
+#[derive(Debug, Default)]
+pub struct GcReport {
+    pub cache: String,
+    pub before: u64,
+    pub after: u64,
+    pub budget: u64,
+    pub evicted: usize,
+    pub pinned: usize,
+}
+
+pub struct CacheManager {
+    cache_dir: std::path::PathBuf,
+    gc_dir: std::path::PathBuf,
+}
+
+impl CacheManager {
+    pub fn new(cache_dir: &std::path::Path) -> Self {
+        CacheManager {
+            cache_dir: cache_dir.to_path_buf(),
+            gc_dir: cache_dir.join("gc"),
+        }
+    }
+
+    // Budgets from gc/budgets.json ({"builds": bytes, ...}), else defaults
+    pub fn budgets(&self) -> HashMap<CacheKind, u64> {
+        let saved: HashMap<String, u64> = std::fs::read(self.gc_dir.join("budgets.json"))
+            .ok()
+            .and_then(|data| serde_json::from_slice(&data).ok())
+            .unwrap_or_default();
+        CacheKind::ALL
+            .into_iter()
+            .map(|kind| (kind, saved.get(kind.name()).copied().unwrap_or(kind.default_budget())))
+            .collect()
+    }
+
+    pub fn save_budgets(&self, budgets: &HashMap<CacheKind, u64>) -> std::io::Result<()> {
+        let named: HashMap<&str, u64> = budgets.iter().map(|(kind, bytes)| (kind.name(), *bytes)).collect();
+        std::fs::create_dir_all(&self.gc_dir)?;
+        std::fs::write(
+            self.gc_dir.join("budgets.json"),
+            serde_json::to_vec_pretty(&named).unwrap_or_default(),
+        )
+    }
+
+    // Evicts until every cache fits its budget or `deadline` passes. Returns
+    // None if another GC holds the lock.
+    pub fn collect(
+        &self,
+        budgets: &HashMap<CacheKind, u64>,
+        deadline: Option<std::time::Instant>,
+        dry_run: bool,
+    ) -> std::io::Result<Option<Vec<GcReport>>> {
+        std::fs::create_dir_all(&self.gc_dir)?;
+        let lock = std::fs::File::create(self.gc_dir.join("gc.lock"))?;
+        match lock.try_lock() {
+            Ok(()) => {}
+            Err(std::fs::TryLockError::WouldBlock) => return Ok(None),
+            Err(std::fs::TryLockError::Error(e)) => return Err(e),
+        }
+
+        let mut state = self.fold_access_log()?;
+        let pins = self.pins()?;
+        let now = unix_time_ns();
+        let mut reports = Vec::new();
+
+        for kind in CacheKind::ALL {
+            let mut entries = self.entries(kind, &state)?;
+            let budget = budgets.get(&kind).copied().unwrap_or(kind.default_budget());
+            let total: u64 = entries.iter().map(|entry| entry.size).sum();
+            let mut report = GcReport {
+                cache: kind.name().to_string(),
+                before: total,
+                after: total,
+                budget,
+                ..GcReport::default()
+            };
+
+            // Segmented LRU: the probationary segment (one use) goes first
+            entries.retain(|entry| {
+                let pinned = pins.contains(&(kind, entry.key.clone()));
+                report.pinned += pinned as usize;
+                !pinned && now - entry.last_use > GC_GRACE_NS
+            });
+            entries.sort_by_key(|entry| (entry.uses >= 2, entry.last_use));
+
+            for entry in entries {
+                if report.after <= budget || deadline.map_or(false, |d| std::time::Instant::now() > d) {
+                    break;
+                }
+                let Some(_build_locks) = self.lock_trees(kind, &entry.key)? else {
+                    continue;
+                };
+                if !dry_run {
+                    for path in &entry.paths {
+                        let removed = if path.is_dir() && !path.is_symlink() {
+                            std::fs::remove_dir_all(path)
+                        } else {
+                            std::fs::remove_file(path)
+                        };
+                        if let Err(e) = removed {
+                            if e.kind() != std::io::ErrorKind::NotFound {
+                                return Err(e);
+                            }
+                        }
+                    }
+                    state.entries.remove(&format!("{}\t{}", kind.name(), entry.key));
+                }
+                report.after -= entry.size;
+                report.evicted += 1;
+            }
+            reports.push(report);
+        }
+
+        if !dry_run {
+            self.save_state(&state)?;
+        }
+        Ok(Some(reports))
+    }
+
+    // Moves the access log aside and folds it into gc/state.json; appends that
+    // race with the rename land in the next log
+    fn fold_access_log(&self) -> std::io::Result<AccessState> {
+        let mut state: AccessState = std::fs::read(self.gc_dir.join("state.json"))
+            .ok()
+            .and_then(|data| serde_json::from_slice(&data).ok())
+            .unwrap_or_default();
+
+        let folding = self.gc_dir.join("access.log.folding");
+        if !folding.exists() {
+            match std::fs::rename(self.gc_dir.join("access.log"), &folding) {
+                Ok(()) => {}
+                Err(e) if e.kind() == std::io::ErrorKind::NotFound => return Ok(state),
+                Err(e) => return Err(e),
+            }
+        }
+        let log = std::fs::read_to_string(&folding)?;
+        for line in log.lines() {
+            let mut fields = line.splitn(3, '\t');
+            let (Some(time), Some(kind), Some(key)) = (fields.next(), fields.next(), fields.next()) else {
+                continue;
+            };
+            let Ok(time) = time.parse::<i64>() else { continue };
+            let record = state.entries.entry(format!("{}\t{}", kind, key)).or_insert((0, 0));
+            record.0 = record.0.max(time);
+            record.1 = record.1.saturating_add(1);
+        }
+        self.save_state(&state)?;
+        std::fs::remove_file(&folding)?;
+        Ok(state)
+    }
+
+    fn save_state(&self, state: &AccessState) -> std::io::Result<()> {
+        let path = self.gc_dir.join("state.json");
+        let tmp = tmp_path(&path);
+        std::fs::write(&tmp, serde_json::to_vec(state).unwrap_or_default())?;
+        std::fs::rename(&tmp, &path)
+    }
+
+    // Takes the build locks of every package whose source or build tree
+    // `key` may be without waiting; None while an install holds one. Build
+    // trees of variants are named <package>-<key>, and package names may
+    // contain '-', so every package with a matching prefix counts. An
+    // artifact <package>/<key> is guarded by the native store's entry lock,
+    // <root>/.locks/<package>-<key>.lock, held while it is built.
+    fn lock_trees(&self, kind: CacheKind, key: &str) -> std::io::Result<Option<Vec<std::fs::File>>> {
+        if kind == CacheKind::Artifacts {
+            let Some((package, fingerprint)) = key.split_once('/') else {
+                return Ok(Some(Vec::new()));
+            };
+            let locks = self.roots(kind)[0].join(".locks");
+            std::fs::create_dir_all(&locks)?;
+            let file = std::fs::OpenOptions::new()
+                .create(true)
+                .truncate(false)
+                .write(true)
+                .open(locks.join(format!("{}-{}.lock", package, fingerprint)))?;
+            return match file.try_lock() {
+                Ok(()) => Ok(Some(vec![file])),
+                Err(std::fs::TryLockError::WouldBlock) => Ok(None),
+                Err(std::fs::TryLockError::Error(e)) => Err(e),
+            };
+        }
+        if !matches!(kind, CacheKind::Builds | CacheKind::Sources) {
+            return Ok(Some(Vec::new()));
+        }
+        let Ok(locks) = std::fs::read_dir(tree_lock_dir()) else {
+            return Ok(Some(Vec::new()));
+        };
+        let mut held = Vec::new();
+        for lock in locks {
+            let lock = lock?;
+            let name = lock.file_name().to_string_lossy().into_owned();
+            let Some(package) = name.strip_suffix(".lock") else {
+                continue;
+            };
+            if key != package && !key.strip_prefix(package).map_or(false, |rest| rest.starts_with('-')) {
+                continue;
+            }
+            let file = std::fs::OpenOptions::new().write(true).open(lock.path())?;
+            match file.try_lock() {
+                Ok(()) => held.push(file),
+                Err(std::fs::TryLockError::WouldBlock) => return Ok(None),
+                Err(std::fs::TryLockError::Error(e)) => return Err(e),
+            }
+        }
+        Ok(Some(held))
+    }
+
+    fn roots(&self, kind: CacheKind) -> Vec<std::path::PathBuf> {
+        match kind {
+            CacheKind::Builds => vec![std::env::temp_dir().join("cpppm_build")],
+            CacheKind::Sources => vec![std::env::temp_dir().join("cpppm_cache")],
+            CacheKind::Artifacts => vec![self.cache_dir.join("artifacts")],
+            CacheKind::Downloads => vec![self.cache_dir.join("downloads"), self.cache_dir.join("cas")],
+            CacheKind::Chunks => vec![self.cache_dir.join("chunks")],
+        }
+    }
+
+    fn entries(&self, kind: CacheKind, state: &AccessState) -> std::io::Result<Vec<CacheEntry>> {
+        let mut grouped: std::collections::BTreeMap<String, Vec<std::path::PathBuf>> = Default::default();
+        let list = |dir: &std::path::Path| -> Vec<(String, std::path::PathBuf)> {
+            std::fs::read_dir(dir)
+                .map(|entries| {
+                    entries
+                        .filter_map(|entry| entry.ok())
+                        .map(|entry| (entry.file_name().to_string_lossy().into_owned(), entry.path()))
+                        .collect()
+                })
+                .unwrap_or_default()
+        };
+
+        let roots = self.roots(kind);
+        match kind {
+            // .locks holds the build locks, not a tree
+            CacheKind::Builds | CacheKind::Sources => {
+                for (name, path) in list(&roots[0]) {
+                    if !name.starts_with('.') {
+                        grouped.entry(name).or_default().push(path);
+                    }
+                }
+            }
+            // <pkg>/<key>/ and its packed <pkg>/<key>.cpkg form one entry;
+            // dot names are the native store's locks and staging areas
+            CacheKind::Artifacts => {
+                for (package, dir) in list(&roots[0]) {
+                    if package.starts_with('.') {
+                        continue;
+                    }
+                    for (name, path) in list(&dir) {
+                        if name.starts_with('.') {
+                            continue;
+                        }
+                        let key = name.strip_suffix(".cpkg").unwrap_or(&name);
+                        grouped.entry(format!("{}/{}", package, key)).or_default().push(path);
+                    }
+                }
+            }
+            CacheKind::Downloads => {
+                for (name, path) in list(&roots[0]) {
+                    grouped.entry(name).or_default().push(path);
+                }
+                for (name, path) in list(&roots[1]) {
+                    grouped.entry(format!("cas/{}", name)).or_default().push(path);
+                }
+            }
+            CacheKind::Chunks => {
+                for (name, dir) in list(&roots[0]) {
+                    let prefix = if name == "index" { "index/" } else { "" };
+                    for (file, path) in list(&dir) {
+                        let key = file
+                            .strip_suffix(".cacnk")
+                            .or_else(|| file.strip_suffix(".caidx"))
+                            .unwrap_or(&file);
+                        grouped.entry(format!("{}{}", prefix, key)).or_default().push(path);
+                    }
+                }
+            }
+        }
+
+        let grouped: Vec<(String, Vec<std::path::PathBuf>)> = grouped.into_iter().collect();
+        let sizes = parallel_map(&grouped, |(_, paths)| paths.iter().map(|p| disk_usage(p)).sum::<u64>());
+
+        // A chunk is as recent as the newest index that references it
+        let mut chunk_refs: HashMap<String, (i64, u32)> = HashMap::new();
+        if kind == CacheKind::Chunks {
+            for (key, paths) in &grouped {
+                let Some(digest) = key.strip_prefix("index/") else { continue };
+                let recency = state
+                    .entries
+                    .get(&format!("chunks\tindex/{}", digest))
+                    .copied()
+                    .unwrap_or((modified_ns(&paths[0]), 1));
+                let Some(index) = std::fs::read(&paths[0])
+                    .ok()
+                    .and_then(|data| ChunkIndex::parse(&data).ok())
+                else {
+                    continue;
+                };
+                for chunk in index.chunks {
+                    let record = chunk_refs.entry(chunk.digest).or_insert((0, 0));
+                    record.0 = record.0.max(recency.0);
+                    record.1 = record.1.saturating_add(recency.1);
+                }
+            }
+        }
+
+        Ok(grouped
+            .into_iter()
+            .zip(sizes)
+            .map(|((key, paths), size)| {
+                let (last_use, uses) = state
+                    .entries
+                    .get(&format!("{}\t{}", kind.name(), key))
+                    .or_else(|| chunk_refs.get(&key))
+                    .copied()
+                    .unwrap_or_else(|| (paths.iter().map(|p| modified_ns(p)).max().unwrap_or(0), 1));
+                CacheEntry { key, paths, size, last_use, uses }
+            })
+            .collect())
+    }
+
+    // Everything referenced by a lockfile that still exists
+    fn pins(&self) -> std::io::Result<std::collections::HashSet<(CacheKind, String)>> {
+        let mut pins = std::collections::HashSet::new();
+        let Ok(roots) = std::fs::read_dir(self.gc_dir.join("roots")) else {
+            return Ok(pins);
+        };
+        let chunks = ChunkStore::new(self.cache_dir.join("chunks"));
+
+        for root in roots {
+            let root = root?.path();
+            // A root that cannot be read pins nothing, but must not stop GC
+            let lockfile = match std::fs::read_to_string(&root) {
+                Ok(lockfile) => std::path::PathBuf::from(lockfile),
+                Err(e) => {
+                    eprintln!("warning: skipping GC root {}: {}", root.display(), e);
+                    continue;
+                }
+            };
+            let Ok(data) = std::fs::read(&lockfile) else {
+                let _ = std::fs::remove_file(&root);
+                continue;
+            };
+            let Ok(lock) = serde_json::from_slice::<Lockfile>(&data) else { continue };
+
+            for package in lock.packages {
+                pins.insert((CacheKind::Sources, package.name.clone()));
+                pins.insert((CacheKind::Builds, package.name.clone()));
+                for extension in ["tar.gz", "cpkg", "tar"] {
+                    pins.insert((
+                        CacheKind::Downloads,
+                        format!("{}-{}.{}", package.name, package.version, extension),
+                    ));
+                }
+                for key in &package.artifact_keys {
+                    pins.insert((CacheKind::Builds, format!("{}-{}", package.name, key)));
+                    pins.insert((CacheKind::Artifacts, format!("{}/{}", package.name, key)));
+                }
+                if let Some(digest) = &package.chunk_index {
+                    pins.insert((CacheKind::Chunks, format!("index/{}", digest)));
+                    let index = std::fs::read(chunks.index_path(digest))
+                        .ok()
+                        .and_then(|data| ChunkIndex::parse(&data).ok());
+                    for chunk in index.map(|index| index.chunks).unwrap_or_default() {
+                        pins.insert((CacheKind::Chunks, chunk.digest));
+                    }
+                }
+            }
+        }
+        Ok(pins)
+    }
+}
+
+// Bytes on disk, with hard-linked files split between their links
+fn disk_usage(path: &std::path::Path) -> u64 {
+    let Ok(meta) = std::fs::symlink_metadata(path) else { return 0 };
+    if meta.is_dir() {
+        return std::fs::read_dir(path)
+            .map(|entries| entries.filter_map(|e| e.ok()).map(|e| disk_usage(&e.path())).sum())
+            .unwrap_or(0);
+    }
+    #[cfg(unix)]
+    {
+        use std::os::unix::fs::MetadataExt;
+        meta.len() / meta.nlink().max(1)
+    }
+    #[cfg(not(unix))]
+    meta.len()
+}
+
+fn modified_ns(path: &std::path::Path) -> i64 {
+    std::fs::symlink_metadata(path)
+        .and_then(|meta| meta.modified())
+        .ok()
+        .and_then(|time| time.duration_since(std::time::UNIX_EPOCH).ok())
+        .map_or(0, |age| age.as_nanos() as i64)
+}
+
+// "10G", "512M", "1024" (bytes)
+fn parse_size(text: &str) -> Option<u64> {
+    let text = text.trim();
+    let (digits, shift) = match text.char_indices().last()? {
+        (i, 'K' | 'k') => (&text[..i], 10),
+        (i, 'M' | 'm') => (&text[..i], 20),
+        (i, 'G' | 'g') => (&text[..i], 30),
+        (i, 'T' | 't') => (&text[..i], 40),
+        _ => (text, 0),
+    };
+    digits.parse::<u64>().ok()?.checked_mul(1 << shift)
+}
+
+// Temporary sibling of `path`, unique per process and call, for writes that
+// are published with a rename. Concurrent cpkg processes share the cache, so
+// a fixed temporary name could be truncated under another writer's rename.
+fn tmp_path(path: &std::path::Path) -> std::path::PathBuf {
+    static NEXT: std::sync::atomic::AtomicU64 = std::sync::atomic::AtomicU64::new(0);
+    let n = NEXT.fetch_add(1, std::sync::atomic::Ordering::Relaxed);
+    let mut name = path.file_name().unwrap_or_default().to_os_string();
+    name.push(format!(".tmp.{}.{}", std::process::id(), n));
+    path.with_file_name(name)
+}
+
+// Serializes work on a package's source and build trees. They live in the
+// temp dir, outside any one cache dir, so the lock lives beside them.
+fn tree_lock_dir() -> std::path::PathBuf {
+    std::env::temp_dir().join("cpppm_cache").join(".locks")
+}
+
+fn tree_lock_path(package: &str) -> std::path::PathBuf {
+    tree_lock_dir().join(format!("{}.lock", package))
+}
+
+// Exclusive advisory lock on `path`, created if missing and released when the
+// returned file is dropped. Waits, saying so, while another process holds it.
+async fn acquire_lock(path: std::path::PathBuf, what: String) -> std::io::Result<std::fs::File> {
+    tokio::task::spawn_blocking(move || {
+        if let Some(parent) = path.parent() {
+            std::fs::create_dir_all(parent)?;
+        }
+        let file = std::fs::OpenOptions::new()
+            .create(true)
+            .truncate(false)
+            .write(true)
+            .open(&path)?;
+        match file.try_lock() {
+            Ok(()) => return Ok(file),
+            Err(std::fs::TryLockError::WouldBlock) => {
+                println!("Waiting for another cpkg process {}", what)
+            }
+            Err(std::fs::TryLockError::Error(e)) => return Err(e),
+        }
+        file.lock()?;
+        Ok(file)
+    })
+    .await
+    .map_err(|e| std::io::Error::new(std::io::ErrorKind::Other, e))?
+}
+
+// Resolves `reference` against the directory of `base` unless it is absolute
+// Whether `value` can name one file or directory inside a cache: package
+// names and versions come from the registry and end up in paths
+fn is_path_component(value: &str) -> bool {
+    !value.is_empty()
+        && !value.starts_with('.')
+        && !value.contains("..")
+        && !value.contains(['/', '\\', '\0'])
+}
+
+fn resolve_url(base: &str, reference: &str) -> String {
+    if reference.contains("://") {
+        return reference.to_string();
+    }
+    let directory = &base[..base.rfind('/').map_or(0, |i| i + 1)];
+    format!("{}{}", directory, reference)
+}
+
+// SHA-256 and BLAKE3 of a file in one pass
+fn archive_digests(path: &std::path::Path) -> std::io::Result<(String, String)> {
+    use std::io::Read;
+    SelfProfile::measure("hash", &path.to_string_lossy(), || {
+        let mut file = std::fs::File::open(path)?;
+        let mut sha256 = sha2::Sha256::new();
+        let mut blake3 = blake3::Hasher::new();
+        let mut buffer = vec![0u8; 1 << 20];
+        loop {
+            let n = file.read(&mut buffer)?;
+            if n == 0 {
+                break;
+            }
+            sha256.update(&buffer[..n]);
+            blake3.update(&buffer[..n]);
+        }
+        Ok((to_hex(&sha256.finalize()), blake3.finalize().to_hex().to_string()))
+    })
+}
+
+// sha2 picks SHA-NI (x86) or the ARMv8 crypto extensions at runtime
+pub fn sha256_file(path: &std::path::Path) -> std::io::Result<String> {
+    use std::io::Read;
+
+    SelfProfile::measure("hash", &path.to_string_lossy(), || {
+        let mut file = std::fs::File::open(path)?;
+        let mut hasher = sha2::Sha256::new();
+        let mut buffer = vec![0u8; 1 << 20];
+        loop {
+            let n = file.read(&mut buffer)?;
+            if n == 0 {
+                break;
+            }
+            hasher.update(&buffer[..n]);
+        }
+        Ok(to_hex(&hasher.finalize()))
+    })
+}
+
+fn to_hex(bytes: &[u8]) -> String {
+    bytes.iter().map(|b| format!("{:02x}", b)).collect()
+}
+
+fn from_hex(hex: &str) -> Option<Vec<u8>> {
+    if hex.len() % 2 != 0 {
+        return None;
+    }
+    (0..hex.len())
+        .step_by(2)
+        .map(|i| u8::from_str_radix(hex.get(i..i + 2)?, 16).ok())
+        .collect()
+}
+
+// Maps `f` over `items` on one scoped thread per core, preserving order
+fn parallel_map<T: Sync, R: Send>(items: &[T], f: impl Fn(&T) -> R + Sync) -> Vec<R> {
+    let workers = std::thread::available_parallelism().map_or(4, |n| n.get());
+    let next = std::sync::atomic::AtomicUsize::new(0);
+    let mut indexed: Vec<(usize, R)> = std::thread::scope(|scope| {
+        let handles: Vec<_> = (0..workers.min(items.len()))
+            .map(|_| {
+                scope.spawn(|| {
+                    let mut results = Vec::new();
+                    loop {
+                        let i = next.fetch_add(1, std::sync::atomic::Ordering::Relaxed);
+                        let Some(item) = items.get(i) else { break };
+                        results.push((i, f(item)));
+                    }
+                    results
+                })
+            })
+            .collect();
+        handles
+            .into_iter()
+            .flat_map(|handle| handle.join().expect("worker panicked"))
+            .collect()
+    });
+    indexed.sort_by_key(|(i, _)| *i);
+    indexed.into_iter().map(|(_, result)| result).collect()
+}
+
+// Content fingerprint of a source tree. Files are re-hashed only when their
+// stat data changed since the cached entry, like the git index: inode, device,
+// size, mtime and ctime must all match, and entries whose mtime is not older
+// than the cache itself ("racily clean") are always re-hashed.
+#[derive(Debug, Clone)]
+pub struct SourceFingerprint {
+    pub root_hash: String,
+    pub files: usize,
+    pub rehashed: usize,
+}
+
+#[derive(Debug, Clone, PartialEq, Serialize, Deserialize)]
+struct StatEntry {
+    ino: u64,
+    dev: u64,
+    size: u64,
+    mtime_ns: i64,
+    ctime_ns: i64,
+    executable: bool,
+    // Symlinks are hashed by their target path, never followed
+    #[serde(default)]
+    symlink: bool,
+    hash: String,
+}
+
+#[derive(Debug, Default, Serialize, Deserialize)]
+struct StatCache {
+    written_ns: i64,
+    entries: HashMap<String, StatEntry>,
+}
+
+// Files at least this big are hashed with BLAKE3's multithreaded tree mode
+const PARALLEL_HASH_THRESHOLD: u64 = 1 << 20;
+
+pub fn fingerprint_source_tree(
+    root: &std::path::Path,
+    cache_path: &std::path::Path,
+) -> std::io::Result<SourceFingerprint> {
+    let cache: StatCache = std::fs::read(cache_path)
+        .ok()
+        .and_then(|data| serde_json::from_slice(&data).ok())
+        .unwrap_or_default();
+    let started_ns = unix_time_ns();
+
+    let files = walk_source_tree(root)?;
+
+    // Reuse cached hashes for unchanged, non-racy entries; hash the rest
+    let mut entries: Vec<(String, StatEntry)> = Vec::with_capacity(files.len());
+    let mut stale = Vec::new();
+    for (relative, mut entry) in files {
+        match cache.entries.get(&relative) {
+            Some(cached)
+                if cached.hash.len() == 64
+                    && entry.mtime_ns < cache.written_ns
+                    && StatEntry { hash: cached.hash.clone(), ..entry.clone() } == *cached =>
+            {
+                entry.hash = cached.hash.clone();
+            }
+            _ => stale.push(entries.len()),
+        }
+        entries.push((relative, entry));
+    }
+
+    let hashes = parallel_map(&stale, |&index| {
+        let (relative, entry) = &entries[index];
+        hash_file(&root.join(relative), entry.size)
+    });
+    for (&index, hash) in stale.iter().zip(hashes) {
+        entries[index].1.hash = hash?;
+    }
+
+    // Root hash covers path, mode and content of every file in path order
+    entries.sort_by(|a, b| a.0.cmp(&b.0));
+    let mut tree = blake3::Hasher::new();
+    for (relative, entry) in &entries {
+        tree.update(relative.as_bytes());
+        tree.update(match (entry.symlink, entry.executable) {
+            (true, _) => b"\0l\0",
+            (false, true) => b"\0x\0",
+            (false, false) => b"\0f\0",
+        });
+        tree.update(entry.hash.as_bytes());
+        tree.update(b"\n");
+    }
+
+    let fingerprint = SourceFingerprint {
+        root_hash: tree.finalize().to_hex().to_string(),
+        files: entries.len(),
+        rehashed: stale.len(),
+    };
+
+    let cache = StatCache {
+        written_ns: started_ns,
+        entries: entries.into_iter().collect(),
+    };
+    if let Some(parent) = cache_path.parent() {
+        std::fs::create_dir_all(parent)?;
+    }
+    let tmp = tmp_path(&cache_path);
+    std::fs::write(&tmp, serde_json::to_vec(&cache).unwrap_or_default())?;
+    std::fs::rename(&tmp, cache_path)?;
+
+    Ok(fingerprint)
+}
+
+// Walks the tree with one worker per core pulling directories off a shared
+// queue; returns stat data (without hashes) keyed by relative path
+fn walk_source_tree(root: &std::path::Path) -> std::io::Result<Vec<(String, StatEntry)>> {
+    use std::sync::{Condvar, Mutex};
+
+    struct Queue {
+        dirs: Vec<std::path::PathBuf>,
+        active: usize,
+    }
+    let queue = Mutex::new(Queue { dirs: vec![root.to_path_buf()], active: 0 });
+    let ready = Condvar::new();
+    let found = Mutex::new(Vec::new());
+    let first_error: Mutex<Option<std::io::Error>> = Mutex::new(None);
+
+    let workers = std::thread::available_parallelism().map_or(4, |n| n.get());
+    std::thread::scope(|scope| {
+        for _ in 0..workers {
+            scope.spawn(|| loop {
+                let dir = {
+                    let mut q = queue.lock().unwrap();
+                    loop {
+                        if let Some(dir) = q.dirs.pop() {
+                            q.active += 1;
+                            break Some(dir);
+                        }
+                        if q.active == 0 {
+                            break None;
+                        }
+                        q = ready.wait(q).unwrap();
+                    }
+                };
+                let Some(dir) = dir else {
+                    ready.notify_all();
+                    return;
+                };
+
+                let mut subdirs = Vec::new();
+                let mut files = Vec::new();
+                let result = (|| -> std::io::Result<()> {
+                    for dir_entry in std::fs::read_dir(&dir)? {
+                        let dir_entry = dir_entry?;
+                        let file_type = dir_entry.file_type()?;
+                        if file_type.is_dir() {
+                            if dir_entry.file_name() != ".git" {
+                                subdirs.push(dir_entry.path());
+                            }
+                            continue;
+                        }
+                        let path = dir_entry.path();
+                        let relative = path
+                            .strip_prefix(root)
+                            .unwrap_or(&path)
+                            .to_string_lossy()
+                            .into_owned();
+                        files.push((relative, stat_entry(&std::fs::symlink_metadata(&path)?)));
+                    }
+                    Ok(())
+                })();
+                if let Err(e) = result {
+                    first_error.lock().unwrap().get_or_insert(e);
+                }
+
+                found.lock().unwrap().extend(files);
+                let mut q = queue.lock().unwrap();
+                q.dirs.extend(subdirs);
+                q.active -= 1;
+                ready.notify_all();
+            });
+        }
+    });
+
+    match first_error.into_inner().unwrap() {
+        Some(e) => Err(e),
+        None => Ok(found.into_inner().unwrap()),
+    }
+}
+
+#[cfg(unix)]
+fn stat_entry(meta: &std::fs::Metadata) -> StatEntry {
+    use std::os::unix::fs::MetadataExt;
+    StatEntry {
+        ino: meta.ino(),
+        dev: meta.dev(),
+        size: meta.size(),
+        mtime_ns: meta.mtime() * 1_000_000_000 + meta.mtime_nsec(),
+        ctime_ns: meta.ctime() * 1_000_000_000 + meta.ctime_nsec(),
+        // A symlink's own mode is always 0777
+        executable: !meta.file_type().is_symlink() && meta.mode() & 0o111 != 0,
+        symlink: meta.file_type().is_symlink(),
+        hash: String::new(),
+    }
+}
+
+#[cfg(not(unix))]
+fn stat_entry(meta: &std::fs::Metadata) -> StatEntry {
+    let mtime_ns = meta
+        .modified()
+        .ok()
+        .and_then(|t| t.duration_since(std::time::UNIX_EPOCH).ok())
+        .map_or(0, |d| d.as_nanos() as i64);
+    StatEntry {
+        ino: 0,
+        dev: 0,
+        size: meta.len(),
+        mtime_ns,
+        ctime_ns: mtime_ns,
+        executable: false,
+        symlink: meta.file_type().is_symlink(),
+        hash: String::new(),
+    }
+}
+
+fn hash_file(path: &std::path::Path, size: u64) -> std::io::Result<String> {
+    let meta = std::fs::symlink_metadata(path)?;
+    let mut hasher = blake3::Hasher::new();
+    if meta.file_type().is_symlink() {
+        hasher.update(std::fs::read_link(path)?.to_string_lossy().as_bytes());
+    } else if size >= PARALLEL_HASH_THRESHOLD {
+        hasher.update_mmap_rayon(path)?;
+    } else {
+        hasher.update(&std::fs::read(path)?);
+    }
+    Ok(hasher.finalize().to_hex().to_string())
+}
+
+fn unix_time_ns() -> i64 {
+    std::time::SystemTime::now()
+        .duration_since(std::time::UNIX_EPOCH)
+        .map_or(0, |d| d.as_nanos() as i64)
+}
+
+// Same FNV-1a 64 the native ABIManager uses for fingerprints
+fn fnv1a(data: &[u8]) -> u64 {
+    data.iter().fold(0xcbf29ce484222325, |hash, byte| {
+        (hash ^ *byte as u64).wrapping_mul(0x100000001b3)
+    })
+}
+
+#[derive(Debug, thiserror::Error)]
+pub enum PackageError {
+    #[error("Network error: {0}")]
+    Network(#[from] reqwest::Error),
+    #[error("IO error: {0}")]
+    Io(#[from] std::io::Error),
+    #[error("Build failed for package: {0}")]
+    BuildFailed(String),
+    #[error("Dependency resolution failed")]
+    DependencyResolution,
+    #[error("Conflicting build configuration for {0}: {1}")]
+    ConfigConflict(String, String),
+    #[error("Checksum mismatch for {package}: expected {expected}, got {actual}")]
+    ChecksumMismatch {
+        package: String,
+        expected: String,
+        actual: String,
+    },
+    #[error("Failed to extract package: {0}")]
+    Extraction(String),
+    #[error("Signature verification failed: {0}")]
+    Signature(String),
+    #[error("Chunk {chunk} of {package} failed verification")]
+    ChunkMismatch { package: String, chunk: usize },
+}
+
+// Build history: one JSON line per package build in cache/history/builds.jsonl,
+// appended like the GC access log so concurrent installs never contend.
+// Records are keyed by package, version, effective config and machine class
+// and feed install time prediction, critical-path scheduling and regression
+// warnings. Builds served from an artifact store are recorded but never
+// predicted from.
+const HISTORY_WINDOW: usize = 10;
+// Rewritten keeping the last HISTORY_WINDOW builds per key beyond this size
+const HISTORY_COMPACT_BYTES: u64 = 8 << 20;
+// A build at least this much slower than its median, and by at least
+// REGRESSION_MIN_SECONDS, is flagged once HISTORY_MIN_SAMPLES builds exist
+const REGRESSION_FACTOR: f64 = 1.5;
+const REGRESSION_MIN_SECONDS: f64 = 10.0;
+const HISTORY_MIN_SAMPLES: usize = 3;
+// Assumed for packages never built on any machine
+const UNKNOWN_BUILD_SECONDS: f64 = 60.0;
+
+#[derive(Debug, Clone, Default, Serialize, Deserialize)]
+pub struct StageStats {
+    pub seconds: f64,
+    #[serde(default)]
+    pub cpu_seconds: f64,
+}
+
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct BuildRecord {
+    pub package: String,
+    pub version: String,
+    pub config: String,
+    pub machine: String,
+    // Unix seconds
+    pub timestamp: u64,
+    // Deployed from an artifact store rather than built
+    pub cached: bool,
+    // Wall time of extraction plus the native build, in seconds
+    pub total: f64,
+    pub stages: std::collections::BTreeMap<String, StageStats>,
+    #[serde(default)]
+    pub regression: bool,
+}
+
+impl BuildRecord {
+    fn key(&self) -> (&str, &str, &str, &str) {
+        (&self.package, &self.version, &self.config, &self.machine)
+    }
+}
+
+// As reported by cpp_last_build_stats
+#[derive(Debug, Default, Deserialize)]
+struct NativeBuildStats {
+    #[serde(default)]
+    stages: std::collections::BTreeMap<String, StageStats>,
+}
+
+// One compiler, linker or CMake error or warning of a native build, as
+// reported by cpp_last_build_diagnostics; repeats are counted, not listed
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct BuildDiagnostic {
+    // "error" or "warning"
+    pub severity: String,
+    // Empty for tool messages without a location
+    pub file: String,
+    pub line: u32,
+    pub column: u32,
+    pub message: String,
+    // -W flag or rule id, when known
+    #[serde(default)]
+    pub option: String,
+    pub count: u32,
+}
+
+impl std::fmt::Display for BuildDiagnostic {
+    fn fmt(&self, f: &mut std::fmt::Formatter) -> std::fmt::Result {
+        if !self.file.is_empty() {
+            write!(f, "{}:", self.file)?;
+            if self.line > 0 {
+                write!(f, "{}:", self.line)?;
+            }
+            if self.column > 0 {
+                write!(f, "{}:", self.column)?;
+            }
+            write!(f, " ")?;
+        }
+        write!(f, "{}: {}", self.severity, self.message)
+    }
+}
+
+#[derive(Debug, Clone)]
+pub struct Estimate {
+    pub seconds: f64,
+    pub samples: usize,
+    // How closely the history matched: "exact", "config", "package" or "other machines"
+    pub basis: &'static str,
+}
+
+// "<arch>-<cpus>c-<GiB>g": builds only predict each other on similar hosts
+pub fn machine_class() -> String {
+    let cpus = std::thread::available_parallelism().map_or(1, |n| n.get());
+    let memory_kb: u64 = std::fs::read_to_string("/proc/meminfo")
+        .ok()
+        .and_then(|info| {
+            info.lines()
+                .find_map(|line| line.strip_prefix("MemTotal:"))
+                .and_then(|value| value.trim().trim_end_matches("kB").trim().parse().ok())
+        })
+        .unwrap_or(0);
+    format!(
+        "{}-{}c-{}g",
+        std::env::consts::ARCH,
+        cpus,
+        (memory_kb as f64 / (1 << 20) as f64).round() as u64
+    )
+}
+
+#[derive(Debug, Default)]
+pub struct BuildHistory {
+    records: Vec<BuildRecord>,
+}
+
+impl BuildHistory {
+    fn path(cache_dir: &std::path::Path) -> std::path::PathBuf {
+        cache_dir.join("history").join("builds.jsonl")
+    }
+
+    // Unreadable lines, e.g. a torn final append, are skipped
+    pub fn load(cache_dir: &std::path::Path) -> Self {
+        let records = std::fs::read_to_string(Self::path(cache_dir))
+            .map(|text| text.lines().filter_map(|line| serde_json::from_str(line).ok()).collect())
+            .unwrap_or_default();
+        BuildHistory { records }
+    }
+
+    pub fn records(&self) -> &[BuildRecord] {
+        &self.records
+    }
+
+    // Bookkeeping only: a failed append never fails the build
+    pub fn append(cache_dir: &std::path::Path, record: &BuildRecord) {
+        use std::io::Write;
+        let path = Self::path(cache_dir);
+        let mut line = serde_json::to_vec(record).unwrap_or_default();
+        line.push(b'\n');
+        let appended = path
+            .parent()
+            .map_or(Ok(()), std::fs::create_dir_all)
+            .and_then(|_| std::fs::OpenOptions::new().create(true).append(true).open(&path))
+            .and_then(|mut log| {
+                log.write_all(&line)?;
+                log.metadata()
+            });
+        if let Ok(meta) = appended {
+            if meta.len() > HISTORY_COMPACT_BYTES {
+                let _ = Self::compact(cache_dir);
+            }
+        }
+    }
+
+    // Keeps the newest HISTORY_WINDOW records per key. Runs under a lock
+    // and swaps the file in by rename; an append racing the rename may be
+    // lost, which only costs one sample.
+    fn compact(cache_dir: &std::path::Path) -> std::io::Result<()> {
+        let lock = std::fs::OpenOptions::new()
+            .create(true)
+            .truncate(false)
+            .write(true)
+            .open(cache_dir.join("history").join("compact.lock"))?;
+        if lock.try_lock().is_err() {
+            return Ok(());
+        }
+        let history = Self::load(cache_dir);
+        let mut kept: HashMap<(&str, &str, &str, &str), usize> = HashMap::new();
+        let mut newest_first: Vec<&BuildRecord> = history
+            .records
+            .iter()
+            .rev()
+            .filter(|record| {
+                let count = kept.entry(record.key()).or_insert(0);
+                *count += 1;
+                *count <= HISTORY_WINDOW
+            })
+            .collect();
+        newest_first.reverse();
+        let mut text = String::new();
+        for record in newest_first {
+            text.push_str(&serde_json::to_string(record).unwrap_or_default());
+            text.push('\n');
+        }
+        let path = Self::path(cache_dir);
+        let tmp = tmp_path(&path);
+        std::fs::write(&tmp, text)?;
+        std::fs::rename(&tmp, &path)
+    }
+
+    // Totals of the newest uncached builds matching `filter`, oldest first
+    fn samples(&self, filter: impl Fn(&BuildRecord) -> bool) -> Vec<f64> {
+        let mut samples: Vec<f64> = self
+            .records
+            .iter()
+            .rev()
+            .filter(|record| !record.cached && filter(record))
+            .take(HISTORY_WINDOW)
+            .map(|record| record.total)
+            .collect();
+        samples.reverse();
+        samples
+    }
+
+    // Median build time from the closest matching history: this exact
+    // version and config on this machine class, then any version with this
+    // config, then any config, then other machines
+    pub fn predict(&self, package: &str, version: &str, config: &str, machine: &str) -> Option<Estimate> {
+        let tiers: [(&'static str, Box<dyn Fn(&BuildRecord) -> bool>); 4] = [
+            ("exact", Box::new(|r: &BuildRecord| {
+                r.package == package && r.version == version && r.config == config && r.machine == machine
+            })),
+            ("config", Box::new(|r: &BuildRecord| r.package == package && r.config == config && r.machine == machine)),
+            ("package", Box::new(|r: &BuildRecord| r.package == package && r.machine == machine)),
+            ("other machines", Box::new(|r: &BuildRecord| r.package == package)),
+        ];
+        tiers.into_iter().find_map(|(basis, filter)| {
+            let samples = self.samples(filter);
+            median(&samples).map(|seconds| Estimate { seconds, samples: samples.len(), basis })
+        })
+    }
+
+    // Median download time of the package's archives on this machine class
+    pub fn predict_download(&self, package: &str, machine: &str) -> Option<f64> {
+        let samples: Vec<f64> = self
+            .records
+            .iter()
+            .rev()
+            .filter(|record| record.package == package && record.machine == machine)
+            .filter_map(|record| record.stages.get("download").map(|stage| stage.seconds))
+            .take(HISTORY_WINDOW)
+            .collect();
+        median(&samples)
+    }
+
+    // (median, samples) when `record` is a regression against earlier
+    // builds of the same package and config on the same machine class
+    pub fn regression(&self, record: &BuildRecord) -> Option<(f64, usize)> {
+        if record.cached {
+            return None;
+        }
+        let samples = self.samples(|r| {
+            r.package == record.package && r.config == record.config && r.machine == record.machine
+        });
+        let baseline = median(&samples).filter(|_| samples.len() >= HISTORY_MIN_SAMPLES)?;
+        (record.total > baseline * REGRESSION_FACTOR && record.total - baseline > REGRESSION_MIN_SECONDS)
+            .then_some((baseline, samples.len()))
+    }
+}
+
+fn median(samples: &[f64]) -> Option<f64> {
+    if samples.is_empty() {
+        return None;
+    }
+    let mut sorted = samples.to_vec();
+    sorted.sort_by(|a, b| a.total_cmp(b));
+    let mid = sorted.len() / 2;
+    Some(if sorted.len() % 2 == 0 { (sorted[mid - 1] + sorted[mid]) / 2.0 } else { sorted[mid] })
+}
+
+// Critical-path priority of each package: its own estimate plus the longest
+// chain of estimates among the packages that (transitively) depend on it.
+// Ready builds start in decreasing priority, so long chains start first.
+pub fn critical_path_priorities(
+    packages: &[Package],
+    estimates: &HashMap<String, f64>,
+) -> HashMap<String, f64> {
+    let names: std::collections::HashSet<&str> = packages.iter().map(|p| p.name.as_str()).collect();
+    let mut dependents: HashMap<&str, Vec<&str>> = HashMap::new();
+    for package in packages {
+        for dependency in &package.dependencies {
+            if names.contains(dependency.as_str()) {
+                dependents.entry(dependency.as_str()).or_default().push(&package.name);
+            }
+        }
+    }
+
+    fn visit<'a>(
+        name: &'a str,
+        dependents: &HashMap<&'a str, Vec<&'a str>>,
+        estimates: &HashMap<String, f64>,
+        priorities: &mut HashMap<String, f64>,
+        visiting: &mut std::collections::HashSet<&'a str>,
+    ) -> f64 {
+        if let Some(&priority) = priorities.get(name) {
+            return priority;
+        }
+        // A dependency cycle contributes nothing beyond the package itself
+        if !visiting.insert(name) {
+            return 0.0;
+        }
+        let downstream = dependents
+            .get(name)
+            .into_iter()
+            .flatten()
+            .map(|dependent| visit(dependent, dependents, estimates, priorities, visiting))
+            .fold(0.0, f64::max);
+        visiting.remove(name);
+        let priority = estimates.get(name).copied().unwrap_or(UNKNOWN_BUILD_SECONDS) + downstream;
+        priorities.insert(name.to_string(), priority);
+        priority
+    }
+
+    let mut priorities = HashMap::new();
+    let mut visiting = std::collections::HashSet::new();
+    for package in packages {
+        visit(&package.name, &dependents, estimates, &mut priorities, &mut visiting);
+    }
+    priorities
+}
+
+#[derive(Debug)]
+pub struct InstallPlan {
+    pub machine: String,
+    pub jobs: usize,
+    // Downloads run in parallel, so this is the slowest one
+    pub download_seconds: f64,
+    pub builds: Vec<(PlannedBuild, Option<Estimate>)>,
+}
+
+impl InstallPlan {
+    pub fn total_seconds(&self) -> f64 {
+        self.download_seconds + self.builds.iter().map(|(build, _)| build.finish).fold(0.0, f64::max)
+    }
+}
+
+pub fn format_seconds(seconds: f64) -> String {
+    match seconds {
+        s if s < 60.0 => format!("{:.1}s", s),
+        s if s < 3600.0 => format!("{}m{:02}s", (s / 60.0) as u64, (s % 60.0) as u64),
+        s => format!("{}h{:02}m", (s / 3600.0) as u64, ((s % 3600.0) / 60.0) as u64),
+    }
+}
+
+#[derive(Debug, Clone)]
+pub struct PlannedBuild {
+    pub package: String,
+    pub start: f64,
+    pub finish: f64,
+}
+
+// Simulates the install scheduler: up to `jobs` builds at once, each
+// starting once its dependencies finished, ready ones by priority.
+// Returns builds in start order; packages in a dependency cycle are left out.
+pub fn simulate_schedule(
+    packages: &[Package],
+    estimates: &HashMap<String, f64>,
+    jobs: usize,
+) -> Vec<PlannedBuild> {
+    let priorities = critical_path_priorities(packages, estimates);
+    let names: std::collections::HashSet<&str> = packages.iter().map(|p| p.name.as_str()).collect();
+    let mut finished: HashMap<&str, f64> = HashMap::new();
+    let mut running: Vec<(&str, f64)> = Vec::new();
+    let mut planned = Vec::new();
+    let mut now = 0.0;
+    loop {
+        let mut ready: Vec<&Package> = packages
+            .iter()
+            .filter(|p| !finished.contains_key(p.name.as_str()) && !running.iter().any(|(n, _)| *n == p.name))
+            .filter(|p| {
+                p.dependencies
+                    .iter()
+                    .all(|d| !names.contains(d.as_str()) || finished.contains_key(d.as_str()))
+            })
+            .collect();
+        ready.sort_by(|a, b| priorities[&b.name].total_cmp(&priorities[&a.name]));
+        for package in ready.into_iter().take(jobs.max(1).saturating_sub(running.len())) {
+            let finish = now + estimates.get(&package.name).copied().unwrap_or(UNKNOWN_BUILD_SECONDS);
+            running.push((&package.name, finish));
+            planned.push(PlannedBuild { package: package.name.clone(), start: now, finish });
+        }
+        let Some(index) = (0..running.len()).min_by(|&a, &b| running[a].1.total_cmp(&running[b].1)) else {
+            break;
+        };
+        let (name, finish) = running.swap_remove(index);
+        now = finish;
+        finished.insert(name, finish);
+    }
+    planned
+}
+
+// Chrome trace / Perfetto timeline of one cpkg run, enabled by naming the
+// output file in CPKG_TRACE and written when main returns. Rust spans are
+// async events, since one task's awaits hop threads and concurrent tasks
+// share them; native spans (CMakeBuilder stages, CompilerDetector probes)
+// are complete events on the thread that ran them, drained from the native
+// layer at write time. Both sides stamp CLOCK_MONOTONIC microseconds. With
+// tracing off a span costs one atomic load.
+static TRACE: std::sync::OnceLock<Trace> = std::sync::OnceLock::new();
+const UNTRACED_COMMANDS: [&str; 2] = ["cc-launcher", "cache-upload"];
+
+pub struct Trace {
+    path: std::path::PathBuf,
+    events: std::sync::Mutex<Vec<serde_json::Value>>,
+    next_id: std::sync::atomic::AtomicU64,
+}
+
+// Writes the trace when dropped
+pub struct TraceGuard;
+
+impl Trace {
+    // Processes a traced run starts inherit CPKG_TRACE; they must not
+    // overwrite its file. Compiler launchers and uploaders, started by the
+    // build, never trace; the run removes the variable from every other
+    // cpkg it spawns.
+    pub fn from_env(command: &str) -> Option<TraceGuard> {
+        if UNTRACED_COMMANDS.contains(&command) {
+            return None;
+        }
+        let path = std::env::var_os("CPKG_TRACE").filter(|path| !path.is_empty())?;
+        let trace = Trace {
+            path: expand_home(std::path::Path::new(&path)),
+            events: std::sync::Mutex::new(vec![serde_json::json!({
+                "name": "process_name",
+                "ph": "M",
+                "pid": std::process::id(),
+                "args": { "name": format!("cpkg {}", command) },
+            })]),
+            next_id: std::sync::atomic::AtomicU64::new(1),
+        };
+        TRACE.set(trace).ok()?;
+        unsafe { cpp_trace_enable(1) };
+        Some(TraceGuard)
+    }
+
+    // Span lasting until the returned value drops; `detail` (usually the
+    // package) is shown in the span's arguments
+    pub fn span(name: &'static str, detail: &str) -> TraceSpan {
+        TraceSpan {
+            active: TRACE.get().map(|_| (monotonic_us(), detail.to_string())),
+            name,
+        }
+    }
+
+    fn write(&self) -> std::io::Result<()> {
+        let mut events = std::mem::take(&mut *self.events.lock().unwrap());
+        let native = unsafe { std::ffi::CStr::from_ptr(cpp_trace_drain()) };
+        if let Ok(serde_json::Value::Array(native)) = serde_json::from_slice(native.to_bytes()) {
+            events.extend(native);
+        }
+        if let Some(parent) = self.path.parent().filter(|p| !p.as_os_str().is_empty()) {
+            std::fs::create_dir_all(parent)?;
+        }
+        let trace = serde_json::json!({ "traceEvents": events, "displayTimeUnit": "ms" });
+        let tmp = tmp_path(&self.path);
+        std::fs::write(&tmp, serde_json::to_vec(&trace).map_err(std::io::Error::other)?)?;
+        std::fs::rename(tmp, &self.path)
+    }
+}
+
+impl Drop for TraceGuard {
+    fn drop(&mut self) {
+        if let Some(trace) = TRACE.get() {
+            match trace.write() {
+                Ok(()) => eprintln!("Trace written to {}", trace.path.display()),
+                Err(e) => eprintln!("warning: could not write trace {}: {}", trace.path.display(), e),
+            }
+        }
+    }
+}
+
+pub struct TraceSpan {
+    active: Option<(u64, String)>,
+    name: &'static str,
+}
+
+impl Drop for TraceSpan {
+    fn drop(&mut self) {
+        if let Some((start, detail)) = self.active.take() {
+            Trace::record("cpkg", self.name, start, serde_json::json!({ "detail": detail }));
+        }
+    }
+}
+
+impl Trace {
+    // Async begin/end pair from `start` until now; args go on the begin event
+    fn record(category: &str, name: &str, start: u64, args: serde_json::Value) {
+        let Some(trace) = TRACE.get() else {
+            return;
+        };
+        let id = trace.next_id.fetch_add(1, std::sync::atomic::Ordering::Relaxed);
+        let pid = std::process::id();
+        let event = |phase: &str, ts: u64| {
+            serde_json::json!({
+                "name": name,
+                "cat": category,
+                "ph": phase,
+                "id": id,
+                "ts": ts,
+                "pid": pid,
+                "tid": pid,
+            })
+        };
+        let mut begin = event("b", start);
+        begin["args"] = args;
+        let end = event("e", monotonic_us());
+        trace.events.lock().unwrap().extend([begin, end]);
+    }
+}
+
+// Always-on counters and histograms for daemons and CI. Each metric is split
+// into cache-line-padded shards and a thread only ever adds to the shard it
+// was assigned, so hot paths pay an uncontended relaxed add. Reads sum the
+// shards. Rendered in the Prometheus text format by GET /metrics on the
+// cpkg servers, and for node exporter's textfile collector into
+// CPKG_METRICS_TEXTFILE when a run ends.
+const METRIC_SHARDS: usize = 16;
+const LATENCY_BUCKETS: [f64; 12] = [0.001, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25, 0.5, 1.0, 2.5, 10.0, 60.0];
+const METRIC_CACHES: [&str; 4] = ["downloads", "chunks", "artifacts", "remote"];
+const BUILD_OUTCOMES: [&str; 3] = ["built", "cached", "failed"];
+// cache-server, chunk-server, debuginfod and the registry stand-in
+const METRIC_SERVERS: [&str; 4] = ["cache", "files", "debuginfod", "registry"];
+// Compiler launchers are processes of their own, started by the build for
+// every translation unit; they append their lookups here, under the cache
+// dir, and the installer folds them into its counters after each build
+const LAUNCHER_METRICS_LOG: &str = "metrics/cc-launcher.log";
+
+pub static METRICS: Metrics = Metrics::new();
+
+fn metric_shard() -> usize {
+    static NEXT: std::sync::atomic::AtomicUsize = std::sync::atomic::AtomicUsize::new(0);
+    thread_local! {
+        static SHARD: usize = NEXT.fetch_add(1, std::sync::atomic::Ordering::Relaxed) % METRIC_SHARDS;
+    }
+    SHARD.with(|shard| *shard)
+}
+
+#[repr(align(64))]
+struct CounterShard(std::sync::atomic::AtomicU64);
+
+pub struct Counter([CounterShard; METRIC_SHARDS]);
+
+impl Counter {
+    const fn new() -> Counter {
+        const ZERO: CounterShard = CounterShard(std::sync::atomic::AtomicU64::new(0));
+        Counter([ZERO; METRIC_SHARDS])
+    }
+
+    pub fn add(&self, n: u64) {
+        self.0[metric_shard()].0.fetch_add(n, std::sync::atomic::Ordering::Relaxed);
+    }
+
+    pub fn get(&self) -> u64 {
+        self.0.iter().map(|shard| shard.0.load(std::sync::atomic::Ordering::Relaxed)).sum()
+    }
+}
+
+// Per-bucket (not cumulative) counts, the last bucket being +Inf
+#[repr(align(64))]
+struct HistogramShard {
+    buckets: [std::sync::atomic::AtomicU64; LATENCY_BUCKETS.len() + 1],
+    sum_ns: std::sync::atomic::AtomicU64,
+}
+
+// Durations in seconds over LATENCY_BUCKETS
+pub struct Histogram([HistogramShard; METRIC_SHARDS]);
+
+impl Histogram {
+    const fn new() -> Histogram {
+        const ZERO: std::sync::atomic::AtomicU64 = std::sync::atomic::AtomicU64::new(0);
+        const SHARD: HistogramShard = HistogramShard {
+            buckets: [ZERO; LATENCY_BUCKETS.len() + 1],
+            sum_ns: ZERO,
+        };
+        Histogram([SHARD; METRIC_SHARDS])
+    }
+
+    pub fn observe(&self, duration: std::time::Duration) {
+        use std::sync::atomic::Ordering;
+        let seconds = duration.as_secs_f64();
+        let bucket = LATENCY_BUCKETS.iter().position(|bound| seconds <= *bound).unwrap_or(LATENCY_BUCKETS.len());
+        let shard = &self.0[metric_shard()];
+        shard.buckets[bucket].fetch_add(1, Ordering::Relaxed);
+        shard.sum_ns.fetch_add(duration.as_nanos() as u64, Ordering::Relaxed);
+    }
+
+    fn render(&self, out: &mut String, name: &str, labels: &str) {
+        use std::fmt::Write;
+        use std::sync::atomic::Ordering;
+        let mut cumulative = 0;
+        for (bucket, bound) in LATENCY_BUCKETS.iter().map(|b| b.to_string()).chain(["+Inf".to_string()]).enumerate() {
+            cumulative += self.0.iter().map(|shard| shard.buckets[bucket].load(Ordering::Relaxed)).sum::<u64>();
+            let _ = writeln!(out, "{}_bucket{{{}le=\"{}\"}} {}", name, labels, bound, cumulative);
+        }
+        let sum_ns: u64 = self.0.iter().map(|shard| shard.sum_ns.load(Ordering::Relaxed)).sum();
+        let labels = labels.trim_end_matches(',');
+        let labels = if labels.is_empty() { String::new() } else { format!("{{{}}}", labels) };
+        let _ = writeln!(out, "{}_sum{} {}", name, labels, sum_ns as f64 / 1e9);
+        let _ = writeln!(out, "{}_count{} {}", name, labels, cumulative);
+    }
+}
+
+pub struct Metrics {
+    registry_requests: [Counter; 2],
+    registry_latency: Histogram,
+    cache_hits: [Counter; METRIC_CACHES.len()],
+    cache_misses: [Counter; METRIC_CACHES.len()],
+    pub downloaded_bytes: Counter,
+    pub extracted_bytes: Counter,
+    builds: [Counter; BUILD_OUTCOMES.len()],
+    pub worker_queue_wait: Histogram,
+    served_hits: [Counter; METRIC_SERVERS.len()],
+    served_misses: [Counter; METRIC_SERVERS.len()],
+    served_bytes: [Counter; METRIC_SERVERS.len()],
+}
+
+// Native counters, from cpp_native_metrics
+#[derive(Debug, Default, Deserialize)]
+struct NativeMetrics {
+    #[serde(default)]
+    probe_cache_hits: u64,
+    #[serde(default)]
+    probe_cache_misses: u64,
+}
+
+impl Metrics {
+    const fn new() -> Metrics {
+        const COUNTER: Counter = Counter::new();
+        Metrics {
+            registry_requests: [COUNTER; 2],
+            registry_latency: Histogram::new(),
+            cache_hits: [COUNTER; METRIC_CACHES.len()],
+            cache_misses: [COUNTER; METRIC_CACHES.len()],
+            downloaded_bytes: Counter::new(),
+            extracted_bytes: Counter::new(),
+            builds: [COUNTER; BUILD_OUTCOMES.len()],
+            worker_queue_wait: Histogram::new(),
+            served_hits: [COUNTER; METRIC_SERVERS.len()],
+            served_misses: [COUNTER; METRIC_SERVERS.len()],
+            served_bytes: [COUNTER; METRIC_SERVERS.len()],
+        }
+    }
+
+    pub fn registry_request(&self, ok: bool, latency: std::time::Duration) {
+        self.registry_requests[!ok as usize].add(1);
+        self.registry_latency.observe(latency);
+    }
+
+    // `cache` is one of METRIC_CACHES
+    pub fn cache_lookup(&self, cache: &str, hits: u64, misses: u64) {
+        if let Some(i) = METRIC_CACHES.iter().position(|c| *c == cache) {
+            self.cache_hits[i].add(hits);
+            self.cache_misses[i].add(misses);
+        }
+    }
+
+    // `outcome` is one of BUILD_OUTCOMES
+    pub fn build(&self, outcome: &str) {
+        if let Some(i) = BUILD_OUTCOMES.iter().position(|o| *o == outcome) {
+            self.builds[i].add(1);
+        }
+    }
+
+    // A GET answered by `server`, one of METRIC_SERVERS; `bytes` of body
+    pub fn served(&self, server: &str, hit: bool, bytes: u64) {
+        if let Some(i) = METRIC_SERVERS.iter().position(|s| *s == server) {
+            if hit {
+                self.served_hits[i].add(1);
+            } else {
+                self.served_misses[i].add(1);
+            }
+            self.served_bytes[i].add(bytes);
+        }
+    }
+
+    // Appends this launcher's cache lookups to LAUNCHER_METRICS_LOG, one
+    // "<cache>\t<hits>\t<misses>" line per cache it used. Bookkeeping only.
+    pub fn append_launcher_log(&self, cache_dir: &std::path::Path) {
+        use std::io::Write;
+        let mut lines = String::new();
+        for (i, cache) in METRIC_CACHES.iter().enumerate() {
+            let (hits, misses) = (self.cache_hits[i].get(), self.cache_misses[i].get());
+            if hits + misses > 0 {
+                lines.push_str(&format!("{}\t{}\t{}\n", cache, hits, misses));
+            }
+        }
+        if lines.is_empty() {
+            return;
+        }
+        let log = cache_dir.join(LAUNCHER_METRICS_LOG);
+        // One write of a few lines to an O_APPEND file does not interleave
+        let _ = log
+            .parent()
+            .map_or(Ok(()), std::fs::create_dir_all)
+            .and_then(|_| std::fs::OpenOptions::new().create(true).append(true).open(&log))
+            .and_then(|mut file| file.write_all(lines.as_bytes()));
+    }
+
+    // Adds what launchers logged since the last fold. The log is renamed
+    // aside first, so lines appended meanwhile wait for the next fold.
+    pub fn fold_launcher_log(&self, cache_dir: &std::path::Path) {
+        let log = cache_dir.join(LAUNCHER_METRICS_LOG);
+        let folding = tmp_path(&log);
+        if std::fs::rename(&log, &folding).is_err() {
+            return;
+        }
+        let text = std::fs::read_to_string(&folding).unwrap_or_default();
+        let _ = std::fs::remove_file(&folding);
+        for line in text.lines() {
+            let mut fields = line.split('\t');
+            let (Some(cache), Some(hits), Some(misses)) = (fields.next(), fields.next(), fields.next()) else {
+                continue;
+            };
+            if let (Ok(hits), Ok(misses)) = (hits.parse(), misses.parse()) {
+                self.cache_lookup(cache, hits, misses);
+            }
+        }
+    }
+
+    pub fn render(&self) -> String {
+        use std::fmt::Write;
+        let mut out = String::new();
+        let family = |out: &mut String, name: &str, kind: &str, help: &str| {
+            let _ = writeln!(out, "# HELP {} {}\n# TYPE {} {}", name, help, name, kind);
+        };
+
+        family(&mut out, "cpkg_registry_requests_total", "counter", "Registry metadata requests.");
+        for (outcome, counter) in ["ok", "error"].iter().zip(&self.registry_requests) {
+            let _ = writeln!(out, "cpkg_registry_requests_total{{outcome=\"{}\"}} {}", outcome, counter.get());
+        }
+        family(&mut out, "cpkg_registry_request_seconds", "histogram", "Registry metadata request latency.");
+        self.registry_latency.render(&mut out, "cpkg_registry_request_seconds", "");
+
+        family(&mut out, "cpkg_cache_hits_total", "counter", "Cache lookups served locally.");
+        for (cache, counter) in METRIC_CACHES.iter().zip(&self.cache_hits) {
+            let _ = writeln!(out, "cpkg_cache_hits_total{{cache=\"{}\"}} {}", cache, counter.get());
+        }
+        family(&mut out, "cpkg_cache_misses_total", "counter", "Cache lookups that had to fetch or build.");
+        for (cache, counter) in METRIC_CACHES.iter().zip(&self.cache_misses) {
+            let _ = writeln!(out, "cpkg_cache_misses_total{{cache=\"{}\"}} {}", cache, counter.get());
+        }
+
+        family(&mut out, "cpkg_downloaded_bytes_total", "counter", "Bytes received for archives, chunks and deltas.");
+        let _ = writeln!(out, "cpkg_downloaded_bytes_total {}", self.downloaded_bytes.get());
+        family(&mut out, "cpkg_extracted_bytes_total", "counter", "Archive bytes unpacked into source trees.");
+        let _ = writeln!(out, "cpkg_extracted_bytes_total {}", self.extracted_bytes.get());
+
+        family(&mut out, "cpkg_builds_total", "counter", "Package builds by outcome.");
+        for (outcome, counter) in BUILD_OUTCOMES.iter().zip(&self.builds) {
+            let _ = writeln!(out, "cpkg_builds_total{{outcome=\"{}\"}} {}", outcome, counter.get());
+        }
+
+        family(&mut out, "cpkg_worker_queue_seconds", "histogram", "Time compile jobs waited for a worker slot.");
+        self.worker_queue_wait.render(&mut out, "cpkg_worker_queue_seconds", "");
+
+        family(&mut out, "cpkg_served_requests_total", "counter", "GET requests answered by cpkg servers.");
+        for (i, server) in METRIC_SERVERS.iter().enumerate() {
+            for (outcome, counter) in [("hit", &self.served_hits[i]), ("miss", &self.served_misses[i])] {
+                let _ = writeln!(
+                    out,
+                    "cpkg_served_requests_total{{server=\"{}\",outcome=\"{}\"}} {}",
+                    server,
+                    outcome,
+                    counter.get()
+                );
+            }
+        }
+        family(&mut out, "cpkg_served_bytes_total", "counter", "Response body bytes sent by cpkg servers.");
+        for (server, counter) in METRIC_SERVERS.iter().zip(&self.served_bytes) {
+            let _ = writeln!(out, "cpkg_served_bytes_total{{server=\"{}\"}} {}", server, counter.get());
+        }
+
+        let native = unsafe { std::ffi::CStr::from_ptr(cpp_native_metrics()) };
+        let native: NativeMetrics = serde_json::from_slice(native.to_bytes()).unwrap_or_default();
+        family(&mut out, "cpkg_probe_cache_lookups_total", "counter", "CompilerDetector flag probe cache lookups.");
+        let _ = writeln!(out, "cpkg_probe_cache_lookups_total{{outcome=\"hit\"}} {}", native.probe_cache_hits);
+        let _ = writeln!(out, "cpkg_probe_cache_lookups_total{{outcome=\"miss\"}} {}", native.probe_cache_misses);
+        out
+    }
+
+    // Textfile collector output; written with a rename so the collector
+    // never reads a partial file
+    pub fn write_textfile(&self, path: &std::path::Path) -> std::io::Result<()> {
+        let tmp = tmp_path(path);
+        std::fs::write(&tmp, self.render())?;
+        std::fs::rename(tmp, path)
+    }
+}
+
+// Writes CPKG_METRICS_TEXTFILE when dropped
+pub struct MetricsGuard(std::path::PathBuf);
+
+impl MetricsGuard {
+    pub fn from_env() -> Option<MetricsGuard> {
+        let path = std::env::var_os("CPKG_METRICS_TEXTFILE").filter(|path| !path.is_empty())?;
+        Some(MetricsGuard(expand_home(std::path::Path::new(&path))))
+    }
+}
+
+impl Drop for MetricsGuard {
+    fn drop(&mut self) {
+        if let Err(e) = METRICS.write_textfile(&self.0) {
+            eprintln!("warning: could not write metrics {}: {}", self.0.display(), e);
+        }
+    }
+}
+
+// Answers GET /metrics; for servers whose own protocol is not HTTP
+pub async fn serve_metrics(bind: String, port: u16) -> Result<(), PackageError> {
+    let listener = tokio::net::TcpListener::bind((bind.as_str(), port)).await?;
+    println!("Serving metrics on http://{}:{}/metrics", bind, port);
+    loop {
+        let (stream, _) = listener.accept().await?;
+        tokio::spawn(async move {
+            if let Err(e) = handle_file_request(stream, "metrics", |_| None).await {
+                eprintln!("metrics request failed: {}", e);
+            }
+        });
+    }
+}
+
+// The Prometheus text response, if `target` is the metrics endpoint
+fn metrics_response(method: &str, target: &str) -> Option<String> {
+    if method != "GET" || target.split('?').next() != Some("/metrics") {
+        return None;
+    }
+    let body = METRICS.render();
+    Some(format!(
+        "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: {}\r\nConnection: close\r\n\r\n{}",
+        body.len(),
+        body
+    ))
+}
+
+// Opt-in self-profiling (CPKG_PROFILE=1) of cpkg's own hot paths: resolving,
+// hashing, extraction and the native build entry, which runs compiler
+// detection. Hardware counters come from perf_event_open on each thread
+// that runs a profiled phase, user space only, so neither the perf binary
+// nor root is needed. When perf_event_paranoid forbids them (or there is no
+// PMU, as in many VMs) only CPU time and context switches are reported; those
+// always come from getrusage(RUSAGE_THREAD). Counters are per thread, so
+// async phases are measured poll by poll on whichever thread polls them.
+// Work a phase hands to other threads (rayon hashing) or to child processes
+// (tar, compilers) is not counted. Phase totals are printed when the run
+// ends and each phase is a "perf" span in the CPKG_TRACE output.
+static SELF_PROFILE: std::sync::OnceLock<SelfProfile> = std::sync::OnceLock::new();
+
+const PERF_TYPE_HARDWARE: u32 = 0;
+const PERF_FORMAT_GROUP: u64 = 1 << 3;
+const PERF_ATTR_EXCLUDE_KERNEL: u64 = 1 << 5;
+const PERF_ATTR_EXCLUDE_HV: u64 = 1 << 6;
+const PERF_FLAG_FD_CLOEXEC: libc::c_ulong = 1 << 3;
+// PERF_COUNT_HW_CPU_CYCLES, _INSTRUCTIONS and _CACHE_MISSES
+const PERF_HW_EVENTS: [u64; 3] = [0, 1, 3];
+
+// struct perf_event_attr up to PERF_ATTR_SIZE_VER5; the bitfield word is
+// `flags`. libc does not define it.
+#[repr(C)]
+#[derive(Default)]
+struct PerfEventAttr {
+    kind: u32,
+    size: u32,
+    config: u64,
+    sample_period: u64,
+    sample_type: u64,
+    read_format: u64,
+    flags: u64,
+    wakeup_events: u32,
+    bp_type: u32,
+    config1: u64,
+    config2: u64,
+    branch_sample_type: u64,
+    sample_regs_user: u64,
+    sample_stack_user: u32,
+    clockid: i32,
+    sample_regs_intr: u64,
+    aux_watermark: u32,
+    sample_max_stack: u16,
+    reserved: u16,
+}
+
+// The calling thread's hardware counters, read together as one group
+struct PerfGroup {
+    fds: Vec<i32>,
+    // Index into PERF_HW_EVENTS of each fd's event
+    events: Vec<usize>,
+}
+
+thread_local! {
+    static PERF_GROUP: Option<PerfGroup> = PerfGroup::open().ok();
+}
+
+impl PerfGroup {
+    fn open() -> std::io::Result<PerfGroup> {
+        let mut group = PerfGroup { fds: Vec::new(), events: Vec::new() };
+        let mut error = None;
+        for (index, config) in PERF_HW_EVENTS.iter().enumerate() {
+            let attr = PerfEventAttr {
+                kind: PERF_TYPE_HARDWARE,
+                size: std::mem::size_of::<PerfEventAttr>() as u32,
+                config: *config,
+                read_format: PERF_FORMAT_GROUP,
+                flags: PERF_ATTR_EXCLUDE_KERNEL | PERF_ATTR_EXCLUDE_HV,
+                ..Default::default()
+            };
+            let leader = group.fds.first().copied().unwrap_or(-1);
+            // pid 0, cpu -1: this thread, on any CPU. Events the CPU lacks
+            // are left out of the group.
+            let fd = unsafe {
+                libc::syscall(libc::SYS_perf_event_open, &attr, 0, -1, leader, PERF_FLAG_FD_CLOEXEC)
+            };
+            if fd >= 0 {
+                group.fds.push(fd as i32);
+                group.events.push(index);
+            } else {
+                error.get_or_insert_with(std::io::Error::last_os_error);
+            }
+        }
+        match error {
+            Some(error) if group.fds.is_empty() => Err(error),
+            _ => Ok(group),
+        }
+    }
+
+    fn read(&self) -> [Option<u64>; 3] {
+        let mut buffer = [0u64; 1 + PERF_HW_EVENTS.len()];
+        let mut values = [None; 3];
+        let size = std::mem::size_of_val(&buffer);
+        let n = unsafe { libc::read(self.fds[0], buffer.as_mut_ptr().cast(), size) };
+        if n >= 8 * (1 + self.fds.len() as isize) {
+            for (slot, event) in self.events.iter().enumerate() {
+                values[*event] = Some(buffer[1 + slot]);
+            }
+        }
+        values
+    }
+}
+
+impl Drop for PerfGroup {
+    fn drop(&mut self) {
+        for fd in &self.fds {
+            unsafe { libc::close(*fd) };
+        }
+    }
+}
+
+#[derive(Debug, Default, Clone, Copy, Serialize)]
+pub struct PerfCounters {
+    pub cpu_ns: u64,
+    pub context_switches: u64,
+    pub cycles: Option<u64>,
+    pub instructions: Option<u64>,
+    pub cache_misses: Option<u64>,
+}
+
+impl PerfCounters {
+    // Running totals of the calling thread
+    fn now() -> PerfCounters {
+        let mut usage: libc::rusage = unsafe { std::mem::zeroed() };
+        unsafe { libc::getrusage(libc::RUSAGE_THREAD, &mut usage) };
+        let micros = |tv: libc::timeval| tv.tv_sec as u64 * 1_000_000 + tv.tv_usec as u64;
+        let [cycles, instructions, cache_misses] =
+            PERF_GROUP.with(|group| group.as_ref().map_or([None; 3], PerfGroup::read));
+        PerfCounters {
+            cpu_ns: (micros(usage.ru_utime) + micros(usage.ru_stime)) * 1_000,
+            context_switches: (usage.ru_nvcsw + usage.ru_nivcsw) as u64,
+            cycles,
+            instructions,
+            cache_misses,
+        }
+    }
+
+    fn since(&self, start: &PerfCounters) -> PerfCounters {
+        let delta = |end: Option<u64>, start: Option<u64>| Some(end?.saturating_sub(start?));
+        PerfCounters {
+            cpu_ns: self.cpu_ns.saturating_sub(start.cpu_ns),
+            context_switches: self.context_switches.saturating_sub(start.context_switches),
+            cycles: delta(self.cycles, start.cycles),
+            instructions: delta(self.instructions, start.instructions),
+            cache_misses: delta(self.cache_misses, start.cache_misses),
+        }
+    }
+
+    // A counter stays known only while every part of the sum had it
+    fn add(&mut self, other: &PerfCounters) {
+        let sum = |a: Option<u64>, b: Option<u64>| Some(a? + b?);
+        *self = PerfCounters {
+            cpu_ns: self.cpu_ns + other.cpu_ns,
+            context_switches: self.context_switches + other.context_switches,
+            cycles: sum(self.cycles, other.cycles),
+            instructions: sum(self.instructions, other.instructions),
+            cache_misses: sum(self.cache_misses, other.cache_misses),
+        };
+    }
+}
+
+#[derive(Debug, Default, Clone, Copy, Serialize)]
+pub struct PhaseProfile {
+    pub calls: u64,
+    pub wall_ns: u64,
+    pub counters: PerfCounters,
+}
+
+pub struct SelfProfile {
+    phases: std::sync::Mutex<std::collections::BTreeMap<&'static str, PhaseProfile>>,
+}
+
+// Prints the phase totals when dropped
+pub struct ProfileGuard;
+
+impl SelfProfile {
+    pub fn from_env() -> Option<ProfileGuard> {
+        let enabled = std::env::var("CPKG_PROFILE").map_or(false, |v| !v.is_empty() && v != "0");
+        enabled.then(SelfProfile::enable)
+    }
+
+    // Starts profiling this process, e.g. from a benchmark harness
+    pub fn enable() -> ProfileGuard {
+        SELF_PROFILE.get_or_init(|| SelfProfile { phases: Default::default() });
+        if let Err(e) = PerfGroup::open() {
+            let reason = match e.raw_os_error() {
+                Some(libc::EACCES) | Some(libc::EPERM) => {
+                    let paranoid = std::fs::read_to_string("/proc/sys/kernel/perf_event_paranoid").unwrap_or_default();
+                    format!("perf_event_paranoid is {}", paranoid.trim())
+                }
+                _ => e.to_string(),
+            };
+            eprintln!(
+                "warning: hardware counters unavailable ({}); profiling CPU time and context switches only",
+                reason
+            );
+        }
+        ProfileGuard
+    }
+
+    pub fn totals() -> std::collections::BTreeMap<&'static str, PhaseProfile> {
+        SELF_PROFILE.get().map(|profile| profile.phases.lock().unwrap().clone()).unwrap_or_default()
+    }
+
+    // Runs synchronous work as one call of `phase`
+    pub fn measure<T>(phase: &'static str, detail: &str, work: impl FnOnce() -> T) -> T {
+        let Some(profile) = SELF_PROFILE.get() else {
+            return work();
+        };
+        let (start_us, before) = (monotonic_us(), PerfCounters::now());
+        let output = work();
+        profile.record(phase, detail, start_us, PerfCounters::now().since(&before));
+        output
+    }
+
+    // Awaits `future` as one call of `phase`, counting each poll on the
+    // thread that ran it
+    pub async fn phase<F: std::future::Future>(phase: &'static str, detail: &str, future: F) -> F::Output {
+        let Some(profile) = SELF_PROFILE.get() else {
+            return future.await;
+        };
+        let mut future = std::pin::pin!(future);
+        let (start_us, mut counters) = (monotonic_us(), PerfCounters::default());
+        let mut first = true;
+        let output = std::future::poll_fn(|cx| {
+            let before = PerfCounters::now();
+            let poll = future.as_mut().poll(cx);
+            let delta = PerfCounters::now().since(&before);
+            if first {
+                (counters, first) = (delta, false);
+            } else {
+                counters.add(&delta);
+            }
+            poll
+        })
+        .await;
+        profile.record(phase, detail, start_us, counters);
+        output
+    }
+
+    fn record(&self, phase: &'static str, detail: &str, start_us: u64, counters: PerfCounters) {
+        let wall_ns = monotonic_us().saturating_sub(start_us) * 1_000;
+        let mut phases = self.phases.lock().unwrap();
+        let total = phases.entry(phase).or_insert_with(|| PhaseProfile { counters, ..Default::default() });
+        if total.calls > 0 {
+            total.counters.add(&counters);
+        }
+        total.calls += 1;
+        total.wall_ns += wall_ns;
+        drop(phases);
+
+        let mut args = serde_json::to_value(counters).unwrap_or_default();
+        args["detail"] = detail.into();
+        Trace::record("perf", phase, start_us, args);
+    }
+}
+
+impl Drop for ProfileGuard {
+    fn drop(&mut self) {
+        let totals = SelfProfile::totals();
+        if totals.is_empty() {
+            return;
+        }
+        let count = |value: Option<u64>| value.map_or("-".to_string(), |v| v.to_string());
+        eprintln!(
+            "{:<10} {:>6} {:>10} {:>10} {:>14} {:>14} {:>6} {:>12} {:>8}",
+            "phase", "calls", "wall ms", "cpu ms", "cycles", "instructions", "ipc", "cache-misses", "ctx-sw"
+        );
+        for (phase, total) in totals {
+            let counters = &total.counters;
+            let ipc = match (counters.instructions, counters.cycles) {
+                (Some(instructions), Some(cycles)) if cycles > 0 => format!("{:.2}", instructions as f64 / cycles as f64),
+                _ => "-".to_string(),
+            };
+            eprintln!(
+                "{:<10} {:>6} {:>10} {:>10} {:>14} {:>14} {:>6} {:>12} {:>8}",
+                phase,
+                total.calls,
+                format!("{:.1}", total.wall_ns as f64 / 1e6),
+                format!("{:.1}", counters.cpu_ns as f64 / 1e6),
+                count(counters.cycles),
+                count(counters.instructions),
+                ipc,
+                count(counters.cache_misses),
+                counters.context_switches
+            );
+        }
+    }
+}
+
+// CLOCK_MONOTONIC, the clock of the native layer's std::chrono::steady_clock
+fn monotonic_us() -> u64 {
+    let mut ts = libc::timespec { tv_sec: 0, tv_nsec: 0 };
+    unsafe { libc::clock_gettime(libc::CLOCK_MONOTONIC, &mut ts) };
+    ts.tv_sec as u64 * 1_000_000 + ts.tv_nsec as u64 / 1_000
+}
 
 // Foreign function interface to C++
 extern "C" {
     fn cpp_build_cmake(package_name: *const i8, name_len: usize) -> i32;
+    fn cpp_build_cmake_with_config(
+        package_name: *const i8,
+        name_len: usize,
+        config_json: *const i8,
+    ) -> i32;
     fn cpp_detect_compiler() -> *const i8;
     fn cpp_get_abi_info() -> *const i8;
+    fn cpp_startup_report(executable: *const i8) -> *const i8;
+    fn cpp_bundle_static(request_json: *const i8) -> i32;
+    fn cpp_build_cmake_variants(
+        package_name: *const i8,
+        name_len: usize,
+        config_json: *const i8,
+        variants_json: *const i8,
+    ) -> i32;
+    fn cpp_artifact_key(config_json: *const i8) -> *const i8;
+    fn cpp_last_build_stats(package_name: *const i8, name_len: usize) -> *const i8;
+    fn cpp_last_build_diagnostics(package_name: *const i8, name_len: usize) -> *const i8;
+    fn cpp_trace_enable(enabled: i32);
+    fn cpp_trace_drain() -> *const i8;
+    fn cpp_native_metrics() -> *const i8;
+}
+
+// Public API for CLI
+pub async fn install_package(package_name: &str) -> Result<(), PackageError> {
+    install_package_with_options(package_name, BuildOptions::default()).await
+}
+
+pub async fn install_package_with_options(
+    package_name: &str,
+    build_options: BuildOptions,
+) -> Result<(), PackageError> {
+    let mut pm = PackageManager::new(
+        default_cache_dir(),
+        default_registry_url(),
+    )
+    .with_build_options(build_options);
+    
+    pm.install(package_name).await
+}
+
+// Remote build cache speaking bazel-remote's HTTP protocol, so a
+// self-hosted bazel-remote (run with --disable_http_ac_validation, as
+// action entries are JSON rather than protobuf) or `cpkg cache-server`
+// can be shared by a cluster. Blobs live at <base>/cas/<sha256 of content>
+// and action entries at <base>/ac/<sha256 of action key>; GET fetches,
+// HEAD probes and PUT stores. Two kinds of actions are cached: whole
+// package artifacts, keyed by the artifact store fingerprint, and single
+// compiles run through `cpkg cc-launcher`.
+pub const REMOTE_CACHE_ENV: &str = "CPKG_REMOTE_CACHE";
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum RemoteKind {
+    Cas,
+    Ac,
+}
+
+impl RemoteKind {
+    fn name(self) -> &'static str {
+        match self {
+            RemoteKind::Cas => "cas",
+            RemoteKind::Ac => "ac",
+        }
+    }
+}
+
+// One output file of an action, restored to `path` from the CAS
+#[derive(Debug, Clone, Serialize, Deserialize)]
+pub struct ActionOutput {
+    pub path: String,
+    pub digest: String,
+    pub size: u64,
+}
+
+#[derive(Debug, Clone, Default, Serialize, Deserialize)]
+pub struct ActionEntry {
+    pub outputs: Vec<ActionOutput>,
+    #[serde(default)]
+    pub stdout: String,
+    #[serde(default)]
+    pub stderr: String,
+}
+
+// Client side. Uploads never block the caller: they run as background tasks,
+// each digest at most once per process and only when the server lacks it,
+// and are awaited by flush() before the process exits. Every failure
+// degrades to a cache miss.
+#[derive(Debug, Clone)]
+pub struct RemoteCache {
+    base: String,
+    client: reqwest::Client,
+    uploaded: std::sync::Arc<std::sync::Mutex<std::collections::HashSet<String>>>,
+    pending: std::sync::Arc<std::sync::Mutex<Vec<tokio::task::JoinHandle<()>>>>,
+}
+
+impl RemoteCache {
+    pub fn new(base: &str) -> Self {
+        RemoteCache {
+            base: base.trim_end_matches('/').to_string(),
+            client: reqwest::Client::new(),
+            uploaded: Default::default(),
+            pending: Default::default(),
+        }
+    }
+
+    pub fn from_env() -> Option<Self> {
+        std::env::var(REMOTE_CACHE_ENV)
+            .ok()
+            .filter(|base| !base.is_empty())
+            .map(|base| RemoteCache::new(&base))
+    }
+
+    pub fn base(&self) -> &str {
+        &self.base
+    }
+
+    fn url(&self, kind: RemoteKind, digest: &str) -> String {
+        format!("{}/{}/{}", self.base, kind.name(), digest)
+    }
+
+    pub async fn get_action(&self, key: &str) -> Option<ActionEntry> {
+        let entry = async {
+            let response = self.client.get(self.url(RemoteKind::Ac, key)).send().await.ok()?;
+            if !response.status().is_success() {
+                return None;
+            }
+            serde_json::from_slice(&response.bytes().await.ok()?).ok()
+        }
+        .await;
+        METRICS.cache_lookup("remote", entry.is_some() as u64, entry.is_none() as u64);
+        entry
+    }
+
+    // Streams a blob into `dest`, verifying its digest on the way; false on
+    // a miss or a corrupt blob
+    pub async fn fetch_blob(&self, digest: &str, dest: &std::path::Path) -> std::io::Result<bool> {
+        use futures::StreamExt;
+        use tokio::io::AsyncWriteExt;
+
+        let response = match self.client.get(self.url(RemoteKind::Cas, digest)).send().await {
+            Ok(response) if response.status().is_success() => response,
+            _ => return Ok(false),
+        };
+        if let Some(parent) = dest.parent() {
+            tokio::fs::create_dir_all(parent).await?;
+        }
+        let partial = tmp_path(dest);
+        let mut file = tokio::fs::File::create(&partial).await?;
+        let mut hasher = sha2::Sha256::new();
+        let mut stream = response.bytes_stream();
+        while let Some(chunk) = stream.next().await {
+            let Ok(chunk) = chunk else {
+                let _ = tokio::fs::remove_file(&partial).await;
+                return Ok(false);
+            };
+            hasher.update(&chunk);
+            file.write_all(&chunk).await?;
+        }
+        file.flush().await?;
+        drop(file);
+        if !to_hex(&hasher.finalize()).eq_ignore_ascii_case(digest) {
+            eprintln!("warning: remote cache returned a corrupt blob for {}", digest);
+            let _ = tokio::fs::remove_file(&partial).await;
+            return Ok(false);
+        }
+        tokio::fs::rename(&partial, dest).await?;
+        Ok(true)
+    }
+
+    async fn contains(&self, kind: RemoteKind, digest: &str) -> bool {
+        matches!(
+            self.client.head(self.url(kind, digest)).send().await,
+            Ok(response) if response.status().is_success()
+        )
+    }
+
+    async fn put_file(&self, digest: &str, path: &std::path::Path) -> Result<(), PackageError> {
+        if self.contains(RemoteKind::Cas, digest).await {
+            return Ok(());
+        }
+        let file = tokio::fs::File::open(path).await?;
+        let len = file.metadata().await?.len();
+        self.client
+            .put(self.url(RemoteKind::Cas, digest))
+            .header(reqwest::header::CONTENT_LENGTH, len)
+            .body(file)
+            .send()
+            .await?
+            .error_for_status()?;
+        Ok(())
+    }
+
+    // Queues the upload of `files` (path, digest) followed by the action
+    // entry that references them, so the entry never points at blobs the
+    // server has not been sent
+    pub fn upload_action(&self, key: String, entry: ActionEntry, files: Vec<(std::path::PathBuf, String)>) {
+        if !self.uploaded.lock().unwrap().insert(format!("ac/{}", key)) {
+            return;
+        }
+        let files: Vec<_> = files
+            .into_iter()
+            .filter(|(_, digest)| self.uploaded.lock().unwrap().insert(format!("cas/{}", digest)))
+            .collect();
+        let cache = self.clone();
+        let task = tokio::spawn(async move {
+            let result = async {
+                for (path, digest) in &files {
+                    cache.put_file(digest, path).await?;
+                }
+                let body = serde_json::to_vec(&entry).unwrap_or_default();
+                cache
+                    .client
+                    .put(cache.url(RemoteKind::Ac, &key))
+                    .body(body)
+                    .send()
+                    .await?
+                    .error_for_status()?;
+                Ok::<(), PackageError>(())
+            }
+            .await;
+            if let Err(e) = result {
+                eprintln!("warning: remote cache upload failed: {}", e);
+            }
+        });
+        self.track(task);
+    }
+
+    // Makes flush() wait for `task` as well
+    pub fn track(&self, task: tokio::task::JoinHandle<()>) {
+        self.pending.lock().unwrap().push(task);
+    }
+
+    // Waits for every queued upload
+    pub async fn flush(&self) {
+        loop {
+            let tasks: Vec<_> = std::mem::take(&mut *self.pending.lock().unwrap());
+            if tasks.is_empty() {
+                return;
+            }
+            futures::future::join_all(tasks).await;
+        }
+    }
+}
+
+pub fn sha256_hex(data: &[u8]) -> String {
+    to_hex(&sha2::Sha256::digest(data))
+}
+
+// Action key of a package artifact store entry
+fn artifact_action_key(package: &str, fingerprint: &str) -> String {
+    sha256_hex(format!("cpkg-artifact-v1\0{}\0{}", package, fingerprint).as_bytes())
+}
+
+// A compile the launcher can cache or distribute: `-c` of one source with
+// one `-o` object and at most one `-MF` depfile. Response files and other
+// modes run locally and uncached.
+struct CompileAction {
+    outputs: Vec<(&'static str, std::path::PathBuf)>,
+    // Compiler arguments with output paths replaced by their role
+    normalized: Vec<String>,
+    // Command printing the preprocessed translation unit; it writes the
+    // depfile too, so a remote compile needs no headers
+    preprocess: Vec<String>,
+    // Arguments that still matter once the source is preprocessed
+    compile_args: Vec<String>,
+    // Extension for the preprocessed source ("i" for C, "ii" for C++);
+    // other languages are never sent to a worker
+    preprocessed_extension: Option<&'static str>,
+}
+
+// Preprocessor options taking their value as the next argument
+const PREPROCESSOR_VALUE_FLAGS: &[&str] =
+    &["-I", "-D", "-U", "-include", "-imacros", "-isystem", "-iquote", "-idirafter"];
+
+fn compile_action(command: &[String]) -> Option<CompileAction> {
+    let (compiler, args) = command.split_first()?;
+    let mut action = CompileAction {
+        outputs: Vec::new(),
+        normalized: Vec::new(),
+        preprocess: vec![compiler.clone()],
+        compile_args: Vec::new(),
+        preprocessed_extension: None,
+    };
+    let has = |action: &CompileAction, role: &str| action.outputs.iter().any(|(r, _)| *r == role);
+    let mut compile_only = false;
+    let mut writes_depfile = false;
+    let mut language = None;
+    let mut source = None;
+    let mut args = args.iter();
+    while let Some(arg) = args.next() {
+        match arg.as_str() {
+            "-c" => compile_only = true,
+            "-o" => {
+                if has(&action, "object") {
+                    return None;
+                }
+                action.outputs.push(("object", std::path::PathBuf::from(args.next()?)));
+                action.normalized.extend(["-o".to_string(), "object".to_string()]);
+                continue;
+            }
+            "-MF" => {
+                let path = args.next()?;
+                if has(&action, "depfile") {
+                    return None;
+                }
+                action.outputs.push(("depfile", std::path::PathBuf::from(path)));
+                action.preprocess.extend([arg.clone(), path.clone()]);
+                action.normalized.extend([arg.clone(), "depfile".to_string()]);
+                continue;
+            }
+            "-MD" | "-MMD" => {
+                writes_depfile = true;
+                action.preprocess.push(arg.clone());
+            }
+            "-E" | "-S" | "-M" | "-MM" | "-" => return None,
+            flag if flag == "-x" || flag == "-MT" || flag == "-MQ" || PREPROCESSOR_VALUE_FLAGS.contains(&flag) => {
+                let value = args.next()?;
+                if flag == "-x" {
+                    language = Some(value.clone());
+                }
+                action.preprocess.extend([arg.clone(), value.clone()]);
+                action.normalized.extend([arg.clone(), value.clone()]);
+                continue;
+            }
+            _ if arg.starts_with('@') || (arg.starts_with("-o") && arg.len() > 2) => return None,
+            _ => {
+                action.preprocess.push(arg.clone());
+                if !arg.starts_with('-') {
+                    if source.replace(arg.clone()).is_some() {
+                        return None;
+                    }
+                } else if !["-I", "-D", "-U", "-i", "-M"].iter().any(|prefix| arg.starts_with(prefix)) {
+                    action.compile_args.push(arg.clone());
+                }
+            }
+        }
+        action.normalized.push(arg.clone());
+    }
+    let source = source?;
+    if !compile_only || !has(&action, "object") || writes_depfile != has(&action, "depfile") {
+        return None;
+    }
+    action.preprocessed_extension = match language.as_deref() {
+        Some("c") => Some("i"),
+        Some("c++") => Some("ii"),
+        Some(_) => None,
+        None => match source.rsplit_once('.').map(|(_, extension)| extension) {
+            Some("c") => Some("i"),
+            Some("cc" | "cp" | "cpp" | "cxx" | "c++" | "C" | "CPP") => Some("ii"),
+            _ => None,
+        },
+    };
+    action.preprocess.push("-E".to_string());
+    Some(action)
+}
+
+// Runs the preprocessor; None when it fails, leaving the diagnostics to
+// the real compile
+fn preprocess(action: &CompileAction) -> Option<Vec<u8>> {
+    let output = std::process::Command::new(&action.preprocess[0])
+        .args(&action.preprocess[1..])
+        .stderr(std::process::Stdio::null())
+        .output()
+        .ok()?;
+    output.status.success().then_some(output.stdout)
+}
+
+// Key of a compile: the compiler's identity, working directory, arguments
+// and preprocessed source, so header edits invalidate it like source edits
+fn compile_action_key(command: &[String], action: &CompileAction, preprocessed: &[u8]) -> Option<String> {
+    let version = std::process::Command::new(&command[0]).arg("--version").output().ok()?;
+    if !version.status.success() {
+        return None;
+    }
+    let mut hasher = sha2::Sha256::new();
+    hasher.update(b"cpkg-compile-v1\0");
+    hasher.update(&version.stdout);
+    hasher.update(std::env::current_dir().ok()?.to_string_lossy().as_bytes());
+    for arg in &action.normalized {
+        hasher.update(b"\0");
+        hasher.update(arg.as_bytes());
+    }
+    hasher.update(b"\0");
+    hasher.update(preprocessed);
+    Some(to_hex(&hasher.finalize()))
+}
+
+struct CompileOutcome {
+    code: i32,
+    stdout: Vec<u8>,
+    stderr: Vec<u8>,
+}
+
+// `cpkg cc-launcher [--remote-cache <url>] [--workers <list>] -- <compiler>
+// <args>...`, installed as CMake's compiler launcher. Restores the outputs
+// of a cached compile; otherwise compiles on the least loaded worker, or
+// locally when none is free or reachable, and leaves uploading what was
+// produced to a detached process. Returns the exit code.
+pub async fn run_compiler_launcher(
+    cache: Option<&RemoteCache>,
+    workers: &[WorkerAddress],
+    command: &[String],
+) -> i32 {
+    use std::io::Write;
+
+    // Preprocessed once; it feeds both the cache key and a remote compile
+    let action = compile_action(command);
+    let preprocessed = match &action {
+        Some(action) if cache.is_some() || !workers.is_empty() => preprocess(action),
+        _ => None,
+    };
+    let key = match (cache, &action, &preprocessed) {
+        (Some(_), Some(action), Some(source)) => compile_action_key(command, action, source),
+        _ => None,
+    };
+
+    if let (Some(cache), Some(action), Some(key)) = (cache, &action, &key) {
+        if let Some(entry) = cache.get_action(key).await {
+            // A hit must restore every output this compile would write;
+            // anything short of that compiles for real
+            let mut restored = true;
+            for (role, path) in &action.outputs {
+                let output = entry.outputs.iter().find(|output| output.path == *role);
+                restored = match output {
+                    Some(output) => cache.fetch_blob(&output.digest, path).await.unwrap_or(false),
+                    None => false,
+                };
+                if !restored {
+                    break;
+                }
+            }
+            if restored {
+                let _ = std::io::stdout().write_all(entry.stdout.as_bytes());
+                let _ = std::io::stderr().write_all(entry.stderr.as_bytes());
+                return 0;
+            }
+        }
+    }
+
+    let remote = match (&action, &preprocessed) {
+        (Some(action), Some(source)) if !workers.is_empty() => {
+            compile_remotely(workers, &command[0], action, source).await
+        }
+        _ => None,
+    };
+    let outcome = match remote {
+        Some(outcome) => outcome,
+        None => match std::process::Command::new(&command[0]).args(&command[1..]).output() {
+            Ok(output) => CompileOutcome {
+                code: output.status.code().unwrap_or(1),
+                stdout: output.stdout,
+                stderr: output.stderr,
+            },
+            Err(e) => {
+                eprintln!("cpkg cc-launcher: cannot run {}: {}", command[0], e);
+                return 127;
+            }
+        },
+    };
+    let _ = std::io::stdout().write_all(&outcome.stdout);
+    let _ = std::io::stderr().write_all(&outcome.stderr);
+    if outcome.code != 0 {
+        return outcome.code;
+    }
+
+    if let (Some(cache), Some(action), Some(key)) = (cache, action, key) {
+        let mut entry = ActionEntry {
+            outputs: Vec::new(),
+            stdout: String::from_utf8_lossy(&outcome.stdout).into_owned(),
+            stderr: String::from_utf8_lossy(&outcome.stderr).into_owned(),
+        };
+        let mut files = Vec::new();
+        for (role, path) in action.outputs {
+            let Ok(data) = std::fs::read(&path) else { return 0 };
+            let digest = sha256_hex(&data);
+            entry.outputs.push(ActionOutput {
+                path: role.to_string(),
+                digest: digest.clone(),
+                size: data.len() as u64,
+            });
+            files.push((data, digest));
+        }
+        // A failed hand-off is a later cache miss, never a failed compile
+        let _ = spool_action_upload(cache, &key, &entry, &files);
+    }
+    0
+}
+
+// Hands a compile's upload to a detached `cpkg cache-upload`, so the
+// compile returns as soon as its outputs are written. The outputs are
+// copied into <cache>/uploads/<key>.<pid>/ first, since the build may
+// rewrite them before the upload runs.
+fn spool_action_upload(
+    cache: &RemoteCache,
+    key: &str,
+    entry: &ActionEntry,
+    files: &[(Vec<u8>, String)],
+) -> std::io::Result<()> {
+    let spool = default_cache_dir()
+        .join("uploads")
+        .join(format!("{}.{}", key, std::process::id()));
+    std::fs::create_dir_all(&spool)?;
+    for (data, digest) in files {
+        std::fs::write(spool.join(digest), data)?;
+    }
+    let manifest = spool.join("action.json");
+    let tmp = tmp_path(&manifest);
+    std::fs::write(&tmp, serde_json::to_vec(entry).unwrap_or_default())?;
+    std::fs::rename(&tmp, &manifest)?;
+    std::process::Command::new(std::env::current_exe()?)
+        .arg("cache-upload")
+        .arg(&spool)
+        .args(["--remote-cache", cache.base()])
+        // The uploader would replace the launcher's metrics with its own
+        .env_remove("CPKG_METRICS_TEXTFILE")
+        .stdin(std::process::Stdio::null())
+        .stdout(std::process::Stdio::null())
+        .stderr(std::process::Stdio::null())
+        .spawn()?;
+    Ok(())
+}
+
+// `cpkg cache-upload <spool>`: uploads what spool_action_upload left in
+// `spool`, then removes it whether or not the upload succeeded
+pub async fn upload_spooled_action(cache: &RemoteCache, spool: &std::path::Path) {
+    let key = spool
+        .file_name()
+        .and_then(|name| name.to_string_lossy().split('.').next().map(str::to_string));
+    let entry = std::fs::read(spool.join("action.json"))
+        .ok()
+        .and_then(|data| serde_json::from_slice::<ActionEntry>(&data).ok());
+    if let (Some(key), Some(entry)) = (key, entry) {
+        let files = entry
+            .outputs
+            .iter()
+            .map(|output| (spool.join(&output.digest), output.digest.clone()))
+            .collect();
+        cache.upload_action(key, entry, files);
+        cache.flush().await;
+    }
+    let _ = std::fs::remove_dir_all(spool);
+}
+
+// Distributed compiles, distcc style: the launcher preprocesses locally and
+// ships the translation unit to a `cpkg compile-worker` over TCP or a Unix
+// socket, which compiles it with its own compiler of the same name and
+// returns the object. Each message is a JSON header and a binary payload:
+//
+//   [header len: u32 LE][header JSON][payload len: u64 LE][payload]
+//
+// Anything going wrong remotely, including a failed compile, falls back to
+// compiling locally, so diagnostics always come from the local compiler.
+pub const WORKERS_ENV: &str = "CPKG_WORKERS";
+// distcc's port
+const DEFAULT_WORKER_PORT: u16 = 3632;
+const WORKER_LOAD_TIMEOUT: std::time::Duration = std::time::Duration::from_millis(500);
+const WORKER_COMPILE_TIMEOUT: std::time::Duration = std::time::Duration::from_secs(600);
+const WORKER_MAX_HEADER: u32 = 1 << 20;
+const WORKER_MAX_PAYLOAD: u64 = 1 << 30;
+
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub enum WorkerAddress {
+    Tcp(String),
+    Unix(std::path::PathBuf),
+}
+
+impl WorkerAddress {
+    // "unix:<path>", "tcp:<host>:<port>" or plain "<host>[:<port>]"
+    pub fn parse(text: &str) -> Option<Self> {
+        if let Some(path) = text.strip_prefix("unix:") {
+            return (!path.is_empty()).then(|| WorkerAddress::Unix(path.into()));
+        }
+        let address = text.strip_prefix("tcp:").unwrap_or(text);
+        match address {
+            "" => None,
+            _ if address.contains(':') => Some(WorkerAddress::Tcp(address.to_string())),
+            _ => Some(WorkerAddress::Tcp(format!("{}:{}", address, DEFAULT_WORKER_PORT))),
+        }
+    }
+
+    // Comma-separated list; unparsable entries are skipped
+    pub fn parse_list(list: &str) -> Vec<Self> {
+        list.split(',').filter_map(|text| Self::parse(text.trim())).collect()
+    }
+
+    pub fn from_env() -> Vec<Self> {
+        std::env::var(WORKERS_ENV).map(|list| Self::parse_list(&list)).unwrap_or_default()
+    }
+
+    async fn connect(&self) -> std::io::Result<Box<dyn WorkerStream>> {
+        Ok(match self {
+            WorkerAddress::Tcp(address) => Box::new(tokio::net::TcpStream::connect(address).await?),
+            WorkerAddress::Unix(path) => Box::new(tokio::net::UnixStream::connect(path).await?),
+        })
+    }
+
+    // One request/reply exchange on a fresh connection
+    async fn call(
+        &self,
+        request: &WorkerRequest,
+        payload: &[u8],
+        timeout: std::time::Duration,
+    ) -> std::io::Result<(WorkerReply, Vec<u8>)> {
+        tokio::time::timeout(timeout, async {
+            let mut stream = self.connect().await?;
+            write_worker_frame(&mut stream, request, payload).await?;
+            read_worker_frame(&mut stream).await
+        })
+        .await
+        .map_err(|_| std::io::Error::new(std::io::ErrorKind::TimedOut, format!("{} timed out", self)))?
+    }
+
+    // (jobs running or queued, slots); None when unreachable
+    async fn load(&self) -> Option<(usize, usize)> {
+        match self.call(&WorkerRequest::Load, &[], WORKER_LOAD_TIMEOUT).await {
+            Ok((WorkerReply::Load { active, slots }, _)) => Some((active, slots)),
+            _ => None,
+        }
+    }
+}
+
+impl std::fmt::Display for WorkerAddress {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        match self {
+            WorkerAddress::Tcp(address) => write!(f, "tcp:{}", address),
+            WorkerAddress::Unix(path) => write!(f, "unix:{}", path.display()),
+        }
+    }
+}
+
+trait WorkerStream: tokio::io::AsyncRead + tokio::io::AsyncWrite + Unpin + Send {}
+impl<T: tokio::io::AsyncRead + tokio::io::AsyncWrite + Unpin + Send> WorkerStream for T {}
+
+#[derive(Debug, Serialize, Deserialize)]
+#[serde(tag = "op", rename_all = "snake_case")]
+enum WorkerRequest {
+    Load,
+    // The payload is the preprocessed source
+    Compile { compiler: String, args: Vec<String>, extension: String },
+}
+
+#[derive(Debug, Serialize, Deserialize)]
+#[serde(tag = "reply", rename_all = "snake_case")]
+enum WorkerReply {
+    Load { active: usize, slots: usize },
+    // The payload is the object file when code is 0
+    Compiled { code: i32, stdout: String, stderr: String },
+    Refused { reason: String },
+}
+
+async fn write_worker_frame<W: tokio::io::AsyncWrite + Unpin>(
+    writer: &mut W,
+    header: &impl Serialize,
+    payload: &[u8],
+) -> std::io::Result<()> {
+    use tokio::io::AsyncWriteExt;
+
+    let header = serde_json::to_vec(header).unwrap_or_default();
+    writer.write_all(&(header.len() as u32).to_le_bytes()).await?;
+    writer.write_all(&header).await?;
+    writer.write_all(&(payload.len() as u64).to_le_bytes()).await?;
+    writer.write_all(payload).await?;
+    writer.flush().await
+}
+
+async fn read_worker_frame<R: tokio::io::AsyncRead + Unpin, T: serde::de::DeserializeOwned>(
+    reader: &mut R,
+) -> std::io::Result<(T, Vec<u8>)> {
+    use tokio::io::AsyncReadExt;
+
+    let invalid = |what: &str| std::io::Error::new(std::io::ErrorKind::InvalidData, what.to_string());
+    let header_len = reader.read_u32_le().await?;
+    if header_len > WORKER_MAX_HEADER {
+        return Err(invalid("worker header too large"));
+    }
+    let mut header = vec![0u8; header_len as usize];
+    reader.read_exact(&mut header).await?;
+    let payload_len = reader.read_u64_le().await?;
+    if payload_len > WORKER_MAX_PAYLOAD {
+        return Err(invalid("worker payload too large"));
+    }
+    let mut payload = vec![0u8; payload_len as usize];
+    reader.read_exact(&mut payload).await?;
+    let header = serde_json::from_slice(&header).map_err(|_| invalid("bad worker header"))?;
+    Ok((header, payload))
+}
+
+// Reachable worker with the lowest share of busy slots and at least one free
+async fn pick_worker(workers: &[WorkerAddress]) -> Option<&WorkerAddress> {
+    let loads = futures::future::join_all(workers.iter().map(|worker| worker.load())).await;
+    workers
+        .iter()
+        .zip(loads)
+        .filter_map(|(worker, load)| load.filter(|(active, slots)| active < slots).map(|load| (worker, load)))
+        .min_by(|(_, (a_active, a_slots)), (_, (b_active, b_slots))| {
+            (a_active * b_slots).cmp(&(b_active * a_slots))
+        })
+        .map(|(worker, _)| worker)
+}
+
+async fn compile_remotely(
+    workers: &[WorkerAddress],
+    compiler: &str,
+    action: &CompileAction,
+    source: &[u8],
+) -> Option<CompileOutcome> {
+    let extension = action.preprocessed_extension?;
+    // Resolved on the worker's own PATH
+    let compiler = std::path::Path::new(compiler).file_name()?.to_string_lossy().into_owned();
+    // A job any worker would refuse is not worth the round trip
+    if worker_refusal(&compiler, &action.compile_args, extension).is_some() {
+        return None;
+    }
+    let worker = pick_worker(workers).await?;
+    let request = WorkerRequest::Compile {
+        compiler,
+        args: action.compile_args.clone(),
+        extension: extension.to_string(),
+    };
+    let (reply, object) = match worker.call(&request, source, WORKER_COMPILE_TIMEOUT).await {
+        Ok(reply) => reply,
+        Err(e) => {
+            eprintln!("cpkg cc-launcher: {} failed ({}), compiling locally", worker, e);
+            return None;
+        }
+    };
+    match reply {
+        WorkerReply::Compiled { code: 0, stdout, stderr } => {
+            let (_, path) = action.outputs.iter().find(|(role, _)| *role == "object")?;
+            let partial = tmp_path(path);
+            std::fs::write(&partial, &object).ok()?;
+            std::fs::rename(&partial, path).ok()?;
+            Some(CompileOutcome { code: 0, stdout: stdout.into_bytes(), stderr: stderr.into_bytes() })
+        }
+        WorkerReply::Refused { reason } => {
+            eprintln!("cpkg cc-launcher: {} refused the job ({}), compiling locally", worker, reason);
+            None
+        }
+        _ => None,
+    }
+}
+
+// Why a worker will not run a job. Only compilers called like gcc or clang,
+// looked up on the worker's PATH, are run, and only with options from an
+// allowlist: an option that is not known to be harmless may load code or
+// write files outside the job directory (-MF, -fdump-*, -Wa,, ...).
+fn worker_refusal(compiler: &str, args: &[String], extension: &str) -> Option<String> {
+    let known = ["cc", "c++"].contains(&compiler)
+        || ["gcc", "g++", "clang"].iter().any(|family| compiler.contains(family));
+    let plain = compiler.chars().all(|c| c.is_ascii_alphanumeric() || "._+-".contains(c));
+    if !known || !plain {
+        return Some(format!("compiler {} not allowed", compiler));
+    }
+    if extension != "i" && extension != "ii" {
+        return Some(format!("unsupported input .{}", extension));
+    }
+    let mut args = args.iter();
+    while let Some(arg) = args.next() {
+        let allowed = match arg.as_str() {
+            "-D" | "-U" => args.next().is_some(),
+            "-I" | "-isystem" | "-iquote" | "-idirafter" => args.next().map_or(false, |dir| in_job_dir(dir)),
+            _ => worker_option_allowed(arg),
+        };
+        if !allowed {
+            return Some(format!("option {} not allowed", arg));
+        }
+    }
+    None
+}
+
+// -f options that neither name a file nor load code
+const WORKER_F_OPTIONS: &[&str] = &[
+    "-fPIC", "-fpic", "-fPIE", "-fpie", "-fno-pic", "-fno-pie", "-fexceptions", "-fno-exceptions",
+    "-frtti", "-fno-rtti", "-fvisibility-inlines-hidden", "-fstack-protector", "-fstack-protector-strong",
+    "-fstack-protector-all", "-fno-stack-protector", "-fstack-clash-protection", "-fcf-protection",
+    "-fomit-frame-pointer", "-fno-omit-frame-pointer", "-fstrict-aliasing", "-fno-strict-aliasing",
+    "-fcommon", "-fno-common", "-ffunction-sections", "-fdata-sections", "-fno-plt", "-fwrapv",
+    "-fno-delete-null-pointer-checks", "-fopenmp", "-flto", "-fno-lto", "-fdiagnostics-color",
+    "-fno-diagnostics-color", "-fcolor-diagnostics", "-fno-color-diagnostics",
+    "-fdiagnostics-format=text", "-fdiagnostics-format=json", "-fdiagnostics-format=json-stderr",
+    "-fdiagnostics-format=sarif-stderr",
+];
+// ... and those whose value is never a path
+const WORKER_F_PREFIXES: &[&str] = &[
+    "-fvisibility=", "-fsanitize=", "-fno-sanitize=", "-fsanitize-recover=", "-fno-sanitize-recover=",
+    "-fcf-protection=", "-flto=", "-fdiagnostics-color=",
+];
+const WORKER_OPTIONS: &[&str] = &["-pthread", "-pipe", "-w", "-pedantic", "-pedantic-errors", "-ansi"];
+
+fn worker_option_allowed(arg: &str) -> bool {
+    let tail = |prefix: &str, extra: &str| {
+        arg.strip_prefix(prefix).map_or(false, |rest| {
+            !rest.is_empty() && rest.chars().all(|c| c.is_ascii_alphanumeric() || extra.contains(c))
+        })
+    };
+    if WORKER_OPTIONS.contains(&arg) || WORKER_F_OPTIONS.contains(&arg) || arg == "-O" || arg == "-g" {
+        return true;
+    }
+    if WORKER_F_PREFIXES.iter().any(|prefix| tail(prefix, "-_,.+")) {
+        return true;
+    }
+    // Joined forms; -iplugindir= and the like are none of these
+    for prefix in ["-I", "-isystem", "-iquote", "-idirafter"] {
+        if let Some(dir) = arg.strip_prefix(prefix) {
+            return in_job_dir(dir);
+        }
+    }
+    // -W<name>[=<value>], but not -Wa,/-Wl,/-Wp, which pass options on
+    arg != "-mllvm"
+        && (tail("-O", "")
+            || tail("-g", "-_=")
+            || tail("-W", "-_=+")
+            || tail("-std=", "+")
+            || tail("-m", "-_=.+")
+            || (arg.len() > 2 && (arg.starts_with("-D") || arg.starts_with("-U"))))
+}
+
+// Relative and without .., so it resolves inside the job directory
+fn in_job_dir(dir: &str) -> bool {
+    !dir.is_empty()
+        && std::path::Path::new(dir)
+            .components()
+            .all(|component| matches!(component, std::path::Component::Normal(_) | std::path::Component::CurDir))
+}
+
+struct WorkerState {
+    slots: usize,
+    active: std::sync::atomic::AtomicUsize,
+    permits: tokio::sync::Semaphore,
+}
+
+// `cpkg compile-worker`: runs at most `slots` compiles at once; further jobs
+// queue, and count towards the load launchers balance on
+pub async fn serve_compile_worker(listen: WorkerAddress, slots: usize) -> Result<(), PackageError> {
+    let state = std::sync::Arc::new(WorkerState {
+        slots,
+        active: std::sync::atomic::AtomicUsize::new(0),
+        permits: tokio::sync::Semaphore::new(slots),
+    });
+    println!("Compile worker with {} slots on {}", slots, listen);
+
+    match &listen {
+        WorkerAddress::Tcp(address) => {
+            let listener = tokio::net::TcpListener::bind(address).await?;
+            loop {
+                let (stream, _) = listener.accept().await?;
+                tokio::spawn(handle_worker_connection(Box::new(stream), state.clone()));
+            }
+        }
+        WorkerAddress::Unix(path) => {
+            // A socket left by an earlier worker would make bind fail
+            let _ = std::fs::remove_file(path);
+            let listener = tokio::net::UnixListener::bind(path)?;
+            loop {
+                let (stream, _) = listener.accept().await?;
+                tokio::spawn(handle_worker_connection(Box::new(stream), state.clone()));
+            }
+        }
+    }
+}
+
+async fn handle_worker_connection(mut stream: Box<dyn WorkerStream>, state: std::sync::Arc<WorkerState>) {
+    use std::sync::atomic::Ordering;
+    use tokio::io::AsyncWriteExt;
+
+    let result = async {
+        let (request, source): (WorkerRequest, Vec<u8>) = read_worker_frame(&mut stream).await?;
+        let (reply, object) = match request {
+            WorkerRequest::Load => (
+                WorkerReply::Load { active: state.active.load(Ordering::Relaxed), slots: state.slots },
+                Vec::new(),
+            ),
+            WorkerRequest::Compile { compiler, args, extension } => {
+                match worker_refusal(&compiler, &args, &extension) {
+                    Some(reason) => (WorkerReply::Refused { reason }, Vec::new()),
+                    None => {
+                        state.active.fetch_add(1, Ordering::Relaxed);
+                        let queued = std::time::Instant::now();
+                        let compiled = match state.permits.acquire().await {
+                            Ok(_permit) => {
+                                METRICS.worker_queue_wait.observe(queued.elapsed());
+                                run_worker_job(&compiler, &args, &extension, &source).await
+                            }
+                            Err(e) => Err(std::io::Error::new(std::io::ErrorKind::Other, e)),
+                        };
+                        state.active.fetch_sub(1, Ordering::Relaxed);
+                        compiled?
+                    }
+                }
+            }
+        };
+        write_worker_frame(&mut stream, &reply, &object).await?;
+        stream.shutdown().await
+    }
+    .await;
+    if let Err(e) = result {
+        eprintln!("worker request failed: {}", e);
+    }
+}
+
+async fn run_worker_job(
+    compiler: &str,
+    args: &[String],
+    extension: &str,
+    source: &[u8],
+) -> std::io::Result<(WorkerReply, Vec<u8>)> {
+    let dir = tmp_path(&std::env::temp_dir().join("cpkg-worker"));
+    tokio::fs::create_dir_all(&dir).await?;
+    let input = dir.join(format!("input.{}", extension));
+    let object = dir.join("output.o");
+    let result = async {
+        tokio::fs::write(&input, source).await?;
+        let output = tokio::process::Command::new(compiler)
+            .args(args)
+            .arg("-c")
+            .arg(&input)
+            .arg("-o")
+            .arg(&object)
+            .current_dir(&dir)
+            .stdin(std::process::Stdio::null())
+            .output()
+            .await?;
+        let code = output.status.code().unwrap_or(1);
+        let data = if code == 0 { tokio::fs::read(&object).await? } else { Vec::new() };
+        let reply = WorkerReply::Compiled {
+            code,
+            stdout: String::from_utf8_lossy(&output.stdout).into_owned(),
+            stderr: String::from_utf8_lossy(&output.stderr).into_owned(),
+        };
+        Ok((reply, data))
+    }
+    .await;
+    let _ = tokio::fs::remove_dir_all(&dir).await;
+    result
+}
+
+// GNU make jobserver in its named-fifo form (make 4.4+, ninja 1.13+), shared
+// by every native build of an install instead of a private -j per build. It
+// holds a token per local CPU plus one per remote worker slot, so make keeps
+// enough compiles in flight to fill the workers. The implicit token each
+// client starts with is not written to the fifo.
+#[derive(Debug)]
+pub struct Jobserver {
+    path: std::path::PathBuf,
+    jobs: usize,
+    // Held open read-write so the fifo never reaches EOF while builds run
+    _fifo: std::fs::File,
+}
+
+impl Jobserver {
+    pub fn create(dir: &std::path::Path, jobs: usize) -> std::io::Result<Self> {
+        use std::io::Write;
+        use std::os::unix::ffi::OsStrExt;
+
+        std::fs::create_dir_all(dir)?;
+        let path = dir.join(format!("jobserver-{}.fifo", std::process::id()));
+        let _ = std::fs::remove_file(&path);
+        let c_path = std::ffi::CString::new(path.as_os_str().as_bytes())
+            .map_err(|e| std::io::Error::new(std::io::ErrorKind::InvalidInput, e))?;
+        if unsafe { libc::mkfifo(c_path.as_ptr(), 0o600) } != 0 {
+            return Err(std::io::Error::last_os_error());
+        }
+        let mut fifo = std::fs::OpenOptions::new().read(true).write(true).open(&path)?;
+        fifo.write_all(&vec![b'+'; jobs.saturating_sub(1)])?;
+        Ok(Jobserver { path, jobs, _fifo: fifo })
+    }
+
+    // Value for MAKEFLAGS' --jobserver-auth
+    pub fn auth(&self) -> String {
+        format!("fifo:{}", self.path.display())
+    }
+
+    pub fn jobs(&self) -> usize {
+        self.jobs
+    }
+}
+
+impl Drop for Jobserver {
+    fn drop(&mut self) {
+        let _ = std::fs::remove_file(&self.path);
+    }
+}
+
+// Minimal cache server for tests and small clusters, answering the same
+// protocol from <root>/{ac,cas}/<first 2 hex>/<digest>. An instance name
+// before /ac or /cas (bazel's --remote_instance_name) is ignored.
+pub async fn serve_remote_cache(
+    root: std::path::PathBuf,
+    bind: &str,
+    port: u16,
+) -> Result<(), PackageError> {
+    let listener = tokio::net::TcpListener::bind((bind, port)).await?;
+    println!("Serving remote cache {} on http://{}:{}", root.display(), bind, port);
+
+    loop {
+        let (stream, _) = listener.accept().await?;
+        let root = root.clone();
+        tokio::spawn(async move {
+            if let Err(e) = handle_cache_request(stream, &root).await {
+                eprintln!("request failed: {}", e);
+            }
+        });
+    }
+}
+
+// Maps .../{ac,cas}/<sha256> onto the server's store
+fn remote_cache_path(root: &std::path::Path, target: &str) -> Option<(RemoteKind, String, std::path::PathBuf)> {
+    let mut segments = target.split('?').next()?.rsplit('/');
+    let digest = segments.next()?.to_ascii_lowercase();
+    let kind = match segments.next()? {
+        "cas" => RemoteKind::Cas,
+        "ac" => RemoteKind::Ac,
+        _ => return None,
+    };
+    if digest.len() != 64 || !digest.chars().all(|c| c.is_ascii_hexdigit()) {
+        return None;
+    }
+    let path = root.join(kind.name()).join(&digest[..2]).join(&digest);
+    Some((kind, digest, path))
+}
+
+async fn handle_cache_request(mut stream: tokio::net::TcpStream, root: &std::path::Path) -> std::io::Result<()> {
+    use tokio::io::{AsyncBufReadExt, AsyncReadExt, AsyncWriteExt, BufReader};
+
+    let (reader, mut writer) = stream.split();
+    let mut reader = BufReader::new(reader);
+    let mut request_line = String::new();
+    reader.read_line(&mut request_line).await?;
+
+    let mut content_length: Option<u64> = None;
+    loop {
+        let mut header = String::new();
+        if reader.read_line(&mut header).await? == 0 || header.trim().is_empty() {
+            break;
+        }
+        if let Some((name, value)) = header.split_once(':') {
+            if name.trim().eq_ignore_ascii_case("content-length") {
+                content_length = value.trim().parse().ok();
+            }
+        }
+    }
+
+    let mut parts = request_line.split_whitespace();
+    let method = parts.next().unwrap_or("");
+    let target = parts.next().unwrap_or("");
+    let status = |code: &str| format!("HTTP/1.1 {}\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", code);
+
+    if let Some(response) = metrics_response(method, target) {
+        writer.write_all(response.as_bytes()).await?;
+        return writer.shutdown().await;
+    }
+    let Some((kind, digest, path)) = remote_cache_path(root, target) else {
+        writer.write_all(status("404 Not Found").as_bytes()).await?;
+        return writer.shutdown().await;
+    };
+
+    match method {
+        "GET" | "HEAD" => match tokio::fs::File::open(&path).await {
+            Ok(mut file) => {
+                let len = file.metadata().await?.len();
+                let header = format!(
+                    "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: {}\r\nConnection: close\r\n\r\n",
+                    len
+                );
+                writer.write_all(header.as_bytes()).await?;
+                if method == "GET" {
+                    let sent = tokio::io::copy(&mut file, &mut writer).await?;
+                    METRICS.served("cache", true, sent);
+                }
+            }
+            Err(_) => {
+                if method == "GET" {
+                    METRICS.served("cache", false, 0);
+                }
+                writer.write_all(status("404 Not Found").as_bytes()).await?
+            }
+        },
+        "PUT" => {
+            let Some(len) = content_length else {
+                writer.write_all(status("411 Length Required").as_bytes()).await?;
+                return writer.shutdown().await;
+            };
+            if let Some(parent) = path.parent() {
+                tokio::fs::create_dir_all(parent).await?;
+            }
+            // Written to a private file and renamed, so readers and racing
+            // uploads of the same digest only ever see complete blobs
+            let partial = tmp_path(&path);
+            let mut file = tokio::fs::File::create(&partial).await?;
+            let mut hasher = sha2::Sha256::new();
+            let mut body = (&mut reader).take(len);
+            let mut buffer = vec![0u8; 256 * 1024];
+            let mut received = 0u64;
+            loop {
+                let n = body.read(&mut buffer).await?;
+                if n == 0 {
+                    break;
+                }
+                hasher.update(&buffer[..n]);
+                file.write_all(&buffer[..n]).await?;
+                received += n as u64;
+            }
+            file.flush().await?;
+            drop(file);
+            let intact = received == len && (kind == RemoteKind::Ac || to_hex(&hasher.finalize()) == digest);
+            if intact {
+                tokio::fs::rename(&partial, &path).await?;
+                writer.write_all(status("200 OK").as_bytes()).await?;
+            } else {
+                tokio::fs::remove_file(&partial).await?;
+                writer.write_all(status("400 Bad Request").as_bytes()).await?;
+            }
+        }
+        _ => writer.write_all(status("405 Method Not Allowed").as_bytes()).await?,
+    }
+
+    writer.shutdown().await
+}
+
+// Serves the build-id tree written by the native DebugInfoStore using the
+// debuginfod HTTP protocol, so gdb/perf can fetch separated debug info with
+// DEBUGINFOD_URLS=http://127.0.0.1:<port>
+pub async fn serve_debuginfo(root: std::path::PathBuf, port: u16) -> Result<(), PackageError> {
+    let listener = tokio::net::TcpListener::bind(("127.0.0.1", port)).await?;
+    println!(
+        "Serving debug info from {} on http://127.0.0.1:{}",
+        root.display(),
+        port
+    );
+
+    loop {
+        let (stream, _) = listener.accept().await?;
+        let root = root.clone();
+        tokio::spawn(async move {
+            if let Err(e) = handle_file_request(stream, "debuginfod", |target| debuginfod_path(&root, target)).await {
+                eprintln!("debuginfod request failed: {}", e);
+            }
+        });
+    }
+}
+
+// Serves a directory over plain HTTP. Stands in for the registry's archive and
+// chunk store hosting (cpkg chunk writes <archive>.caidx and the chunks), so
+// transfers can be exercised end to end without the real registry.
+pub async fn serve_directory(root: std::path::PathBuf, port: u16) -> Result<(), PackageError> {
+    let listener = tokio::net::TcpListener::bind(("127.0.0.1", port)).await?;
+    println!("Serving {} on http://127.0.0.1:{}", root.display(), port);
+
+    loop {
+        let (stream, _) = listener.accept().await?;
+        let root = root.clone();
+        tokio::spawn(async move {
+            if let Err(e) = handle_file_request(stream, "files", |target| static_path(&root, target)).await {
+                eprintln!("request failed: {}", e);
+            }
+        });
+    }
+}
+
+// Answers one GET/HEAD with the file `resolve` maps the target to. Honours
+// open-ended "Range: bytes=N-" so interrupted downloads can resume. GETs
+// count towards `server`'s metrics.
+async fn handle_file_request(
+    stream: impl tokio::io::AsyncRead + tokio::io::AsyncWrite + Unpin,
+    server: &str,
+    resolve: impl Fn(&str) -> Option<std::path::PathBuf>,
+) -> std::io::Result<()> {
+    use tokio::io::{AsyncBufReadExt, AsyncSeekExt, AsyncWriteExt, BufReader};
+
+    let (reader, mut writer) = tokio::io::split(stream);
+    let mut reader = BufReader::new(reader);
+    let mut request_line = String::new();
+    reader.read_line(&mut request_line).await?;
+
+    let mut range_start: Option<u64> = None;
+    loop {
+        let mut header = String::new();
+        if reader.read_line(&mut header).await? == 0 || header.trim().is_empty() {
+            break;
+        }
+        if let Some((name, value)) = header.split_once(':') {
+            if name.trim().eq_ignore_ascii_case("range") {
+                range_start = value
+                    .trim()
+                    .strip_prefix("bytes=")
+                    .and_then(|range| range.strip_suffix('-'))
+                    .and_then(|start| start.parse().ok());
+            }
+        }
+    }
+
+    let mut parts = request_line.split_whitespace();
+    let method = parts.next().unwrap_or("");
+    let target = parts.next().unwrap_or("");
+
+    if let Some(response) = metrics_response(method, target) {
+        writer.write_all(response.as_bytes()).await?;
+        return writer.shutdown().await;
+    }
+    let file = match resolve(target) {
+        Some(path) if method == "GET" || method == "HEAD" => tokio::fs::File::open(path).await.ok(),
+        _ => None,
+    };
+
+    match file {
+        Some(mut file) => {
+            let len = file.metadata().await?.len();
+            let start = range_start.filter(|&start| start <= len);
+            let header = match start {
+                Some(start) => format!(
+                    "HTTP/1.1 206 Partial Content\r\nContent-Type: application/octet-stream\r\nContent-Range: bytes {}-{}/{}\r\nContent-Length: {}\r\nConnection: close\r\n\r\n",
+                    start,
+                    len.saturating_sub(1),
+                    len,
+                    len - start
+                ),
+                None => format!(
+                    "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\nContent-Length: {}\r\nConnection: close\r\n\r\n",
+                    len
+                ),
+            };
+            writer.write_all(header.as_bytes()).await?;
+            if method == "GET" {
+                file.seek(std::io::SeekFrom::Start(start.unwrap_or(0))).await?;
+                let sent = tokio::io::copy(&mut file, &mut writer).await?;
+                METRICS.served(server, true, sent);
+            }
+        }
+        None => {
+            if method == "GET" {
+                METRICS.served(server, false, 0);
+            }
+            writer
+                .write_all(b"HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n")
+                .await?;
+        }
+    }
+
+    writer.shutdown().await
+}
+
+// Maps /buildid/<hex>/{debuginfo,executable,source/<path>} into the store
+fn debuginfod_path(root: &std::path::Path, target: &str) -> Option<std::path::PathBuf> {
+    let rest = target.strip_prefix("/buildid/")?;
+    let (build_id, artifact) = rest.split_once('/')?;
+    if build_id.is_empty() || !build_id.chars().all(|c| c.is_ascii_hexdigit()) {
+        return None;
+    }
+
+    let entry = root.join("buildid").join(build_id.to_ascii_lowercase());
+    match artifact {
+        "debuginfo" | "executable" => Some(entry.join(artifact)),
+        _ => {
+            // source/<absolute path>, the path percent-encoded or not
+            let source = percent_decode(artifact.strip_prefix("source/")?)?;
+            let relative = std::path::Path::new(source.trim_start_matches('/'));
+            let safe = relative
+                .components()
+                .all(|c| matches!(c, std::path::Component::Normal(_)));
+            if !safe {
+                return None;
+            }
+            Some(entry.join("source").join(relative))
+        }
+    }
+}
+
+// A simulated network path for local servers: every request waits `latency`
+// before it is read, and response bytes from all connections share
+// `bytes_per_second`
+pub struct SimulatedLink {
+    latency: std::time::Duration,
+    bytes_per_second: Option<u64>,
+    // When everything reserved so far has been sent
+    free_at: std::sync::Mutex<tokio::time::Instant>,
+    pub requests: std::sync::atomic::AtomicU64,
+    pub sent_bytes: std::sync::atomic::AtomicU64,
+}
+
+// Largest write paced as a unit
+const LINK_QUANTUM: usize = 16 * 1024;
+
+impl SimulatedLink {
+    pub fn new(latency: std::time::Duration, bytes_per_second: Option<u64>) -> SimulatedLink {
+        SimulatedLink {
+            latency,
+            bytes_per_second: bytes_per_second.filter(|&rate| rate > 0),
+            free_at: std::sync::Mutex::new(tokio::time::Instant::now()),
+            requests: std::sync::atomic::AtomicU64::new(0),
+            sent_bytes: std::sync::atomic::AtomicU64::new(0),
+        }
+    }
+
+    // When `bytes` queued behind everything reserved earlier have been sent
+    fn reserve(&self, bytes: usize) -> Option<tokio::time::Instant> {
+        let rate = self.bytes_per_second?;
+        let mut free_at = self.free_at.lock().unwrap_or_else(|e| e.into_inner());
+        let start = (*free_at).max(tokio::time::Instant::now());
+        *free_at = start + std::time::Duration::from_secs_f64(bytes as f64 / rate as f64);
+        Some(*free_at)
+    }
 }
 
-// Public API for CLI
-pub async fn install_package(package_name: &str) -> Result<(), PackageError> {
-    let mut pm = PackageManager::new(
-        std::path::PathBuf::from("~/.cpppm/cache"),
-        "https://registry.cpppm.org".to_string(),
-    );
-    
-    pm.install(package_name).await
+// Writes through a SimulatedLink: each write waits for its turn on the link
+struct ThrottledStream<S> {
+    inner: S,
+    link: std::sync::Arc<SimulatedLink>,
+    // The pending write's reservation
+    pacing: Option<(std::pin::Pin<Box<tokio::time::Sleep>>, usize)>,
+}
+
+impl<S: tokio::io::AsyncRead + Unpin> tokio::io::AsyncRead for ThrottledStream<S> {
+    fn poll_read(
+        self: std::pin::Pin<&mut Self>,
+        cx: &mut std::task::Context<'_>,
+        buf: &mut tokio::io::ReadBuf<'_>,
+    ) -> std::task::Poll<std::io::Result<()>> {
+        std::pin::Pin::new(&mut self.get_mut().inner).poll_read(cx, buf)
+    }
+}
+
+impl<S: tokio::io::AsyncWrite + Unpin> tokio::io::AsyncWrite for ThrottledStream<S> {
+    fn poll_write(
+        self: std::pin::Pin<&mut Self>,
+        cx: &mut std::task::Context<'_>,
+        buf: &[u8],
+    ) -> std::task::Poll<std::io::Result<usize>> {
+        use std::future::Future;
+        let this = self.get_mut();
+        let mut len = buf.len();
+        if this.pacing.is_none() {
+            len = len.min(LINK_QUANTUM);
+            if let Some(deadline) = this.link.reserve(len) {
+                this.pacing = Some((Box::pin(tokio::time::sleep_until(deadline)), len));
+            }
+        }
+        if let Some((pacing, reserved)) = &mut this.pacing {
+            std::task::ready!(pacing.as_mut().poll(cx));
+            len = len.min(*reserved);
+        }
+        let written = std::task::ready!(std::pin::Pin::new(&mut this.inner).poll_write(cx, &buf[..len]))?;
+        this.pacing = None;
+        this.link.sent_bytes.fetch_add(written as u64, std::sync::atomic::Ordering::Relaxed);
+        std::task::Poll::Ready(Ok(written))
+    }
+
+    fn poll_flush(
+        self: std::pin::Pin<&mut Self>,
+        cx: &mut std::task::Context<'_>,
+    ) -> std::task::Poll<std::io::Result<()>> {
+        std::pin::Pin::new(&mut self.get_mut().inner).poll_flush(cx)
+    }
+
+    fn poll_shutdown(
+        self: std::pin::Pin<&mut Self>,
+        cx: &mut std::task::Context<'_>,
+    ) -> std::task::Poll<std::io::Result<()>> {
+        std::pin::Pin::new(&mut self.get_mut().inner).poll_shutdown(cx)
+    }
+}
+
+// Package metadata of a fixture, in <fixture>/cpkg.json
+#[derive(Debug, Deserialize)]
+struct FixtureManifest {
+    name: String,
+    version: String,
+    #[serde(default)]
+    dependencies: Vec<String>,
+}
+
+// Local stand-in for the registry and its archive hosting, serving a fixture
+// corpus: every <fixtures>/<name>/ with a cpkg.json is packed into a tarball
+// and published with its metadata under `root`, which is then served over a
+// SimulatedLink. Used by `cpppm bench-install`, or on its own with
+// CPKG_REGISTRY pointing at it. Packages are unsigned.
+pub struct RegistryStandIn {
+    fixtures: std::path::PathBuf,
+    // Served tree: api/v1/packages/<name> and archives/<name>-<version>.tar.gz
+    root: std::path::PathBuf,
+    pub url: String,
+    pub link: std::sync::Arc<SimulatedLink>,
+}
+
+impl RegistryStandIn {
+    // Publishes every fixture and serves on 127.0.0.1:`port` (0 picks a free port)
+    pub async fn start(
+        fixtures: std::path::PathBuf,
+        root: std::path::PathBuf,
+        port: u16,
+        link: SimulatedLink,
+    ) -> Result<RegistryStandIn, PackageError> {
+        let listener = tokio::net::TcpListener::bind(("127.0.0.1", port)).await?;
+        let registry = RegistryStandIn {
+            fixtures,
+            root,
+            url: format!("http://{}", listener.local_addr()?),
+            link: std::sync::Arc::new(link),
+        };
+        for name in registry.fixture_names()? {
+            registry.publish(&name, None)?;
+        }
+
+        let (root, link) = (registry.root.clone(), registry.link.clone());
+        tokio::spawn(async move {
+            while let Ok((stream, _)) = listener.accept().await {
+                link.requests.fetch_add(1, std::sync::atomic::Ordering::Relaxed);
+                let (root, link) = (root.clone(), link.clone());
+                tokio::spawn(async move {
+                    tokio::time::sleep(link.latency).await;
+                    let stream = ThrottledStream { inner: stream, link, pacing: None };
+                    if let Err(e) = handle_file_request(stream, "registry", |target| static_path(&root, target)).await {
+                        eprintln!("registry request failed: {}", e);
+                    }
+                });
+            }
+        });
+        Ok(registry)
+    }
+
+    pub fn fixture_names(&self) -> std::io::Result<Vec<String>> {
+        let mut names = Vec::new();
+        for entry in std::fs::read_dir(&self.fixtures)? {
+            let entry = entry?;
+            if entry.path().join("cpkg.json").is_file() {
+                names.push(entry.file_name().to_string_lossy().into_owned());
+            }
+        }
+        names.sort();
+        Ok(names)
+    }
+
+    fn fixture_manifest(&self, name: &str) -> std::io::Result<FixtureManifest> {
+        let data = std::fs::read(self.fixtures.join(name).join("cpkg.json"))?;
+        serde_json::from_slice(&data).map_err(|e| std::io::Error::new(std::io::ErrorKind::InvalidData, e))
+    }
+
+    // Packs and publishes a fixture as `version`, or as its own version. The
+    // version is written into the packed cpkg.json, so every version's
+    // archive, and with it the source hash, differs.
+    pub fn publish(&self, name: &str, version: Option<&str>) -> Result<Package, PackageError> {
+        let manifest = self.fixture_manifest(name)?;
+        let version = version.unwrap_or(&manifest.version).to_string();
+        let stem = format!("{}-{}", manifest.name, version);
+        let staging = self.root.join("staging");
+        let tree = staging.join(&stem);
+        if tree.exists() {
+            std::fs::remove_dir_all(&tree)?;
+        }
+        copy_tree(&self.fixtures.join(name), &tree)?;
+        let packed = serde_json::json!({
+            "name": manifest.name,
+            "version": version,
+            "dependencies": manifest.dependencies,
+        });
+        std::fs::write(tree.join("cpkg.json"), serde_json::to_vec_pretty(&packed).unwrap_or_default())?;
+
+        let archive = self.root.join("archives").join(format!("{}.tar.gz", stem));
+        std::fs::create_dir_all(self.root.join("archives"))?;
+        let status = std::process::Command::new("tar")
+            .arg("-czf")
+            .arg(&archive)
+            .arg("-C")
+            .arg(&staging)
+            .arg(&stem)
+            .status()?;
+        if !status.success() {
+            return Err(PackageError::BuildFailed(format!("packing fixture {}", name)));
+        }
+
+        let package = Package {
+            name: manifest.name,
+            version,
+            dependencies: manifest.dependencies,
+            source_url: format!("{}/archives/{}.tar.gz", self.url, stem),
+            build_type: BuildType::CMake,
+            checksum: Some(sha256_file(&archive)?),
+            merkle_root: None,
+            chunk_index: None,
+            deltas: Vec::new(),
+            signature: None,
+            usage_requirements: UsageRequirements::default(),
+        };
+        // Renamed into place, as installers may be reading the old version
+        let metadata = self.root.join("api/v1/packages").join(&package.name);
+        std::fs::create_dir_all(self.root.join("api/v1/packages"))?;
+        let tmp = tmp_path(&metadata);
+        std::fs::write(&tmp, serde_json::to_vec_pretty(&package).unwrap_or_default())?;
+        std::fs::rename(tmp, &metadata)?;
+        Ok(package)
+    }
+}
+
+fn copy_tree(from: &std::path::Path, to: &std::path::Path) -> std::io::Result<()> {
+    std::fs::create_dir_all(to)?;
+    for entry in std::fs::read_dir(from)? {
+        let entry = entry?;
+        let target = to.join(entry.file_name());
+        if entry.file_type()?.is_dir() {
+            copy_tree(&entry.path(), &target)?;
+        } else {
+            std::fs::copy(entry.path(), target)?;
+        }
+    }
+    Ok(())
+}
+
+// End-to-end install benchmark against a RegistryStandIn. Scenarios, in
+// the order given:
+//   cold            installs `package` into an empty cache
+//   warm            installs it again
+//   update          publishes a new version of `update` and updates to it
+//   concurrent      starts `concurrency` installer processes at once on a
+//                   shared empty cache
+// The others run in this process on a PackageManager for `work`'s cache and
+// the stand-in; installer processes get the same settings in their own
+// environment. System caches, the remote cache and workers are disabled, so
+// only what the benchmark itself cached is ever hit.
+pub struct InstallBench {
+    pub fixtures: std::path::PathBuf,
+    pub work: std::path::PathBuf,
+    pub package: String,
+    pub update: String,
+    pub concurrency: usize,
+    pub scenarios: Vec<String>,
+}
+
+pub const INSTALL_SCENARIOS: [&str; 4] = ["cold", "warm", "update", "concurrent"];
+
+#[derive(Debug, Serialize)]
+pub struct ScenarioReport {
+    pub scenario: String,
+    pub wall_seconds: f64,
+    // Of this process and every child it waited for (tar, CMake, compilers,
+    // installers)
+    pub cpu_seconds: f64,
+    pub failures: usize,
+    // As seen by the registry stand-in
+    pub requests: u64,
+    pub served_bytes: u64,
+    // As counted by the installers (METRICS)
+    pub downloaded_bytes: u64,
+    pub extracted_bytes: u64,
+    pub cache_hits: std::collections::BTreeMap<String, u64>,
+    pub cache_misses: std::collections::BTreeMap<String, u64>,
+    pub builds: std::collections::BTreeMap<String, u64>,
+}
+
+// Counters at the start of a scenario
+struct ScenarioStart {
+    started: std::time::Instant,
+    cpu_seconds: f64,
+    requests: u64,
+    sent_bytes: u64,
+    samples: std::collections::BTreeMap<String, f64>,
+}
+
+impl ScenarioStart {
+    fn now(link: &SimulatedLink) -> ScenarioStart {
+        use std::sync::atomic::Ordering;
+        ScenarioStart {
+            started: std::time::Instant::now(),
+            cpu_seconds: process_cpu_seconds(),
+            requests: link.requests.load(Ordering::Relaxed),
+            sent_bytes: link.sent_bytes.load(Ordering::Relaxed),
+            samples: metric_samples(&METRICS.render()),
+        }
+    }
+
+    // `installers` holds the summed samples of installer processes
+    fn report(
+        self,
+        scenario: &str,
+        link: &SimulatedLink,
+        failures: usize,
+        installers: std::collections::BTreeMap<String, f64>,
+    ) -> ScenarioReport {
+        use std::sync::atomic::Ordering;
+        let mut samples = metric_samples(&METRICS.render());
+        for (key, value) in &mut samples {
+            *value -= self.samples.get(key).copied().unwrap_or(0.0);
+        }
+        for (key, value) in installers {
+            *samples.entry(key).or_insert(0.0) += value;
+        }
+        let value = |key: &str| samples.get(key).copied().unwrap_or(0.0) as u64;
+        ScenarioReport {
+            scenario: scenario.to_string(),
+            wall_seconds: self.started.elapsed().as_secs_f64(),
+            cpu_seconds: process_cpu_seconds() - self.cpu_seconds,
+            failures,
+            requests: link.requests.load(Ordering::Relaxed) - self.requests,
+            served_bytes: link.sent_bytes.load(Ordering::Relaxed) - self.sent_bytes,
+            downloaded_bytes: value("cpkg_downloaded_bytes_total"),
+            extracted_bytes: value("cpkg_extracted_bytes_total"),
+            cache_hits: labelled_samples(&samples, "cpkg_cache_hits_total", "cache"),
+            cache_misses: labelled_samples(&samples, "cpkg_cache_misses_total", "cache"),
+            builds: labelled_samples(&samples, "cpkg_builds_total", "outcome"),
+        }
+    }
+}
+
+// Samples of Prometheus text, keyed by name and labels
+fn metric_samples(text: &str) -> std::collections::BTreeMap<String, f64> {
+    text.lines()
+        .filter(|line| !line.starts_with('#'))
+        .filter_map(|line| {
+            let (key, value) = line.rsplit_once(' ')?;
+            Some((key.to_string(), value.parse().ok()?))
+        })
+        .collect()
+}
+
+// Non-zero samples of `name`, keyed by the value of its single `label`
+fn labelled_samples(
+    samples: &std::collections::BTreeMap<String, f64>,
+    name: &str,
+    label: &str,
+) -> std::collections::BTreeMap<String, u64> {
+    let prefix = format!("{}{{{}=\"", name, label);
+    samples
+        .iter()
+        .filter(|(_, value)| **value > 0.0)
+        .filter_map(|(key, value)| Some((key.strip_prefix(&prefix)?.strip_suffix("\"}")?.to_string(), *value as u64)))
+        .collect()
+}
+
+// CPU time of this process and of the children it has waited for
+fn process_cpu_seconds() -> f64 {
+    let seconds = |who| {
+        let mut usage: libc::rusage = unsafe { std::mem::zeroed() };
+        unsafe { libc::getrusage(who, &mut usage) };
+        let micros = |tv: libc::timeval| tv.tv_sec as f64 * 1e6 + tv.tv_usec as f64;
+        (micros(usage.ru_utime) + micros(usage.ru_stime)) / 1e6
+    };
+    seconds(libc::RUSAGE_SELF) + seconds(libc::RUSAGE_CHILDREN)
+}
+
+impl InstallBench {
+    pub async fn run(&self, link: SimulatedLink) -> Result<Vec<ScenarioReport>, PackageError> {
+        for dir in ["registry", "cache", "prefix", "cache-concurrent", "prefix-concurrent", "installers"] {
+            let dir = self.work.join(dir);
+            if dir.exists() {
+                std::fs::remove_dir_all(&dir)?;
+            }
+        }
+        let registry = RegistryStandIn::start(self.fixtures.clone(), self.work.join("registry"), 0, link).await?;
+        let options = BuildOptions {
+            install_prefix: Some(self.work.join("prefix")),
+            ..Default::default()
+        };
+
+        let mut reports = Vec::new();
+        for scenario in &self.scenarios {
+            let start = ScenarioStart::now(&registry.link);
+            let (failures, installers) = match scenario.as_str() {
+                "cold" => {
+                    clear_build_trees(&registry)?;
+                    (self.install(&registry, options.clone()).await, Default::default())
+                }
+                "warm" => (self.install(&registry, options.clone()).await, Default::default()),
+                "update" => {
+                    let version = format!("{}.1", registry.fixture_manifest(&self.update)?.version);
+                    registry.publish(&self.update, Some(&version))?;
+                    match self.manager(&registry, options.clone()).update(&self.update).await {
+                        Ok(_) => (0, Default::default()),
+                        Err(e) => {
+                            eprintln!("update of {} failed: {}", self.update, e);
+                            (1, Default::default())
+                        }
+                    }
+                }
+                "concurrent" => {
+                    clear_build_trees(&registry)?;
+                    self.install_concurrently(&registry).await?
+                }
+                other => {
+                    eprintln!("unknown scenario {}", other);
+                    continue;
+                }
+            };
+            reports.push(start.report(scenario, &registry.link, failures, installers));
+        }
+        Ok(reports)
+    }
+
+    fn manager(&self, registry: &RegistryStandIn, options: BuildOptions) -> PackageManager {
+        PackageManager::new(self.work.join("cache"), registry.url.clone())
+            .isolated()
+            .with_build_options(options)
+    }
+
+    async fn install(&self, registry: &RegistryStandIn, options: BuildOptions) -> usize {
+        match self.manager(registry, options).install(&self.package).await {
+            Ok(()) => 0,
+            Err(e) => {
+                eprintln!("install of {} failed: {}", self.package, e);
+                1
+            }
+        }
+    }
+
+    // Installer processes of this binary, started together; their counters
+    // come from the metrics textfiles they write on exit and their output
+    // goes to installers/<n>.log
+    async fn install_concurrently(
+        &self,
+        registry: &RegistryStandIn,
+    ) -> Result<(usize, std::collections::BTreeMap<String, f64>), PackageError> {
+        let exe = std::env::current_exe()?;
+        let dir = self.work.join("installers");
+        std::fs::create_dir_all(&dir)?;
+        let mut installers = Vec::new();
+        for i in 0..self.concurrency {
+            let log = std::fs::File::create(dir.join(format!("{}.log", i)))?;
+            let child = tokio::process::Command::new(&exe)
+                .args(["install", self.package.as_str(), "--prefix"])
+                .arg(self.work.join("prefix-concurrent"))
+                .env("CPKG_REGISTRY", &registry.url)
+                .env("CPKG_CACHE_DIR", self.work.join("cache-concurrent"))
+                .env("CPKG_SYSTEM_CACHES", "")
+                .env_remove(REMOTE_CACHE_ENV)
+                .env_remove(WORKERS_ENV)
+                .env_remove("CPKG_TRACE")
+                .env("CPKG_METRICS_TEXTFILE", dir.join(format!("{}.prom", i)))
+                .stdin(std::process::Stdio::null())
+                .stdout(log.try_clone()?)
+                .stderr(log)
+                .spawn()?;
+            installers.push(child);
+        }
+
+        let mut failures = 0;
+        for installer in &mut installers {
+            if !installer.wait().await?.success() {
+                failures += 1;
+            }
+        }
+        let mut samples = std::collections::BTreeMap::new();
+        for i in 0..self.concurrency {
+            let Ok(text) = std::fs::read_to_string(dir.join(format!("{}.prom", i))) else { continue };
+            for (key, value) in metric_samples(&text) {
+                *samples.entry(key).or_insert(0.0) += value;
+            }
+        }
+        Ok((failures, samples))
+    }
+}
+
+// Native build trees outlive the cache, so a scenario on an empty cache
+// removes those of the fixtures to configure from scratch
+fn clear_build_trees(registry: &RegistryStandIn) -> std::io::Result<()> {
+    for name in registry.fixture_names()? {
+        let _ = std::fs::remove_dir_all(std::env::temp_dir().join("cpppm_build").join(name));
+    }
+    Ok(())
+}
+
+// Maps a request target onto `root`, refusing anything that escapes it
+fn static_path(root: &std::path::Path, target: &str) -> Option<std::path::PathBuf> {
+    let path = percent_decode(target.split('?').next()?)?;
+    let relative = std::path::Path::new(path.trim_start_matches('/'));
+    let safe = relative
+        .components()
+        .all(|c| matches!(c, std::path::Component::Normal(_)));
+    if !safe || relative.as_os_str().is_empty() {
+        return None;
+    }
+    Some(root.join(relative))
+}
+
+fn percent_decode(input: &str) -> Option<String> {
+    let bytes = input.as_bytes();
+    let mut decoded = Vec::with_capacity(bytes.len());
+    let mut i = 0;
+    while i < bytes.len() {
+        if bytes[i] == b'%' {
+            let hex = input.get(i + 1..i + 3)?;
+            decoded.push(u8::from_str_radix(hex, 16).ok()?);
+            i += 3;
+        } else {
+            decoded.push(bytes[i]);
+            i += 1;
+        }
+    }
+    String::from_utf8(decoded).ok()
+}
+
+// Relocation counts and LD_DEBUG=statistics timings for an executable, as
+// collected by the native StartupProfiler
+pub fn startup_report(executable: &str) -> Result<serde_json::Value, PackageError> {
+    let path = std::ffi::CString::new(executable)
+        .map_err(|_| std::io::Error::new(std::io::ErrorKind::InvalidInput, "invalid path"))?;
+    let report = unsafe { std::ffi::CStr::from_ptr(cpp_startup_report(path.as_ptr())) };
+    let report: serde_json::Value = serde_json::from_slice(report.to_bytes())
+        .map_err(|e| std::io::Error::new(std::io::ErrorKind::InvalidData, e))?;
+    if let Some(error) = report["error"].as_str() {
+        return Err(std::io::Error::new(
+            std::io::ErrorKind::Other,
+            format!("cannot profile {}: {}", executable, error),
+        )
+        .into());
+    }
+    Ok(report)
+}
+
+fn print_startup_comparison(before: &serde_json::Value, after: &serde_json::Value) {
+    println!("{:<40} {:>14} {:>14} {:>10}", "metric", "before", "after", "change");
+    let mut rows: Vec<(String, u64, u64)> = Vec::new();
+    for key in ["relative", "symbolic", "plt", "relr_words"] {
+        rows.push((
+            format!("relocations: {}", key),
+            before["total"][key].as_u64().unwrap_or(0),
+            after["total"][key].as_u64().unwrap_or(0),
+        ));
+    }
+    if let Some(stats) = after["loader_statistics"].as_object() {
+        for (key, value) in stats {
+            rows.push((
+                key.clone(),
+                before["loader_statistics"][key].as_u64().unwrap_or(0),
+                value.as_u64().unwrap_or(0),
+            ));
+        }
+    }
+
+    for (metric, old, new) in rows {
+        let change = if old == 0 {
+            "-".to_string()
+        } else {
+            format!("{:+.1}%", (new as f64 - old as f64) * 100.0 / old as f64)
+        };
+        println!("{:<40} {:>14} {:>14} {:>10}", metric, old, new, change);
+    }
+}
+
+fn flag_value<'a>(args: &'a [String], flag: &str) -> Option<&'a str> {
+    args.iter()
+        .position(|arg| arg == flag)
+        .and_then(|i| args.get(i + 1))
+        .map(|value| value.as_str())
+}
+
+fn flag_values(args: &[String], flag: &str) -> Vec<String> {
+    args.windows(2)
+        .filter(|pair| pair[0] == flag)
+        .map(|pair| pair[1].clone())
+        .collect()
+}
+
+// --latency-ms and --bandwidth-kbps (kilobits per second; unlimited if unset)
+fn simulated_link(args: &[String]) -> SimulatedLink {
+    let latency = flag_value(args, "--latency-ms").and_then(|ms| ms.parse().ok()).unwrap_or(0);
+    let kbps: Option<u64> = flag_value(args, "--bandwidth-kbps").and_then(|kbps| kbps.parse().ok());
+    SimulatedLink::new(std::time::Duration::from_millis(latency), kbps.map(|kbps| kbps * 125))
 }
 
 #[tokio::main]
 async fn main() -> Result<(), PackageError> {
     // CLI interface
     let args: Vec<String> = std::env::args().collect();
+    let _metrics = MetricsGuard::from_env();
+    let _trace = args.get(1).and_then(|command| Trace::from_env(command));
+    let _profile = SelfProfile::from_env();
     
-    if args.len() < 3 {
-        eprintln!("Usage: cpppm install <package_name>");
+    if args.len() < 2 {
+        eprintln!("Usage: cpppm install <package_name> [--split-debug] [--profile startup]");
+        eprintln!("                     [--sanitizers plain,asan,tsan,ubsan]");
+        eprintln!("                     [--build-type <type>] [--define NAME[=VALUE]]...");
+        eprintln!("                     [--compile-flag <flag>]... [--link-flag <flag>]...");
+        eprintln!("                     [--lockfile <path>] [--remote-cache <url>] [--worker <addr>]...");
+        eprintln!("                     [--package-jobs <n>] [--prefix <dir>] [--fail-fast]");
+        eprintln!("       cpppm plan <package_name> [--package-jobs <n>] [--worker <addr>]...");
+        eprintln!("       cpppm history [<package_name>] [--regressions]");
+        eprintln!("       cpppm debuginfod [--port <port>]");
+        eprintln!("       cpppm startup-report <executable> [--baseline <executable>]");
+        eprintln!("       cpppm bundle <package_name> [--output <dir>] [--thin] [--no-index]");
+        eprintln!("       cpppm verify [<prefix>] [--store]");
+        eprintln!("       cpppm trust <key_id> <ed25519_public_key_hex>");
+        eprintln!("       cpppm chunk-manifest <archive> [--chunk-size <bytes>]");
+        eprintln!("       cpppm chunk <archive> [--store <dir>] [--store-url <url>]");
+        eprintln!("       cpppm chunk-server <dir> [--port <port>]");
+        eprintln!("       cpppm update <package_name>");
+        eprintln!("       cpppm pack <dir> <output.cpkg> [--level <n>]");
+        eprintln!("       cpppm pack --store");
+        eprintln!("       cpppm list <archive.cpkg>");
+        eprintln!("       cpppm materialize <archive.cpkg> <prefix> [--merkle-root <root>] [<path>...]");
+        eprintln!("       cpppm dict <train|bench> [metadata|manifests|logs]");
+        eprintln!("       cpppm gc [--budget <cache>=<size>]... [--dry-run] [--background]");
+        eprintln!("       cpppm delta <old_archive> <new_archive> --from-version <version> [--url <url>]");
+        eprintln!("       cpppm cache-layers");
+        eprintln!("       cpppm cache-server <dir> [--bind <addr>] [--port <port>]");
+        eprintln!("       cpppm cc-launcher [--remote-cache <url>] [--workers <addr,...>] -- <compiler> <args>...");
+        eprintln!("       cpppm cache-upload <spool_dir> --remote-cache <url>");
+        eprintln!("       cpppm compile-worker [--listen tcp:<host>:<port>|unix:<path>] [--slots <n>]");
+        eprintln!("                            [--metrics-port <port>]");
+        eprintln!("       cpppm workers [--workers <addr,...>]");
+        eprintln!("       cpppm registry-standin <fixtures> [--root <dir>] [--port <port>]");
+        eprintln!("                              [--latency-ms <ms>] [--bandwidth-kbps <kbit/s>]");
+        eprintln!("       cpppm bench-install [--fixtures <dir>] [--work <dir>] [--package <name>]");
+        eprintln!("                           [--update <name>] [--concurrency <n>]");
+        eprintln!("                           [--scenarios cold,warm,update,concurrent]");
+        eprintln!("                           [--latency-ms <ms>] [--bandwidth-kbps <kbit/s>] [--output <file>]");
         std::process::exit(1);
     }
     
     match args[1].as_str() {
-        "install" => {
-            install_package(&args[2]).await?;
+        "install" if args.len() >= 3 => {
+            let options = BuildOptions {
+                split_debug_info: args.iter().any(|arg| arg == "--split-debug"),
+                profile: flag_value(&args, "--profile").map(str::to_string),
+                // "plain" selects the uninstrumented variant; "asan+ubsan" combines
+                sanitizers: flag_value(&args, "--sanitizers")
+                    .map(|list| {
+                        list.split(',')
+                            .map(|v| if v == "plain" { String::new() } else { v.replace('+', ",") })
+                            .collect()
+                    })
+                    .unwrap_or_default(),
+                build_type: flag_value(&args, "--build-type").map(str::to_string),
+                root_requirements: UsageRequirements {
+                    defines: flag_values(&args, "--define"),
+                    compile_flags: flag_values(&args, "--compile-flag"),
+                    link_flags: flag_values(&args, "--link-flag"),
+                },
+                lockfile: flag_value(&args, "--lockfile").map(std::path::PathBuf::from),
+                remote_cache: flag_value(&args, "--remote-cache").map(str::to_string),
+                workers: flag_values(&args, "--worker"),
+                package_jobs: flag_value(&args, "--package-jobs").and_then(|n| n.parse().ok()),
+                install_prefix: flag_value(&args, "--prefix").map(std::path::PathBuf::from),
+                fail_fast: args.iter().any(|arg| arg == "--fail-fast"),
+            };
+            install_package_with_options(&args[2], options).await?;
             println!("Package {} installed successfully", args[2]);
+            spawn_background_gc(&default_cache_dir());
+        }
+        "update" if args.len() >= 3 => {
+            let mut pm = PackageManager::new(
+                default_cache_dir(),
+                default_registry_url(),
+            );
+            match pm.update(&args[2]).await? {
+                Some((Some(old), new)) => println!("Updated {} from {} to {}", args[2], old, new),
+                Some((None, new)) => println!("Installed {} {}", args[2], new),
+                None => println!("{} is up to date", args[2]),
+            }
+            spawn_background_gc(&default_cache_dir());
+        }
+        "delta" if args.len() >= 4 => {
+            // Publisher side: writes <new_archive>.from-<version>.zst and prints
+            // the entry for the package's `deltas` list
+            let Some(from_version) = flag_value(&args, "--from-version") else {
+                eprintln!("delta requires --from-version");
+                std::process::exit(1);
+            };
+            let (old, new) = (std::path::Path::new(&args[2]), std::path::Path::new(&args[3]));
+            let mut output = new.as_os_str().to_owned();
+            output.push(format!(".from-{}.zst", from_version));
+            let output = std::path::PathBuf::from(output);
+
+            let status = std::process::Command::new("zstd")
+                .args(["-19", "-q", "-f", "--long=31"])
+                .arg(format!("--patch-from={}", old.display()))
+                .arg(new)
+                .arg("-o")
+                .arg(&output)
+                .status()?;
+            if !status.success() {
+                return Err(PackageError::BuildFailed(format!("zstd delta for {}", args[3])));
+            }
+
+            let delta = PackageDelta {
+                from_version: from_version.to_string(),
+                from_checksum: sha256_file(old)?,
+                url: flag_value(&args, "--url").map(str::to_string).unwrap_or_else(|| {
+                    output.file_name().unwrap_or_default().to_string_lossy().into_owned()
+                }),
+                size: std::fs::metadata(&output)?.len(),
+            };
+            println!("{}", serde_json::to_string_pretty(&delta).unwrap_or_default());
+        }
+        "pack" if args.iter().any(|arg| arg == "--store") => {
+            let pm = PackageManager::new(
+                default_cache_dir(),
+                default_registry_url(),
+            );
+            for archive in pm.pack_artifact_store(19)? {
+                println!("{}", archive.display());
+            }
+        }
+        "pack" if args.len() >= 4 => {
+            let level = flag_value(&args, "--level")
+                .and_then(|level| level.parse().ok())
+                .unwrap_or(19);
+            let index = pack_archive(std::path::Path::new(&args[2]), std::path::Path::new(&args[3]), level)?;
+            println!("Packed {} files into {}", index.files.len(), args[3]);
+        }
+        "list" if args.len() >= 3 => {
+            let archive = SeekableArchive::open(std::path::Path::new(&args[2]))?;
+            for entry in &archive.index.files {
+                let compressed: u64 = entry.frames.iter().map(|frame| frame.compressed).sum();
+                match &entry.link {
+                    Some(link) => println!("{:o} {:>12} {:>12} {} -> {}", entry.mode, 0, 0, entry.path, link),
+                    None if entry.dir => println!("{:o} {:>12} {:>12} {}/", entry.mode, 0, 0, entry.path),
+                    None => println!(
+                        "{:o} {:>12} {:>12} {}",
+                        entry.mode, entry.size, compressed, entry.path
+                    ),
+                }
+            }
+        }
+        "materialize" if args.len() >= 4 => {
+            let path = std::path::Path::new(&args[2]);
+            let archive = match flag_value(&args, "--merkle-root") {
+                // Checked against <archive>.merkle, as published by chunk-manifest
+                Some(root) => {
+                    let mut manifest_path = path.as_os_str().to_os_string();
+                    manifest_path.push(".merkle");
+                    let manifest = serde_json::from_slice(&std::fs::read(&manifest_path)?)
+                        .map_err(|e| std::io::Error::new(std::io::ErrorKind::InvalidData, e))?;
+                    SeekableArchive::open_verified(path, manifest, root)?
+                }
+                None => SeekableArchive::open(path)?,
+            };
+            let mut select = Vec::new();
+            let mut rest = args[4..].iter();
+            while let Some(arg) = rest.next() {
+                if arg == "--merkle-root" {
+                    rest.next();
+                } else {
+                    select.push(arg.clone());
+                }
+            }
+            let written = archive.extract(std::path::Path::new(&args[3]), &select)?;
+            println!("Materialized {} files into {}", written, args[3]);
+        }
+        "gc" => {
+            let manager = CacheManager::new(&default_cache_dir());
+            let mut budgets = manager.budgets();
+            let overrides = flag_values(&args, "--budget");
+            for budget in &overrides {
+                let parsed = budget
+                    .split_once('=')
+                    .and_then(|(cache, size)| Some((CacheKind::parse(cache)?, parse_size(size)?)));
+                let Some((kind, bytes)) = parsed else {
+                    eprintln!("Invalid budget: {} (expected <cache>=<size>)", budget);
+                    std::process::exit(1);
+                };
+                budgets.insert(kind, bytes);
+            }
+            if !overrides.is_empty() {
+                manager.save_budgets(&budgets)?;
+            }
+
+            let background = args.iter().any(|arg| arg == "--background");
+            let deadline = background.then(|| std::time::Instant::now() + GC_SLICE);
+            match manager.collect(&budgets, deadline, args.iter().any(|arg| arg == "--dry-run"))? {
+                Some(reports) if !background => {
+                    for report in reports {
+                        println!(
+                            "{:<10} {:>14} -> {:>14} bytes (budget {}), {} evicted, {} pinned",
+                            report.cache, report.before, report.after, report.budget, report.evicted, report.pinned
+                        );
+                    }
+                }
+                Some(_) => {}
+                None => println!("Another garbage collection is running"),
+            }
+        }
+        "cache-server" if args.len() >= 3 => {
+            let port = flag_value(&args, "--port")
+                .and_then(|port| port.parse().ok())
+                .unwrap_or(9090);
+            let bind = flag_value(&args, "--bind").unwrap_or("127.0.0.1");
+            serve_remote_cache(std::path::PathBuf::from(&args[2]), bind, port).await?;
+        }
+        "cc-launcher" => {
+            let Some(separator) = args.iter().position(|arg| arg == "--").filter(|&i| i + 1 < args.len()) else {
+                eprintln!("Usage: cpppm cc-launcher [--remote-cache <url>] [--workers <addr,...>] -- <compiler> <args>...");
+                std::process::exit(1);
+            };
+            let options = &args[..separator];
+            let cache = flag_value(options, "--remote-cache").map(RemoteCache::new);
+            let workers = flag_value(options, "--workers").map(WorkerAddress::parse_list).unwrap_or_default();
+            let code = run_compiler_launcher(cache.as_ref(), &workers, &args[separator + 1..]).await;
+            // Exiting skips the textfile guard, which is the installer's
+            // file; the installer picks the lookups up from the log instead
+            METRICS.append_launcher_log(&default_cache_dir());
+            std::process::exit(code);
+        }
+        "cache-upload" if args.len() >= 3 => {
+            let Some(cache) = flag_value(&args, "--remote-cache").map(RemoteCache::new) else {
+                eprintln!("cache-upload requires --remote-cache");
+                std::process::exit(1);
+            };
+            upload_spooled_action(&cache, std::path::Path::new(&args[2])).await;
+        }
+        "compile-worker" => {
+            let listen = flag_value(&args, "--listen").unwrap_or("tcp:127.0.0.1:3632");
+            let Some(listen) = WorkerAddress::parse(listen) else {
+                eprintln!("Invalid listen address: {}", listen);
+                std::process::exit(1);
+            };
+            let slots = flag_value(&args, "--slots")
+                .and_then(|slots| slots.parse().ok())
+                .unwrap_or_else(|| std::thread::available_parallelism().map_or(1, |n| n.get()));
+            // Metrics are served next to a TCP worker, or on loopback
+            if let Some(port) = flag_value(&args, "--metrics-port").and_then(|port| port.parse().ok()) {
+                let host = match &listen {
+                    WorkerAddress::Tcp(address) => address.rsplit_once(':').map_or(address.as_str(), |(host, _)| host),
+                    WorkerAddress::Unix(_) => "127.0.0.1",
+                };
+                let host = host.trim_start_matches('[').trim_end_matches(']').to_string();
+                tokio::spawn(async move {
+                    if let Err(e) = serve_metrics(host, port).await {
+                        eprintln!("metrics server failed: {}", e);
+                    }
+                });
+            }
+            serve_compile_worker(listen, slots.max(1)).await?;
+        }
+        "workers" => {
+            let workers = match flag_value(&args, "--workers") {
+                Some(list) => WorkerAddress::parse_list(list),
+                None => WorkerAddress::from_env(),
+            };
+            for worker in &workers {
+                match worker.load().await {
+                    Some((active, slots)) => println!("{:<32} {}/{} slots busy", worker.to_string(), active, slots),
+                    None => println!("{:<32} unreachable", worker.to_string()),
+                }
+            }
+        }
+        "plan" if args.len() >= 3 => {
+            let pm = PackageManager::new(
+                default_cache_dir(),
+                default_registry_url(),
+            )
+            .with_build_options(BuildOptions {
+                workers: flag_values(&args, "--worker"),
+                package_jobs: flag_value(&args, "--package-jobs").and_then(|n| n.parse().ok()),
+                ..Default::default()
+            });
+            let plan = pm.plan(&args[2]).await?;
+            println!("Machine class {}, {} package(s) at once", plan.machine, plan.jobs);
+            println!("{:<32} {:>10} {:>10} {:>10}  {}", "package", "start", "finish", "estimate", "basis");
+            for (build, estimate) in &plan.builds {
+                match estimate {
+                    Some(estimate) => println!(
+                        "{:<32} {:>10} {:>10} {:>10}  {} ({} builds)",
+                        build.package,
+                        format_seconds(build.start),
+                        format_seconds(build.finish),
+                        format_seconds(estimate.seconds),
+                        estimate.basis,
+                        estimate.samples
+                    ),
+                    None => println!(
+                        "{:<32} {:>10} {:>10} {:>10}  no history",
+                        build.package,
+                        format_seconds(build.start),
+                        format_seconds(build.finish),
+                        "?"
+                    ),
+                }
+            }
+            println!("Downloads: {}", format_seconds(plan.download_seconds));
+            println!("Estimated install time: {}", format_seconds(plan.total_seconds()));
+        }
+        "registry-standin" if args.len() >= 3 => {
+            let root = flag_value(&args, "--root")
+                .map(std::path::PathBuf::from)
+                .unwrap_or_else(|| std::env::temp_dir().join("cpppm_registry"));
+            let port = flag_value(&args, "--port").and_then(|p| p.parse().ok()).unwrap_or(8090);
+            let registry =
+                RegistryStandIn::start(std::path::PathBuf::from(&args[2]), root, port, simulated_link(&args)).await?;
+            println!(
+                "Serving {} fixture packages on {} (CPKG_REGISTRY={})",
+                registry.fixture_names()?.len(),
+                registry.url,
+                registry.url
+            );
+            std::future::pending::<()>().await;
+        }
+        "bench-install" => {
+            let bench = InstallBench {
+                fixtures: std::path::PathBuf::from(flag_value(&args, "--fixtures").unwrap_or("benches/fixtures")),
+                work: flag_value(&args, "--work")
+                    .map(std::path::PathBuf::from)
+                    .unwrap_or_else(|| std::env::temp_dir().join("cpppm_bench_install")),
+                package: flag_value(&args, "--package").unwrap_or("greet").to_string(),
+                update: flag_value(&args, "--update").unwrap_or("textutil").to_string(),
+                concurrency: flag_value(&args, "--concurrency").and_then(|n| n.parse().ok()).unwrap_or(64),
+                scenarios: flag_value(&args, "--scenarios")
+                    .map(|list| list.split(',').map(str::to_string).collect())
+                    .unwrap_or_else(|| INSTALL_SCENARIOS.map(str::to_string).to_vec()),
+            };
+            let reports = bench.run(simulated_link(&args)).await?;
+            println!(
+                "{:<12} {:>8} {:>8} {:>8} {:>12} {:>12} {:>6} {:>6} {:>6} {:>6} {:>6}",
+                "scenario", "wall", "cpu", "requests", "served", "downloaded", "hits", "misses", "built", "cached", "failed"
+            );
+            for report in &reports {
+                println!(
+                    "{:<12} {:>8} {:>8} {:>8} {:>12} {:>12} {:>6} {:>6} {:>6} {:>6} {:>6}",
+                    report.scenario,
+                    format!("{:.2}s", report.wall_seconds),
+                    format!("{:.2}s", report.cpu_seconds),
+                    report.requests,
+                    report.served_bytes,
+                    report.downloaded_bytes,
+                    report.cache_hits.values().sum::<u64>(),
+                    report.cache_misses.values().sum::<u64>(),
+                    report.builds.get("built").copied().unwrap_or(0),
+                    report.builds.get("cached").copied().unwrap_or(0),
+                    report.failures
+                );
+            }
+            if let Some(output) = flag_value(&args, "--output") {
+                let results = serde_json::json!({
+                    "package": bench.package,
+                    "latency_ms": flag_value(&args, "--latency-ms").and_then(|ms| ms.parse::<u64>().ok()).unwrap_or(0),
+                    "bandwidth_kbps": flag_value(&args, "--bandwidth-kbps").and_then(|k| k.parse::<u64>().ok()),
+                    "concurrency": bench.concurrency,
+                    "scenarios": reports,
+                });
+                std::fs::write(output, serde_json::to_vec_pretty(&results).unwrap_or_default())?;
+            }
+            if reports.iter().any(|report| report.failures > 0) {
+                std::process::exit(1);
+            }
+        }
+        "history" => {
+            let history = BuildHistory::load(&default_cache_dir());
+            let package = args.get(2).filter(|arg| !arg.starts_with("--"));
+            let regressions = args.iter().any(|arg| arg == "--regressions");
+            for record in history.records() {
+                if package.is_some_and(|p| *p != record.package) || (regressions && !record.regression) {
+                    continue;
+                }
+                let stages: Vec<String> = record
+                    .stages
+                    .iter()
+                    .map(|(stage, stats)| format!("{}={}", stage, format_seconds(stats.seconds)))
+                    .collect();
+                println!(
+                    "{} {:<24} {:<12} {} {:>10}{}{}  {}",
+                    record.timestamp,
+                    record.package,
+                    record.version,
+                    record.machine,
+                    format_seconds(record.total),
+                    if record.cached { " cached" } else { "" },
+                    if record.regression { " REGRESSION" } else { "" },
+                    stages.join(" ")
+                );
+            }
+        }
+        "cache-layers" => {
+            let layers = CacheLayers::from_env(default_cache_dir());
+            let downloads = layers.index("downloads");
+            let artifacts: Vec<std::path::PathBuf> = layers
+                .index("artifacts")
+                .into_keys()
+                .flat_map(|package| {
+                    layers
+                        .index(&format!("artifacts/{}", package))
+                        .into_iter()
+                        .filter(|(name, _)| !name.ends_with(".cpkg"))
+                        .map(|(_, layer)| layer)
+                        .collect::<Vec<_>>()
+                })
+                .collect();
+            for layer in layers.all() {
+                println!(
+                    "{} ({}): {} downloads, {} artifacts",
+                    layer.display(),
+                    if layer == layers.user { "writable" } else { "read-only" },
+                    downloads.values().filter(|served| served.as_path() == layer).count(),
+                    artifacts.iter().filter(|served| served.as_path() == layer).count()
+                );
+            }
+        }
+        "dict" if args.len() >= 3 => {
+            let kinds: Vec<ObjectKind> = match args.get(3) {
+                Some(name) => match ObjectKind::parse(name) {
+                    Some(kind) => vec![kind],
+                    None => {
+                        eprintln!("Unknown object kind: {}", name);
+                        std::process::exit(1);
+                    }
+                },
+                None => ObjectKind::ALL.to_vec(),
+            };
+            let cache_dir = default_cache_dir();
+            for kind in kinds {
+                let store = ObjectStore::new(&cache_dir, kind);
+                match args[2].as_str() {
+                    "train" => match store.train()? {
+                        Some(version) => println!("{}: trained dictionary v{}", kind.name(), version),
+                        None => println!("{}: not enough objects to train", kind.name()),
+                    },
+                    "bench" => {
+                        println!("{} ({} objects)", kind.name(), store.keys()?.len());
+                        for result in benchmark_object_store(&store)? {
+                            println!(
+                                "  {:<14} {:>12} bytes {:>10.1} MB/s",
+                                result.codec, result.bytes, result.decode_mb_per_s
+                            );
+                        }
+                    }
+                    other => {
+                        eprintln!("Unknown dict command: {}", other);
+                        std::process::exit(1);
+                    }
+                }
+            }
+        }
+        "debuginfod" => {
+            let port = flag_value(&args, "--port")
+                .and_then(|port| port.parse().ok())
+                .unwrap_or(8002);
+            let pm = PackageManager::new(
+                default_cache_dir(),
+                default_registry_url(),
+            );
+            serve_debuginfo(pm.debug_store_dir(), port).await?;
+        }
+        "bundle" if args.len() >= 3 => {
+            let pm = PackageManager::new(
+                default_cache_dir(),
+                default_registry_url(),
+            );
+            let output_dir = pm
+                .bundle(
+                    &args[2],
+                    flag_value(&args, "--output").map(std::path::PathBuf::from),
+                    args.iter().any(|arg| arg == "--thin"),
+                    !args.iter().any(|arg| arg == "--no-index"),
+                )
+                .await?;
+            println!(
+                "Bundle written to {} (find_package({} CONFIG PATHS {}))",
+                output_dir.display(),
+                args[2],
+                output_dir.display()
+            );
+        }
+        "trust" if args.len() >= 4 => {
+            let pm = PackageManager::new(
+                default_cache_dir(),
+                default_registry_url(),
+            );
+            pm.trust_key(&args[2], &args[3])?;
+            println!("Trusting key {}", args[2]);
+        }
+        "verify" => {
+            let pm = PackageManager::new(
+                default_cache_dir(),
+                default_registry_url(),
+            );
+            let report = if args.iter().any(|arg| arg == "--store") {
+                pm.verify_store()?
+            } else {
+                pm.verify_installed(args.get(2).map(std::path::Path::new))?
+            };
+            for path in &report.corrupted {
+                eprintln!("corrupted: {}", path);
+            }
+            for path in &report.missing {
+                eprintln!("missing: {}", path);
+            }
+            println!(
+                "{} verified, {} corrupted, {} missing",
+                report.verified,
+                report.corrupted.len(),
+                report.missing.len()
+            );
+            if !report.is_ok() {
+                std::process::exit(1);
+            }
+        }
+        "chunk-manifest" if args.len() >= 3 => {
+            // Publisher side: writes <archive>.merkle and prints the root to sign
+            let archive = std::path::PathBuf::from(&args[2]);
+            let chunk_size = flag_value(&args, "--chunk-size")
+                .and_then(|size| size.parse().ok())
+                .filter(|&size| size > 0)
+                .unwrap_or(DEFAULT_CHUNK_SIZE);
+            let manifest = ChunkManifest::for_file(&archive, chunk_size)?;
+            let mut path = archive.into_os_string();
+            path.push(".merkle");
+            std::fs::write(&path, serde_json::to_vec(&manifest).unwrap_or_default())?;
+            println!("{}", manifest.root().unwrap_or_default());
+        }
+        "chunk" if args.len() >= 3 => {
+            // Publisher side: chunks the uncompressed tarball into a chunk
+            // store, writes <archive>.caidx and prints its digest for the index
+            let archive = std::path::PathBuf::from(&args[2]);
+            let store_dir = flag_value(&args, "--store")
+                .map(std::path::PathBuf::from)
+                .unwrap_or_else(|| archive.with_file_name("chunks"));
+            let store_url = flag_value(&args, "--store-url").unwrap_or("chunks/");
+            let store = ChunkStore::new(store_dir);
+
+            let mut magic = [0u8; 2];
+            let gzipped = std::io::Read::read_exact(&mut std::fs::File::open(&archive)?, &mut magic)
+                .map_or(false, |_| magic == [0x1f, 0x8b]);
+            let (index, reused) = if gzipped {
+                let mut gunzip = std::process::Command::new("gzip")
+                    .arg("-dc")
+                    .arg(&archive)
+                    .stdout(std::process::Stdio::piped())
+                    .spawn()?;
+                let stdout = gunzip.stdout.take().expect("piped stdout");
+                let built = ChunkIndex::build(std::io::BufReader::new(stdout), &store, store_url)?;
+                if !gunzip.wait()?.success() {
+                    return Err(PackageError::Extraction(args[2].clone()));
+                }
+                built
+            } else {
+                ChunkIndex::build(std::fs::File::open(&archive)?, &store, store_url)?
+            };
+
+            let body = serde_json::to_vec(&index).unwrap_or_default();
+            let mut path = archive.into_os_string();
+            path.push(".caidx");
+            std::fs::write(&path, &body)?;
+            eprintln!(
+                "{} chunks, {} already in the store, {} bytes",
+                index.chunks.len(),
+                reused,
+                index.total_size
+            );
+            println!("{}", to_hex(&sha2::Sha256::digest(&body)));
+        }
+        "chunk-server" if args.len() >= 3 => {
+            let port = flag_value(&args, "--port")
+                .and_then(|port| port.parse().ok())
+                .unwrap_or(8003);
+            serve_directory(std::path::PathBuf::from(&args[2]), port).await?;
+        }
+        "startup-report" if args.len() >= 3 => {
+            let report = startup_report(&args[2])?;
+            match flag_value(&args, "--baseline") {
+                Some(baseline) => print_startup_comparison(&startup_report(baseline)?, &report),
+                None => println!("{}", serde_json::to_string_pretty(&report).unwrap_or_default()),
+            }
         }
         _ => {
             eprintln!("Unknown command: {}", args[1]);
@@ -216,4 +7764,553 @@ async fn main() -> Result<(), PackageError> {
     }
     
     Ok(())
-}
\ No newline at end of file
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    // Installers of one package share its source and build trees. While the
+    // trees are locked every installer must wait; once released, one builds
+    // each package and the rest deploy what it published.
+    #[tokio::test(flavor = "multi_thread")]
+    async fn concurrent_installs_build_each_package_once() {
+        const INSTALLERS: usize = 64;
+        let fixtures = std::path::Path::new(env!("CARGO_MANIFEST_DIR")).join("benches").join("fixtures");
+        let work = std::env::temp_dir().join(format!("cpkg-concurrent-{}", std::process::id()));
+        let _ = std::fs::remove_dir_all(&work);
+        let registry = RegistryStandIn::start(
+            fixtures,
+            work.join("registry"),
+            0,
+            SimulatedLink::new(std::time::Duration::ZERO, None),
+        )
+        .await
+        .expect("registry stand-in");
+        let packages = ["hello", "textutil", "greeter"];
+        for name in packages {
+            let _ = std::fs::remove_dir_all(std::env::temp_dir().join("cpppm_build").join(name));
+        }
+
+        let held: Vec<std::fs::File> = futures::future::try_join_all(
+            packages.map(|name| acquire_lock(tree_lock_path(name), format!("to build {}", name))),
+        )
+        .await
+        .expect("tree locks");
+        let (built, cached) = (METRICS.builds[0].get(), METRICS.builds[1].get());
+
+        // Each installer on a runtime of its own, as separate processes would be
+        let installers: Vec<_> = (0..INSTALLERS)
+            .map(|_| {
+                let mut pm = PackageManager::new(work.join("cache"), registry.url.clone())
+                    .isolated()
+                    .with_build_options(BuildOptions {
+                        install_prefix: Some(work.join("prefix")),
+                        ..Default::default()
+                    });
+                std::thread::spawn(move || {
+                    tokio::runtime::Builder::new_current_thread()
+                        .enable_all()
+                        .build()
+                        .expect("installer runtime")
+                        .block_on(pm.install("greeter"))
+                })
+            })
+            .collect();
+
+        tokio::time::sleep(std::time::Duration::from_secs(2)).await;
+        assert!(installers.iter().all(|installer| !installer.is_finished()));
+        assert_eq!(METRICS.builds[0].get(), built);
+        drop(held);
+
+        for installer in installers {
+            tokio::task::spawn_blocking(move || installer.join())
+                .await
+                .expect("join")
+                .expect("installer thread")
+                .expect("install");
+        }
+        assert_eq!(METRICS.builds[0].get() - built, packages.len() as u64);
+        assert_eq!(
+            METRICS.builds[1].get() - cached,
+            ((INSTALLERS - 1) * packages.len()) as u64
+        );
+        assert_eq!(METRICS.builds[2].get(), 0);
+        let _ = std::fs::remove_dir_all(&work);
+    }
+
+    fn args(command: &str) -> Vec<String> {
+        command.split_whitespace().map(str::to_string).collect()
+    }
+
+    fn scratch_dir(name: &str) -> std::path::PathBuf {
+        let dir = std::env::temp_dir().join(format!("cpkg-{}-{}", name, std::process::id()));
+        let _ = std::fs::remove_dir_all(&dir);
+        std::fs::create_dir_all(&dir).expect("scratch dir");
+        dir
+    }
+
+    #[test]
+    fn worker_refusal_allows_only_harmless_options() {
+        let cases: &[(&str, &str, &str, bool)] = &[
+            ("gcc", "-O2 -fPIC -std=c11 -Wall -Wno-unused -g", "i", false),
+            ("g++", "-march=native -fsanitize=address -pthread -D NDEBUG", "ii", false),
+            ("clang", "-I include -iquote src -Iinclude/sub", "ii", false),
+            ("x86_64-linux-gnu-g++-12", "-O3", "ii", false),
+            ("gcc", "-Wa,-adhln=/tmp/listing", "i", true),
+            ("gcc", "-Wl,-rpath,/tmp", "i", true),
+            ("gcc", "-Wp,-MD,/tmp/deps", "i", true),
+            ("gcc", "-fplugin=/tmp/plugin.so", "i", true),
+            ("gcc", "-fdump-tree-all", "i", true),
+            ("gcc", "-fsanitize-blacklist=/etc/shadow", "i", true),
+            ("gcc", "-I../x", "i", true),
+            ("gcc", "-I ../x", "i", true),
+            ("gcc", "-isystem /usr/include", "i", true),
+            ("clang", "-mllvm -debug-pass=Structure", "ii", true),
+            ("gcc", "-MF deps.d", "i", true),
+            ("gcc", "-D", "i", true),
+            ("/usr/bin/gcc", "-O2", "i", true),
+            ("gcc;sh", "-O2", "i", true),
+            ("python3", "-O2", "i", true),
+            ("gcc", "-O2", "c", true),
+        ];
+        for &(compiler, options, extension, refused) in cases {
+            let refusal = worker_refusal(compiler, &args(options), extension);
+            assert_eq!(refusal.is_some(), refused, "{} {} (.{}): {:?}", compiler, options, extension, refusal);
+        }
+    }
+
+    #[test]
+    fn compile_action_accepts_single_compiles() {
+        // (command, object, depfile, preprocessed extension); None where the
+        // command must run locally
+        let cases: &[(&str, Option<(&str, Option<&str>, Option<&str>)>)] = &[
+            ("gcc -c a.c -o a.o", Some(("a.o", None, Some("i")))),
+            ("g++ -O2 -c src/a.cpp -o obj/a.o -MD -MF obj/a.d", Some(("obj/a.o", Some("obj/a.d"), Some("ii")))),
+            ("gcc -c -x c++ a.c -o a.o", Some(("a.o", None, Some("ii")))),
+            ("gfortran -c a.f90 -o a.o", Some(("a.o", None, None))),
+            ("gcc -c a.c -o a.o -MD", None),
+            ("gcc -c a.c -o a.o -MF a.d", None),
+            ("gcc a.c -o a", None),
+            ("gcc -c a.c", None),
+            ("gcc -c a.c b.c -o a.o", None),
+            ("gcc -c a.c -o a.o -o b.o", None),
+            ("gcc -c a.c -oa.o", None),
+            ("gcc -c @args.rsp -o a.o", None),
+            ("gcc -E a.c -o a.i", None),
+            ("gcc -S a.c -o a.s", None),
+            ("gcc -c - -o a.o", None),
+            ("gcc -c a.c -o", None),
+        ];
+        for &(command, expected) in cases {
+            let action = compile_action(&args(command));
+            let got = action.as_ref().map(|action| {
+                let output = |role: &str| {
+                    action.outputs.iter().find(|(r, _)| *r == role).map(|(_, path)| path.to_string_lossy().into_owned())
+                };
+                (output("object").unwrap_or_default(), output("depfile"), action.preprocessed_extension)
+            });
+            let expected = expected.map(|(object, depfile, extension)| {
+                (object.to_string(), depfile.map(str::to_string), extension)
+            });
+            assert_eq!(got, expected, "{}", command);
+        }
+
+        // Output paths never reach the key, and definitions and include
+        // directories only matter to the preprocessor
+        let action = compile_action(&args("g++ -O2 -DX=1 -Iinc -c a.cpp -o out/a.o -MD -MF out/a.d"))
+            .expect("a single compile");
+        assert_eq!(action.normalized, args("g++ -O2 -DX=1 -Iinc -c a.cpp -o object -MD -MF depfile")[1..]);
+        assert_eq!(action.compile_args, args("-O2"));
+        assert_eq!(action.preprocess, args("g++ -O2 -DX=1 -Iinc a.cpp -MD -MF out/a.d -E"));
+    }
+
+    #[test]
+    fn remote_cache_path_maps_only_digests() {
+        let root = std::path::Path::new("/srv/cache");
+        let digest = "ab".repeat(32);
+        let cases: Vec<(String, Option<(RemoteKind, String)>)> = vec![
+            (format!("/cas/{}", digest), Some((RemoteKind::Cas, digest.clone()))),
+            (format!("/v1/ac/{}?instance=ci", digest.to_uppercase()), Some((RemoteKind::Ac, digest.clone()))),
+            (format!("/cas/{}", &digest[1..]), None),
+            (format!("/cas/{}0", digest), None),
+            (format!("/cas/{}g", &digest[1..]), None),
+            (format!("/blobs/{}", digest), None),
+            (digest.clone(), None),
+            ("/cas/..".to_string(), None),
+            (format!("/cas/{}/", digest), None),
+        ];
+        for (target, expected) in cases {
+            let got = remote_cache_path(root, &target);
+            let expected = expected.map(|(kind, digest)| {
+                let path = root.join(kind.name()).join(&digest[..2]).join(&digest);
+                (kind, digest, path)
+            });
+            assert_eq!(got, expected, "{}", target);
+        }
+    }
+
+    #[test]
+    fn request_paths_stay_under_their_root() {
+        let root = std::path::Path::new("/srv/registry");
+        let cases: &[(&str, Option<&str>)] = &[
+            ("/packages/zlib.json", Some("packages/zlib.json")),
+            ("/packages/zlib.json?v=2", Some("packages/zlib.json")),
+            ("/a%2Fb", Some("a/b")),
+            ("/", None),
+            ("/../etc/passwd", None),
+            ("/a/../../etc/passwd", None),
+            ("/%2e%2e/etc/passwd", None),
+            ("/a/%2e%2e/%2E%2E/etc/passwd", None),
+            ("/%2e%2e%2fetc%2fpasswd", None),
+            ("/%zz", None),
+            ("/%2", None),
+        ];
+        for &(target, expected) in cases {
+            assert_eq!(static_path(root, target), expected.map(|path| root.join(path)), "{}", target);
+        }
+
+        let root = std::path::Path::new("/srv/debuginfo");
+        let cases: &[(&str, Option<&str>)] = &[
+            ("/buildid/ABCD/debuginfo", Some("buildid/abcd/debuginfo")),
+            ("/buildid/abcd/executable", Some("buildid/abcd/executable")),
+            ("/buildid/abcd/source/%2Fsrc%2Fmain.c", Some("buildid/abcd/source/src/main.c")),
+            ("/buildid/abcd/source//src/main.c", Some("buildid/abcd/source/src/main.c")),
+            ("/buildid/abcd/source/%2e%2e/%2e%2e/etc/passwd", None),
+            ("/buildid/abcd/source/src/%2e%2e/%2e%2e/%2e%2e/etc/passwd", None),
+            ("/buildid/abcd/source/%2e%2e%2f%2e%2e%2fetc%2fpasswd", None),
+            ("/buildid/abcd/source/../../etc/passwd", None),
+            ("/buildid/../debuginfo", None),
+            ("/buildid/%2e%2e/debuginfo", None),
+            ("/buildid//debuginfo", None),
+            ("/buildid/xyz/debuginfo", None),
+            ("/buildid/abcd/symbols", None),
+            ("/other/abcd/debuginfo", None),
+        ];
+        for &(target, expected) in cases {
+            assert_eq!(debuginfod_path(root, target), expected.map(|path| root.join(path)), "{}", target);
+        }
+    }
+
+    #[test]
+    fn parse_size_reads_binary_suffixes() {
+        let cases: &[(&str, Option<u64>)] = &[
+            ("1024", Some(1024)),
+            ("0", Some(0)),
+            ("4K", Some(4 << 10)),
+            ("512m", Some(512 << 20)),
+            ("10G", Some(10 << 30)),
+            ("2t", Some(2 << 40)),
+            (" 8M\n", Some(8 << 20)),
+            ("", None),
+            ("G", None),
+            ("1.5G", None),
+            ("-1", None),
+            ("10X", None),
+            ("10 G", None),
+            ("99999999999T", None),
+        ];
+        for &(text, expected) in cases {
+            assert_eq!(parse_size(text), expected, "{:?}", text);
+        }
+    }
+
+    #[test]
+    fn chunk_manifest_root_covers_the_chunking() {
+        let dir = scratch_dir("chunk-manifest");
+        let path = dir.join("artifact");
+        let data: Vec<u8> = (0..10u8).collect();
+        std::fs::write(&path, &data).expect("artifact");
+        let manifest = ChunkManifest::for_file(&path, 4).expect("manifest");
+        assert_eq!(manifest.chunks.len(), 3);
+        let root = manifest.root().expect("root");
+
+        // (what changed, the changed manifest, whether it still has a root)
+        let with = |change: &dyn Fn(&mut ChunkManifest)| {
+            let mut changed = manifest.clone();
+            change(&mut changed);
+            changed.root()
+        };
+        let cases: Vec<(&str, Option<String>, bool)> = vec![
+            ("chunk_size 0", with(&|m| m.chunk_size = 0), false),
+            ("a chunk dropped", with(&|m| {
+                m.chunks.pop();
+            }), false),
+            ("a chunk added", with(&|m| m.chunks.push(m.chunks[0].clone())), false),
+            ("chunk_size without its leaves", with(&|m| m.chunk_size = 5), false),
+            ("a leaf that is not hex", with(&|m| m.chunks[1] = "zz".repeat(32)), false),
+            ("a short leaf", with(&|m| m.chunks[1].truncate(62)), false),
+            ("total_size, same chunk count", with(&|m| m.total_size = 11), true),
+            ("chunk_size, same chunk count", with(&|m| {
+                m.chunk_size = 3;
+                m.total_size = 9;
+            }), true),
+            ("leaves swapped", with(&|m| m.chunks.swap(0, 1)), true),
+        ];
+        for (what, changed, has_root) in cases {
+            assert_eq!(changed.is_some(), has_root, "{}", what);
+            assert_ne!(changed.as_deref(), Some(root.as_str()), "{}", what);
+        }
+
+        let file = std::fs::File::open(&path).expect("open");
+        assert_eq!(manifest.read_verified(&file, 3, 5).expect("read"), data[3..8]);
+        assert_eq!(manifest.read_verified(&file, 8, 2).expect("read"), data[8..]);
+        assert!(manifest.read_verified(&file, 0, 0).expect("read").is_empty());
+        for (offset, len) in [(8, 3), (10, 1), (u64::MAX, 2)] {
+            let error = manifest.read_verified(&file, offset, len).expect_err("read past the end");
+            assert_eq!(error.kind(), std::io::ErrorKind::UnexpectedEof, "{}+{}", offset, len);
+        }
+
+        let mut corrupt = data.clone();
+        corrupt[5] ^= 0xff;
+        std::fs::write(&path, &corrupt).expect("corrupt");
+        let file = std::fs::File::open(&path).expect("open");
+        assert_eq!(manifest.verify_file(&path, 0..3).expect("verify"), vec![1]);
+        assert_eq!(manifest.read_verified(&file, 0, 4).expect("read"), data[..4]);
+        let error = manifest.read_verified(&file, 2, 4).expect_err("a corrupt chunk");
+        assert_eq!(error.kind(), std::io::ErrorKind::InvalidData);
+        let _ = std::fs::remove_dir_all(&dir);
+    }
+
+    // Archive bytes as pack_archive lays them out, with any index
+    fn archive_with_index(data: &[u8], index: &serde_json::Value) -> Vec<u8> {
+        let body = serde_json::to_vec(index).expect("index");
+        let mut archive = data.to_vec();
+        archive.extend_from_slice(&ZSTD_SKIPPABLE_MAGIC.to_le_bytes());
+        archive.extend_from_slice(&((body.len() + 12) as u32).to_le_bytes());
+        archive.extend_from_slice(&body);
+        archive.extend_from_slice(&(body.len() as u32).to_le_bytes());
+        archive.extend_from_slice(ARCHIVE_MAGIC);
+        archive
+    }
+
+    #[test]
+    fn seekable_archive_refuses_corrupt_indexes() {
+        let dir = scratch_dir("seekable-archive");
+        let path = dir.join("artifact.cpkg");
+        let content = b"hello, archive";
+        let frame = zstd::bulk::compress(content, 3).expect("compress");
+        let index = |frames: serde_json::Value, size: u64| {
+            serde_json::json!({ "files": [{
+                "path": "hello.txt",
+                "mode": 0o644,
+                "size": size,
+                "sha256": to_hex(&sha2::Sha256::digest(content)),
+                "frames": frames,
+            }]})
+        };
+        let frames = |offset: u64, compressed: u64, size: u64| {
+            serde_json::json!([{ "offset": offset, "compressed": compressed, "size": size }])
+        };
+        let len = content.len() as u64;
+        let compressed = frame.len() as u64;
+
+        let valid = archive_with_index(&frame, &index(frames(0, compressed, len), len));
+        std::fs::write(&path, &valid).expect("archive");
+        let archive = SeekableArchive::open(&path).expect("a valid archive");
+        let entry = archive.entry("hello.txt").expect("entry").clone();
+        assert_eq!(archive.read(&entry).expect("read"), content);
+        assert_eq!(archive.read_range(&entry, 7, 100).expect("read"), b"archive");
+
+        let mut bad_magic = valid.clone();
+        *bad_magic.last_mut().unwrap() ^= 1;
+        let mut long_index = valid.clone();
+        let at = long_index.len() - 12;
+        long_index[at..at + 4].copy_from_slice(&u32::MAX.to_le_bytes());
+        let cases: Vec<(&str, Vec<u8>)> = vec![
+            ("empty", Vec::new()),
+            ("shorter than a footer", valid[valid.len() - 12..].to_vec()),
+            ("bad magic", bad_magic),
+            ("index longer than the file", long_index),
+            ("index not JSON", {
+                let mut archive = frame.clone();
+                archive.extend_from_slice(b"{\"files\": [");
+                archive.extend_from_slice(&11u32.to_le_bytes());
+                archive.extend_from_slice(ARCHIVE_MAGIC);
+                archive
+            }),
+            ("frame past the data", archive_with_index(&frame, &index(frames(1, compressed, len), len))),
+            ("frame into the index", archive_with_index(&frame, &index(frames(0, compressed + 8, len), len))),
+            ("frame offset overflows", archive_with_index(&frame, &index(frames(u64::MAX, compressed, len), len))),
+            ("frame length overflows", archive_with_index(&frame, &index(frames(1, u64::MAX, len), len))),
+            ("frame larger than a frame", archive_with_index(
+                &frame,
+                &index(frames(0, compressed, ARCHIVE_FRAME_SIZE as u64 + 1), ARCHIVE_FRAME_SIZE as u64 + 1),
+            )),
+            ("frames short of the size", archive_with_index(&frame, &index(frames(0, compressed, len), len + 1))),
+            ("frames past the size", archive_with_index(&frame, &index(frames(0, compressed, len), len - 1))),
+            ("no frames for the size", archive_with_index(&frame, &index(serde_json::json!([]), len))),
+        ];
+        for (what, bytes) in cases {
+            std::fs::write(&path, &bytes).expect("archive");
+            let error = SeekableArchive::open(&path).err().unwrap_or_else(|| panic!("{} was opened", what));
+            assert_eq!(error.kind(), std::io::ErrorKind::InvalidData, "{}: {}", what, error);
+        }
+
+        // A frame that decompresses short of its recorded size opens, but
+        // does not read
+        let short = archive_with_index(&frame, &index(frames(0, compressed, len + 1), len + 1));
+        std::fs::write(&path, &short).expect("archive");
+        let archive = SeekableArchive::open(&path).expect("frames that add up");
+        let short_entry = archive.entry("hello.txt").expect("entry");
+        let error = archive.read_range(short_entry, 0, 1).expect_err("a short frame");
+        assert_eq!(error.kind(), std::io::ErrorKind::InvalidData);
+
+        std::fs::write(&path, &valid).expect("archive");
+        let manifest = ChunkManifest::for_file(&path, 16).expect("manifest");
+        let root = manifest.root().expect("root");
+        assert!(SeekableArchive::open_verified(&path, manifest.clone(), &"00".repeat(32)).is_err());
+        let archive = SeekableArchive::open_verified(&path, manifest, &root).expect("a verified archive");
+        assert_eq!(archive.read(&entry).expect("read"), content);
+        let _ = std::fs::remove_dir_all(&dir);
+    }
+
+    // Every artifact is over budget and long unused; only those a live
+    // lockfile references survive
+    #[test]
+    fn collect_keeps_artifacts_pinned_by_lockfiles() {
+        let artifacts = ["zlib/aaa", "zlib/bbb", "png/ccc"];
+        let cases: &[(&[(&str, &str)], &[&str])] = &[
+            (&[], &[]),
+            (&[("zlib", "aaa")], &["zlib/aaa"]),
+            (&[("zlib", "aaa"), ("png", "ccc")], &["zlib/aaa", "png/ccc"]),
+            (&[("zlib", "ccc")], &[]),
+        ];
+        for (case, &(pinned, survivors)) in cases.iter().enumerate() {
+            let cache = scratch_dir(&format!("collect-{}", case));
+            let mut state = AccessState::default();
+            for artifact in artifacts {
+                let entry = cache.join("artifacts").join(artifact);
+                std::fs::create_dir_all(&entry).expect("entry");
+                std::fs::write(entry.join(".cpkg-complete"), vec![b'x'; 100]).expect("entry");
+                state.entries.insert(format!("artifacts\t{}", artifact), (1, 1));
+            }
+            std::fs::create_dir_all(cache.join("gc")).expect("gc dir");
+            std::fs::write(cache.join("gc").join("state.json"), serde_json::to_vec(&state).unwrap()).expect("state");
+
+            let lockfile = cache.join("cpkg.lock");
+            let lock = Lockfile {
+                packages: pinned
+                    .iter()
+                    .map(|(name, key)| LockedPackage {
+                        name: name.to_string(),
+                        version: "1.0".to_string(),
+                        checksum: None,
+                        chunk_index: None,
+                        artifact_keys: vec![key.to_string()],
+                    })
+                    .collect(),
+            };
+            std::fs::write(&lockfile, serde_json::to_vec(&lock).unwrap()).expect("lockfile");
+            register_lockfile(&cache, &lockfile).expect("root");
+
+            let manager = CacheManager::new(&cache);
+            let budgets: HashMap<CacheKind, u64> = CacheKind::ALL
+                .into_iter()
+                .map(|kind| (kind, if kind == CacheKind::Artifacts { 0 } else { u64::MAX }))
+                .collect();
+            let reports = manager.collect(&budgets, None, false).expect("collect").expect("the GC lock");
+            let report = reports.iter().find(|report| report.cache == "artifacts").expect("report");
+            assert_eq!(report.pinned, survivors.len(), "case {}", case);
+            assert_eq!(report.evicted, artifacts.len() - survivors.len(), "case {}", case);
+            for artifact in artifacts {
+                assert_eq!(
+                    cache.join("artifacts").join(artifact).exists(),
+                    survivors.contains(&artifact),
+                    "case {}: {}",
+                    case,
+                    artifact
+                );
+            }
+
+            // Once the lockfile is gone, nothing is pinned
+            std::fs::remove_file(&lockfile).expect("lockfile");
+            manager.collect(&budgets, None, false).expect("collect").expect("the GC lock");
+            for artifact in artifacts {
+                assert!(!cache.join("artifacts").join(artifact).exists(), "case {}: {}", case, artifact);
+            }
+            let _ = std::fs::remove_dir_all(&cache);
+        }
+    }
+
+    fn package(name: &str, dependencies: &[&str]) -> Package {
+        serde_json::from_value(serde_json::json!({
+            "name": name,
+            "version": "1.0",
+            "dependencies": dependencies,
+            "source_url": format!("https://example.com/{}.tar.gz", name),
+            "build_type": "CMake",
+        }))
+        .expect("package")
+    }
+
+    #[test]
+    fn simulate_schedule_starts_the_critical_path_first() {
+        // (packages with their dependencies, estimates, jobs, builds as
+        // (package, start, finish) in start order)
+        type Case = (
+            &'static [(&'static str, &'static [&'static str])],
+            &'static [(&'static str, f64)],
+            usize,
+            &'static [(&'static str, f64, f64)],
+        );
+        let cases: &[Case] = &[
+            // A chain runs one after another however many jobs there are
+            (
+                &[("c", &["b"]), ("b", &["a"]), ("a", &[])],
+                &[("a", 1.0), ("b", 2.0), ("c", 3.0)],
+                4,
+                &[("a", 0.0, 1.0), ("b", 1.0, 3.0), ("c", 3.0, 6.0)],
+            ),
+            // Independent builds on one job, longest first
+            (
+                &[("x", &[]), ("y", &[]), ("z", &[])],
+                &[("x", 5.0), ("y", 1.0), ("z", 3.0)],
+                1,
+                &[("x", 0.0, 5.0), ("z", 5.0, 8.0), ("y", 8.0, 9.0)],
+            ),
+            // A short build with a long dependent goes before a longer leaf
+            (
+                &[("leaf", &[]), ("base", &[]), ("app", &["base"])],
+                &[("leaf", 5.0), ("base", 1.0), ("app", 10.0)],
+                1,
+                &[("base", 0.0, 1.0), ("app", 1.0, 11.0), ("leaf", 11.0, 16.0)],
+            ),
+            // Two jobs: the dependent starts as soon as its dependency ends
+            (
+                &[("leaf", &[]), ("base", &[]), ("app", &["base"])],
+                &[("leaf", 5.0), ("base", 1.0), ("app", 10.0)],
+                2,
+                &[("base", 0.0, 1.0), ("leaf", 0.0, 5.0), ("app", 1.0, 11.0)],
+            ),
+            // Dependencies outside the set are already there; zero jobs is one
+            (
+                &[("tool", &["system-zlib"]), ("lib", &[])],
+                &[("tool", 2.0), ("lib", 1.0)],
+                0,
+                &[("tool", 0.0, 2.0), ("lib", 2.0, 3.0)],
+            ),
+            // No history: UNKNOWN_BUILD_SECONDS
+            (&[("new", &[])], &[], 1, &[("new", 0.0, UNKNOWN_BUILD_SECONDS)]),
+            // A cycle is left out
+            (
+                &[("p", &["q"]), ("q", &["p"]), ("r", &[])],
+                &[("p", 1.0), ("q", 1.0), ("r", 2.0)],
+                2,
+                &[("r", 0.0, 2.0)],
+            ),
+        ];
+        for (case, &(packages, estimates, jobs, expected)) in cases.iter().enumerate() {
+            let packages: Vec<Package> = packages.iter().map(|(name, deps)| package(name, deps)).collect();
+            let estimates: HashMap<String, f64> =
+                estimates.iter().map(|(name, seconds)| (name.to_string(), *seconds)).collect();
+            let planned: Vec<(String, f64, f64)> = simulate_schedule(&packages, &estimates, jobs)
+                .into_iter()
+                .map(|build| (build.package, build.start, build.finish))
+                .collect();
+            let expected: Vec<(String, f64, f64)> =
+                expected.iter().map(|(name, start, finish)| (name.to_string(), *start, *finish)).collect();
+            assert_eq!(planned, expected, "case {}", case);
+        }
+    }
+}
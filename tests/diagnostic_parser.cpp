@@ -0,0 +1,184 @@
+// DiagnosticParser against recorded compiler and CMake output. Run through
+// ctest; a failed check prints what differed and fails the run.
+//
+// gcc.json is GCC 12 output with -fdiagnostics-format=json (a translation
+// unit with diagnostics, then one without) and cmake.txt a failed configure
+// with CMake 3.25, both recorded with only paths rewritten. gcc13.sarif
+// follows GCC 13's -fdiagnostics-format=sarif-stderr log, and msvc.txt
+// cl.exe with /diagnostics:column.
+#include "compiler_detector.cpp"
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const std::string& what) {
+    if (!ok) {
+        std::fprintf(stderr, "FAIL: %s\n", what.c_str());
+        failures++;
+    }
+}
+
+std::string fixture(const std::string& name) {
+    std::ifstream in(std::string(CPPPM_TEST_FIXTURES) + "/diagnostics/" + name, std::ios::binary);
+    check(in.good(), "fixture " + name + " is readable");
+    return std::string(std::istreambuf_iterator<char>(in), {});
+}
+
+// A parser fed `text` in chunks of `chunk` bytes, with what it echoed to
+// stderr and passed through to stdout
+struct Parsed {
+    DiagnosticParser parser;
+    std::string echoed;
+    std::string passed;
+
+    explicit Parsed(const std::string& text, size_t chunk = 4096) {
+        std::ostringstream err, out;
+        auto* cerr = std::cerr.rdbuf(err.rdbuf());
+        auto* cout = std::cout.rdbuf(out.rdbuf());
+        for (size_t i = 0; i < text.size(); i += chunk) {
+            parser.feed(text.data() + i, std::min(chunk, text.size() - i));
+        }
+        parser.finish();
+        std::cerr.rdbuf(cerr);
+        std::cout.rdbuf(cout);
+        echoed = err.str();
+        passed = out.str();
+    }
+
+    const DiagnosticParser::Diagnostic& at(size_t i) const {
+        static const DiagnosticParser::Diagnostic none;
+        return i < parser.diagnostics().size() ? parser.diagnostics()[i] : none;
+    }
+};
+
+void check_diagnostic(const DiagnosticParser::Diagnostic& d, const std::string& severity,
+                      const std::string& file, long line, long column, const std::string& message,
+                      const std::string& option = "") {
+    std::string got = d.severity + " " + d.file + ":" + std::to_string(d.line) + ":" +
+        std::to_string(d.column) + " " + d.message + " [" + d.option + "]";
+    std::string want = severity + " " + file + ":" + std::to_string(line) + ":" +
+        std::to_string(column) + " " + message + " [" + option + "]";
+    check(got == want, "diagnostic: got \"" + got + "\", want \"" + want + "\"");
+}
+
+void gcc_json() {
+    // Small chunks split the document across many reads
+    Parsed parsed(fixture("gcc.json"), 7);
+    check(parsed.parser.diagnostics().size() == 3, "gcc.json: three diagnostics");
+    check(parsed.parser.errors() == 1, "gcc.json: one error");
+    check_diagnostic(parsed.at(0), "error", "src/bad.c", 1, 35, "expected ';' before '}' token");
+    check_diagnostic(parsed.at(1), "warning", "src/bad.c", 1, 19, "unused variable 'unused'",
+                     "-Wunused-variable");
+    check_diagnostic(parsed.at(2), "warning", "src/bad.c", 2, 18, "division by zero", "-Wdiv-by-zero");
+    check(parsed.passed.empty(), "gcc.json: nothing passes through, not even []: \"" + parsed.passed + "\"");
+    check(parsed.echoed ==
+          "src/bad.c:1:35: error: expected ';' before '}' token\n"
+          "src/bad.c:1:19: warning: unused variable 'unused' [-Wunused-variable]\n"
+          "src/bad.c:2:18: warning: division by zero [-Wdiv-by-zero]\n",
+          "gcc.json: echoed as text: \"" + parsed.echoed + "\"");
+}
+
+void gcc_sarif() {
+    Parsed parsed(fixture("gcc13.sarif"));
+    check(parsed.parser.diagnostics().size() == 2, "gcc13.sarif: two diagnostics");
+    check(parsed.parser.errors() == 1, "gcc13.sarif: one error");
+    check_diagnostic(parsed.at(0), "warning", "src/warn.c", 1, 19, "unused variable 'unused'",
+                     "-Wunused-variable");
+    check_diagnostic(parsed.at(1), "error", "src/warn.c", 1, 36, "expected ';' before '}' token");
+    check(parsed.passed.empty(), "gcc13.sarif: nothing passes through");
+}
+
+void msvc() {
+    Parsed parsed(fixture("msvc.txt"));
+    check(parsed.parser.diagnostics().size() == 3, "msvc.txt: three diagnostics");
+    check_diagnostic(parsed.at(0), "error", "C:\\src\\app\\main.cpp", 12, 5,
+                     "'undeclared': undeclared identifier", "C2065");
+    check_diagnostic(parsed.at(1), "warning", "C:\\src\\app\\main.cpp", 8, 9,
+                     "'unused': unreferenced local variable", "C4101");
+    check_diagnostic(parsed.at(2), "warning", "C:\\src\\app\\util.h", 3, 0,
+                     "'return': conversion from 'double' to 'int', possible loss of data", "C4244");
+    check(parsed.at(2).count == 2, "msvc.txt: the header's warning is counted twice");
+    check(parsed.passed == "main.cpp\nutil.cpp\n", "msvc.txt: file names pass through");
+}
+
+void cmake() {
+    Parsed parsed(fixture("cmake.txt"));
+    check(parsed.parser.diagnostics().size() == 3, "cmake.txt: three diagnostics");
+    check(parsed.parser.errors() == 1, "cmake.txt: one error");
+    check_diagnostic(parsed.at(0), "warning", "CMakeLists.txt", 3, 0,
+                     "The bundled zlib is older than the system one; using the system copy");
+    check_diagnostic(parsed.at(1), "warning", "CMakeLists.txt", 4, 0, "Policy CMP0135 is not set");
+    check(parsed.at(2).file == "CMakeLists.txt" && parsed.at(2).line == 5 &&
+          parsed.at(2).message.rfind("By not providing \"FindNoSuchPackage.cmake\"", 0) == 0 &&
+          parsed.at(2).message.find("be sure it has been installed.") != std::string::npos,
+          "cmake.txt: the error keeps all its paragraphs: \"" + parsed.at(2).message + "\"");
+    check(parsed.passed ==
+          "This warning is for project developers.  Use -Wno-dev to suppress it.\n"
+          "\n"
+          "-- Configuring incomplete, errors occurred!\n"
+          "See also \"/home/ci/sample/bld/CMakeFiles/CMakeOutput.log\".\n",
+          "cmake.txt: other lines pass through: \"" + parsed.passed + "\"");
+}
+
+void text_formats() {
+    Parsed parsed(
+        "src/a.cpp:10:3: warning: comparison of integer expressions [-Wsign-compare]\n"
+        "src/a.cpp:11: error: expected ';'\n"
+        "c++: fatal error: no input files\n"
+        "/usr/bin/ld: main.o: in function `main': undefined reference to `f()'\n"
+        "CMake Error: The source \"/b/CMakeLists.txt\" does not match the source \"/a/CMakeLists.txt\" "
+        "used to generate cache.  Re-run cmake with a different source directory.");
+    check_diagnostic(parsed.at(0), "warning", "src/a.cpp", 10, 3, "comparison of integer expressions",
+                     "-Wsign-compare");
+    check_diagnostic(parsed.at(1), "error", "src/a.cpp", 11, 0, "expected ';'");
+    check_diagnostic(parsed.at(2), "error", "", 0, 0, "c++: no input files");
+    check_diagnostic(parsed.at(3), "error", "", 0, 0,
+                     "/usr/bin/ld: main.o: in function `main': undefined reference to `f()'");
+    check(parsed.at(4).severity == "error" && parsed.at(4).message.rfind("The source", 0) == 0,
+          "text: CMake error without a location");
+    // The last line has no newline of its own
+    check(!parsed.echoed.empty() && parsed.echoed.back() == '\n' &&
+          parsed.echoed.find("directory.\n") != std::string::npos,
+          "text: every echoed line ends in a newline");
+}
+
+void not_json() {
+    // Unbalanced brackets: the lines after the first are read as text again
+    Parsed unbalanced("{\"step\": [1, 2,\nsrc/a.cpp:3:1: error: expected declaration\nmake: *** [all] Error 2\n");
+    check(unbalanced.parser.errors() == 1, "not json: the error after unbalanced brackets is found");
+    check(unbalanced.passed == "{\"step\": [1, 2,\nmake: *** [all] Error 2\n",
+          "not json: other lines pass through: \"" + unbalanced.passed + "\"");
+
+    // An unterminated string
+    Parsed unterminated("[{\"a\nsrc/a.cpp:3:1: error: expected declaration\n");
+    check(unterminated.parser.errors() == 1, "not json: the error after an unterminated string is found");
+}
+
+void long_lines() {
+    // Deep enough to overflow the stack of a recursive regex match
+    std::string filler(4 << 20, 'x');
+    Parsed passthrough(filler + "\n");
+    check(passthrough.passed.size() == filler.size() + 1, "long line: passes through");
+    Parsed diagnostic("src/t.hpp:1:1: error: " + filler + "\n");
+    check(diagnostic.parser.errors() == 1 && diagnostic.at(0).message.size() == filler.size(),
+          "long line: parsed as a diagnostic");
+}
+
+}  // namespace
+
+int main() {
+    gcc_json();
+    gcc_sarif();
+    msvc();
+    cmake();
+    text_formats();
+    not_json();
+    long_lines();
+    if (failures > 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("all diagnostic parser checks passed\n");
+    return 0;
+}